@@ -0,0 +1,21 @@
+#include <benchmark/benchmark.h>
+
+#include "base_types.hpp"
+
+using namespace uep;
+
+static void BM_inplace_xor(benchmark::State &state) {
+  const std::size_t L = state.range(0);
+  buffer_type lhs(L, 0x55);
+  const buffer_type rhs(L, 0x0f);
+
+  for (auto _ : state) {
+    inplace_xor(lhs, rhs);
+    benchmark::DoNotOptimize(lhs.data());
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(state.iterations() * L);
+}
+BENCHMARK(BM_inplace_xor)->RangeMultiplier(4)->Range(16, 64 << 10);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,70 @@
+#include <benchmark/benchmark.h>
+
+#include "block_decoder.hpp"
+#include "block_encoder.hpp"
+#include "log.hpp"
+
+using namespace uep;
+
+namespace {
+
+/** Keep the decoder logs out of the timings. */
+struct quiet_logs {
+  quiet_logs() {
+    log::init();
+    auto warn_filter = boost::log::expressions::attr<
+      log::severity_level>("Severity") >= log::warning;
+    boost::log::core::get()->set_filter(warn_filter);
+  }
+};
+const quiet_logs quiet;
+
+/** Encode a block of K packets of L bytes. Produce enough packets
+ *  to always decode it.
+ */
+std::vector<fountain_packet> encode_block(std::size_t K, std::size_t L) {
+  const block_encoder::seed_t seed = 0x42424242;
+  const lt_row_generator rg(robust_soliton_distribution(K, 0.1, 0.5));
+  block_encoder enc(rg);
+  std::vector<packet> block;
+  for (std::size_t i = 0; i < K; ++i) {
+    block.push_back(packet(L, static_cast<char>(i)));
+  }
+  enc.set_block(block.cbegin(), block.cend());
+  enc.set_seed(seed);
+
+  block_decoder dec(rg);
+  std::vector<fountain_packet> out;
+  while (!dec.has_decoded()) {
+    fountain_packet fp(enc.next_coded());
+    fp.block_number(0);
+    fp.block_seed(seed);
+    fp.sequence_number(out.size());
+    dec.push(fp);
+    out.push_back(std::move(fp));
+  }
+  return out;
+}
+
+}
+
+/** Decode a block pushing one packet at a time. */
+static void BM_block_decoder_push(benchmark::State &state) {
+  const std::size_t K = state.range(0);
+  const std::vector<fountain_packet> pkts = encode_block(K, state.range(1));
+  block_decoder dec(lt_row_generator(robust_soliton_distribution(K, 0.1, 0.5)));
+
+  for (auto _ : state) {
+    dec.reset();
+    for (const fountain_packet &p : pkts) dec.push(p);
+    if (!dec.has_decoded()) state.SkipWithError("Not decoded");
+  }
+  state.SetItemsProcessed(state.iterations() * pkts.size());
+  state.SetBytesProcessed(state.iterations() * K * state.range(1));
+  state.counters["packets"] = pkts.size();
+}
+BENCHMARK(BM_block_decoder_push)
+->ArgsProduct({{100, 1000}, {16, 1024}})
+->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,107 @@
+#include <benchmark/benchmark.h>
+
+#include "lazy_xor.hpp"
+#include "message_passing.hpp"
+#include "packets.hpp"
+#include "rng.hpp"
+
+#include <cstdint>
+
+using namespace uep;
+using namespace uep::mp;
+
+namespace {
+
+/** Overhead of the simulated blocks, enough to decode most of them. */
+const double OVERHEAD = 1.3;
+
+/** Same symbols used by block_decoder. */
+typedef lazy_xor<buffer_type> lx_symbol;
+
+/** Symbol that refers to the data of an output. */
+template <class Symbol>
+Symbol make_symbol(const buffer_type &data);
+
+template <>
+bool make_symbol<bool>(const buffer_type &) {
+  return true;
+}
+
+template <>
+lx_symbol make_symbol<lx_symbol>(const buffer_type &data) {
+  return lx_symbol(&data);
+}
+
+/** Rows and symbols of an LT-coded block with outputs of `L`
+ *  bytes.
+ */
+template <class Symbol>
+struct coded_block {
+  std::vector<lt_row_generator::row_type> rows;
+  std::vector<buffer_type> data;
+  std::vector<Symbol> symbols;
+
+  coded_block(std::size_t K, std::size_t L) {
+    lt_row_generator rg(robust_soliton_distribution(K, 0.1, 0.5));
+    const std::size_t N = K * OVERHEAD;
+    data.reserve(N);
+    for (std::size_t i = 0; i < N; ++i) {
+      rows.push_back(rg.next_row());
+      data.push_back(buffer_type(L, static_cast<char>(i)));
+      symbols.push_back(make_symbol<Symbol>(data.back()));
+    }
+  }
+
+  void add_to(mp_context<Symbol> &ctx) const {
+    for (std::size_t i = 0; i < rows.size(); ++i) {
+      ctx.add_output(symbols[i], rows[i].cbegin(), rows[i].cend());
+    }
+  }
+};
+
+}
+
+/** Build the graph of a whole block. */
+template <class Symbol>
+static void BM_mp_add_output(benchmark::State &state) {
+  const std::size_t K = state.range(0);
+  const coded_block<Symbol> blk(K, state.range(1));
+
+  for (auto _ : state) {
+    mp_context<Symbol> ctx(K);
+    blk.add_to(ctx);
+    benchmark::DoNotOptimize(ctx.output_size());
+  }
+  state.SetItemsProcessed(state.iterations() * blk.rows.size());
+}
+BENCHMARK_TEMPLATE(BM_mp_add_output, bool)
+->ArgsProduct({{100, 1000, 10000}, {0}});
+BENCHMARK_TEMPLATE(BM_mp_add_output, lx_symbol)
+->ArgsProduct({{100, 1000}, {1024}});
+
+/** Decode a whole block, the graph is built outside of the timing. */
+template <class Symbol>
+static void BM_mp_run(benchmark::State &state) {
+  const std::size_t K = state.range(0);
+  const coded_block<Symbol> blk(K, state.range(1));
+
+  std::size_t decoded = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    mp_context<Symbol> ctx(K);
+    blk.add_to(ctx);
+    state.ResumeTiming();
+
+    ctx.run();
+    decoded += ctx.decoded_count();
+  }
+  state.SetItemsProcessed(state.iterations() * blk.rows.size());
+  state.counters["decoded_fraction"] =
+    static_cast<double>(decoded) / (state.iterations() * K);
+}
+BENCHMARK_TEMPLATE(BM_mp_run, bool)
+->ArgsProduct({{100, 1000, 10000}, {0}});
+BENCHMARK_TEMPLATE(BM_mp_run, lx_symbol)
+->ArgsProduct({{100, 1000}, {1024}});
+
+BENCHMARK_MAIN();
@@ -0,0 +1,37 @@
+#include <benchmark/benchmark.h>
+
+#include "packets_rw.hpp"
+
+using namespace uep;
+
+static fountain_packet make_packet(std::size_t L) {
+  fountain_packet fp(L, 0x5a);
+  fp.block_number(42);
+  fp.block_seed(0x42424242);
+  fp.sequence_number(1234);
+  return fp;
+}
+
+static void BM_build_raw_packet(benchmark::State &state) {
+  const std::size_t L = state.range(0);
+  const fountain_packet fp = make_packet(L);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(build_raw_packet(fp));
+  }
+  state.SetBytesProcessed(state.iterations() * L);
+}
+BENCHMARK(BM_build_raw_packet)->RangeMultiplier(4)->Range(16, 16 << 10);
+
+static void BM_parse_raw_data_packet(benchmark::State &state) {
+  const std::size_t L = state.range(0);
+  const std::vector<char> raw = build_raw_packet(make_packet(L));
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(parse_raw_data_packet(raw));
+  }
+  state.SetBytesProcessed(state.iterations() * L);
+}
+BENCHMARK(BM_parse_raw_data_packet)->RangeMultiplier(4)->Range(16, 16 << 10);
+
+BENCHMARK_MAIN();
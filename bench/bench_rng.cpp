@@ -0,0 +1,47 @@
+#include <benchmark/benchmark.h>
+
+#include "rng.hpp"
+
+using namespace uep;
+
+static void BM_robust_soliton(benchmark::State &state) {
+  const std::size_t K = state.range(0);
+
+  for (auto _ : state) {
+    robust_soliton_distribution d(K, 0.1, 0.5);
+    benchmark::DoNotOptimize(d.beta());
+  }
+}
+BENCHMARK(BM_robust_soliton)->RangeMultiplier(10)->Range(10, 10000);
+
+static void BM_lt_next_row(benchmark::State &state) {
+  const std::size_t K = state.range(0);
+  lt_row_generator rg(robust_soliton_distribution(K, 0.1, 0.5));
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(rg.next_row());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_lt_next_row)->RangeMultiplier(10)->Range(10, 10000);
+
+/** Two sub-blocks, the first 10% of the block repeated 3 times, as in
+ *  the UEP simulations.
+ */
+static void BM_uep_next_row(benchmark::State &state) {
+  const std::size_t K = state.range(0);
+  const std::size_t Ks[] = {K / 10, K - K / 10};
+  const std::size_t RFs[] = {3, 1};
+  const std::size_t EF = state.range(1);
+  uep_row_generator rg(std::begin(Ks), std::end(Ks),
+		       std::begin(RFs), std::end(RFs),
+		       EF, 0.1, 0.5);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(rg.next_row());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_uep_next_row)->ArgsProduct({{100, 1000, 10000}, {1, 4}});
+
+BENCHMARK_MAIN();
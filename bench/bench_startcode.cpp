@@ -0,0 +1,28 @@
+#include <benchmark/benchmark.h>
+
+#include "nal_writer.hpp"
+
+#include <random>
+
+using namespace uep;
+
+/** Scan a buffer without zero bytes that ends with a start code,
+ *  like a large NAL.
+ */
+static void BM_find_startcode(benchmark::State &state) {
+  const std::size_t L = state.range(0);
+  std::vector<char> buf(L);
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int> byte(1, 255);
+  for (char &c : buf) c = static_cast<char>(byte(rng));
+  buf.insert(buf.end(), {0, 0, 1});
+
+  for (auto _ : state) {
+    auto i = find_startcode(buf.cbegin(), buf.cend());
+    benchmark::DoNotOptimize(i);
+  }
+  state.SetBytesProcessed(state.iterations() * L);
+}
+BENCHMARK(BM_find_startcode)->RangeMultiplier(8)->Range(64, 1 << 20);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,280 @@
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+#include <unistd.h>
+
+#include "log.hpp"
+#include "uep_decoder.hpp"
+#include "uep_encoder.hpp"
+#include "utils.hpp"
+
+using namespace uep;
+
+/** Parameters of a simulated transmission. */
+struct codec_bench_params {
+  lt_uep_parameter_set uep; /**< Parameters of the code. */
+  std::size_t packet_size; /**< Size of the source packets. */
+  std::size_t nblocks; /**< Number of blocks to send. */
+  /** Coded packets sent for each block. If zero, send until the
+   *  block is decoded, as with an ideal ACK channel.
+   */
+  std::size_t max_n_per_block;
+  std::vector<double> drop_probs; /**< Markov channel (p_GB, p_BG). */
+  unsigned int seed; /**< Seed for the source and the channel. */
+};
+
+/** Counters and timings of a simulated transmission. */
+struct codec_bench_result {
+  std::size_t source_pkts;
+  std::size_t coded_pkts;
+  std::size_t received_pkts;
+  std::vector<std::size_t> sent; /**< Source packets per priority. */
+  std::vector<std::size_t> delivered; /**< Correct packets per priority. */
+  std::size_t delivered_bytes;
+  double enc_time; /**< Seconds spent in the encoder. */
+  double dec_time; /**< Seconds spent in the decoder. */
+  double cpu_time; /**< CPU seconds used by the process. */
+};
+
+/** Fill the source packet with sequence number `n` deterministically,
+ *  so the output can be checked without storing the input.
+ */
+void fill_source(buffer_type &buf, std::size_t n) {
+  std::minstd_rand gen(n + 1);
+  for (char &c : buf) c = static_cast<char>(gen());
+}
+
+class codec_bench {
+public:
+  typedef std::chrono::steady_clock clock_type;
+
+  explicit codec_bench(const codec_bench_params &p) :
+    params(p),
+    enc(p.uep),
+    dec(p.uep),
+    channel(p.drop_probs.at(0), p.drop_probs.at(1), p.seed),
+    expected(p.packet_size),
+    out_count(0) {
+    res.source_pkts = 0;
+    res.coded_pkts = 0;
+    res.received_pkts = 0;
+    res.sent.resize(p.uep.Ks.size(), 0);
+    res.delivered.resize(p.uep.Ks.size(), 0);
+    res.delivered_bytes = 0;
+    res.enc_time = 0;
+    res.dec_time = 0;
+  }
+
+  codec_bench_result run() {
+    std::clock_t cpu_start = std::clock();
+    for (std::size_t b = 0; b < params.nblocks; ++b) {
+      push_block();
+      send_block();
+      drain();
+    }
+    clock_type::time_point t = clock_type::now();
+    dec.flush();
+    res.dec_time += elapsed(t);
+    drain();
+    res.cpu_time = static_cast<double>(std::clock() - cpu_start) /
+      CLOCKS_PER_SEC;
+    return res;
+  }
+
+private:
+  const codec_bench_params params;
+  uep_encoder<std::mt19937> enc;
+  uep_decoder dec;
+  markov2_distribution channel;
+  codec_bench_result res;
+  buffer_type expected;
+  std::size_t out_count; /**< Packets extracted from the decoder. */
+
+  static double elapsed(clock_type::time_point since) {
+    return std::chrono::duration<double>(clock_type::now() - since).count();
+  }
+
+  /** Pass one block of source packets to the encoder. */
+  void push_block() {
+    for (std::size_t i = 0; i < params.uep.Ks.size(); ++i) {
+      for (std::size_t j = 0; j < params.uep.Ks[i]; ++j) {
+	fountain_packet p(params.packet_size, 0);
+	fill_source(p.buffer(), res.source_pkts++);
+	p.setPriority(i);
+	++res.sent[i];
+
+	clock_type::time_point t = clock_type::now();
+	enc.push(std::move(p));
+	res.enc_time += elapsed(t);
+      }
+    }
+  }
+
+  /** Send the coded packets of the current block through the
+   *  channel.
+   */
+  void send_block() {
+    for (std::size_t n = 0;
+	 params.max_n_per_block == 0 || n < params.max_n_per_block;
+	 ++n) {
+      clock_type::time_point t = clock_type::now();
+      fountain_packet p = enc.next_coded();
+      res.enc_time += elapsed(t);
+      ++res.coded_pkts;
+
+      if (channel() == 1) continue;
+      ++res.received_pkts;
+      t = clock_type::now();
+      dec.push(std::move(p));
+      res.dec_time += elapsed(t);
+
+      if (params.max_n_per_block == 0 && dec.has_decoded()) break;
+    }
+    clock_type::time_point t = clock_type::now();
+    enc.next_block();
+    res.enc_time += elapsed(t);
+  }
+
+  /** Extract and check the decoded packets. */
+  void drain() {
+    for (;;) {
+      clock_type::time_point t = clock_type::now();
+      if (!dec.has_queued_packets()) {
+	res.dec_time += elapsed(t);
+	break;
+      }
+      fountain_packet p = dec.next_decoded();
+      res.dec_time += elapsed(t);
+
+      fill_source(expected, out_count++);
+      if (!p.empty() && p.buffer() == expected) {
+	++res.delivered.at(p.getPriority());
+	res.delivered_bytes += p.size();
+      }
+    }
+  }
+};
+
+void print_result(const codec_bench_params &p, const codec_bench_result &r) {
+  const double source_bits = 8.0 * r.source_pkts * p.packet_size;
+  const double coded_bits = 8.0 * r.coded_pkts * p.packet_size;
+
+  std::cout << "source_pkts=" << r.source_pkts << std::endl;
+  std::cout << "coded_pkts=" << r.coded_pkts << std::endl;
+  std::cout << "received_pkts=" << r.received_pkts << std::endl;
+  std::cout << "enc_time=" << r.enc_time << std::endl;
+  std::cout << "dec_time=" << r.dec_time << std::endl;
+  std::cout << "enc_mbps=" << source_bits / r.enc_time / 1e6 << std::endl;
+  std::cout << "enc_coded_mbps=" << coded_bits / r.enc_time / 1e6 << std::endl;
+  std::cout << "dec_mbps=" << source_bits / r.dec_time / 1e6 << std::endl;
+  std::cout << "enc_symbols_per_s=" << r.coded_pkts / r.enc_time << std::endl;
+  std::cout << "dec_symbols_per_s=" << r.received_pkts / r.dec_time
+	    << std::endl;
+  for (std::size_t i = 0; i < r.sent.size(); ++i) {
+    std::cout << "residual_loss_" << i << "="
+	      << 1 - static_cast<double>(r.delivered[i]) / r.sent[i]
+	      << std::endl;
+  }
+  std::cout << "delivered_bytes=" << r.delivered_bytes << std::endl;
+  std::cout << "cpu_ns_per_byte=" << r.cpu_time * 1e9 / r.delivered_bytes
+	    << std::endl;
+}
+
+int main(int argc, char **argv) {
+  log::init();
+  auto warn_filter = boost::log::expressions::attr<
+    log::severity_level>("Severity") >= log::warning;
+  boost::log::core::get()->set_filter(warn_filter);
+
+  codec_bench_params params;
+  params.uep.Ks = {100, 900};
+  params.uep.RFs = {3, 1};
+  params.uep.EF = 4;
+  params.uep.c = 0.1;
+  params.uep.delta = 0.5;
+  params.packet_size = 1024;
+  params.nblocks = 10;
+  params.max_n_per_block = 0;
+  params.drop_probs = {0, 1};
+  params.seed = 1;
+
+  int c;
+  opterr = 0;
+  while ((c = getopt(argc, argv, "K:R:E:c:d:L:p:b:n:s:")) != -1) {
+    switch (c) {
+    case 'K': {
+      std::istringstream iss(optarg);
+      iss >> params.uep.Ks;
+      break;
+    }
+    case 'R': {
+      std::istringstream iss(optarg);
+      iss >> params.uep.RFs;
+      break;
+    }
+    case 'E':
+      params.uep.EF = std::strtoull(optarg, nullptr, 10);
+      break;
+    case 'c':
+      params.uep.c = std::strtod(optarg, nullptr);
+      break;
+    case 'd':
+      params.uep.delta = std::strtod(optarg, nullptr);
+      break;
+    case 'L':
+      params.packet_size = std::strtoull(optarg, nullptr, 10);
+      break;
+    case 'p': {
+      std::istringstream iss(optarg);
+      if (iss.peek() == '[') {
+	iss >> params.drop_probs;
+      }
+      else {
+	double p;
+	iss >> p;
+	params.drop_probs = {p, 1-p};
+      }
+      break;
+    }
+    case 'b':
+      params.nblocks = std::strtoull(optarg, nullptr, 10);
+      break;
+    case 'n':
+      params.max_n_per_block = std::strtoull(optarg, nullptr, 10);
+      break;
+    case 's':
+      params.seed = std::strtoul(optarg, nullptr, 10);
+      break;
+    default:
+      std::cerr << "Usage: " << argv[0]
+		<< " [-K <Ks>]"
+		<< " [-R <RFs>]"
+		<< " [-E <EF>]"
+		<< " [-c <c>]"
+		<< " [-d <delta>]"
+		<< " [-L <packet size>]"
+		<< " [-p <IID loss prob> | -p <[p_GB, p_BG]>]"
+		<< " [-b <blocks>]"
+		<< " [-n <pkts per block>]"
+		<< " [-s <seed>]"
+		<< std::endl;
+      return 2;
+    }
+  }
+  if (params.uep.Ks.size() != params.uep.RFs.size() ||
+      params.drop_probs.size() != 2) {
+    std::cerr << "Wrong Ks, RFs or loss probabilities" << std::endl;
+    return 2;
+  }
+  if (params.max_n_per_block == 0 && params.drop_probs[1] == 0) {
+    std::cerr << "The channel never recovers, set -n" << std::endl;
+    return 2;
+  }
+
+  codec_bench bench(params);
+  codec_bench_result res = bench.run();
+  print_result(params, res);
+}
@@ -0,0 +1,51 @@
+import argparse
+
+from utils.aws import *
+from utils.result_store import append_records
+
+def pack_records(d):
+    """Records of an IID data pack saved by run_uep_iid.py, one per
+    overhead."""
+    records = list()
+    for l, oh in enumerate(d['overheads']):
+        r = {'Ks': list(d['Ks']),
+             'RFs': list(d['RFs']),
+             'EF': d['EF'],
+             'c': d['c'],
+             'delta': d['delta'],
+             'iid_per': d['iid_per'],
+             'overhead': float(oh),
+             'nblocks': d['nblocks'],
+             'error_counts': [int(e) for e in d['error_counts'][l]],
+             'drop_rate': float(d['avg_drops'][l])}
+        if 'avg_ripples' in d:
+            r['avg_ripple'] = float(d['avg_ripples'][l])
+        if d.get('git_sha1') is not None:
+            r['git_sha1'] = d['git_sha1']
+        if d.get('timestamp') is not None:
+            r['timestamp'] = float(d['timestamp'])
+        records.append(r)
+    return records
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description='Appends IID UEP data packs'
+                                     ' to a result store.',
+                                     allow_abbrev=False)
+    parser.add_argument("store", help="Result store to append to", type=str)
+    parser.add_argument("files", help="Local .pickle.xz data packs",
+                        type=str, nargs='*')
+    parser.add_argument("--prefix", help="Also load the data packs on S3"
+                        " with this prefix", type=str, default=None)
+    args = parser.parse_args()
+
+    data = [load_data_local(f) for f in args.files]
+    if args.prefix is not None:
+        data.extend(load_data_prefix(args.prefix))
+
+    nrecords = 0
+    for d in data:
+        records = pack_records(d)
+        append_records(args.store, records)
+        nrecords += len(records)
+    print("Appended {:d} records from {:d} data packs".format(nrecords,
+                                                              len(data)))
@@ -9,6 +9,7 @@ from plots import *
 from uep import *
 from utils.aws import *
 from utils.plots import *
+from utils.result_store import ResultStore
 from utils.stats import *
 
 
@@ -25,14 +26,51 @@ class param_filters:
     def iid_errors(Ks, RFs, EF, c, delta, iid_per):
         return (iid_per != 0)
 
+def load_store_packs(path, param_filter):
+    """Read the IID records of a result store as data packs with a
+    single overhead. Only the records that pass param_filter are
+    copied out of the mapped file."""
+    needed = ('Ks', 'RFs', 'EF', 'c', 'delta', 'iid_per', 'nblocks',
+              'overhead', 'error_counts', 'drop_rate')
+    def is_iid(r):
+        if any(k not in r for k in needed):
+            return False
+        if r.get('markov_pGB', 0) != 0 and r.get('markov_pBG', 1) != 1:
+            return False
+        return param_filter(tuple(r['Ks']), tuple(r['RFs']), r['EF'],
+                            r['c'], r['delta'], r['iid_per'])
+
+    packs = list()
+    for r in ResultStore(path).select(where=is_iid):
+        packs.append({'git_sha1': r.get('git_sha1'),
+                      'Ks': list(r['Ks']),
+                      'RFs': list(r['RFs']),
+                      'EF': r['EF'],
+                      'c': r['c'],
+                      'delta': r['delta'],
+                      'iid_per': r['iid_per'],
+                      'nblocks': r['nblocks'],
+                      'overheads': [r['overhead']],
+                      'error_counts': [list(r['error_counts'])],
+                      'avg_ripples': [r.get('avg_ripple', float('nan'))],
+                      'avg_drops': [r['drop_rate']]})
+    return packs
+
 if __name__ == "__main__":
     parser = argparse.ArgumentParser(description='Plots the IID UEP results.',
                                      allow_abbrev=False)
     parser.add_argument("--param_filter", help="How to filter the data",
                         type=str, default="all")
+    parser.add_argument("--store", type=str, default=None,
+                        help="Read the results from this result store"
+                        " instead of the data packs on S3")
     args = parser.parse_args()
 
-    data = load_data_prefix("uep_iid_final/")
+    if args.store is not None:
+        data = load_store_packs(args.store,
+                                getattr(param_filters, args.param_filter))
+    else:
+        data = load_data_prefix("uep_iid_final/")
 
     git_sha1_set = sorted(set(d.get('git_sha1') or 'None' for d in data))
     print("Found {:d} commits:".format(len(git_sha1_set)))
@@ -18,6 +18,10 @@ if __name__ == "__main__":
     parser.add_argument("ef", help="Expanding factor",type=int)
     parser.add_argument("nblocks", help="nblocks for the simulation",type=int)
     parser.add_argument("--iid_per", help="Channel packet drop rate",type=float, default=0)
+    parser.add_argument("--bit_parallel", action="store_true",
+                        help="Decode 64 blocks at once, one run per overhead")
+    parser.add_argument("--store", type=str, default=None,
+                        help="Also append the results to this result store")
     args = parser.parse_args()
 
     git_sha1 = None
@@ -65,10 +69,20 @@ if __name__ == "__main__":
     avg_drops = np.zeros(len(overheads))
     avg_ripples = np.zeros(len(overheads))
     error_counts = np.zeros((len(overheads), len(Ks)), dtype=int)
+    sweep_results = None
+    if not args.bit_parallel:
+        # Decode each block only once, up to the largest overhead
+        print("Running a single-pass sweep of {:d} overheads".format(
+            len(overheads)))
+        sweep_results = sim.run_sweep(overheads, store=args.store)
+
     for j, oh in enumerate(overheads):
-        print("Run with oh = {:.3f}".format(oh))
-        sim.overhead = oh
-        results = run_parallel(sim)
+        if sweep_results is not None:
+            results = sweep_results[j]
+        else:
+            print("Run with oh = {:.3f}".format(oh))
+            sim.overhead = oh
+            results = run_parallel(sim, True, args.store)
         avg_pers[j] = results['error_rates']
         avg_drops[j] = results['drop_rate']
         avg_ripples[j] = results['avg_ripple']
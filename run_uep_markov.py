@@ -22,6 +22,8 @@ if __name__ == "__main__":
     parser.add_argument("--overhead", help="Overhead",type=float, default=0.25)
     parser.add_argument("--kmin", help="k_min",type=int, default=100)
     parser.add_argument("--kmax", help="k_max",type=int, default=None)
+    parser.add_argument("--bit_parallel", action="store_true",
+                        help="Decode 64 blocks at once (no ripple stats)")
 
     args = parser.parse_args()
 
@@ -93,7 +95,7 @@ if __name__ == "__main__":
                             markov_pGB=pGB,
                             markov_pBG=pBG,
                             nblocks=nblocks)
-        results = run_parallel(sim)
+        results = run_parallel(sim, args.bit_parallel)
         avg_pers[j] = results['error_rates']
         avg_drops[j] = results['drop_rate']
         error_counts[j] = results['error_counts']
@@ -0,0 +1,326 @@
+#include "annexb_reader.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+
+#include "nal_reader.hpp"
+#include "startcode_scanner.hpp"
+
+using namespace std;
+
+namespace uep {
+
+nal_unit_header nal_unit_header::parse(const char *nal, std::size_t size) {
+  std::array<unsigned char, 4> b{};
+  std::copy(nal, nal + std::min(size, b.size()), b.begin());
+
+  nal_unit_header h{};
+  h.nal_unit_type = b[0] & 0x1f;
+  h.svc_extension = h.nal_unit_type == 14 || h.nal_unit_type == 20;
+  if (h.svc_extension) {
+    // svc_extension_flag(1) idr_flag(1) priority_id(6)
+    // no_inter_layer_pred_flag(1) dependency_id(3) quality_id(4)
+    // temporal_id(3) use_ref_base_pic_flag(1) discardable_flag(1) ...
+    h.dependency_id = (b[2] >> 4) & 0x07;
+    h.quality_id = b[2] & 0x0f;
+    h.temporal_id = (b[3] >> 5) & 0x07;
+    h.discardable = (b[3] >> 3) & 0x01;
+  }
+  return h;
+}
+
+bool nal_unit_header::is_parameter_set() const {
+  return nal_unit_type == 7 || nal_unit_type == 8 || nal_unit_type == 15;
+}
+
+bool nal_unit_header::is_sei() const {
+  return nal_unit_type == 6;
+}
+
+std::size_t nal_unit_header::priority() const {
+  if (discardable && quality_id > 0) {
+    return 1;
+  }
+  else {
+    return 0;
+  }
+}
+
+const std::size_t annexb_reader::READ_SIZE;
+
+annexb_reader::annexb_reader(const std::string &path, std::size_t pktsize) :
+  basic_lg(boost::log::keywords::channel = log::basic),
+  perf_lg(boost::log::keywords::channel = log::performance),
+  in_backend(new ifstream(path, ios_base::binary)),
+  in(*in_backend),
+  pkt_size(pktsize),
+  in_pos(0),
+  scan_pos(0),
+  in_eof(false),
+  totalLength(0),
+  in_header(true),
+  seen_ps(false),
+  nal_prio(0),
+  cur_fill(0),
+  cur_prio(0),
+  finished(false),
+  use_eos(false),
+  _tot_added_oh(2, 0),
+  _tot_size(2, 0) {
+  BOOST_LOG_SEV(basic_lg, log::trace) << "Creating an Annex-B reader for "
+				      << path;
+  if (!in) throw runtime_error("Cannot open " + path);
+  read_header();
+}
+
+annexb_reader::annexb_reader(std::istream &in_stream, std::size_t pktsize) :
+  basic_lg(boost::log::keywords::channel = log::basic),
+  perf_lg(boost::log::keywords::channel = log::performance),
+  in(in_stream),
+  pkt_size(pktsize),
+  in_pos(0),
+  scan_pos(0),
+  in_eof(false),
+  totalLength(0),
+  in_header(true),
+  seen_ps(false),
+  nal_prio(0),
+  cur_fill(0),
+  cur_prio(0),
+  finished(false),
+  use_eos(false),
+  _tot_added_oh(2, 0),
+  _tot_size(2, 0) {
+  BOOST_LOG_SEV(basic_lg, log::trace) << "Creating an Annex-B reader"
+				      << " with a given istream";
+  read_header();
+}
+
+void annexb_reader::read_header() {
+  while (in_header && !finished) {
+    fill();
+  }
+  if (in_header) throw runtime_error("No slice NAL in the H264 bitstream");
+  BOOST_LOG_SEV(basic_lg, log::debug) << "Read the header: "
+				      << hdr.size() << " bytes";
+}
+
+void annexb_reader::fill() {
+  if (read_more()) {
+    split_nals(false);
+  }
+  else {
+    split_nals(true);
+    finish();
+  }
+}
+
+bool annexb_reader::read_more() {
+  if (in_eof) return false;
+
+  // Drop the bytes already assigned to the NALs
+  in_buf.erase(in_buf.begin(), in_buf.begin() + in_pos);
+  scan_pos -= in_pos;
+  in_pos = 0;
+
+  // Block for one byte, then take what is already available
+  std::size_t old_size = in_buf.size();
+  in_buf.resize(old_size + READ_SIZE);
+  in.read(in_buf.data() + old_size, 1);
+  std::size_t got = in.gcount();
+  if (got == 1) {
+    got += in.readsome(in_buf.data() + old_size + 1, READ_SIZE - 1);
+  }
+  in_buf.resize(old_size + got);
+
+  if (got == 0) {
+    BOOST_LOG_SEV(basic_lg, log::debug) << "End of the H264 bitstream after "
+					<< totalLength << " bytes";
+    in_eof = true;
+    return false;
+  }
+  totalLength += got;
+  return true;
+}
+
+void annexb_reader::split_nals(bool at_eof) {
+  const char *const base = in_buf.data();
+  const char *const end = base + in_buf.size();
+  std::size_t nal_count = 0;
+
+  for (;;) {
+    const char *sc = scan_startcode(base + scan_pos, end);
+
+    if (sc == end) { // No more NALs: keep a possible partial startcode
+      const char *keep_from = at_eof ? end :
+	std::max(base + in_pos, end - std::min<std::size_t>(3, end - base));
+      append(base + in_pos, keep_from - (base + in_pos));
+      in_pos = keep_from - base;
+      scan_pos = in_pos;
+      break;
+    }
+
+    // Any zero_byte before the startcode stays with the previous
+    // NAL, as in the JSVM trace
+    const char *nal_begin = sc;
+
+    // Wait for the header bytes used by parse()
+    const char *payload = sc + 3;
+    std::size_t avail = end - payload;
+    bool hdr_complete = avail >= 4 ||
+      (avail >= 1 && (payload[0] & 0x1f) != 14 && (payload[0] & 0x1f) != 20);
+    if (!hdr_complete && !at_eof) {
+      append(base + in_pos, nal_begin - (base + in_pos));
+      in_pos = nal_begin - base;
+      scan_pos = in_pos;
+      break;
+    }
+
+    append(base + in_pos, nal_begin - (base + in_pos));
+    in_pos = nal_begin - base;
+    scan_pos = payload - base;
+    begin_nal(nal_unit_header::parse(payload, avail));
+    ++nal_count;
+  }
+
+  BOOST_LOG_SEV(basic_lg, log::trace) << "Found " << nal_count << " NALs"
+				      << " at_eof=" << std::boolalpha << at_eof
+				      << " left=" << in_buf.size() - in_pos;
+}
+
+void annexb_reader::begin_nal(const nal_unit_header &h) {
+  if (in_header) {
+    if (h.is_parameter_set()) {
+      seen_ps = true;
+    }
+    else if (!(h.is_sei() && !seen_ps)) {
+      // The first NAL after the parameter sets
+      in_header = false;
+    }
+  }
+  nal_prio = h.priority();
+
+  BOOST_LOG_SEV(basic_lg, log::trace) << "New NAL: type=" << h.nal_unit_type
+				      << " Lid=" << h.dependency_id
+				      << " Tid=" << h.temporal_id
+				      << " Qid=" << h.quality_id
+				      << std::boolalpha
+				      << " Disc=" << h.discardable
+				      << " prio=" << nal_prio
+				      << " header=" << in_header;
+}
+
+void annexb_reader::append(const char *data, std::size_t size) {
+  if (in_header) {
+    hdr.insert(hdr.end(), data, data + size);
+    return;
+  }
+
+  while (size > 0) {
+    // A full packet is queued only when there is more data, so that
+    // the end of the input always has a packet to queue
+    if (cur_pkt && (cur_prio != nal_prio || cur_fill == pkt_size)) {
+      queue_packet();
+    }
+    if (!cur_pkt) {
+      cur_pkt = pkt_pool.get(pkt_size);
+      cur_fill = 0;
+      cur_prio = nal_prio;
+    }
+    std::size_t len = std::min(size, pkt_size - cur_fill);
+    std::copy(data, data + len, cur_pkt->begin() + cur_fill);
+    cur_fill += len;
+    data += len;
+    size -= len;
+    _tot_size.at(cur_prio) += len;
+  }
+}
+
+void annexb_reader::queue_packet() {
+  std::fill(cur_pkt->begin() + cur_fill, cur_pkt->end(), 0x00);
+  _tot_added_oh.at(cur_prio) += pkt_size - cur_fill;
+  if (cur_fill < pkt_size) {
+    BOOST_LOG(perf_lg) << "annexb_reader::queue_packet padding="
+		       << pkt_size - cur_fill
+		       << " priority=" << cur_prio
+		       << " pkt_size=" << pkt_size;
+  }
+
+  fountain_packet fp{packet(std::move(cur_pkt))};
+  fp.setPriority(cur_prio);
+  pkt_queue.push(std::move(fp));
+  cur_pkt.reset();
+  cur_fill = 0;
+}
+
+void annexb_reader::finish() {
+  if (cur_pkt) queue_packet();
+
+  if (use_eos && !in_header) {
+    static const std::array<char, 3> nal_sc{0x00, 0x00, 0x01};
+    const buffer_type &eos = nal_reader::EOS_NAL;
+    assert(eos.size() + nal_sc.size() <= pkt_size);
+    std::shared_ptr<buffer_type> buf = pkt_pool.get(pkt_size);
+    std::fill(buf->begin(), buf->end(), 0x00);
+    auto fpi = std::copy(nal_sc.begin(), nal_sc.end(), buf->begin());
+    std::copy(eos.begin(), eos.end(), fpi);
+    fountain_packet fp{packet(std::move(buf))};
+    fp.setPriority(0);
+    pkt_queue.push(std::move(fp));
+    _tot_added_oh.at(0) += pkt_size;
+    BOOST_LOG_SEV(basic_lg, log::debug) << "Annex-B reader enqueued the EOS NAL";
+  }
+
+  finished = true;
+  BOOST_LOG_SEV(basic_lg, log::debug) << "Annex-B reader finished";
+}
+
+fountain_packet annexb_reader::next_packet() {
+  while (pkt_queue.empty()) {
+    if (finished) throw runtime_error("Out of NALs");
+    fill();
+  }
+
+  fountain_packet fp = std::move(pkt_queue.front());
+  pkt_queue.pop();
+  return fp;
+}
+
+const buffer_type &annexb_reader::header() const {
+  return hdr;
+}
+
+bool annexb_reader::has_packet() const {
+  return !(pkt_queue.empty() && finished);
+}
+
+std::size_t annexb_reader::totLength() const {
+  return totalLength;
+}
+
+annexb_reader::operator bool() const {
+  return has_packet();
+}
+
+bool annexb_reader::operator!() const {
+  return !has_packet();
+}
+
+bool annexb_reader::use_end_of_stream() const {
+  return use_eos;
+}
+
+void annexb_reader::use_end_of_stream(bool use) {
+  use_eos = use;
+}
+
+const std::vector<std::size_t> &annexb_reader::total_overhead() const {
+  return _tot_added_oh;
+}
+
+const std::vector<std::size_t> &annexb_reader::total_read() const {
+  return _tot_size;
+}
+
+}
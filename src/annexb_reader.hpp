@@ -0,0 +1,173 @@
+#ifndef UEP_ANNEXB_READER_HPP
+#define UEP_ANNEXB_READER_HPP
+
+#include <atomic>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <queue>
+
+#include "buffer_pool.hpp"
+#include "log.hpp"
+#include "lt_param_set.hpp"
+#include "packets.hpp"
+
+namespace uep {
+
+/** Fields of the header of an H264 NAL unit, with the SVC extension
+ *  of the prefix and coded slice extension NALs.
+ */
+struct nal_unit_header {
+  unsigned int nal_unit_type;
+  bool svc_extension; /**< True for the NAL types 14 and 20. */
+  unsigned int dependency_id;
+  unsigned int temporal_id;
+  unsigned int quality_id;
+  bool discardable;
+
+  /** Parse the header at the start of the NAL payload, after the
+   *  startcode. Missing bytes are read as zero.
+   */
+  static nal_unit_header parse(const char *nal, std::size_t size);
+
+  /** True for the SPS, subset SPS and PPS NALs. */
+  bool is_parameter_set() const;
+  /** True for the SEI NALs. */
+  bool is_sei() const;
+  /** Assign a priority to the NAL unit. This is the same rule used
+   *  by nal_reader with the JSVM trace.
+   */
+  std::size_t priority() const;
+};
+
+/** Read the NAL units of an Annex-B H264 bitstream as it is produced,
+ *  for example from a pipe fed by a live encoder, and pack them into
+ *  fixed-size packets with the same priority.
+ *
+ *  The NAL boundaries are found with the startcode scanner and the
+ *  priority is taken from the NAL header, so no JSVM trace is
+ *  needed. The leading SEI and parameter set NALs form the stream
+ *  header, which is read at construction. The input is read in
+ *  chunks of at most READ_SIZE bytes and each packet is emitted as
+ *  soon as it is full, so the memory use does not depend on the
+ *  length of the NALs. The packets are the same produced by
+ *  nal_reader on the same bitstream.
+ */
+class annexb_reader {
+public:
+  /** Type of the parameter set used to setup the reader. */
+  typedef net_parameter_set parameter_set;
+
+  /** Maximum number of bytes read from the input at once. */
+  static const std::size_t READ_SIZE = 64*1024;
+
+  /** Construct a reader for the Annex-B bitstream in `path`, which
+   *  can be a FIFO.
+   */
+  explicit annexb_reader(const std::string &path, std::size_t pktsize);
+  /** Construct a reader that takes the bitstream from the given
+   *  istream. The stream must outlive the reader.
+   */
+  explicit annexb_reader(std::istream &in, std::size_t pktsize);
+
+  /** Extract the next fixed-size packet, with zero padding if
+   *  required, along with its assigned priority. This blocks until
+   *  enough input is available.
+   */
+  fountain_packet next_packet();
+
+  /** Reference to the raw bitstream of the first set of NALs, which
+   *  contain the H264 parameter sets.
+   */
+  const buffer_type &header() const;
+
+  /** Return true until the end of the input has been reached and
+   *  all the packets have been extracted.
+   */
+  bool has_packet() const;
+
+  /** Return the number of bytes read so far. The total length of a
+   *  live stream is not known in advance. This can be called while
+   *  another thread reads.
+   */
+  std::size_t totLength() const;
+
+  /** Return true when the reader is able to produce a packet. */
+  explicit operator bool() const;
+  /** Return true when the reader cannot produce a packet. */
+  bool operator!() const;
+
+  /** True when the reader sends a 4-byte word to signal the end of
+   *  the stream.
+   */
+  bool use_end_of_stream() const;
+  void use_end_of_stream(bool use);
+
+  const std::vector<std::size_t> &total_overhead() const;
+  const std::vector<std::size_t> &total_read() const;
+
+private:
+  log::default_logger basic_lg, perf_lg;
+
+  std::unique_ptr<std::ifstream> in_backend;
+  std::istream &in;
+  std::size_t pkt_size;
+
+  buffer_type in_buf; /**< Bytes read from the input. */
+  std::size_t in_pos; /**< Offset in in_buf of the first byte not yet
+		       *   assigned to a NAL.
+		       */
+  std::size_t scan_pos; /**< Offset in in_buf where the search for
+			 *   the next startcode resumes.
+			 */
+  bool in_eof; /**< Set when the input has ended. */
+  std::atomic_size_t totalLength;
+
+  buffer_type hdr;
+  bool in_header; /**< True while reading the header NALs. */
+  bool seen_ps; /**< True after the first parameter set. */
+  std::size_t nal_prio; /**< Priority of the NAL being read. */
+
+  std::shared_ptr<buffer_type> cur_pkt; /**< Packet being filled. */
+  std::size_t cur_fill; /**< Bytes used in cur_pkt. */
+  std::size_t cur_prio; /**< Priority of cur_pkt. */
+  buffer_pool pkt_pool; /**< Buffers of the output packets. */
+  std::queue<fountain_packet> pkt_queue;
+  bool finished; /**< Set when the last packet has been queued. */
+
+  bool use_eos; /**< Flag to enable the sending of the EOS code. */
+
+  std::vector<std::size_t> _tot_added_oh; /**< Keep track of the total
+					   *   amount of overhead
+					   *   added per pkt type.
+					   */
+  std::vector<std::size_t> _tot_size; /**< Keep track of the total
+				       *    amount of data read.
+				       */
+
+  /** Read the NALs of the header. */
+  void read_header();
+  /** Read more input and split it into NALs. At the end of the
+   *  input queue the last packets.
+   */
+  void fill();
+  /** Read a chunk of input. Return false at the end of the input. */
+  bool read_more();
+  /** Assign the bytes in in_buf to the NALs. When `at_eof` is false
+   *  keep the bytes that can be part of a startcode or of a NAL
+   *  header.
+   */
+  void split_nals(bool at_eof);
+  /** Start a new NAL with the given header. */
+  void begin_nal(const nal_unit_header &h);
+  /** Append the bytes to the NAL being read. */
+  void append(const char *data, std::size_t size);
+  /** Queue cur_pkt, padded with zeros. */
+  void queue_packet();
+  /** Queue the last packets at the end of the input. */
+  void finish();
+};
+
+}
+
+#endif
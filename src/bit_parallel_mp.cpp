@@ -0,0 +1,114 @@
+#include "bit_parallel_mp.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace uep { namespace mp {
+
+constexpr std::size_t bit_parallel_mp::TRIALS;
+
+bit_parallel_mp::bit_parallel_mp(std::size_t in_size) :
+  decoded(in_size, 0),
+  out_offsets(1, 0) {
+}
+
+void bit_parallel_mp::build_input_edges() {
+  // Counting sort of the edges by input
+  in_offsets.assign(decoded.size() + 1, 0);
+  for (std::size_t i : out_edges) {
+    if (i >= decoded.size()) {
+      throw std::out_of_range("Input symbol out of range");
+    }
+    ++in_offsets[i + 1];
+  }
+  for (std::size_t i = 1; i < in_offsets.size(); ++i) {
+    in_offsets[i] += in_offsets[i-1];
+  }
+  in_edges.resize(out_edges.size());
+  std::vector<std::size_t> fill(in_offsets.cbegin(), in_offsets.cend() - 1);
+  for (std::size_t j = 0; j < received.size(); ++j) {
+    for (std::size_t e = out_offsets[j]; e < out_offsets[j+1]; ++e) {
+      in_edges[fill[out_edges[e]]++] = j;
+    }
+  }
+}
+
+void bit_parallel_mp::process_output(std::size_t j) {
+  const std::size_t first = out_offsets[j];
+  const std::size_t deg = out_offsets[j+1] - first;
+  const std::size_t *edges = out_edges.data() + first;
+
+  // An output decodes the k-th input in the trials where it was
+  // received and all the other inputs are known
+  suffix.resize(deg + 1);
+  suffix[deg] = ~mask_type(0);
+  for (std::size_t k = deg; k-- > 0;) {
+    suffix[k] = suffix[k+1] & decoded[edges[k]];
+  }
+  mask_type prefix = received[j];
+  for (std::size_t k = 0; k < deg && prefix != 0; ++k) {
+    const std::size_t in = edges[k];
+    const mask_type old = decoded[in];
+    const mask_type recovered = prefix & suffix[k+1] & ~old;
+    prefix &= old;
+    if (recovered == 0) continue;
+
+    decoded[in] = old | recovered;
+    for (std::size_t e = in_offsets[in]; e < in_offsets[in+1]; ++e) {
+      const std::size_t o = in_edges[e];
+      if (!queued[o]) {
+	queued[o] = true;
+	queue.push_back(o);
+      }
+    }
+  }
+}
+
+void bit_parallel_mp::run() {
+  build_input_edges();
+
+  queue.clear();
+  queued.assign(received.size(), true);
+  for (std::size_t j = received.size(); j-- > 0;) queue.push_back(j);
+
+  while (!queue.empty()) {
+    std::size_t j = queue.back();
+    queue.pop_back();
+    queued[j] = false;
+    if (received[j] != 0) process_output(j);
+  }
+}
+
+void bit_parallel_mp::reset() {
+  std::fill(decoded.begin(), decoded.end(), 0);
+  received.clear();
+  out_offsets.assign(1, 0);
+  out_edges.clear();
+}
+
+std::size_t bit_parallel_mp::input_size() const {
+  return decoded.size();
+}
+
+std::size_t bit_parallel_mp::output_size() const {
+  return received.size();
+}
+
+bit_parallel_mp::mask_type bit_parallel_mp::input_mask(std::size_t i) const {
+  return decoded.at(i);
+}
+
+bit_parallel_mp::mask_type bit_parallel_mp::decoded_trials() const {
+  mask_type all = ~mask_type(0);
+  for (mask_type m : decoded) all &= m;
+  return all;
+}
+
+std::size_t bit_parallel_mp::decoded_count(std::size_t trial) const {
+  if (trial >= TRIALS) throw std::out_of_range("Trial out of range");
+  std::size_t n = 0;
+  for (mask_type m : decoded) n += (m >> trial) & 1;
+  return n;
+}
+
+}}
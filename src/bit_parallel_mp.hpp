@@ -0,0 +1,86 @@
+#ifndef UEP_BIT_PARALLEL_MP_HPP
+#define UEP_BIT_PARALLEL_MP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace uep { namespace mp {
+
+/** Peeling decoder that runs the same graph for 64 erasure patterns
+ *  at once.
+ *
+ *  Each output symbol carries a mask with one bit per trial, set when
+ *  the output was received in that trial. The decoder computes for
+ *  each input symbol the mask of the trials where it is recovered by
+ *  the message-passing algorithm. The result of each trial is the
+ *  same as running an mp_context<bool> with only the received
+ *  outputs, since the set of inputs recovered by peeling does not
+ *  depend on the order of decoding. The ripple is not tracked.
+ */
+class bit_parallel_mp {
+public:
+  /** Mask with one bit per trial. */
+  typedef std::uint64_t mask_type;
+  /** Number of trials decoded together. */
+  static constexpr std::size_t TRIALS = 64;
+
+  /** Construct with in_size input symbols. */
+  explicit bit_parallel_mp(std::size_t in_size);
+
+  /** Add an output symbol linked to the input symbols in
+   *  [edges_begin, edges_end), received in the trials set in
+   *  `received`. Parallel edges are allowed.
+   */
+  template <class EdgeIter>
+  void add_output(mask_type received, EdgeIter edges_begin, EdgeIter edges_end);
+
+  /** Run the message-passing algorithm for all the trials. */
+  void run();
+  /** Remove the outputs and forget the decoded inputs. */
+  void reset();
+
+  /** Number of input symbols. */
+  std::size_t input_size() const;
+  /** Number of output symbols. */
+  std::size_t output_size() const;
+  /** Trials where the input `i` has been decoded. */
+  mask_type input_mask(std::size_t i) const;
+  /** Trials where all the inputs have been decoded. */
+  mask_type decoded_trials() const;
+  /** Number of inputs decoded in `trial`. */
+  std::size_t decoded_count(std::size_t trial) const;
+
+private:
+  std::vector<mask_type> decoded; /**< Decoded mask of each input. */
+  std::vector<mask_type> received; /**< Received mask of each output. */
+  /** Edges of the outputs, in CSR form: the edges of output j are
+   *  out_edges[out_offsets[j]], ..., out_edges[out_offsets[j+1]-1].
+   */
+  std::vector<std::size_t> out_offsets, out_edges;
+  /** Outputs linked to each input, in CSR form. Built by run(). */
+  std::vector<std::size_t> in_offsets, in_edges;
+  /** Scratch space of run(). */
+  std::vector<mask_type> suffix;
+  std::vector<std::size_t> queue;
+  std::vector<char> queued;
+
+  /** Build the input -> output adjacency. */
+  void build_input_edges();
+  /** Decode the inputs of output j with the current masks. */
+  void process_output(std::size_t j);
+};
+
+	     //// bit_parallel_mp template definitions ////
+
+template <class EdgeIter>
+void bit_parallel_mp::add_output(mask_type recv,
+				 EdgeIter edges_begin, EdgeIter edges_end) {
+  received.push_back(recv);
+  out_edges.insert(out_edges.end(), edges_begin, edges_end);
+  out_offsets.push_back(out_edges.size());
+}
+
+}}
+
+#endif
@@ -1,9 +1,15 @@
 #include "block_decoder.hpp"
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <iterator>
+#include <limits>
 #include <stdexcept>
 
+#include "metrics.hpp"
+#include "perf_trace.hpp"
+
 using namespace std;
 using namespace std::chrono;
 
@@ -17,14 +23,19 @@ block_decoder::block_decoder(std::unique_ptr<base_row_generator> &&rg) :
   basic_lg(boost::log::keywords::channel = log::basic),
   perf_lg(boost::log::keywords::channel = log::performance),
   rowgen(std::move(rg)),
+  received_unique(0),
+  link_offsets(1, 0),
   mp_ctx(rowgen->K()),
   mp_pristine(rowgen->K()) {
-  link_cache.reserve(rowgen->K());
+  if (rowgen->K() > std::numeric_limits<link_index_t>::max()) {
+    throw std::invalid_argument("The block is too large");
+  }
+  link_offsets.reserve(rowgen->K() + 1);
 }
 
 void block_decoder::check_correct_block(const fountain_packet &p) {
   // First packet: set blockno, length, seed
-  if (received_seqnos.empty()) {
+  if (received_unique == 0) {
     blockno = p.block_number();
     rowgen->reset(p.block_seed());
     pktsize = p.size();
@@ -40,6 +51,30 @@ void block_decoder::check_correct_block(const fountain_packet &p) {
   }
 }
 
+bool block_decoder::mark_received(std::size_t seqno) {
+  const std::size_t word = seqno / 64;
+  const std::uint64_t bit = std::uint64_t(1) << (seqno % 64);
+  if (word >= received_seqnos.size()) {
+    // Grow geometrically, the capacity is kept by reset()
+    received_seqnos.resize(std::max(word + 1, 2 * received_seqnos.size()), 0);
+  }
+  if (received_seqnos[word] & bit) return false;
+  received_seqnos[word] |= bit;
+  ++received_unique;
+  return true;
+}
+
+void block_decoder::generate_links(std::size_t max_seqno) {
+  while (link_offsets.size() <= max_seqno + 1) {
+    const base_row_generator::row_type row = rowgen->next_row();
+    link_edges.insert(link_edges.end(), row.cbegin(), row.cend());
+    if (link_edges.size() > std::numeric_limits<link_index_t>::max()) {
+      throw std::length_error("Too many links in the block");
+    }
+    link_offsets.push_back(static_cast<link_index_t>(link_edges.size()));
+  }
+}
+
 bool block_decoder::push(fountain_packet &&p) {
   // Make a size-one iter range with p, *mv_ptr should be an rvalue
   auto mv_ptr = std::make_move_iterator(&p);
@@ -55,8 +90,11 @@ bool block_decoder::push(const fountain_packet &p) {
 
 void block_decoder::reset() {
   rowgen->reset();
-  received_seqnos.clear();
-  link_cache.clear();
+  // Keep the capacity of the buffers for the next block
+  std::fill(received_seqnos.begin(), received_seqnos.end(), 0);
+  received_unique = 0;
+  link_offsets.assign(1, 0);
+  link_edges.clear();
   last_received.clear();
   mp_ctx.reset();
   mp_pristine.reset();
@@ -65,12 +103,12 @@ void block_decoder::reset() {
 }
 
 block_decoder::seed_t block_decoder::seed() const {
-  if (received_seqnos.empty()) throw std::runtime_error("No received packets");
+  if (received_unique == 0) throw std::runtime_error("No received packets");
   return rowgen->seed();
 }
 
 std::size_t block_decoder::block_number() const {
-  if (received_seqnos.empty()) throw std::runtime_error("No received packets");
+  if (received_unique == 0) throw std::runtime_error("No received packets");
   return blockno;
 }
 
@@ -127,12 +165,18 @@ bool block_decoder::operator!() const {
 }
 
 void block_decoder::run_message_passing() {
+  static metrics::histogram &setup_ns = metrics::get_histogram("mp.setup_ns");
+  static metrics::histogram &run_ns = metrics::get_histogram("mp.run_ns");
+  static metrics::histogram &ripple = metrics::get_histogram("mp.ripple_size");
+
   auto tic = high_resolution_clock::now();
 
-  for (auto i = last_received.cbegin(); i != last_received.cend(); ++i) {
+  for (fountain_packet &p : last_received) {
     // Update the context
-    const base_row_generator::row_type &row = link_cache[i->sequence_number()];
-    mp_pristine.add_output(sym_t(std::move(i->buffer())), row.cbegin(), row.cend());
+    const std::size_t seqno = p.sequence_number();
+    const link_index_t *row = link_edges.data();
+    mp_pristine.add_output(sym_t(std::move(p.buffer())),
+			   row + link_offsets[seqno], row + link_offsets[seqno+1]);
   }
   last_received.clear();
 
@@ -141,13 +185,17 @@ void block_decoder::run_message_passing() {
 
   duration<double> mp_tdiff = high_resolution_clock::now() - tic;
 
-  BOOST_LOG(perf_lg) << "block_decoder::run_message_passing mp_setup_time="
-		     << mp_tdiff.count();
+  UEP_TRACE(perf_trace::block_decoder_mp_setup, mp_tdiff.count());
 
   mp_ctx.run();
 
   avg_setup.add_sample(mp_tdiff.count());
   avg_mp.add_sample(mp_ctx.run_duration());
+  setup_ns.record(mp_tdiff);
+  run_ns.record(duration<double>(mp_ctx.run_duration()));
+  // Average size of the ripple during this run
+  double rs = mp_ctx.average_ripple_size();
+  if (std::isfinite(rs)) ripple.record(std::lround(rs));
 
   // BOOST_LOG(perf_lg) << "block_decoder::run_message_passing decoded_pkts="
   //		     << mp_ctx.decoded_count()
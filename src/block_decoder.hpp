@@ -1,8 +1,7 @@
 #ifndef UEP_BLOCK_DECODER_HPP
 #define UEP_BLOCK_DECODER_HPP
 
-#include <forward_list>
-#include <set>
+#include <cstdint>
 #include <vector>
 
 #include "counter.hpp"
@@ -47,8 +46,8 @@ private:
   typedef lazy_xor<buffer_type,LX_MAX_SIZE> sym_t;
   /** Type of the underlying message passing context. */
   typedef mp::mp_context<sym_t> mp_ctx_t;
-  /** Type of the container used to cache the row generator output. */
-  typedef std::vector<base_row_generator::row_type> link_cache_t;
+  /** Type of the indices stored in the link cache. */
+  typedef std::uint32_t link_index_t;
 
 public:
   /** Iterator over the input packets, either decoded or empty. */
@@ -140,9 +139,15 @@ private:
   log::default_logger basic_lg, perf_lg;
 
   std::unique_ptr<base_row_generator> rowgen;
-  std::set<std::size_t> received_seqnos;
-  link_cache_t link_cache;
-  std::forward_list<fountain_packet> last_received;
+  /** Bitmap of the received seqnos, one bit per seqno. */
+  std::vector<std::uint64_t> received_seqnos;
+  std::size_t received_unique; /**< Number of bits set in received_seqnos. */
+  /** Rows of the generated seqnos in CSR form: the row of seqno i is
+   *  link_edges[link_offsets[i]], ..., link_edges[link_offsets[i+1]-1].
+   */
+  std::vector<link_index_t> link_offsets, link_edges;
+  /** Packets pushed since the last run of the message passing. */
+  std::vector<fountain_packet> last_received;
   mp_ctx_t mp_ctx; /**< Context used to run the mp algorithm and hold
 		    *   the result.
 		    */
@@ -163,6 +168,10 @@ private:
    *  exception if they don't match the current block.
    */
   void check_correct_block(const fountain_packet &p);
+  /** Mark a seqno as received. Return false if it was already. */
+  bool mark_received(std::size_t seqno);
+  /** Generate the rows up to the given seqno. */
+  void generate_links(std::size_t max_seqno);
   /** Run the message passing algortihm over the currently received
    *  packets.
    */
@@ -184,26 +193,19 @@ std::size_t block_decoder::push(Iter in_first, Iter in_last) {
     check_correct_block(p);
     size_t p_seqno = p.sequence_number();
 
-    auto ins_ret = received_seqnos.insert(p_seqno);
     // Ignore duplicates
-    if (!ins_ret.second) {
+    if (!mark_received(p_seqno)) {
       break;
     }
 
-    last_received.push_front(std::move(p));
+    last_received.push_back(std::move(p));
     ++pushed;
     if (max_seqno < p_seqno)
       max_seqno = p_seqno;
   }
 
   // Generate enough output links
-  if (link_cache.size() <= max_seqno) {
-    size_t prev_size = link_cache.size();
-    link_cache.resize(max_seqno+1);
-    for (size_t i = prev_size; i < max_seqno+1; ++i) {
-      link_cache[i] = rowgen->next_row();
-    }
-  }
+  generate_links(max_seqno);
 
   if (pushed > 0) run_message_passing();
   return pushed;
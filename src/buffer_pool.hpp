@@ -0,0 +1,84 @@
+#ifndef UEP_BUFFER_POOL_HPP
+#define UEP_BUFFER_POOL_HPP
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "base_types.hpp"
+
+namespace uep {
+
+/** Pool of reusable buffers.
+ *
+ *  The buffers are handed out as shared pointers that return the
+ *  buffer to the pool, keeping its capacity, when the last reference
+ *  is dropped. This can happen on any thread and also after the pool
+ *  has been destroyed. At most max_free() buffers are kept for reuse.
+ */
+class buffer_pool {
+public:
+  /** Construct an empty pool that keeps up to `max_free` unused
+   *  buffers.
+   */
+  explicit buffer_pool(std::size_t max_free = 4096) :
+    free_(std::make_shared<free_list>()) {
+    free_->max_free = max_free;
+  }
+
+  /** Return a buffer of the given size. Its content is unspecified. */
+  std::shared_ptr<buffer_type> get(std::size_t size) {
+    std::unique_ptr<buffer_type> b;
+    {
+      std::lock_guard<std::mutex> lock(free_->mutex);
+      if (!free_->bufs.empty()) {
+	b = std::move(free_->bufs.back());
+	free_->bufs.pop_back();
+      }
+    }
+    if (!b) b.reset(new buffer_type());
+    b->resize(size);
+
+    std::weak_ptr<free_list> wfl(free_);
+    return std::shared_ptr<buffer_type>(b.release(),
+					[wfl](buffer_type *p) {
+					  recycle(wfl, p);
+					});
+  }
+
+  /** Number of buffers currently available for reuse. */
+  std::size_t free_count() const {
+    std::lock_guard<std::mutex> lock(free_->mutex);
+    return free_->bufs.size();
+  }
+
+  /** Maximum number of unused buffers kept by the pool. */
+  std::size_t max_free() const {
+    return free_->max_free;
+  }
+
+private:
+  struct free_list {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<buffer_type>> bufs;
+    std::size_t max_free;
+  };
+
+  std::shared_ptr<free_list> free_;
+
+  /** Put the buffer back in the free list, or delete it if the pool
+   *  is gone or full.
+   */
+  static void recycle(const std::weak_ptr<free_list> &wfl, buffer_type *p) {
+    std::unique_ptr<buffer_type> b(p);
+    std::shared_ptr<free_list> fl = wfl.lock();
+    if (!fl) return;
+    std::lock_guard<std::mutex> lock(fl->mutex);
+    if (fl->bufs.size() < fl->max_free)
+      fl->bufs.push_back(std::move(b));
+  }
+};
+
+}
+
+#endif
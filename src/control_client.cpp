@@ -0,0 +1,215 @@
+#include "control_client.hpp"
+
+#include <cassert>
+#include <functional>
+
+namespace uep { namespace net {
+
+const uep_client_parameters DEFAULT_CLIENT_PARAMETERS{
+  "",
+  "12345",
+  "127.0.0.1",
+  "12312",
+  {0,1},
+  0,
+  false
+};
+
+control_client::control_client(boost::asio::io_service &io_svc,
+			       const uep_client_parameters &cl_par) :
+  basic_lg(boost::log::keywords::channel = log::basic),
+  perf_lg(boost::log::keywords::channel = log::performance),
+  state(SEND_STREAM),
+  io_svc_(io_svc),
+  strand(io_svc),
+  tcp_socket(io_svc),
+  proto_rd(io_svc, tcp_socket),
+  proto_wr(io_svc, tcp_socket),
+  dc(io_svc),
+  client_params(cl_par),
+  out_stream(nullptr),
+  done(false) {
+}
+
+control_client::control_client(boost::asio::io_service &io_svc,
+			       const uep_client_parameters &cl_par,
+			       std::ostream &out) :
+  control_client(io_svc, cl_par) {
+  out_stream = &out;
+}
+
+bool control_client::is_done() const {
+  return done;
+}
+
+void control_client::start() {
+  using namespace boost::asio::ip;
+  using namespace std::placeholders;
+
+  tcp::resolver resolver(io_svc_);
+  tcp::resolver::query query(client_params.remote_control_addr,
+			     client_params.remote_control_port);
+  tcp::resolver::iterator ep_iter = resolver.resolve(query);
+  auto h = strand.wrap(std::bind(&control_client::handle_connection,
+				 this,
+				 _1, _2));
+  boost::asio::async_connect(tcp_socket, ep_iter, h);
+}
+
+void control_client::handle_connection(const boost::system::error_code &ec,
+				       boost::asio::ip::tcp::resolver::iterator i) {
+  if (ec) throw boost::system::system_error(ec);
+  if (i == decltype(i){}) throw std::runtime_error("Could not connect");
+
+  if (client_params.stream_name.empty())
+    throw std::runtime_error("Stream name is empty");
+  out_msg.set_stream_name(client_params.stream_name);
+  BOOST_LOG_SEV(basic_lg, log::trace) << "Sending the stream name";
+  auto h = strand.wrap([this](const boost::system::error_code &ec,
+			      std::size_t bytes_tx) {
+			 if (ec) throw boost::system::system_error(ec);
+			 if (state != SEND_STREAM)
+			   throw std::logic_error("Unexpected state");
+			 state = WAIT_PARAMS;
+		       });
+  proto_wr.async_write_one(out_msg, h);
+  wait_for_message();
+}
+
+void control_client::wait_for_message() {
+  using namespace std::placeholders;
+  auto handler = strand.wrap(std::bind(&control_client::handle_new_message,
+				       this, _1, _2));
+  proto_rd.async_read_one(last_msg, handler);
+}
+
+void control_client::handle_new_message(const boost::system::error_code &ec,
+					std::size_t bytes) {
+  if (ec == boost::asio::error::operation_aborted) {
+    return; // Client was stopped
+  }
+
+  if (ec) throw boost::system::system_error(ec);
+
+  switch (state) {
+  case WAIT_PARAMS:
+    handle_params();
+    state = SEND_CLIENT_PORT;
+    send_client_port();
+    break;
+  case WAIT_SERVER_PORT:
+    handle_server_port();
+    state = SEND_START;
+    send_start();
+    break;
+  case RUNNING:
+    // handle stop msg
+    break;
+  default:
+    throw std::runtime_error("Should never get a message in this state");
+  }
+  wait_for_message();
+}
+
+void control_client::handle_params() {
+  const protobuf::ClientParameters &cp = last_msg.client_parameters();
+  assert(cp.ks_size() == cp.rfs_size());
+  assert(cp.ks_size() != 0);
+  assert(cp.ef() != 0);
+  assert(cp.c() != 0);
+  assert(cp.delta() != 0);
+  std::vector<std::size_t> Ks, RFs;
+  for (int i = 0; i < cp.ks_size(); ++i) {
+    Ks.push_back(cp.ks(i));
+    RFs.push_back(cp.rfs(i));
+  }
+  out_header.assign(cp.header().begin(), cp.header().end());
+  multicast_addr = cp.multicastaddress();
+  // Servers that do not send the packing use padded_packing
+  nal_packing packing = static_cast<nal_packing>(cp.nalpacking());
+  dc.setup_decoder(Ks.begin(), Ks.end(),
+		   RFs.begin(), RFs.end(),
+		   cp.ef(),
+		   cp.c(),
+		   cp.delta());
+  if (out_stream)
+    dc.setup_sink(std::ref(*out_stream), out_header,
+		  client_params.async_write, packing);
+  else
+    dc.setup_sink(out_header, client_params.stream_name,
+		  client_params.async_write, packing);
+  dc.enable_ack(cp.ack());
+  if (cp.datagramsize() > 0)
+    dc.datagram_size(cp.datagramsize(), cp.symbolsize());
+  // Servers that do not send the header version use version 0
+  if (cp.has_headerversion())
+    dc.header_version(static_cast<raw_header_version>(cp.headerversion()));
+  else
+    dc.header_version(header_v0);
+  //dc.expected_count(0);
+  dc.timeout(client_params.timeout);
+  //dc.add_stop_handler();
+  dc.channel_transition_probabilities(client_params.drop_probs[0],
+				      client_params.drop_probs[1]);
+  dc.bind(client_params.local_data_port);
+}
+
+void control_client::send_client_port() {
+  unsigned short cp = dc.client_endpoint().port();
+  out_msg.set_client_port(cp);
+  BOOST_LOG_SEV(basic_lg, log::trace) << "Sending the client port "
+				      << cp;
+  auto h = strand.wrap([this](const boost::system::error_code &ec,
+			      std::size_t bytes_tx) {
+			 if (ec) throw boost::system::system_error(ec);
+			 if (state != SEND_CLIENT_PORT)
+			   throw std::logic_error("Unexpected state");
+			 state = WAIT_SERVER_PORT;
+		       });
+  proto_wr.async_write_one(out_msg, h);
+}
+
+void control_client::handle_server_port() {
+  using namespace std::placeholders;
+
+  unsigned short sp = static_cast<unsigned short>(last_msg.server_port());
+  assert(sp != 0);
+  remote_data_ep.port(sp);
+  remote_data_ep.address(tcp_socket.remote_endpoint().address());
+  auto dc_stop_h = strand.wrap(std::bind(&control_client::handle_dc_stop,
+					 this, _1));
+  dc.add_stop_handler(dc_stop_h);
+  if (!multicast_addr.empty()) {
+    // The server sends to the group on the same port it uses for the ACKs
+    using namespace boost::asio::ip;
+    udp::endpoint group_ep(address::from_string(multicast_addr), sp);
+    BOOST_LOG_SEV(basic_lg, log::debug) << "Join the multicast group "
+					<< group_ep;
+    dc.join_group(group_ep, tcp_socket.local_endpoint().address());
+  }
+  dc.start_receive(remote_data_ep);
+}
+
+void control_client::send_start() {
+  out_msg.set_start_stop(protobuf::START);
+  BOOST_LOG_SEV(basic_lg, log::trace) << "Sending the start command";
+  auto h = strand.wrap([this](const boost::system::error_code &ec,
+			      std::size_t bytes_tx) {
+			 if (ec) throw boost::system::system_error(ec);
+			 if (state != SEND_START)
+			   throw std::logic_error("Unexpected state");
+			 state = RUNNING;
+		       });
+  proto_wr.async_write_one(out_msg, h);
+}
+
+void control_client::handle_dc_stop(const boost::system::error_code &ec) {
+  if (ec) throw boost::system::system_error(ec);
+
+  BOOST_LOG_SEV(basic_lg, log::debug) << "TCP client is stopping";
+  tcp_socket.cancel();
+  tcp_socket.close();
+  done = true;
+}
+
+}}
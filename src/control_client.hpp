@@ -0,0 +1,116 @@
+#ifndef UEP_CONTROL_CLIENT_HPP
+#define UEP_CONTROL_CLIENT_HPP
+
+#include <atomic>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "controlMessage.pb.h"
+#include "data_client_server.hpp"
+#include "log.hpp"
+#include "nal_writer.hpp"
+#include "protobuf_rw.hpp"
+#include "uep_decoder.hpp"
+
+namespace uep { namespace net {
+
+/** Set of parameters needed by the control_client to setup a
+ *  connection.
+ */
+struct uep_client_parameters {
+  std::string stream_name;
+  std::string local_data_port;
+  std::string remote_control_addr;
+  std::string remote_control_port;
+  std::vector<double> drop_probs;
+  double timeout;
+  /** Write the received stream from a background thread. */
+  bool async_write;
+};
+
+/** Default values for the client parameters. */
+extern const uep_client_parameters DEFAULT_CLIENT_PARAMETERS;
+
+/** Class that requests a stream from a control_server and sets up a
+ *  data_client to receive it.
+ */
+class control_client {
+  using dec_t = uep_decoder;
+  using sink_t = nal_writer;
+  using dc_type = data_client<dec_t, sink_t>;
+
+  enum client_state {
+    SEND_STREAM, // Send the requested stream name (initial state)
+    WAIT_PARAMS, // Wait for the client parameters
+    SEND_CLIENT_PORT, // Send the local data port
+    WAIT_SERVER_PORT, // Wait for the remote data port
+    SEND_START, // Send the start command
+    RUNNING // Data client is active
+  };
+
+public:
+  /** Construct the client. This does not open the connection to the
+   *  server. The received stream is written to
+   *  `dataset_client/${stream_name}.264`.
+   */
+  explicit control_client(boost::asio::io_service &io_svc,
+			  const uep_client_parameters &cl_par);
+  /** Construct the client. This does not open the connection to the
+   *  server. The received stream is written to `out`.
+   */
+  explicit control_client(boost::asio::io_service &io_svc,
+			  const uep_client_parameters &cl_par,
+			  std::ostream &out);
+
+  /** Open the connction to the server and start the receiving process. */
+  void start();
+
+  /** True when the data client has received the whole stream and the
+   *  control connection is closed.
+   */
+  bool is_done() const;
+
+private:
+  log::default_logger basic_lg, perf_lg;
+
+  client_state state;
+
+  boost::asio::io_service &io_svc_;
+  boost::asio::io_service::strand strand;
+  boost::asio::ip::tcp::socket tcp_socket;
+  protobuf_reader proto_rd;
+  protobuf_writer proto_wr;
+  dc_type dc;
+  uep_client_parameters client_params;
+  std::ostream *out_stream; /**< Stream where the received NALs are
+			     *   written, or nullptr to use the
+			     *   default file.
+			     */
+  std::atomic_bool done; /**< Set when the data client has stopped. */
+
+  uep::protobuf::ControlMessage last_msg;
+  uep::protobuf::ControlMessage out_msg;
+  buffer_type out_header;
+  boost::asio::ip::udp::endpoint remote_data_ep;
+  std::string multicast_addr; /**< Group where the server sends the
+			       *   data, or empty for unicast.
+			       */
+
+  void handle_connection(const boost::system::error_code &ec,
+			 boost::asio::ip::tcp::resolver::iterator i);
+  void wait_for_message();
+  /** Handle a new control message. */
+  void handle_new_message(const boost::system::error_code &ec, std::size_t bytes);
+  void handle_params();
+  void send_client_port();
+  void handle_server_port();
+  void send_start();
+  void handle_dc_stop(const boost::system::error_code &ec);
+};
+
+}}
+
+#endif
@@ -0,0 +1,586 @@
+#include "control_server.hpp"
+
+#include <numeric>
+
+/*
+  1: client to server: streamName
+  2: server to client: TXParam
+  2.1 decoder parameters
+  2.1.1 K size_t (unsigned long)
+  2.1.2 c (double)
+  2.1.3 delta (double)
+  2.1.4 RFM (uint8_t)
+  2.1.5 RFL (uint8_t)
+  2.1.6 EF (uint8_t)
+  2.2 ACK enabled
+  2.3 File size
+  3: client to server: Connect
+  3.1 udp port where to send data
+  When the server receives it the encoder must be created
+  4: server to client: ConnACK
+  4.1 udp port where to receive ack
+  5: client to server: Play
+  DataServer.start
+*/
+
+namespace uep {
+namespace net {
+
+const uep_server_parameters DEFAULT_SERVER_PARAMETERS{
+  {50,1000},
+  {10,1},
+  1,
+  0.1,
+  0.5,
+  50,
+  true,
+  0,
+  "12312",
+  true,
+  uep_encoder<>::MAX_SEQNO,
+  0,
+  1,
+  false,
+  "",
+  padded_packing,
+  ""
+};
+
+std::shared_ptr<control_connection>
+control_connection::create(boost::asio::io_service& io_service,
+			   control_server &psrv,
+			   const uep_server_parameters &sp) {
+  auto ccptr = new control_connection(io_service, psrv, sp);
+  return std::shared_ptr<control_connection>(ccptr);
+}
+
+void control_connection::start() {
+  BOOST_LOG_SEV(basic_lg, log::debug) << "Start a new connection";
+  wait_for_message();
+}
+
+control_connection::control_connection(boost::asio::io_service& io_service,
+				       control_server &psrv,
+				       const uep_server_parameters &sp) :
+  basic_lg(boost::log::keywords::channel = log::basic),
+  perf_lg(boost::log::keywords::channel = log::performance),
+  parent_srv(psrv),
+  state(WAIT_STREAM),
+  io(io_service),
+  strand(io),
+  socket_(io),
+  proto_rd(io, socket_),
+  proto_wr(io, socket_),
+  ds(io),
+  live_ds(io),
+  srv_params(sp),
+  member_id(0) {
+}
+
+boost::asio::ip::tcp::socket &control_connection::socket() {
+  return socket_;
+}
+
+const control_connection::ds_type &control_connection::sender() const {
+  return group_ds ? *group_ds : ds;
+}
+
+bool control_connection::is_live() const {
+  return !srv_params.live_input.empty();
+}
+
+void control_connection::wait_for_message() {
+  using namespace std::placeholders;
+  auto handler = strand.wrap(std::bind(&control_connection::handle_new_message,
+				       this, _1, _2));
+  proto_rd.async_read_one(last_msg, handler);
+}
+
+void control_connection::handle_new_message(const boost::system::error_code &ec,
+					    std::size_t bytes) {
+  if (ec == boost::asio::error::eof) {
+    // Client closed the connction
+    socket_.cancel();
+    //socket_.close();
+    if (group_ds) {
+      group_ds->remove_member(client_ep);
+      group_ds->session()->unsubscribe(member_id);
+    }
+    // Stop the data server before forgetting the connection. The
+    // handlers of the cancelled operations are already queued when
+    // the stop handler runs: forget the connection after them.
+    auto forget = [this](const boost::system::error_code&) {
+      io.post([this]() { parent_srv.forget_connection(*this); });
+    };
+    if (is_live()) {
+      live_ds.add_stop_handler(forget);
+      live_ds.stop();
+    }
+    else {
+      ds.add_stop_handler(forget);
+      ds.stop();
+    }
+    return;
+  }
+
+  if (ec) throw boost::system::system_error(ec);
+
+  switch (state) {
+  case WAIT_STREAM:
+    streamName = last_msg.stream_name();
+    if (streamName.empty()) throw std::runtime_error("Empty stream name");
+    if (is_live()) {
+      open_live_input();
+      return; // Wait for the next message once the input is open
+    }
+    handle_stream_name();
+    state = SEND_PARAMS;
+    send_client_params();
+    break;
+  case WAIT_CLIENT_PORT:
+    clientPort = static_cast<unsigned short>(last_msg.client_port());
+    if (clientPort == 0) throw std::runtime_error("Client port == 0");
+    handle_client_port();
+    state = SEND_SERVER_PORT;
+    send_server_port();
+    break;
+  case WAIT_START: {
+    uep::protobuf::StartStop ss = last_msg.start_stop();
+    if (ss == uep::protobuf::START) {
+      handle_start();
+      state = RUNNING;
+    }
+    break;
+  }
+  case RUNNING:
+    // handle stop msg
+    break;
+  default:
+    throw std::runtime_error("Should never get a message in this state");
+  }
+  wait_for_message();
+}
+
+void control_connection::handle_stream_name() {
+  std::cout << "Stream name received from client: \"" << streamName << "\"\n";
+
+  /* CREATION OF DATA SERVER */
+  if (!srv_params.multicast_addr.empty()) {
+    // Join the group of the clients that share the session
+    auto ep = socket_.local_endpoint();
+    group_ds = parent_srv.group_server(streamName, ep.address());
+    member_id = group_ds->session()->subscribe({});
+  }
+  else if (srv_params.shared_streams) {
+    ds.attach_session(parent_srv.join_stream(streamName));
+  }
+  else {
+    //BOOST_LOG_SEV(basic_lg, debug) << "Creation of encoder...\n";
+    std::cout << "Creation of encoder...\n";
+    // setup the encoder inside the data_server
+    ds.setup_encoder(srv_params.Ks.begin(), srv_params.Ks.end(),
+		     srv_params.RFs.begin(), srv_params.RFs.end(),
+		     srv_params.EF,
+		     srv_params.c,
+		     srv_params.delta);
+    // setup the source  inside the data_server
+    ds.setup_source(streamName, srv_params.packet_size);
+    ds.source().use_end_of_stream(true);
+    ds.source().packing(srv_params.packing);
+  }
+
+  configure_sender(ds);
+}
+
+void control_connection::open_live_input() {
+  std::cout << "Stream name received from client: \"" << streamName
+	    << "\", sending the live input\n";
+
+  live_ds.setup_encoder(srv_params.Ks.begin(), srv_params.Ks.end(),
+			srv_params.RFs.begin(), srv_params.RFs.end(),
+			srv_params.EF,
+			srv_params.c,
+			srv_params.delta);
+  configure_sender(live_ds);
+  // Opening a FIFO and reading its header block until the encoder
+  // writes them: do it on the source thread. Keep two blocks ready.
+  std::size_t queue_size = 2 * std::accumulate(srv_params.Ks.cbegin(),
+					       srv_params.Ks.cend(),
+					       std::size_t(0));
+  auto h = strand.wrap([this](std::exception_ptr e) {
+      if (e) std::rethrow_exception(e);
+      live_ds.source().use_end_of_stream(true);
+      state = SEND_PARAMS;
+      send_client_params();
+      wait_for_message();
+    });
+  live_ds.async_setup_source(queue_size, h, srv_params.live_input,
+			     srv_params.packet_size);
+}
+
+template <class DS>
+void control_connection::configure_sender(DS &d) {
+  d.target_send_rate(srv_params.sendRate);
+  d.enable_ack(srv_params.ack);
+  d.max_sequence_number(srv_params.max_n_per_block);
+  d.datagram_size(srv_params.datagram_size);
+}
+
+void control_connection::send_client_params() {
+  using namespace uep::protobuf;
+
+  // SENDING ENCODER PARAMETERS
+  const auto &Ks = srv_params.Ks;
+  const auto &RFs = srv_params.RFs;
+  ClientParameters &cp = *(out_msg.mutable_client_parameters());
+
+  auto j = Ks.begin();
+  auto k = RFs.begin();
+  while (j != Ks.end()) {
+    cp.add_ks(*j++);
+    cp.add_rfs(*k++);
+  }
+
+  cp.set_c(srv_params.c);
+  cp.set_delta(srv_params.delta);
+
+  cp.set_ef(srv_params.EF);
+  cp.set_ack(srv_params.ack);
+
+  const buffer_type &hdr = is_live() ? live_ds.source().header() :
+    sender().source().header();
+  cp.set_header(hdr.data(), hdr.size());
+  cp.set_headersize(hdr.size());
+  cp.set_filesize(is_live() ? live_ds.source().totLength() :
+		  sender().source().totLength());
+  // The coded symbols carry the uep_packet seqno in the payload
+  cp.set_symbolsize(srv_params.packet_size + sizeof(uep_packet::seqno_type));
+  cp.set_datagramsize(srv_params.datagram_size);
+  cp.set_headerversion(is_live() ? live_ds.header_version() :
+		       sender().header_version());
+  if (group_ds)
+    cp.set_multicastaddress(srv_params.multicast_addr);
+  cp.set_nalpacking(srv_params.packing);
+
+  BOOST_LOG_SEV(basic_lg, log::trace) << "Sending the client parameters";
+  auto h = strand.wrap([this](const boost::system::error_code &ec,
+			      std::size_t bytes_tx) {
+			 if (ec) throw boost::system::system_error(ec);
+			 if (state != SEND_PARAMS)
+			   throw std::logic_error("Unexpected state");
+			 state = WAIT_CLIENT_PORT;
+		       });
+  proto_wr.async_write_one(out_msg, h);
+}
+
+void control_connection::handle_client_port() {
+  using namespace boost::asio;
+  ip::address remote_addr = socket_.remote_endpoint().address();
+  client_ep = ip::udp::endpoint{remote_addr, clientPort};
+  if (group_ds) {
+    BOOST_LOG_SEV(basic_lg, log::debug) << "Add client " << client_ep
+					<< " to the multicast group";
+    group_ds->add_member(client_ep, member_id);
+    return;
+  }
+  if (is_live()) {
+    BOOST_LOG_SEV(basic_lg, log::debug) << "Opening UDP server for client "
+					<< client_ep << " (live input)";
+    live_ds.open(client_ep);
+    return;
+  }
+  BOOST_LOG_SEV(basic_lg, log::debug) << "Opening UDP server for client "
+				      << client_ep;
+  ds.open(client_ep);
+}
+
+void control_connection::send_server_port() {
+  unsigned short sp = is_live() ? live_ds.server_endpoint().port() :
+    sender().server_endpoint().port();
+  out_msg.set_server_port(sp);
+  BOOST_LOG_SEV(basic_lg, log::trace) << "Sending the server port ("
+				      << sp << ")";
+  auto h = strand.wrap([this](const boost::system::error_code &ec,
+			      std::size_t bytes_tx) {
+			 if (ec) throw boost::system::system_error(ec);
+			 if (state != SEND_SERVER_PORT)
+			   throw std::logic_error("Unexpected state");
+			 state = WAIT_START;
+		       });
+  proto_wr.async_write_one(out_msg, h);
+}
+
+void control_connection::handle_start() {
+  if (group_ds)
+    group_ds->start(); // Does nothing if already started
+  else if (is_live())
+    live_ds.start();
+  else
+    ds.start();
+}
+
+control_server::control_server(boost::asio::io_service& io_service,
+			       const uep_server_parameters &srv_params,
+			       control_server_pool &pool,
+			       bool reuse_port) :
+  basic_lg(boost::log::keywords::channel = log::basic),
+  perf_lg(boost::log::keywords::channel = log::performance),
+  io(io_service),
+  pool(pool),
+  strand(io),
+  acceptor(io_service),
+  server_params(srv_params),
+  accepted_count_(0) {
+  using boost::asio::ip::tcp;
+
+  tcp::resolver resolver(io);
+  tcp::resolver::query listen_q(server_params.tcp_port_num);
+  tcp::endpoint ep = *resolver.resolve(listen_q); // Take the first one
+
+  acceptor.open(ep.protocol());
+  if (reuse_port) {
+#ifdef SO_REUSEPORT
+    typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET,
+							 SO_REUSEPORT>
+      reuse_port_option;
+    acceptor.set_option(reuse_port_option(true));
+#else
+    throw std::runtime_error("SO_REUSEPORT is not supported");
+#endif
+  }
+  acceptor.bind(ep);
+  acceptor.listen();
+
+  // start_accept() creates a socket and
+  // initiates an asynchronous accept operation
+  // to wait for a new connection.
+  start_accept();
+  BOOST_LOG_SEV(basic_lg, log::info) << "Server is listening on "
+				     << acceptor.local_endpoint();
+}
+
+void control_server::forget_connection(const control_connection &c) {
+  const control_connection *const cptr = &c;
+  auto i = std::find_if(active_conns.cbegin(), active_conns.cend(),
+			[cptr](const std::shared_ptr<control_connection> &ptr){
+			  return ptr.get() == cptr;
+			});
+  if (i != active_conns.cend()) {
+    BOOST_LOG_SEV(basic_lg, log::debug) << "Forget connection from "
+					<< (*i)->socket().remote_endpoint();
+    active_conns.erase(i);
+    if (server_params.oneshot) {
+      acceptor.cancel();
+    }
+  }
+}
+
+boost::asio::ip::tcp::endpoint control_server::local_endpoint() const {
+  return acceptor.local_endpoint();
+}
+
+std::size_t control_server::accepted_count() const {
+  return accepted_count_;
+}
+
+std::shared_ptr<control_connection::session_type>
+control_server::join_stream(const std::string &stream_name) {
+  return pool.join_stream(stream_name);
+}
+
+std::shared_ptr<control_connection::ds_type>
+control_server::group_server(const std::string &stream_name,
+			     const boost::asio::ip::address &iface) {
+  return pool.group_server(stream_name, io, iface);
+}
+
+void control_server::start_accept() {
+  using namespace std::placeholders;
+
+  std::shared_ptr<control_connection> new_connection =
+    control_connection::create(io, *this, server_params);
+  auto &socket = new_connection->socket();
+  acceptor.async_accept(socket,
+			strand.wrap(std::bind(&control_server::handle_accept,
+					      this,
+					      new_connection,
+					      _1)));
+}
+
+void control_server::handle_accept(std::shared_ptr<control_connection> new_connection,
+				   const boost::system::error_code& error) {
+  if (error == boost::asio::error::operation_aborted) return;
+
+  if (error) {
+    std::cerr << "Error on async_accept: " << error.message() << std::endl;
+  }
+  else if (!server_params.oneshot || active_conns.empty()) {
+    BOOST_LOG_SEV(basic_lg, log::debug) << "New connection from "
+					<< new_connection->socket().remote_endpoint();
+    active_conns.push_back(new_connection);
+    ++accepted_count_;
+    new_connection->start();
+  }
+
+  // Call start_accept() to initiate the next accept operation.
+  start_accept();
+}
+
+control_server_pool::control_server_pool(const uep_server_parameters &srv_params) :
+  basic_lg(boost::log::keywords::channel = log::basic),
+  perf_lg(boost::log::keywords::channel = log::performance),
+  server_params(srv_params),
+  shards(srv_params.threads) {
+  if (shards.empty())
+    throw std::invalid_argument("Need at least one thread");
+  if (srv_params.oneshot && shards.size() > 1)
+    throw std::invalid_argument("A oneshot server must use one thread");
+  if (!srv_params.live_input.empty() &&
+      (srv_params.shared_streams || srv_params.packing != padded_packing))
+    throw std::invalid_argument("The live input is sent to each client"
+				" with padded packing");
+
+  bool reuse_port = shards.size() > 1;
+  uep_server_parameters sp = srv_params;
+  for (shard &s : shards) {
+    s.io = std::make_unique<boost::asio::io_service>();
+    s.server = std::make_unique<control_server>(*s.io, sp, *this,
+						 reuse_port);
+    // The other servers must bind to the same port, also when it was
+    // chosen by the OS
+    sp.tcp_port_num = std::to_string(s.server->local_endpoint().port());
+  }
+}
+
+control_server_pool::~control_server_pool() {
+  stop();
+  for (shard &s : shards) {
+    if (s.thread.joinable()) s.thread.join();
+  }
+  // A multicast server can be held by the connections of any thread:
+  // destroy all the servers before the io_services
+  for (shard &s : shards) {
+    s.server.reset();
+  }
+}
+
+void control_server_pool::start() {
+  BOOST_LOG_SEV(basic_lg, log::info) << "Starting " << shards.size()
+				     << " server threads";
+  for (shard &s : shards) {
+    if (s.thread.joinable())
+      throw std::logic_error("The pool was already started");
+    s.thread = std::thread(&control_server_pool::run_shard, this, std::ref(s));
+  }
+}
+
+void control_server_pool::stop() {
+  for (shard &s : shards) {
+    s.io->stop();
+  }
+}
+
+void control_server_pool::join() {
+  for (shard &s : shards) {
+    if (s.thread.joinable()) s.thread.join();
+  }
+  for (shard &s : shards) {
+    if (s.error) std::rethrow_exception(s.error);
+  }
+}
+
+void control_server_pool::run() {
+  start();
+  join();
+}
+
+boost::asio::ip::tcp::endpoint control_server_pool::local_endpoint() const {
+  return shards.front().server->local_endpoint();
+}
+
+std::size_t control_server_pool::size() const {
+  return shards.size();
+}
+
+std::vector<std::size_t> control_server_pool::accepted_counts() const {
+  std::vector<std::size_t> counts;
+  for (const shard &s : shards) {
+    counts.push_back(s.server->accepted_count());
+  }
+  return counts;
+}
+
+std::shared_ptr<control_connection::session_type>
+control_server_pool::join_stream(const std::string &stream_name) {
+  std::lock_guard<std::mutex> lck(streams_mtx);
+  return join_stream_locked(stream_name);
+}
+
+std::shared_ptr<control_connection::ds_type>
+control_server_pool::group_server(const std::string &stream_name,
+				  boost::asio::io_service &io,
+				  const boost::asio::ip::address &iface) {
+  std::lock_guard<std::mutex> lck(streams_mtx);
+  auto s = join_stream_locked(stream_name);
+  shared_stream &entry = shared_streams[stream_name];
+  auto g = entry.group_server.lock();
+  if (g) return g;
+
+  const auto &sp = server_params;
+  using ds_type = control_connection::ds_type;
+  // The cross-thread calls only queue handlers on the server's
+  // strand: destroy it on its thread, after them and after the ones
+  // cancelled by the stop
+  g = std::shared_ptr<ds_type>(new ds_type(io), [&io](ds_type *p) {
+      std::shared_ptr<ds_type> owner(p);
+      io.post([&io,owner]() {
+	  owner->stop();
+	  io.post([owner]() {});
+	});
+    });
+  g->target_send_rate(sp.sendRate);
+  g->enable_ack(sp.ack);
+  g->max_sequence_number(sp.max_n_per_block);
+  g->datagram_size(sp.datagram_size);
+  g->attach_session(s, true);
+  g->open_multicast(boost::asio::ip::address::from_string(sp.multicast_addr),
+		    iface);
+  entry.group_server = g;
+  return g;
+}
+
+std::shared_ptr<control_connection::session_type>
+control_server_pool::join_stream_locked(const std::string &stream_name) {
+  shared_stream &entry = shared_streams[stream_name];
+  auto s = entry.session.lock();
+  if (s && s->is_joinable()) return s;
+
+  BOOST_LOG_SEV(basic_lg, log::info) << "New shared session for \""
+				     << stream_name << "\"";
+  s = std::make_shared<control_connection::session_type>();
+  const auto &sp = server_params;
+  s->setup_encoder(sp.Ks.begin(), sp.Ks.end(),
+		   sp.RFs.begin(), sp.RFs.end(),
+		   sp.EF,
+		   sp.c,
+		   sp.delta);
+  s->setup_source(stream_name, sp.packet_size);
+  s->source().use_end_of_stream(true);
+  s->source().packing(sp.packing);
+  entry.session = s;
+  entry.group_server.reset();
+  return s;
+}
+
+void control_server_pool::run_shard(shard &s) {
+  try {
+    s.io->run();
+  }
+  catch (...) {
+    s.error = std::current_exception();
+    // Stop the other threads: join() will rethrow
+    stop();
+  }
+}
+
+}}
@@ -0,0 +1,342 @@
+#ifndef UEP_CONTROL_SERVER_HPP
+#define UEP_CONTROL_SERVER_HPP
+
+#include <atomic>
+#include <cassert>
+#include <codecvt>
+#include <ctime>
+#include <exception>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "annexb_reader.hpp"
+#include "controlMessage.pb.h"
+#include "data_client_server.hpp"
+#include "log.hpp"
+#include "lt_param_set.hpp"
+#include "nal_reader.hpp"
+#include "protobuf_rw.hpp"
+#include "uep_encoder.hpp"
+#include "utils.hpp"
+
+
+namespace uep {
+namespace net {
+
+/** Set of parameters needed by the server to setup a new connection. */
+struct uep_server_parameters{
+  std::vector<std::size_t> Ks;
+  std::vector<std::size_t> RFs;
+  std::size_t EF;
+  double c;
+  double delta;
+  std::size_t packet_size;
+  bool ack;
+  double sendRate;
+  std::string tcp_port_num;
+  bool oneshot;
+  std::size_t max_n_per_block;
+  std::size_t datagram_size; /**< Maximum size of the multi-symbol
+			      *   datagrams. Use 0 to send one symbol
+			      *   per datagram.
+			      */
+  std::size_t threads; /**< Number of threads, each with its own
+			*   io_service and control_server, that share
+			*   the TCP port.
+			*/
+  bool shared_streams; /**< Code each stream once for all the
+			*   clients that request it together.
+			*/
+  std::string multicast_addr; /**< Send the shared streams to this
+			       *   multicast group. Leave empty to
+			       *   send to each client.
+			       */
+  nal_packing packing; /**< Packing of the NALs into the packets. */
+  std::string live_input; /**< Annex-B H264 bitstream, for example a
+			   *   FIFO fed by a live encoder, sent to
+			   *   every client whatever stream it
+			   *   requests. Each client opens it
+			   *   again. Leave empty to send the streams
+			   *   of the dataset.
+			   */
+};
+
+/** Default values for the server parameters. */
+extern const uep_server_parameters DEFAULT_SERVER_PARAMETERS;
+
+class control_server; // Forward declaration for control_connection
+class control_server_pool; // Forward declaration for control_server
+
+/** Class to handle the control connection used to setup the
+ *  data_server and data_client.
+ */
+class control_connection {
+  friend control_server; // needs to get a ref to the socket
+  friend control_server_pool; // needs the session and server types
+
+  using enc_t = uep_encoder<>;
+  using src_t = nal_reader;
+  using ds_type = data_server<enc_t, src_t>;
+  using session_type = ds_type::session_type;
+  using live_ds_type = data_server<enc_t, annexb_reader>;
+
+  /** Enum used to keep track of the current state of the server. */
+  enum connection_state {
+    WAIT_STREAM, // Wait for the stream name (initial state)
+    SEND_PARAMS, // Send the client parameters
+    WAIT_CLIENT_PORT, // Wait for the client data port
+    SEND_SERVER_PORT, // Send the server data port
+    WAIT_START, // Wait for the Start from the client
+    RUNNING // Data server is active
+  };
+
+public:
+  /** Create a new control_connection and return a shared pointer to it. */
+  static std::shared_ptr<control_connection>
+  create(boost::asio::io_service& io_service,
+	 control_server &psrv,
+	 const uep_server_parameters &sp);
+
+  /** Wait for the stream name from the client. */
+  void start();
+
+private:
+  log::default_logger basic_lg, perf_lg;
+
+  control_server &parent_srv;
+
+  connection_state state;
+
+  boost::asio::io_service& io;
+  boost::asio::io_service::strand strand;
+  boost::asio::ip::tcp::socket socket_;
+  protobuf_reader proto_rd;
+  protobuf_writer proto_wr;
+  ds_type ds;
+  live_ds_type live_ds; /**< Sender of the live input, if any. */
+  uep_server_parameters srv_params;
+  std::shared_ptr<ds_type> group_ds; /**< Multicast sender shared with
+				      *   the other clients, if any.
+				      */
+  session_type::subscriber_id member_id; /**< Subscriber of the
+					  *   client in the session of
+					  *   group_ds.
+					  */
+  boost::asio::ip::udp::endpoint client_ep;
+
+  uep::protobuf::ControlMessage last_msg; /**< Last received message. */
+  uep::protobuf::ControlMessage out_msg; /**< Hold the message to be sent. */
+  std::string streamName;
+  unsigned short clientPort;
+
+  control_connection(boost::asio::io_service& io_service,
+		     control_server &psrv,
+		     const uep_server_parameters &sp);
+
+  boost::asio::ip::tcp::socket &socket();
+  /** Return the data_server that sends to the client. */
+  const ds_type &sender() const;
+  /** True when the client gets the live input. */
+  bool is_live() const;
+
+  /** Schedule a TCP read to receive a message. */
+  void wait_for_message();
+  /** Handle a new control message. */
+  void handle_new_message(const boost::system::error_code &ec, std::size_t bytes);
+  /** Use the streamName to setup the data server. */
+  void handle_stream_name();
+  /** Open the live input and read it on its own thread, then send
+   *  the parameters to the client.
+   */
+  void open_live_input();
+  /** Set the parameters of the data server that sends to the
+   *  client.
+   */
+  template <class DS>
+  void configure_sender(DS &d);
+  /** Send the parameters to the client. */
+  void send_client_params();
+  /** Open the server socket to send to the received client port. */
+  void handle_client_port();
+  /** Send the UDP server port to the client. */
+  void send_server_port();
+  /** Start the UDP server. */
+  void handle_start();
+};
+
+/** Class that accepts incoming connections on the TCP control port
+ *	and setups a new control_connection for each one.
+ *
+ *  This class holds a shared pointer to every new connection. They
+ *  must be deleted using forget_connection.
+ *
+ *  The shared sessions are kept by the control_server_pool that owns
+ *  the server (see control_server_pool::join_stream()).
+ */
+class control_server {
+public:
+  /** Builds using the given io_service. The server parameters will be
+   *  used for each new connection. When `reuse_port` is true the
+   *  acceptor sets SO_REUSEPORT, so that more control_servers can
+   *  listen on the same port. The shared streams are taken from
+   *  `pool`, which must outlive the server.
+   */
+  control_server(boost::asio::io_service& io_service,
+		 const uep_server_parameters &srv_params,
+		 control_server_pool &pool,
+		 bool reuse_port = false);
+
+  /** Delete the shared pointer to a connection held by the server. If
+   *	there are no other shared pointers to the connection it will be
+   *	destroyed.
+   */
+  void forget_connection(const control_connection &c);
+
+  /** Return the TCP endpoint where the server is listening. */
+  boost::asio::ip::tcp::endpoint local_endpoint() const;
+  /** Return the number of connections accepted so far. */
+  std::size_t accepted_count() const;
+
+  /** Return the pool's joinable shared session that codes the given
+   *  stream.
+   */
+  std::shared_ptr<control_connection::session_type>
+  join_stream(const std::string &stream_name);
+  /** Return the pool's multicast server for the given stream. If a
+   *  new one is needed, it runs on the io_service of this server.
+   */
+  std::shared_ptr<control_connection::ds_type>
+  group_server(const std::string &stream_name,
+	       const boost::asio::ip::address &iface);
+
+private:
+  log::default_logger basic_lg, perf_lg;
+
+  boost::asio::io_service &io;
+  control_server_pool &pool;
+  boost::asio::io_service::strand strand;
+  boost::asio::ip::tcp::acceptor acceptor;
+  uep_server_parameters server_params;
+  std::list<std::shared_ptr<control_connection>> active_conns;
+  std::atomic_size_t accepted_count_; /**< Number of accepted
+				       *   connections.
+				       */
+
+  /** Wait for a new connection attempt. */
+  void start_accept();
+  /** Handle a new connection attempt. */
+  void handle_accept(std::shared_ptr<control_connection> new_connection,
+		     const boost::system::error_code& error);
+};
+
+/** Class that runs a number of control_servers on the same TCP
+ *  port, each one with its own io_service and thread.
+ *
+ *  The acceptors use SO_REUSEPORT, so the kernel spreads the
+ *  incoming connections among the threads. Each connection, with its
+ *  data_server, is then handled only by the thread that accepted it.
+ *
+ *  With shared_streams the connections that request the same stream
+ *  while its session is still joinable read it from the same
+ *  stream_session, so that it is coded only once. The sessions, and
+ *  the multicast servers, are shared by all the threads: a
+ *  multicast server runs on the thread of the connection that
+ *  created it, the others only use its thread-safe methods.
+ */
+class control_server_pool {
+public:
+  /** Construct the servers and bind them to the port given in the
+   *  parameters, using `srv_params.threads` threads. The threads are
+   *  not started yet.
+   */
+  explicit control_server_pool(const uep_server_parameters &srv_params);
+  /** Stop and join the threads. */
+  ~control_server_pool();
+
+  /** Start one thread for each server. */
+  void start();
+  /** Stop the io_services. The threads return as soon as possible. */
+  void stop();
+  /** Wait for all the threads to return. If a thread terminated with
+   *  an exception, rethrow it.
+   */
+  void join();
+  /** Start the threads and wait for them to return. */
+  void run();
+
+  /** Return the TCP endpoint where the servers are listening. */
+  boost::asio::ip::tcp::endpoint local_endpoint() const;
+  /** Return the number of threads. */
+  std::size_t size() const;
+  /** Return the number of connections accepted by each thread. */
+  std::vector<std::size_t> accepted_counts() const;
+
+  /** Return a joinable shared session that codes the given stream,
+   *  creating a new one if needed. Can be called by any thread.
+   */
+  std::shared_ptr<control_connection::session_type>
+  join_stream(const std::string &stream_name);
+  /** Return the server that sends the current session of the given
+   *  stream to the multicast group, creating it on `io` if needed.
+   *  The datagrams are sent through the interface with address
+   *  `iface`. Can be called by any thread.
+   *
+   *  The last shared pointer to the server can be released by any
+   *  thread: the server is then stopped and destroyed by its own
+   *  io_service, after the handlers already queued.
+   */
+  std::shared_ptr<control_connection::ds_type>
+  group_server(const std::string &stream_name,
+	       boost::asio::io_service &io,
+	       const boost::asio::ip::address &iface);
+
+private:
+  /** Server bound to a single thread. */
+  struct shard {
+    std::unique_ptr<boost::asio::io_service> io;
+    std::unique_ptr<control_server> server;
+    std::thread thread;
+    std::exception_ptr error; /**< Exception that terminated the
+			       *   thread, if any.
+			       */
+  };
+
+  /** Current shared session of a stream and its multicast sender. */
+  struct shared_stream {
+    std::weak_ptr<control_connection::session_type> session;
+    std::weak_ptr<control_connection::ds_type> group_server;
+  };
+
+  log::default_logger basic_lg, perf_lg;
+
+  uep_server_parameters server_params;
+  std::mutex streams_mtx; /**< Protects shared_streams. */
+  std::map<std::string, shared_stream> shared_streams;
+  std::vector<shard> shards;
+
+  /** Implement join_stream(). Must be called with streams_mtx
+   *  locked.
+   */
+  std::shared_ptr<control_connection::session_type>
+  join_stream_locked(const std::string &stream_name);
+  /** Run the io_service of a shard until it is stopped. If it
+   *  throws, stop all the shards.
+   */
+  void run_shard(shard &s);
+};
+
+}}
+
+#endif
@@ -1,19 +1,34 @@
 #ifndef UEP_NET_DATA_CLIENT_SERVER_HPP
 #define UEP_NET_DATA_CLIENT_SERVER_HPP
 
+#include <algorithm>
+#include <array>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
 #include <system_error>
+#include <thread>
+#include <vector>
 
 #include <boost/asio.hpp>
 #include <boost/asio/steady_timer.hpp>
 
+#include "buffer_pool.hpp"
 #include "counter.hpp"
 #include "log.hpp"
+#include "metrics.hpp"
 #include "packets_rw.hpp"
+#include "perf_trace.hpp"
+#include "stream_session.hpp"
+#include "token_bucket.hpp"
 #include "utils.hpp"
 
 namespace uep { namespace net {
@@ -55,6 +70,12 @@ public:
   void bind(const std::string &service);
   /** Bind the socket to the given port. */
   void bind(unsigned short port);
+  /** Receive the data packets from the multicast group `group_ep`,
+   *  joined on the interface with address `iface`. The socket bound
+   *  by bind() is still used to send the ACKs.
+   */
+  void join_group(const boost::asio::ip::udp::endpoint &group_ep,
+		  const boost::asio::ip::address &iface);
 
   /** Listen asynchronously for packets coming from a given remote
    *  (source) endpoint.
@@ -103,6 +124,22 @@ public:
   void channel_transition_probabilities(double p_GB, double p_BG);
   /** Get the channel state transition probabilities. */
   std::pair<double, double> channel_transition_probabilities() const;
+  /** Expect datagrams of up to `datagram_size` bytes that carry
+   *  multiple symbols of `symbol_size` bytes. Their payloads are
+   *  received directly into the symbol buffers. A datagram_size of 0
+   *  expects single-symbol datagrams. Datagrams with a different
+   *  layout are still accepted, at the cost of a copy.
+   */
+  void datagram_size(std::size_t datagram_size, std::size_t symbol_size);
+  /** Get the expected multi-symbol datagram size, or 0. */
+  std::size_t datagram_size() const;
+  /** Set the version of the raw headers expected from the server and
+   *  used for the ACKs. Datagrams with a different version are still
+   *  accepted, at the cost of a copy.
+   */
+  void header_version(raw_header_version v);
+  /** Get the version of the raw headers. */
+  raw_header_version header_version() const;
 
   /** Add an handler that will be called when this client stops. */
   template <class H>
@@ -134,6 +171,10 @@ private:
 					    *   across threads.
 					    */
   boost::asio::ip::udp::socket socket_;
+  boost::asio::ip::udp::socket group_socket_; /**< Socket that receives
+					       *   from the multicast
+					       *   group, if open.
+					       */
   boost::asio::ip::udp::endpoint listen_endpoint_; /**< The local
 						    *   endpoint where
 						    *   the
@@ -148,9 +189,55 @@ private:
 						    *   receive
 						    *   packets.
 						    */
-  buffer_type recv_buffer; /**< Buffer that holds the last received
-			    *	UDP payload.
-			    */
+  std::size_t datagram_size_; /**< Expected size of the multi-symbol
+			       *   datagrams, or 0 for single-symbol
+			       *   datagrams.
+			       */
+  std::size_t multi_symbol_size; /**< Expected size of the symbols in
+				  *   a multi-symbol datagram.
+				  */
+  raw_header_version header_version_; /**< Expected version of the
+				       *   raw headers.
+				       */
+  raw_data_header recv_header; /**< Header of the last received
+				*   single-symbol packet.
+				*/
+  raw_data_multi_header recv_multi_header; /**< Header of the last
+					    *   received
+					    *   multi-symbol
+					    *   packet.
+					    */
+  std::vector<raw_data_multi_seqno> recv_seqnos;
+  std::vector<std::shared_ptr<buffer_type>> recv_payloads; /**< Pooled
+							    *   buffers
+							    *   that
+							    *   receive
+							    *   the
+							    *   payloads.
+							    *   They
+							    *   are
+							    *   moved
+							    *   into
+							    *   the
+							    *   received
+							    *   packets.
+							    */
+  buffer_type recv_overflow; /**< Receives the part of the datagram
+			      *   that does not fit in the other
+			      *   buffers.
+			      */
+  std::vector<boost::asio::mutable_buffer> recv_bufs; /**< Buffer
+						       *   sequence
+						       *   of the
+						       *   next
+						       *   receive.
+						       */
+  std::size_t recv_symbol_size; /**< Size of the pooled payload
+				 *   buffers for single-symbol
+				 *   datagrams: the largest payload
+				 *   received so far.
+				 */
+  buffer_pool recv_pool;
   buffer_type ack_buffer; /**< Buffer to hold the raw ack during
 			   *   the async transmission.
 			   */
@@ -169,6 +256,9 @@ private:
   markov2_distribution drop_dist; /**< Distribution of packet
 				   *   dropping.
 				   */
+  bool rx_any; /**< Set after the first received packet. */
+  std::uint32_t rx_blockno; /**< Block of the newest received packet. */
+  std::uint32_t rx_seqno; /**< Seqno of the newest received packet. */
 
   boost::asio::steady_timer timeout_timer; /**< Timer used to stop the
 					   *   reception after some
@@ -187,8 +277,28 @@ private:
    */
   std::atomic<std::chrono::steady_clock::duration> timeout_;
 
+  /** Return the socket that receives the data packets. */
+  boost::asio::ip::udp::socket &recv_socket();
   /** Setup the socket to asynchronously receive a packet. */
   void async_receive_pkt();
+  /** Return the buffer sequence used to receive the next datagram:
+   *  the header, the pooled payload buffers (preceded by the
+   *  sequence numbers for multi-symbol datagrams) and the overflow
+   *  buffer.
+   */
+  const std::vector<boost::asio::mutable_buffer> &recv_buffers();
+  /** Append to `out` the fountain_packets carried by the received
+   *  datagram of `size` bytes. The payloads are not copied when the
+   *  datagram matches the layout of the receive buffers. If the
+   *  datagram is malformed throw a runtime_error. Return the header
+   *  version of the datagram.
+   */
+  raw_header_version take_received(std::size_t size,
+				   std::list<fountain_packet> &out);
+  /** Parse a received datagram and append its packets to `out`
+   *  unless the channel model drops it.
+   */
+  void receive_datagram(std::size_t size, std::list<fountain_packet> &out);
   /** Setup the timer to expire after the timeout value. */
   void reset_timer();
   /** Schedule the transmission of an ACK to the server. */
@@ -219,13 +329,33 @@ private:
  *  is called.
  *
  *  The send rate can be dynamically limited by specifying it in
- *  bit/s. If it is too high the server sends at maximum rate.
+ *  bit/s. If it is too high, zero or infinite the server sends at
+ *  maximum rate. The rate is enforced by a token bucket that is
+ *  checked before each transmission: the timer is only used when the
+ *  bucket is empty and it waits at least one pacing tick, so the
+ *  packets leave in bursts of about one tick worth of data. After a
+ *  late wake-up the bucket holds the tokens of the delay, up to
+ *  MAX_BURST_TICKS ticks, so that the average rate is kept on a
+ *  loaded machine while the bursts stay short.
+ *
+ *  A Source that blocks on its input, such as a FIFO fed by a live
+ *  encoder, can be built and read on a separate thread (see
+ *  async_setup_source()), so that it never stalls the io_service.
+ *
+ *  Instead of its own Encoder and Source, the server can read the
+ *  coded packets from a stream_session shared with other servers
+ *  (see attach_session()). A session can also be sent to a multicast
+ *  group by a single server (see open_multicast()).
  */
 template <class Encoder, class Source>
 class data_server {
 public:
   typedef Encoder encoder_type;
   typedef Source source_type;
+  typedef stream_session<Encoder, Source> session_type;
+
+  /** Largest burst, in pacing ticks, sent after a late wake-up. */
+  static constexpr int MAX_BURST_TICKS = 8;
   typedef typename Encoder::parameter_set encoder_parameter_set;
   typedef typename Source::parameter_set source_parameter_set;
 
@@ -242,8 +372,31 @@ public:
     is_stopped_(true),
     ack_enabled(true),
     max_per_block(Encoder::MAX_SEQNO),
-    last_ack(ack_header_size),
-    pkt_timer(io_service_) {
+    datagram_size_(0),
+    header_version_(header_v1),
+    last_dgram_size(0),
+    last_ack(ack_header_size_v1),
+    pkt_timer(io_service_),
+    pkt_timer_gen(0),
+    pkt_in_flight(false),
+    pacing_tick_(std::chrono::milliseconds(1)),
+    pace_gap(0),
+    sent_bytes(0),
+    session_id(0),
+    is_subscribed(false),
+    session_wait(false),
+    is_multicast(false),
+    source_wait(false) {
+  }
+
+  /** Stop the thread of a source built by async_setup_source(). It
+   *  returns as soon as its current read does.
+   */
+  ~data_server() {
+    if (!feed_) return;
+    std::lock_guard<std::mutex> lck(feed_->mtx);
+    feed_->closed = true;
+    feed_->not_full.notify_one();
   }
 
   /** Replace the encoder with a new one built using the given
@@ -261,7 +414,36 @@ public:
   template<typename ...Args>
   void setup_source(Args... args) {
     BOOST_LOG_SEV(basic_lg, log::trace) << "Setting up the source";
-    source_ = std::make_unique<Source>(args...);
+    source_ = std::make_shared<Source>(args...);
+  }
+
+  /** Build the source with the given arguments on a separate thread,
+   *  which after start() keeps reading up to `queue_size` packets
+   *  ahead of the encoder. The handler is called through the strand
+   *  with a null std::exception_ptr when the source is ready, or with
+   *  the exception thrown by its constructor.
+   */
+  template<class Handler, typename ...Args>
+  void async_setup_source(std::size_t queue_size, Handler h, Args... args) {
+    if (queue_size < 1)
+      throw std::invalid_argument("Must read ahead at least one packet");
+    BOOST_LOG_SEV(basic_lg, log::trace) << "Setting up the source thread";
+    source_.reset();
+    feed_ = std::make_shared<source_feed>();
+    feed_->max_size = queue_size;
+    feed_->wake = [this]() {
+      strand_.post(std::bind(&data_server::handle_source_wake, this));
+    };
+    auto ready = [this,h](std::shared_ptr<Source> src,
+			  std::exception_ptr e) {
+      strand_.post([this,h,src,e]() mutable {
+	  source_ = src;
+	  h(e);
+	});
+    };
+    auto make = [args...]() { return std::make_shared<Source>(args...); };
+    std::thread(&data_server::read_source<decltype(ready), decltype(make)>,
+		feed_, ready, make).detach();
   }
 
   /** Resolve the destination (client) endpoint and bind the socket. */
@@ -293,6 +475,77 @@ public:
 				       << socket_.local_endpoint();
   }
 
+  /** Bind the socket to a free port and send to the multicast group
+   *  `group` on the same port, through the interface with address
+   *  `iface`. The ACKs are accepted only from the clients added with
+   *  add_member().
+   */
+  void open_multicast(const boost::asio::ip::address &group,
+		      const boost::asio::ip::address &iface) {
+    using namespace boost::asio::ip;
+
+    if (!group.is_multicast())
+      throw std::invalid_argument("Not a multicast address");
+
+    socket_.open(udp::v4());
+    // The clients on this host must bind the same port
+    socket_.set_option(udp::socket::reuse_address(true));
+#ifdef IP_MULTICAST_ALL
+    // Do not receive the datagrams sent to the group
+    typedef boost::asio::detail::socket_option::boolean<IPPROTO_IP,
+							 IP_MULTICAST_ALL>
+      multicast_all_option;
+    socket_.set_option(multicast_all_option(false));
+#endif
+    socket_.bind(udp::endpoint(address_v4::any(), 0));
+    socket_.set_option(multicast::outbound_interface(iface.to_v4()));
+    socket_.set_option(multicast::enable_loopback(true));
+    socket_.set_option(multicast::hops(1));
+    client_endpoint_ = udp::endpoint(group, socket_.local_endpoint().port());
+    is_multicast = true;
+    BOOST_LOG_SEV(basic_lg, log::info) << "Server will send data to the group "
+				       << client_endpoint_ << " via "
+				       << iface;
+  }
+
+  /** Read the coded packets from a shared session instead of the own
+   *  encoder and source. A follower always sends the frontier block
+   *  of the session, as needed to send to a multicast group.
+   */
+  void attach_session(std::shared_ptr<session_type> s,
+		      bool follower = false) {
+    session_ = std::move(s);
+    session_id = session_->subscribe([this]() {
+	strand_.post(std::bind(&data_server::handle_session_wake, this));
+      }, follower);
+    is_subscribed = true;
+  }
+
+  /** Return the shared session, or nullptr. */
+  std::shared_ptr<session_type> session() const {
+    return session_;
+  }
+
+  /** Accept the ACKs coming from `client_ep` as the ones of the
+   *  session subscriber `id`. This is used by multicast servers.
+   */
+  void add_member(const boost::asio::ip::udp::endpoint &client_ep,
+		  typename session_type::subscriber_id id) {
+    strand_.dispatch([this, client_ep, id]() {
+	members_[client_ep] = id;
+      });
+  }
+
+  /** Stop accepting the ACKs from `client_ep`. When there are no
+   *  members left the server stops.
+   */
+  void remove_member(const boost::asio::ip::udp::endpoint &client_ep) {
+    strand_.dispatch([this, client_ep]() {
+	members_.erase(client_ep);
+	if (members_.empty()) handle_stopped();
+      });
+  }
+
   /** Schedule the start of a transmission toward the client endpoint. */
   void start() {
     BOOST_LOG_SEV(basic_lg, log::info) << "UDP server is starting";
@@ -320,12 +573,38 @@ public:
     return target_send_rate_;
   }
 
+  /** Return the average send rate (bit/s) obtained from the first
+   *  to the last transmitted packet.
+   */
+  double achieved_send_rate() const {
+    std::chrono::duration<double> dt = last_sent_time - first_sent_time;
+    if (dt.count() <= 0) return 0;
+    return sent_bytes * 8 / dt.count();
+  }
+
+  /** Set the minimum time between two wake-ups of the pacing
+   *  timer. Larger ticks produce larger bursts.
+   */
+  void pacing_tick(std::chrono::steady_clock::duration t) {
+    if (t <= std::chrono::steady_clock::duration::zero())
+      throw std::invalid_argument("The pacing tick must be positive");
+    pacing_tick_ = t;
+  }
+
+  /** Get the current pacing tick. */
+  std::chrono::steady_clock::duration pacing_tick() const {
+    return pacing_tick_;
+  }
+
   /** Set the maximum sequence number before skipping to the next
-   *  block.
+   *  block. It cannot exceed the limits of the Encoder and of the
+   *  header version.
    */
   void max_sequence_number(std::size_t m) {
     if (m > Encoder::MAX_SEQNO)
       throw std::overflow_error("Cannot exceed the Encoder's limit");
+    if (m > raw_max_number(header_version_))
+      throw std::overflow_error("Cannot exceed the header's limit");
     if (m < 1)
       throw std::underflow_error("Must send at least one packet");
     max_per_block = m;
@@ -335,6 +614,38 @@ public:
     return max_per_block;
   }
 
+  /** Pack multiple coded symbols of the same block in each datagram,
+   *  up to `ds` bytes. A value of 0 sends one symbol per datagram
+   *  with the single-symbol header.
+   */
+  void datagram_size(std::size_t ds) {
+    if (ds > UDP_MAX_PAYLOAD)
+      throw std::overflow_error("The datagram size exceeds the UDP limit");
+    datagram_size_ = ds;
+  }
+
+  /** Get the maximum datagram size, or 0 for single-symbol datagrams. */
+  std::size_t datagram_size() const {
+    return datagram_size_;
+  }
+
+  /** Set the version of the raw headers sent to the client and
+   *  expected in the ACKs. Version 0 lowers the maximum sequence
+   *  number to fit its 16-bit field.
+   */
+  void header_version(raw_header_version v) {
+    if (v != header_v0 && v != header_v1)
+      throw std::invalid_argument("Unknown header version");
+    header_version_ = v;
+    if (max_per_block > raw_max_number(v))
+      max_per_block = raw_max_number(v);
+  }
+
+  /** Get the version of the raw headers. */
+  raw_header_version header_version() const {
+    return header_version_;
+  }
+
   /** Get the UDP endpoint that the server socket is currently bound
    *  to.
    */
@@ -369,12 +680,12 @@ public:
 
   /** Return a const reference to the source object. */
   Source &source() const {
-    return *source_;
+    return session_ ? session_->source() : *source_;
   }
 
   /** Return a const referece to the encoder object. */
   const Encoder &encoder() const {
-    return *encoder_;
+    return session_ ? session_->encoder() : *encoder_;
   }
 
 private:
@@ -384,9 +695,11 @@ private:
 				      *	  to allow for
 				      *	  default-construction.
 				      */
-  std::unique_ptr<Source> source_; /**< The source. Use a pointer to
+  std::shared_ptr<Source> source_; /**< The source. Use a pointer to
 				    *	allow for
-				    *	default-construction.
+				    *	default-construction
+				    *	and to share it with
+				    *	its thread.
 				    */
 
   boost::asio::io_service &io_service_;
@@ -397,6 +710,10 @@ private:
 					    */
   boost::asio::ip::udp::socket socket_;
   boost::asio::ip::udp::endpoint client_endpoint_;
+  boost::asio::ip::udp::endpoint ack_endpoint_; /**< Source of the
+						 *   last received
+						 *   ACK.
+						 */
 
   std::atomic<double> target_send_rate_; /**< Target send rate in
 					  *   bit/s.
@@ -413,14 +730,83 @@ private:
 				     *   each block before skipping to
 				     *   the next.
 				     */
-  buffer_type last_pkt; /**< Last _raw_ coded packet generated
-			       *   by the encoder.
+  std::size_t datagram_size_; /**< Maximum size of the multi-symbol
+			       *   datagrams. When 0 each datagram
+			       *   carries a single symbol.
 			       */
+  raw_header_version header_version_; /**< Version of the raw headers. */
+  std::vector<fountain_packet> last_pkts; /**< Coded packets carried
+					   *   by the next datagram.
+					   */
+  raw_data_header last_header; /**< Raw header used when sending a
+				*   single symbol.
+				*/
+  raw_data_multi_header last_multi_header; /**< Raw header used when
+					    *   sending multiple
+					    *   symbols.
+					    */
+  std::vector<raw_data_multi_seqno> last_seqnos;
+  std::vector<boost::asio::const_buffer> send_bufs; /**< Buffers that
+						     *   form the
+						     *   next
+						     *   datagram.
+						     */
+  std::size_t last_dgram_size; /**< Total size of send_bufs. */
   buffer_type last_ack; /**< Last _raw_ ack packet received. */
-  std::chrono::steady_clock::time_point last_sent_time;
-  boost::asio::steady_timer pkt_timer; /**< Timer used to schedule the
-					*   packet transmissions.
+  boost::asio::steady_timer pkt_timer; /**< Timer used to wait for
+					*   the token bucket to refill.
 					*/
+  std::size_t pkt_timer_gen; /**< Incremented each time the timer is
+			      *   armed or cancelled, to discard
+			      *   stale expirations.
+			      */
+  bool pkt_in_flight; /**< Set while a datagram is being sent. */
+  token_bucket pacer; /**< Token bucket (in bits) that enforces the
+		       *   target send rate.
+		       */
+  std::chrono::steady_clock::duration pacing_tick_;
+  std::chrono::steady_clock::time_point last_pace_time; /**< Last call
+							 *   to pace_pkt.
+							 */
+  std::chrono::duration<double> pace_gap; /**< Maximum of the gaps
+					   *   between the calls to
+					   *   pace_pkt, decaying over
+					   *   time.
+					   */
+  std::size_t sent_bytes; /**< Bytes sent since the start. */
+  std::chrono::steady_clock::time_point first_sent_time;
+  std::chrono::steady_clock::time_point last_sent_time;
+
+  std::shared_ptr<session_type> session_; /**< Shared session that
+					   *   replaces the encoder
+					   *   and source, if any.
+					   */
+  typename session_type::subscriber_id session_id;
+  bool is_subscribed; /**< Set while subscribed to session_. */
+  bool session_wait; /**< Set while waiting for the session. */
+  bool is_multicast; /**< Set when sending to a multicast group. */
+  std::map<boost::asio::ip::udp::endpoint,
+	   typename session_type::subscriber_id> members_; /**< Session
+							    *   subscribers
+							    *   of the
+							    *   multicast
+							    *   clients.
+							    */
+
+  /** Packets read ahead by the thread of the source. */
+  struct source_feed {
+    std::mutex mtx;
+    std::condition_variable not_full;
+    std::deque<fountain_packet> queue;
+    std::size_t max_size = 0;
+    bool running = false; /**< Set by start() to begin the reads. */
+    bool waiting = false; /**< Set while the server waits for packets. */
+    bool ended = false; /**< Set when the source has no more packets. */
+    bool closed = false; /**< Set when the server is destroyed. */
+    std::function<void()> wake; /**< Post handle_source_wake(). */
+  };
+  std::shared_ptr<source_feed> feed_; /**< Set by async_setup_source(). */
+  bool source_wait; /**< Set while waiting for the source thread. */
 
   std::list<
     std::function<
@@ -434,20 +820,24 @@ private:
   void schedule_next_pkt() {
     BOOST_LOG_SEV(basic_lg, log::debug) << "Called schedule_next_pkt";
     using std::move;
-    //using std::chrono::seconds;
-    using std::chrono::microseconds;
-    using namespace std::placeholders;
 
     if (is_stopped_) return;
 
+    if (session_) {
+      schedule_session_pkt();
+      return;
+    }
+
     // Check if the max number has been reached
     if (max_per_block <= encoder_->coded_count()) {
       encoder_->next_block();
     }
 
     // Load the encoder until it has a full block
-    while (*source_ && !encoder_->has_block()) {
-      encoder_->push(source_->next_packet());
+    source_wait = false;
+    if (!fill_encoder([this]() { return !encoder_->has_block(); })) {
+      source_wait = true;
+      return;
     }
 
     // Encoder has partial blocks left: use padding
@@ -465,23 +855,251 @@ private:
       return;
     }
 
-    fountain_packet p = encoder_->next_coded();
-    bool is_first = last_pkt.empty();
-    last_pkt = build_raw_packet(move(p));
+    last_pkts.clear();
+    last_pkts.push_back(encoder_->next_coded());
+
+    // Add more symbols of the same block if they fit the datagram
+    if (datagram_size_ > 0) {
+      std::size_t max_count = symbols_per_datagram(last_pkts.front().size(),
+						   datagram_size_,
+						   header_version_);
+      while (last_pkts.size() < max_count &&
+	     encoder_->coded_count() < max_per_block) {
+	last_pkts.push_back(encoder_->next_coded());
+      }
+    }
+
+    build_send_buffers();
+    pace_pkt();
+  }
+
+  /** Read the next coded packets from the session and schedule their
+   *  transmission. If the session is not ready wait for a wake-up.
+   */
+  void schedule_session_pkt() {
+    last_pkts.clear();
+    auto st = session_->next_coded(session_id, 1, max_per_block, last_pkts);
+    if (st == session_type::session_end) {
+      BOOST_LOG_SEV(basic_lg, log::info) <<
+	"Data server out of data to send";
+      stop();
+      return;
+    }
+    if (st == session_type::session_wait) {
+      session_wait = true;
+      // Waiting for data is not a late wake-up
+      last_pace_time = std::chrono::steady_clock::time_point();
+      // Read again when the session may push the slow subscribers
+      pkt_timer.expires_from_now(session_->max_block_time());
+      pkt_timer.async_wait(strand_.wrap(std::bind(&data_server::handle_session_timer,
+						  this, std::placeholders::_1,
+						  ++pkt_timer_gen)));
+      return;
+    }
+
+    // Add more symbols of the same block if they fit the datagram
+    if (datagram_size_ > 0) {
+      std::size_t max_count = symbols_per_datagram(last_pkts.front().size(),
+						   datagram_size_,
+						   header_version_);
+      session_->next_coded(session_id, max_count - 1, max_per_block,
+			   last_pkts);
+    }
+
+    build_send_buffers();
+    pace_pkt();
+  }
+
+  /** Called when the session can be read again. */
+  void handle_session_wake() {
+    if (is_stopped_ || !session_wait) return;
+    session_wait = false;
+    ++pkt_timer_gen;
+    pkt_timer.cancel();
+    schedule_next_pkt();
+  }
+
+  /** Push the packets of the source into the encoder while `need()`
+   *  is true. A source with its own thread gives only the packets
+   *  already read: return false if they are not enough and the
+   *  source has not ended.
+   */
+  template <class Pred>
+  bool fill_encoder(Pred need) {
+    if (!feed_) {
+      while (*source_ && need()) {
+	encoder_->push(source_->next_packet());
+      }
+      return true;
+    }
+
+    std::lock_guard<std::mutex> lck(feed_->mtx);
+    while (!feed_->queue.empty() && need()) {
+      encoder_->push(std::move(feed_->queue.front()));
+      feed_->queue.pop_front();
+    }
+    feed_->not_full.notify_one();
+    feed_->waiting = !feed_->ended && need();
+    return !feed_->waiting;
+  }
+
+  /** Body of the source thread: build the source, pass it to
+   *  `ready`, then read it into the feed until the end or until the
+   *  server is destroyed.
+   */
+  template <class Ready, class Make>
+  static void read_source(std::shared_ptr<source_feed> f, Ready ready,
+			  Make make) {
+    std::shared_ptr<Source> src;
+    try {
+      src = make();
+    }
+    catch (...) {
+      std::lock_guard<std::mutex> lck(f->mtx);
+      if (!f->closed) ready(nullptr, std::current_exception());
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lck(f->mtx);
+      if (f->closed) return;
+      ready(src, nullptr);
+    }
+
+    for (;;) {
+      {
+	std::unique_lock<std::mutex> lck(f->mtx);
+	f->not_full.wait(lck, [&f]() {
+	    return f->closed || (f->running && f->queue.size() < f->max_size);
+	  });
+	if (f->closed) return;
+      }
+
+      // Read without the lock, since it can block
+      bool more = false;
+      fountain_packet p;
+      try {
+	more = static_cast<bool>(*src);
+	if (more) p = src->next_packet();
+      }
+      catch (const std::exception &e) {
+	log::default_logger lg(boost::log::keywords::channel = log::basic);
+	BOOST_LOG_SEV(lg, log::error) << "Cannot read the source: "
+				      << e.what();
+	more = false;
+      }
+
+      std::lock_guard<std::mutex> lck(f->mtx);
+      if (f->closed) return;
+      if (more) f->queue.push_back(std::move(p));
+      else f->ended = true;
+      if (f->waiting) {
+	f->waiting = false;
+	f->wake();
+      }
+      if (!more) return;
+    }
+  }
+
+  /** Called when the source thread has read more packets. */
+  void handle_source_wake() {
+    if (is_stopped_ || !source_wait) return;
+    schedule_next_pkt();
+  }
+
+  /** Called when a wait for the session has lasted max_block_time. */
+  void handle_session_timer(const boost::system::error_code &ec,
+			    std::size_t gen) {
+    if (ec == boost::asio::error::operation_aborted) return; // cancelled
+    if (ec) throw boost::system::system_error(ec);
+    if (gen != pkt_timer_gen) return;
+    handle_session_wake();
+  }
+
+  /** Fill send_bufs with the headers and the payloads of last_pkts. */
+  void build_send_buffers() {
+    using boost::asio::buffer;
+    const raw_header_version v = header_version_;
+
+    // Version 0 carries only the low 16 bits of the block number
+    if (v == header_v0) {
+      for (fountain_packet &fp : last_pkts)
+	fp.block_number(fp.block_number() & raw_max_number(v));
+    }
+
+    send_bufs.clear();
+    if (datagram_size_ == 0) {
+      last_header = build_raw_data_header(last_pkts.front(), v);
+      send_bufs.push_back(buffer(last_header.data(),
+				 raw_data_header_size(v)));
+      send_bufs.push_back(buffer(last_pkts.front().buffer()));
+    }
+    else {
+      last_multi_header = build_raw_data_multi_header(last_pkts.front(),
+						      last_pkts.size(), v);
+      send_bufs.push_back(buffer(last_multi_header.data(),
+				 raw_data_multi_header_size(v)));
+      last_seqnos.resize(last_pkts.size());
+      for (std::size_t i = 0; i < last_pkts.size(); ++i) {
+	last_seqnos[i] = build_raw_data_multi_seqno(last_pkts[i], v);
+	send_bufs.push_back(buffer(last_seqnos[i].data(),
+				   raw_data_multi_seqno_size(v)));
+	send_bufs.push_back(buffer(last_pkts[i].buffer()));
+      }
+    }
+    last_dgram_size = boost::asio::buffer_size(send_bufs);
+  }
 
-    if (is_first) { // First packet: no need to wait
-      pkt_timer.expires_from_now(microseconds(0));
+  /** Send the next datagram if the token bucket allows it, otherwise
+   *  wait for the bucket to refill.
+   */
+  void pace_pkt() {
+    using namespace std::chrono;
+
+    auto now = steady_clock::now();
+    double pkt_bits = last_dgram_size * 8.0;
+
+    // Track the longest recent gap between two calls, which grows
+    // when the timer fires late or the thread is descheduled. It is
+    // forgotten with a time constant of 100 ms.
+    if (last_pace_time != steady_clock::time_point()) {
+      duration<double> gap = now - last_pace_time;
+      pace_gap = std::max(gap, pace_gap * std::exp(-gap.count() / 0.1));
     }
-    else { // Set an interarrival time to have the target send rate
-      double sr = target_send_rate_;
-      decltype(last_sent_time) next_send = last_sent_time +
-	microseconds(static_cast<long>(last_pkt.size() * (8e6 / sr)));
-      pkt_timer.expires_at(next_send);
+    last_pace_time = now;
+
+    // Follow the changes of the target rate. Allow bursts of two
+    // ticks, or of the longest gap up to MAX_BURST_TICKS, so that the
+    // tokens accumulated during a late wake-up are not lost.
+    double sr = target_send_rate_;
+    duration<double> tick = pacing_tick_;
+    duration<double> window = std::min(std::max(2 * tick, pace_gap),
+				       MAX_BURST_TICKS * tick);
+    double depth = std::max(sr * window.count(), pkt_bits);
+    if (sr != pacer.rate() || depth != pacer.depth())
+      pacer.configure(sr, depth, now);
+
+    if (pacer.consume(pkt_bits, now)) {
+      send_pkt();
+      return;
     }
 
-    // Schedule the timer
+    auto wait = std::max(pacer.wait_time(pkt_bits, now), pacing_tick_);
+    pkt_timer.expires_at(now + wait);
     pkt_timer.async_wait(strand_.wrap(std::bind(&data_server::handle_send_timer,
-						this, std::placeholders::_1)));
+						this, std::placeholders::_1,
+						++pkt_timer_gen)));
+  }
+
+  /** Start the transmission of the datagram in send_bufs. */
+  void send_pkt() {
+    if (sent_bytes == 0)
+      first_sent_time = std::chrono::steady_clock::now();
+    pkt_in_flight = true;
+    socket_.async_send_to(send_bufs,
+			  client_endpoint_,
+			  strand_.wrap(std::bind(&data_server::handle_sent,
+						 this,
+						 std::placeholders::_1, std::placeholders::_2)));
   }
 
   /** Listen asynchronously for incoming ACK packets. */
@@ -492,7 +1110,7 @@ private:
     if (!ack_enabled) return;
 
     // Listen
-    socket_.async_receive_from(boost::asio::buffer(last_ack), client_endpoint_,
+    socket_.async_receive_from(boost::asio::buffer(last_ack), ack_endpoint_,
 			       strand_.wrap(std::bind(&data_server::handle_ack,
 						      this,
 						      std::placeholders::_1, std::placeholders::_2)));
@@ -503,8 +1121,14 @@ private:
     if (ec == boost::asio::error::operation_aborted) return; // cancelled
     if (ec) throw boost::system::system_error(ec);
 
-    if (recv_size != ack_header_size)
+    if (recv_size != raw_ack_size(header_version_)) {
+      // Anyone can send to the port of a multicast server
+      if (is_multicast) {
+	listen_for_acks();
+	return;
+      }
       throw std::runtime_error("The packet has a wrong size");
+    }
 
     std::size_t ack_blockno_;
     try {
@@ -515,6 +1139,15 @@ private:
       // should ignore wrong packets?
       throw e;
     }
+    // Version 0 carries only the low 16 bits of the block number
+    if (header_version_ == header_v0)
+      ack_blockno_ = extend_block_number(ack_blockno_, encoder().blockno());
+
+    if (session_) {
+      handle_session_ack(ack_blockno_);
+      listen_for_acks();
+      return;
+    }
 
     // Fill the encoder buffer with enough packets
     circular_counter<std::size_t>
@@ -530,33 +1163,55 @@ private:
       return;
     }
     std::size_t required_pkts = diff * encoder_->K();
-    while (*source_ && encoder_->size() < required_pkts)
-      encoder_->push(source_->next_packet());
+    fill_encoder([this,required_pkts]() {
+	return encoder_->size() < required_pkts;
+      });
 
     // Skip blocks
     encoder_->next_block(ack_blockno_);
 
-    // Reschedule the next coded packet: must be rebuilt
-    pkt_timer.cancel();
-    schedule_next_pkt();
+    // Reschedule the next coded packet: must be rebuilt. When a
+    // transmission is in progress handle_sent will do it.
+    if (!pkt_in_flight) {
+      ++pkt_timer_gen;
+      pkt_timer.cancel();
+      schedule_next_pkt();
+    }
     // Keep listening
     listen_for_acks();
   }
 
-  /** Called when the packet timer has expired or was cancelled. */
-  void handle_send_timer(const boost::system::error_code &ec) {
-    using namespace std::placeholders;
+  /** Pass an ACK to the session, on behalf of the sender client or of
+   *  a multicast member.
+   */
+  void handle_session_ack(std::size_t ack_blockno) {
+    if (is_multicast) {
+      auto i = members_.find(ack_endpoint_);
+      if (i != members_.end())
+	session_->acknowledge(i->second, ack_blockno);
+      return;
+    }
+
+    bool moved = session_->acknowledge(session_id, ack_blockno);
+    // The next datagram carries a block that the client does not
+    // need anymore: rebuild it
+    if (moved && !pkt_in_flight && !session_wait) {
+      ++pkt_timer_gen;
+      pkt_timer.cancel();
+      schedule_next_pkt();
+    }
+  }
 
+  /** Called when the packet timer has expired or was cancelled. */
+  void handle_send_timer(const boost::system::error_code &ec,
+			 std::size_t gen) {
     if (ec == boost::asio::error::operation_aborted) return; // cancelled
     if (ec) throw boost::system::system_error(ec);
+    // Expired before a cancel that could not abort it
+    if (gen != pkt_timer_gen) return;
+    if (is_stopped_) return;
 
-    // Start transmission
-    last_sent_time = std::chrono::steady_clock::now();
-    socket_.async_send_to(boost::asio::buffer(last_pkt),
-			  client_endpoint_,
-			  strand_.wrap(std::bind(&data_server::handle_sent,
-						 this,
-						 std::placeholders::_1, std::placeholders::_2)));
+    pace_pkt();
   }
 
   /** Called at the end of a transmission. */
@@ -565,18 +1220,44 @@ private:
     if (ec == boost::asio::error::operation_aborted) return; // cancelled
     if (ec == boost::system::errc::bad_file_descriptor) return; // socket was closed
     if (ec) throw boost::system::system_error(ec);
-    if (sent_size != last_pkt.size())
+    if (sent_size != last_dgram_size)
       throw std::runtime_error("Did not send all the packet");
 
-    BOOST_LOG(perf_lg) << "data_server::handle_sent udp_pkt_sent"
-		       << " sent_size=" << sent_size;
+    static metrics::counter &sent_dgrams =
+      metrics::get_counter("data_server.sent_datagrams");
+    static metrics::counter &sent_total =
+      metrics::get_counter("data_server.sent_bytes");
+    static metrics::gauge &rate_error =
+      metrics::get_gauge("data_server.send_rate_error");
+
+    pkt_in_flight = false;
+    sent_bytes += sent_size;
+    last_sent_time = std::chrono::steady_clock::now();
+
+    UEP_TRACE(perf_trace::data_server_pkt_sent, sent_size);
+    sent_dgrams.add();
+    sent_total.add(sent_size);
+    // Relative error of the average rate w.r.t. the target
+    double target = target_send_rate_;
+    double achieved = achieved_send_rate();
+    if (std::isfinite(target) && target > 0 && achieved > 0)
+      rate_error.set(achieved / target - 1);
     schedule_next_pkt();
   }
 
   /** Called after start(). */
   void handle_started() {
     BOOST_LOG_SEV(basic_lg, log::debug) << "Called handle_started";
+    if (!is_stopped_) return; // Already running
     is_stopped_ = false;
+    if (feed_) {
+      std::lock_guard<std::mutex> lck(feed_->mtx);
+      feed_->running = true;
+      feed_->not_full.notify_one();
+    }
+    pacer.reset(std::chrono::steady_clock::now());
+    last_pace_time = std::chrono::steady_clock::time_point();
+    pace_gap = std::chrono::duration<double>::zero();
     schedule_next_pkt();
     listen_for_acks();
   }
@@ -585,9 +1266,17 @@ private:
   void handle_stopped() {
     is_stopped_ = true;
     pkt_timer.cancel();
-    socket_.cancel();
+    boost::system::error_code ec;
+    socket_.cancel(ec); // The socket may not be open yet
+    if (is_subscribed) {
+      session_->unsubscribe(session_id);
+      is_subscribed = false;
+    }
     BOOST_LOG(perf_lg) << "data_server::stopped sent_pkts="
-		       << encoder_->total_coded_count();
+		       << (session_ ? session_->total_coded_count() :
+			   encoder_ ? encoder_->total_coded_count() : 0)
+		       << " achieved_send_rate=" << achieved_send_rate()
+		       << " target_send_rate=" << target_send_rate_;
     BOOST_LOG_SEV(basic_lg, log::debug) << "UDP server is stopped";
 
     // Call all handlers
@@ -607,11 +1296,19 @@ data_client<Decoder,Sink>::data_client(boost::asio::io_service &io) :
   io_service_(io),
   strand_(io_service_),
   socket_(io_service_),
-  recv_buffer(UDP_MAX_PAYLOAD),
+  group_socket_(io_service_),
+  datagram_size_(0),
+  multi_symbol_size(0),
+  header_version_(header_v1),
+  recv_overflow(UDP_MAX_PAYLOAD),
+  recv_symbol_size(0),
   ack_enabled(true),
   exp_count(0),
   is_stopped_(true),
   drop_dist(0),
+  rx_any(false),
+  rx_blockno(0),
+  rx_seqno(0),
   timeout_timer(io),
   timeout_(std::chrono::steady_clock::duration::zero()) {
 }
@@ -675,6 +1372,26 @@ void data_client<Decoder,Sink>::bind(unsigned short port) {
 				     << newsize << " bytes";
 }
 
+template <class Decoder, class Sink>
+void data_client<Decoder,Sink>::join_group(const boost::asio::ip::udp::endpoint &group_ep,
+					   const boost::asio::ip::address &iface) {
+  using namespace boost::asio::ip;
+
+  if (!group_ep.address().is_multicast())
+    throw std::invalid_argument("Not a multicast address");
+
+  group_socket_.open(udp::v4());
+  // Other clients on this host receive from the same group
+  group_socket_.set_option(udp::socket::reuse_address(true));
+  group_socket_.bind(group_ep);
+  group_socket_.set_option(multicast::join_group(group_ep.address().to_v4(),
+						 iface.to_v4()));
+  group_socket_.set_option(boost::asio::socket_base::receive_buffer_size(50000000));
+
+  BOOST_LOG_SEV(basic_lg, log::info) << "Client joined the group "
+				     << group_ep << " via " << iface;
+}
+
 template <class Decoder, class Sink>
 void data_client<Decoder,Sink>::start_receive(const boost::asio::ip::udp::endpoint &src_ep) {
   using namespace std::placeholders;
@@ -684,7 +1401,7 @@ void data_client<Decoder,Sink>::start_receive(const boost::asio::ip::udp::endpoi
 				     << server_endpoint_;
   BOOST_LOG(perf_lg) << "data_client::start_receive";
 
-  socket_.non_blocking(true); // Read without blocking in handle_received
+  recv_socket().non_blocking(true); // Read without blocking in handle_received
   is_stopped_ = false;
   async_receive_pkt();
   reset_timer();
@@ -784,6 +1501,33 @@ data_client<Decoder,Sink>::channel_transition_probabilities() const {
   return std::make_pair(drop_dist.p_01(), drop_dist.p_10());
 }
 
+template <class Decoder, class Sink>
+void data_client<Decoder,Sink>::datagram_size(std::size_t datagram_size,
+					      std::size_t symbol_size) {
+  if (datagram_size > UDP_MAX_PAYLOAD)
+    throw std::overflow_error("The datagram size exceeds the UDP limit");
+  datagram_size_ = datagram_size;
+  multi_symbol_size = symbol_size;
+  recv_payloads.clear();
+}
+
+template <class Decoder, class Sink>
+std::size_t data_client<Decoder,Sink>::datagram_size() const {
+  return datagram_size_;
+}
+
+template <class Decoder, class Sink>
+void data_client<Decoder,Sink>::header_version(raw_header_version v) {
+  if (v != header_v0 && v != header_v1)
+    throw std::invalid_argument("Unknown header version");
+  header_version_ = v;
+}
+
+template <class Decoder, class Sink>
+raw_header_version data_client<Decoder,Sink>::header_version() const {
+  return header_version_;
+}
+
 template <class Decoder, class Sink>
 const Sink &data_client<Decoder,Sink>::sink() const {
   return *sink_;
@@ -794,14 +1538,177 @@ const Decoder &data_client<Decoder,Sink>::decoder() const {
   return *decoder_;
 }
 
+template <class Decoder, class Sink>
+boost::asio::ip::udp::socket &data_client<Decoder,Sink>::recv_socket() {
+  return group_socket_.is_open() ? group_socket_ : socket_;
+}
+
 template <class Decoder, class Sink>
 void data_client<Decoder,Sink>::async_receive_pkt() {
-  socket_.async_receive_from(boost::asio::buffer(recv_buffer),
-			     server_endpoint_,
-			     strand_.wrap(std::bind(&data_client::handle_received,
-						    this,
-						    std::placeholders::_1,
-						    std::placeholders::_2)));
+  recv_socket().async_receive_from(recv_buffers(),
+				   server_endpoint_,
+				   strand_.wrap(std::bind(&data_client::handle_received,
+							  this,
+							  std::placeholders::_1,
+							  std::placeholders::_2)));
+}
+
+template <class Decoder, class Sink>
+const std::vector<boost::asio::mutable_buffer> &
+data_client<Decoder,Sink>::recv_buffers() {
+  using boost::asio::buffer;
+
+  recv_bufs.clear();
+  if (datagram_size_ == 0) {
+    recv_payloads.resize(1);
+    if (!recv_payloads[0])
+      recv_payloads[0] = recv_pool.get(recv_symbol_size);
+    recv_bufs.push_back(buffer(recv_header.data(),
+			       raw_data_header_size(header_version_)));
+    recv_bufs.push_back(buffer(*recv_payloads[0]));
+  }
+  else {
+    std::size_t n = symbols_per_datagram(multi_symbol_size, datagram_size_,
+					 header_version_);
+    std::size_t seqno_size = raw_data_multi_seqno_size(header_version_);
+    recv_payloads.resize(n);
+    recv_seqnos.resize(n);
+    recv_bufs.push_back(buffer(recv_multi_header.data(),
+			       raw_data_multi_header_size(header_version_)));
+    for (std::size_t i = 0; i < n; ++i) {
+      if (!recv_payloads[i])
+	recv_payloads[i] = recv_pool.get(multi_symbol_size);
+      recv_bufs.push_back(buffer(recv_seqnos[i].data(), seqno_size));
+      recv_bufs.push_back(buffer(*recv_payloads[i]));
+    }
+  }
+  recv_bufs.push_back(buffer(recv_overflow));
+  return recv_bufs;
+}
+
+template <class Decoder, class Sink>
+raw_header_version
+data_client<Decoder,Sink>::take_received(std::size_t size,
+					 std::list<fountain_packet> &out) {
+  // The type is always in the first buffer
+  char type = datagram_size_ == 0 ? recv_header[0] : recv_multi_header[0];
+
+  if (datagram_size_ == 0 &&
+      type == raw_type_byte(raw_packet_type::data, header_version_)) {
+    std::size_t header_size = raw_data_header_size(header_version_);
+    if (size < header_size)
+      throw std::runtime_error("The packet is too short");
+
+    fountain_packet fp(packet(std::move(recv_payloads[0])));
+    std::size_t length = parse_raw_data_header(recv_header, fp);
+    if (size - header_size < length)
+      throw std::runtime_error("The packet is too short");
+
+    buffer_type &payload = fp.buffer();
+    if (length > recv_symbol_size) {
+      // Complete the payload from the overflow buffer and enlarge the
+      // next pooled buffers
+      payload.resize(length);
+      std::copy(recv_overflow.cbegin(),
+		recv_overflow.cbegin() + (length - recv_symbol_size),
+		payload.begin() + recv_symbol_size);
+      recv_symbol_size = length;
+    }
+    else {
+      payload.resize(length);
+    }
+    out.push_back(std::move(fp));
+    return header_version_;
+  }
+
+  if (datagram_size_ > 0 &&
+      type == raw_type_byte(raw_packet_type::data_multi, header_version_)) {
+    std::size_t header_size = raw_data_multi_header_size(header_version_);
+    std::size_t seqno_size = raw_data_multi_seqno_size(header_version_);
+    if (size < header_size)
+      throw std::runtime_error("The packet is too short");
+    fountain_packet proto;
+    std::size_t length;
+    std::size_t count = parse_raw_data_multi_header(recv_multi_header,
+						    proto, length);
+    if (length == multi_symbol_size && count <= recv_payloads.size()) {
+      if (size < header_size + count * (seqno_size + length))
+	throw std::runtime_error("The packet is too short");
+      for (std::size_t i = 0; i < count; ++i) {
+	fountain_packet fp(packet(std::move(recv_payloads[i])));
+	fp.block_number(proto.block_number());
+	fp.block_seed(proto.block_seed());
+	parse_raw_data_multi_seqno(recv_seqnos[i], fp, header_version_);
+	out.push_back(std::move(fp));
+      }
+      return header_version_;
+    }
+  }
+
+  // The datagram does not match the receive buffers: gather it and
+  // parse a copy
+  buffer_type raw(size);
+  boost::asio::buffer_copy(boost::asio::buffer(raw), recv_bufs);
+  if (raw_packet_type_of(raw[0]) == raw_packet_type::data_multi) {
+    std::vector<fountain_packet> fps = parse_raw_multi_packet(raw);
+    out.insert(out.end(),
+	       std::make_move_iterator(fps.begin()),
+	       std::make_move_iterator(fps.end()));
+  }
+  else {
+    out.push_back(parse_raw_data_packet(raw));
+  }
+  return raw_header_version_of(raw[0]);
+}
+
+template <class Decoder, class Sink>
+void data_client<Decoder,Sink>::receive_datagram(std::size_t size,
+						 std::list<fountain_packet> &out) {
+  static metrics::counter &recv_pkts =
+    metrics::get_counter("data_client.received_pkts");
+  static metrics::counter &lost_pkts =
+    metrics::get_counter("data_client.lost_pkts");
+  static metrics::counter &dropped_pkts =
+    metrics::get_counter("data_client.channel_drops");
+
+  std::list<fountain_packet> pkts;
+  raw_header_version v = take_received(size, pkts);
+
+  // Version 0 carries only the low 16 bits of the block number
+  if (v == header_v0) {
+    for (fountain_packet &p : pkts) {
+      p.block_number(extend_block_number(p.block_number(),
+					 decoder_->blockno()));
+    }
+  }
+
+  // A gap in the seqnos of a block counts the packets lost in the
+  // network or in the socket buffer
+  for (const fountain_packet &p : pkts) {
+    bool same_block = rx_any && p.block_number() == rx_blockno;
+    if (same_block && p.sequence_number() > rx_seqno + 1)
+      lost_pkts.add(p.sequence_number() - rx_seqno - 1);
+    if (!same_block || p.sequence_number() > rx_seqno) {
+      rx_any = true;
+      rx_blockno = p.block_number();
+      rx_seqno = p.sequence_number();
+    }
+  }
+  recv_pkts.add(pkts.size());
+
+  // The channel drops whole datagrams
+  if (drop_packet(pkts.front())) {
+    dropped_pkts.add(pkts.size());
+    for (const fountain_packet &p : pkts) {
+      UEP_TRACE(perf_trace::data_client_drop_pkt,
+		p.block_number(), p.sequence_number(),
+		static_cast<std::uint32_t>(p.block_seed()), p.size(),
+		p.getPriority());
+    }
+    return;
+  }
+
+  out.splice(out.end(), pkts);
 }
 
 template <class Decoder, class Sink>
@@ -819,7 +1726,8 @@ template <class Decoder, class Sink>
 void data_client<Decoder,Sink>::schedule_ack(std::size_t blockno) {
   if (!ack_enabled) return;
 
-  ack_buffer = build_raw_ack(blockno);
+  ack_buffer = build_raw_ack(blockno & raw_max_number(header_version_),
+			     header_version_);
   socket_.async_send_to(boost::asio::buffer(ack_buffer),
 			server_endpoint_,
 			strand_.wrap(std::bind(&data_client::handle_sent_ack,
@@ -837,32 +1745,13 @@ void data_client<Decoder,Sink>::handle_received(const boost::system::error_code&
   if (size == 0) throw std::runtime_error("Empty packet");
 
   std::list<fountain_packet> recv_list;
-
-  // Insert first packet
-  fountain_packet p;
-  try {
-    p = parse_raw_data_packet(recv_buffer);
-  }
-  catch (const std::runtime_error &e) {
-    // should handle malformed packets
-    throw e;
-  }
-
-  if (drop_packet(p)) {
-    BOOST_LOG(perf_lg) << "data_client::handle_received"
-		       << " drop_pkt" << p;
-    async_receive_pkt();
-    return;
-  }
-
-  recv_list.push_back(std::move(p));
+  receive_datagram(size, recv_list);
 
   // Read more packets if available
-  while (socket_.available() > 0) {
+  while (recv_socket().available() > 0) {
+    std::size_t sz;
     try {
-      socket_.receive_from(boost::asio::buffer(recv_buffer),
-			   server_endpoint_);
-      p = parse_raw_data_packet(recv_buffer);
+      sz = recv_socket().receive_from(recv_buffers(), server_endpoint_);
     }
     catch(const boost::system::system_error &e) {
       if (e.code() == boost::asio::error::would_block) {
@@ -872,22 +1761,17 @@ void data_client<Decoder,Sink>::handle_received(const boost::system::error_code&
       }
       else throw e;
     }
-    catch (const std::runtime_error &e) {
-      // should handle malformed packets
-      throw e;
-    }
+    if (sz == 0) throw std::runtime_error("Empty packet");
 
-    if (drop_packet(p)) {
-      BOOST_LOG(perf_lg) << "data_client::handle_received"
-			 << " drop_pkt" << p;
-      continue;
-    }
+    receive_datagram(sz, recv_list);
+  }
 
-    recv_list.push_back(std::move(p));
+  if (recv_list.empty()) { // All dropped
+    async_receive_pkt();
+    return;
   }
 
-  BOOST_LOG(perf_lg) << "data_client::handle_received received_count="
-		     << recv_list.size();
+  UEP_TRACE(perf_trace::data_client_received, recv_list.size());
 
   reset_timer();
 
@@ -906,7 +1790,7 @@ void data_client<Decoder,Sink>::handle_received(const boost::system::error_code&
   }
 
   // Keep listening if not all packets have been decoded or failed
-  bool more_eos = *sink_;
+  bool more_eos = static_cast<bool>(*sink_);
   bool more_pktnum = exp_count == 0 ||
     (decoder_->total_decoded_count() +
      decoder_->total_failed_count()) < exp_count;
@@ -975,6 +1859,10 @@ void data_client<Decoder, Sink>::handle_stop() {
   timeout_timer.cancel();
   socket_.cancel();
   socket_.close();
+  if (group_socket_.is_open()) {
+    group_socket_.cancel();
+    group_socket_.close();
+  }
   is_stopped_ = true;
   BOOST_LOG(perf_lg) << "data_client::stopped"
 		     << " received_pkts="
@@ -1002,6 +1890,9 @@ bool data_client<Decoder,Sink>::drop_packet(const fountain_packet &p) {
 
 //	   data_server<Encoder,Source> template definitions
 
+template <class Encoder, class Source>
+constexpr int data_server<Encoder, Source>::MAX_BURST_TICKS;
+
 template <class Encoder, class Source>
 template <class H>
 void data_server<Encoder, Source>::add_stop_handler(const H &h) {
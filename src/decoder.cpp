@@ -9,6 +9,10 @@ using namespace std;
 
 namespace uep {
 
+constexpr std::size_t lt_decoder::MAX_BLOCKNO;
+constexpr std::size_t lt_decoder::BLOCK_WINDOW;
+constexpr std::size_t lt_decoder::MAX_BLOCK_SKIP;
+
 lt_decoder::lt_decoder(const parameter_set &ps) :
   lt_decoder(ps.K, ps.c, ps.delta) {
 }
@@ -34,7 +38,8 @@ lt_decoder::lt_decoder(std::unique_ptr<base_row_generator> &&rg) :
   has_enqueued(false),
   uniq_recv_count(0),
   tot_dec_count(0),
-  tot_failed_count(0) {
+  tot_failed_count(0),
+  block_started(false) {
   blockno_counter.set(0);
 }
 
@@ -97,6 +102,14 @@ void lt_decoder::flush(std::size_t blockno_) {
   if (dist % win > 0) flush_small_blockno(blockno_);
 }
 
+void lt_decoder::first_block_number(std::size_t blockno_) {
+  if (uniq_recv_count != 0 || tot_failed_count != 0)
+    throw std::logic_error("The decoder has already received packets");
+  if (blockno_ > MAX_BLOCKNO)
+    throw std::invalid_argument("The block number is too large");
+  blockno_counter.set(blockno_);
+}
+
 void lt_decoder::flush_small_blockno(std::size_t blockno_) {
   auto recv_blockno(blockno_counter);
   recv_blockno.set(blockno_);
@@ -195,8 +208,20 @@ bool lt_decoder::operator!() const {
 }
 
 void lt_decoder::enqueue_partially_decoded() {
+  static metrics::histogram &block_ns =
+    metrics::get_histogram("lt_decoder.block_decode_ns");
+  static metrics::counter &partial_blocks =
+    metrics::get_counter("lt_decoder.partial_blocks");
+
   if (has_enqueued) return;
 
+  // Time from the first packet to the output of the block
+  if (block_started) {
+    block_ns.record(std::chrono::steady_clock::now() - block_start);
+    block_started = false;
+  }
+  if (!the_block_decoder.has_decoded()) partial_blocks.add();
+
   the_output_queue.push_shallow(the_block_decoder.partial_begin(),
 				the_block_decoder.partial_end());
   tot_dec_count += the_block_decoder.decoded_count();
@@ -8,7 +8,9 @@
 #include "counter.hpp"
 #include "log.hpp"
 #include "lt_param_set.hpp"
+#include "metrics.hpp"
 #include "packets.hpp"
+#include "perf_trace.hpp"
 #include "rng.hpp"
 #include "utils.hpp"
 
@@ -30,9 +32,14 @@ public:
   /** Maximum allowed value for the block numbers.
    *  The decoder expects that it loops back to zero after this value.
    */
-  static constexpr std::size_t MAX_BLOCKNO = 0xffff;
+  static constexpr std::size_t MAX_BLOCKNO = 0xffffffff;
   /** Maximum forward distance for a block to be considered more recent. */
   static constexpr std::size_t BLOCK_WINDOW = MAX_BLOCKNO / 2;
+  /** Maximum number of blocks that push() skips at once. A packet
+   *  further ahead is dropped as stray, since the skipped blocks are
+   *  queued as empty packets.
+   */
+  static constexpr std::size_t MAX_BLOCK_SKIP = 0x8000;
 
   /** Construct using the given parameter set. */
   explicit lt_decoder(const parameter_set &ps);
@@ -52,7 +59,7 @@ public:
    *  the accumulated set of packets, unless the current block is
    *  already fully decoded. Duplicate and old packets are silently
    *  discarded.  The decoder switches to a new block if a more recent
-   *  block number is received.
+   *  block number is received, at most MAX_BLOCK_SKIP blocks ahead.
    */
   void push(fountain_packet &&p);
 
@@ -91,6 +98,12 @@ public:
    */
   void flush_n_blocks(std::size_t n);
 
+  /** Expect the first block to be numbered `blockno_` instead of
+   *  zero. This method throws a logic_error if some packets were
+   *  already received.
+   */
+  void first_block_number(std::size_t blockno_);
+
   /** Return true if the current block has been decoded. */
   bool has_decoded() const;
   /** Return the block size. */
@@ -152,6 +165,13 @@ private:
   stat::average_counter avg_push_t; /**< Average time spent processing
 				     *	 an incoming packet.
 				     */
+  std::chrono::steady_clock::time_point block_start; /**< Time of the
+						      *   first packet
+						      *   of the
+						      *   current
+						      *   block.
+						      */
+  bool block_started; /**< Set when block_start is valid. */
 
   /** If the current block was not yet enqueued, then do it even if it
    *  is not fully decoded. The missing packets will be empty.
@@ -172,6 +192,10 @@ private:
 template <class Iter>
 void lt_decoder::push(Iter first, Iter last) {
   using namespace std::chrono;
+  static metrics::histogram &push_ns =
+    metrics::get_histogram("lt_decoder.push_ns");
+  static metrics::gauge &out_queue =
+    metrics::get_gauge("lt_decoder.output_queue");
 
   auto tic = high_resolution_clock::now();
 
@@ -185,7 +209,7 @@ void lt_decoder::push(Iter first, Iter last) {
 	      return lhs.block_number() < rhs.block_number();
 	    });
 
-  BOOST_LOG(perf_lg) << "lt_decoder::push recvd_pkts=" << pkts.size();
+  UEP_TRACE(perf_trace::lt_decoder_push_recvd, pkts.size());
 
   // Push to the block decoder block-by-block
   auto i = std::make_move_iterator(pkts.begin());
@@ -202,26 +226,35 @@ void lt_decoder::push(Iter first, Iter last) {
     if (blockno_counter.last() != static_cast<std::size_t>(bn)) {
       auto recv_blockno(blockno_counter);
       recv_blockno.set(bn);
+      if (recv_blockno.is_after(blockno_counter) &&
+	  blockno_counter.forward_distance(recv_blockno) > MAX_BLOCK_SKIP) {
+	BOOST_LOG_SEV(basic_lg, log::warning) << "Decoder dropped a packet"
+					      << " too far ahead, in block "
+					      << bn;
+	i = next;
+	continue;
+      }
       if (recv_blockno.is_after(blockno_counter)) {
-	BOOST_LOG(perf_lg) << "lt_decoder::push new_block blockno="
-			   << bn;
+	UEP_TRACE(perf_trace::lt_decoder_push_new_block, bn);
 	flush_small_blockno(bn); // Then push normally
       }
       else {
-	BOOST_LOG(perf_lg) << "lt_decoder::push old_block blockno="
-			   << bn;
+	UEP_TRACE(perf_trace::lt_decoder_push_old_block, bn);
 	// This is not a new block number: do nothing
 	i = next;
 	continue;
       }
     }
 
+    if (!block_started && !has_enqueued) {
+      block_start = steady_clock::now();
+      block_started = true;
+    }
     std::size_t pushed = the_block_decoder.push(i, next);
-    BOOST_LOG(perf_lg) << "lt_decoder::push uniq_pkts=" << pushed;
+    UEP_TRACE(perf_trace::lt_decoder_push_uniq, pushed);
     uniq_recv_count += pushed;
     if (pushed != static_cast<std::size_t>(next - i))
-      BOOST_LOG(perf_lg) << "lt_decoder::push duplicate_pkts blockno="
-			 << bn;
+      UEP_TRACE(perf_trace::lt_decoder_push_duplicate, bn);
 
     // Extract if fully decoded block (just once)
     if (the_block_decoder) {
@@ -232,9 +265,10 @@ void lt_decoder::push(Iter first, Iter last) {
   }
 
   duration<double> push_tdiff = high_resolution_clock::now() - tic;
-  BOOST_LOG(perf_lg) << "lt_decoder::push push_time="
-		     << push_tdiff.count();
+  UEP_TRACE(perf_trace::lt_decoder_push_time, push_tdiff.count());
   avg_push_t.add_sample(push_tdiff.count());
+  push_ns.record(push_tdiff);
+  out_queue.set(the_output_queue.size());
 }
 
 }
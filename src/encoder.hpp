@@ -12,6 +12,7 @@
 #include "log.hpp"
 #include "lt_param_set.hpp"
 #include "packets.hpp"
+#include "perf_trace.hpp"
 #include "rng.hpp"
 #include "utils.hpp"
 
@@ -40,11 +41,11 @@ public:
    *  If the encoder tries to generate more packets from a single
    *  input block, an exception is thrown.
    */
-  static constexpr std::size_t MAX_SEQNO = 0xffff;
+  static constexpr std::size_t MAX_SEQNO = 0xffffffff;
   /** Maximum allowed value for the block numbers.
    *  When the encoder goes past this value it loop back to zero.
    */
-  static constexpr std::size_t MAX_BLOCKNO = 0xffff;
+  static constexpr std::size_t MAX_BLOCKNO = 0xffffffff;
   /** Maximum forward distance for a block number to be considered
    *  more recent.
    */
@@ -109,19 +110,24 @@ public:
 
   /** Generate the next coded packet from the current block. */
   fountain_packet next_coded() {
+#ifdef UEP_PERF_TRACE
     using namespace std::chrono;
 
     auto tic = high_resolution_clock::now();
+#endif
 
     fountain_packet p(the_block_encoder.next_coded());
     p.sequence_number(seqno_counter.next());
     p.block_number(blockno_counter.last());
     p.block_seed(the_block_encoder.seed());
 
+#ifdef UEP_PERF_TRACE
     duration<double> tdiff = high_resolution_clock::now() - tic;
-    BOOST_LOG(perf_lg) << "lt_encoder::next_coded"
-		       << " new_coded_packet=" << p
-		       << " encode_time=" << tdiff.count();
+    UEP_TRACE(perf_trace::lt_encoder_next_coded,
+	      p.block_number(), p.sequence_number(),
+	      static_cast<std::uint32_t>(p.block_seed()), p.size(),
+	      p.getPriority(), tdiff.count());
+#endif
 
     return p;
   }
@@ -151,6 +157,19 @@ public:
     check_has_block();
   }
 
+  /** Number the current block as `blockno_` instead of zero, for
+   *  instance to resume a stream at a known block number. This
+   *  method throws a logic_error if some coded packets were already
+   *  produced.
+   */
+  void first_block_number(std::size_t blockno_) {
+    if (tot_coded_count != 0 || coded_count() != 0)
+      throw std::logic_error("The encoder has already produced packets");
+    if (blockno_ > MAX_BLOCKNO)
+      throw std::invalid_argument("The block number is too large");
+    blockno_counter.set(blockno_);
+  }
+
   /** Drop all the blocks up to the given block number.
    *  This method throws an exception if there are not enough queued
    *  packets to skip.
@@ -174,8 +174,9 @@ private:
 
   void read_nal(const streamTrace &st, buffer_type &buf) {
     buf.resize(st.len);
-    if (in_file.tellg() != st.startPos) {
-      in_file.seekg(st.startPos);
+    const std::streamoff pos = st.startPos;
+    if (in_file.tellg() != pos) {
+      in_file.seekg(pos);
     }
     in_file.read(buf.data(), buf.size());
     assert(in_file.gcount() == st.len);
@@ -1,4 +1,5 @@
 #include "log.hpp"
+#include "perf_trace.hpp"
 
 namespace expr = boost::log::expressions;
 namespace keywords = boost::log::keywords;
@@ -60,6 +61,10 @@ void init(const std::string &perflog, severity_level console_level) {
   console_sink->set_filter(filter_basic);
   console_sink->locked_backend()->auto_flush(true);
   console_sink->set_formatter(formatter_basic);
+
+#ifdef UEP_PERF_TRACE
+  if (perflog != "/dev/null") perf_trace::start(perflog + ".trace");
+#endif
 }
 
 std::ostream &operator<<(std::ostream &strm, severity_level level) {
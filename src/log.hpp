@@ -50,7 +50,10 @@ typedef boost::log::sources::severity_channel_logger<
 void init(const std::string &perflog);
 /** Setup the logging library. Write the basic messages to the console
  *  if their severity is at least at the given value. Write the
- *  performance messages to the given file.
+ *  performance messages to the given file. When the per-packet
+ *  performance trace is compiled in, its events are written to
+ *  `${perflog}.trace` and can be merged back into the text log with
+ *  perf_trace_convert.
  */
 void init(const std::string &perflog, severity_level console_level);
 /** Setup the logging library. Write the basic messages to the console
@@ -1,6 +1,7 @@
 #ifndef UEP_LT_PARAM_SET_HPP
 #define UEP_LT_PARAM_SET_HPP
 
+#include <cstdint>
 #include <limits>
 
 namespace uep {
@@ -51,7 +52,7 @@ struct streamTrace {
     slice_data = 3
   };
 
-  unsigned int startPos;
+  std::uint64_t startPos; /**< Offset in the bitstream. */
   int len;
   int lid;
   int tid;
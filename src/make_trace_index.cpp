@@ -0,0 +1,42 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+#include "trace_index.hpp"
+
+/** Convert a JSVM text trace into the binary index read by
+ *  nal_reader. By default the index is written next to the trace, as
+ *  `${trace}.idx`.
+ */
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 3) {
+    std::cerr << "Usage: " << argv[0]
+	      << " <trace file>"
+	      << " [<index file>]"
+	      << std::endl;
+    return 2;
+  }
+
+  const std::string trace_path = argv[1];
+  const std::string index_path = argc == 3 ?
+    argv[2] : uep::trace_index::index_path(trace_path);
+
+  auto t0 = std::chrono::steady_clock::now();
+  uep::trace_index ti;
+  try {
+    ti = uep::trace_index::parse_file(trace_path);
+  }
+  catch (const std::ios_base::failure&) {
+    std::cerr << "Cannot open " << trace_path << std::endl;
+    return 1;
+  }
+  std::ofstream out(index_path, std::ios_base::binary | std::ios_base::trunc);
+  ti.write(out);
+  out.close();
+  auto t1 = std::chrono::steady_clock::now();
+
+  std::cout << "Wrote " << ti.size() << " NALs to " << index_path
+	    << " in " << std::chrono::duration<double>(t1 - t0).count()
+	    << " s" << std::endl;
+  return 0;
+}
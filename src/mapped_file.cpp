@@ -0,0 +1,91 @@
+#include "mapped_file.hpp"
+
+#include <cerrno>
+#include <map>
+#include <mutex>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace uep {
+
+namespace {
+
+std::system_error errno_error(const std::string &what) {
+  return std::system_error(errno, std::system_category(), what);
+}
+
+}
+
+mapped_file::mapped_file(const std::string &path) :
+  path_(path),
+  data_(nullptr),
+  size_(0) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) throw errno_error("Failed to open " + path);
+
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    auto e = errno_error("Failed to stat " + path);
+    ::close(fd);
+    throw e;
+  }
+  size_ = static_cast<std::size_t>(st.st_size);
+
+  if (size_ > 0) {
+    void *p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      auto e = errno_error("Failed to map " + path);
+      ::close(fd);
+      throw e;
+    }
+    // The file is read sequentially, once per reader. The advice
+    // values are not flags: give them one at a time. They are only
+    // hints, so their failure is ignored.
+    (void) ::madvise(p, size_, MADV_SEQUENTIAL);
+    (void) ::madvise(p, size_, MADV_WILLNEED);
+    data_ = static_cast<const char*>(p);
+  }
+  ::close(fd); // The mapping stays valid
+}
+
+mapped_file::~mapped_file() {
+  if (data_) ::munmap(const_cast<char*>(data_), size_);
+}
+
+std::shared_ptr<const mapped_file>
+mapped_file::open_shared(const std::string &path) {
+  static std::mutex mtx;
+  static std::map<std::string, std::weak_ptr<const mapped_file>> mappings;
+
+  std::lock_guard<std::mutex> lck(mtx);
+  auto &wp = mappings[path];
+  std::shared_ptr<const mapped_file> sp = wp.lock();
+  if (!sp) {
+    sp = std::make_shared<const mapped_file>(path);
+    wp = sp;
+  }
+  // Drop the entries of the files that are no longer mapped
+  for (auto i = mappings.begin(); i != mappings.end();) {
+    if (i->second.expired()) i = mappings.erase(i);
+    else ++i;
+  }
+  return sp;
+}
+
+const char *mapped_file::data() const {
+  return data_;
+}
+
+std::size_t mapped_file::size() const {
+  return size_;
+}
+
+const std::string &mapped_file::path() const {
+  return path_;
+}
+
+}
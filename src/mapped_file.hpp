@@ -0,0 +1,47 @@
+#ifndef UEP_MAPPED_FILE_HPP
+#define UEP_MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace uep {
+
+/** Read-only memory mapping of a whole file.
+ *
+ *  The mapping is kept until the object is destroyed. Use
+ *  open_shared() to map each file only once for all the readers
+ *  that are alive at the same time.
+ */
+class mapped_file {
+public:
+  /** Map the file at `path`. Throw std::system_error on failure. */
+  explicit mapped_file(const std::string &path);
+  ~mapped_file();
+
+  mapped_file(const mapped_file&) = delete;
+  mapped_file &operator=(const mapped_file&) = delete;
+
+  /** Return the mapping of `path`, shared with the other callers
+   *  that still hold it, or map it if there is none. Thread-safe.
+   */
+  static std::shared_ptr<const mapped_file> open_shared(const std::string &path);
+
+  /** Pointer to the first byte of the file. It is nullptr when the
+   *  file is empty.
+   */
+  const char *data() const;
+  /** Size of the file in bytes. */
+  std::size_t size() const;
+  /** Path used to open the file. */
+  const std::string &path() const;
+
+private:
+  std::string path_;
+  const char *data_;
+  std::size_t size_;
+};
+
+}
+
+#endif
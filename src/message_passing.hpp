@@ -56,6 +56,14 @@ public:
   }
 };
 
+/** Specialize the xor between bool symbols, which only track whether
+ *  a symbol is known. A decoded symbol always remains decoded.
+ */
+template<>
+inline void symbol_traits<bool>::inplace_xor(bool &lhs, const bool &rhs) {
+  if (!lhs) lhs = rhs;
+}
+
 }}
 
 // Backward compatibility
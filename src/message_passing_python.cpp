@@ -1,19 +1,84 @@
 #include "message_passing.hpp"
+#include "uep_simulation.hpp"
 
 #include <Python.h>
 #include <structmember.h>
 
-namespace uep { namespace mp {
-/** Specialize the xor between bool symbols. A decoded symbol always
- *  remains decoded.
+#include <cctype>
+#include <cstring>
+#include <limits>
+
+#include <type_traits>
+#include <vector>
+
+using mp_ctx_t = uep::mp::mp_context<bool>;
+
+/** Copy the integers of a buffer of type T, which must be
+ *  non-negative. Return false otherwise.
  */
-template<>
-void symbol_traits<bool>::inplace_xor(bool &lhs, const bool &rhs) {
-  if (!lhs) lhs = rhs;
+template <class T>
+static bool copy_indices(const void *buf, std::size_t n,
+			 std::vector<std::size_t> &out) {
+  const T *p = static_cast<const T*>(buf);
+  out.resize(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    if (std::is_signed<T>::value && p[i] < 0) return false;
+    out[i] = static_cast<std::size_t>(p[i]);
+  }
+  return true;
 }
-}}
 
-using mp_ctx_t = uep::mp::mp_context<bool>;
+/** Copy a one-dimensional buffer of native integers, such as a NumPy
+ *  array or an array.array. Return false and set the Python error on
+ *  failure.
+ */
+static bool buffer_to_indices(PyObject *obj, const char *name,
+			      std::vector<std::size_t> &out) {
+  Py_buffer view;
+  if (PyObject_GetBuffer(obj, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) < 0) {
+    return false;
+  }
+
+  const char *fmt = view.format ? view.format : "B";
+  if (*fmt == '@' || *fmt == '=') ++fmt;
+  bool is_int = fmt[0] != '\0' && fmt[1] == '\0' &&
+    std::strchr("bBhHiIlLqQnN", fmt[0]) != nullptr;
+  bool is_signed = is_int && std::islower(fmt[0]);
+  bool ok = is_int && view.ndim <= 1;
+  if (ok) {
+    std::size_t n = view.len / view.itemsize;
+    switch (view.itemsize) {
+    case 1:
+      ok = is_signed ? copy_indices<std::int8_t>(view.buf, n, out) :
+	copy_indices<std::uint8_t>(view.buf, n, out);
+      break;
+    case 2:
+      ok = is_signed ? copy_indices<std::int16_t>(view.buf, n, out) :
+	copy_indices<std::uint16_t>(view.buf, n, out);
+      break;
+    case 4:
+      ok = is_signed ? copy_indices<std::int32_t>(view.buf, n, out) :
+	copy_indices<std::uint32_t>(view.buf, n, out);
+      break;
+    case 8:
+      ok = is_signed ? copy_indices<std::int64_t>(view.buf, n, out) :
+	copy_indices<std::uint64_t>(view.buf, n, out);
+      break;
+    default:
+      ok = false;
+    }
+    if (!ok) {
+      PyErr_Format(PyExc_ValueError, "%s has negative values", name);
+    }
+  }
+  else {
+    PyErr_Format(PyExc_TypeError,
+		 "%s must be a one-dimensional array of native integers",
+		 name);
+  }
+  PyBuffer_Release(&view);
+  return ok;
+}
 
 extern "C" {
 
@@ -61,55 +126,69 @@ static PyMemberDef mp_context_members[] = {
   {NULL}  /* Sentinel */
 };
 
-struct sequence_iterator {
-  explicit sequence_iterator(PyObject *seq, std::size_t start = 0) {
-    _seq = seq;
-    _next = start;
+static PyObject *mp_context_add_output(mp_ctx_py *self, PyObject *args) {
+  PyObject *seq;
+  if (!PyArg_ParseTuple(args, "O", &seq)) {
+    return NULL;
   }
 
-  bool operator==(const sequence_iterator &other) const {
-    return _seq == other._seq && _next == other._next;
-
+  PyObject *fast = PySequence_Fast(seq, "The edges must be a sequence");
+  if (!fast) return NULL;
+  Py_ssize_t len = PySequence_Fast_GET_SIZE(fast);
+  std::vector<std::size_t> edges(len);
+  for (Py_ssize_t i = 0; i < len; ++i) {
+    edges[i] = PyLong_AsSize_t(PySequence_Fast_GET_ITEM(fast, i));
+    if (PyErr_Occurred()) {
+      Py_DECREF(fast);
+      return NULL;
+    }
+    if (edges[i] >= self->mp_ctx->input_size()) {
+      Py_DECREF(fast);
+      PyErr_SetString(PyExc_IndexError, "Input symbol out of range");
+      return NULL;
+    }
   }
+  Py_DECREF(fast);
 
-  bool operator!=(const sequence_iterator &other) const {
-    return !(operator==(other));
-  }
+  self->mp_ctx->add_output(true, edges.cbegin(), edges.cend());
+  Py_RETURN_NONE;
+}
 
-  std::size_t operator*() const {
-    PyObject *n = PySequence_GetItem(_seq, _next);
-    return PyLong_AsUnsignedLongLong(n);
+static PyObject *mp_context_add_outputs(mp_ctx_py *self, PyObject *args) {
+  PyObject *ind_obj, *off_obj;
+  if (!PyArg_ParseTuple(args, "OO", &ind_obj, &off_obj)) {
+    return NULL;
   }
 
-  sequence_iterator &operator++() {
-    ++_next;
-    return *this;
+  std::vector<std::size_t> indices, offsets;
+  if (!buffer_to_indices(ind_obj, "indices", indices) ||
+      !buffer_to_indices(off_obj, "offsets", offsets)) {
+    return NULL;
   }
 
-  sequence_iterator operator++(int) {
-    sequence_iterator tmp(*this);
-    operator++();
-    return tmp;
+  // Check everything before changing the graph
+  for (std::size_t i = 1; i < offsets.size(); ++i) {
+    if (offsets[i] < offsets[i-1]) {
+      PyErr_SetString(PyExc_ValueError, "The offsets must not decrease");
+      return NULL;
+    }
   }
-
-private:
-  PyObject *_seq;
-  std::size_t _next;
-};
-
-static PyObject *mp_context_add_output(mp_ctx_py *self, PyObject *args) {
-  PyObject *seq;
-  if (!PyArg_ParseTuple(args, "O", &seq)) {
+  if (!offsets.empty() && offsets.back() > indices.size()) {
+    PyErr_SetString(PyExc_ValueError, "The offsets exceed the indices");
     return NULL;
   }
-
-  if (!PySequence_Check(seq)) {
-    return NULL;
+  for (std::size_t e : indices) {
+    if (e >= self->mp_ctx->input_size()) {
+      PyErr_SetString(PyExc_IndexError, "Input symbol out of range");
+      return NULL;
+    }
   }
 
-  self->mp_ctx->add_output(true,
-			   sequence_iterator(seq),
-			   sequence_iterator(seq, PySequence_Size(seq)));
+  for (std::size_t i = 1; i < offsets.size(); ++i) {
+    self->mp_ctx->add_output(true,
+			     indices.cbegin() + offsets[i-1],
+			     indices.cbegin() + offsets[i]);
+  }
   Py_RETURN_NONE;
 }
 
@@ -168,10 +247,41 @@ static PyObject *mp_context_input_symbols(mp_ctx_py *self) {
   return out;
 }
 
+static PyObject *mp_context_input_symbols_array(mp_ctx_py *self) {
+  const mp_ctx_t &mp_ctx = *(self->mp_ctx);
+  PyObject *numpy = PyImport_ImportModule("numpy");
+  if (!numpy) return NULL;
+
+  // The array shares the memory of a bytearray of 0/1 values
+  PyObject *bytes = PyByteArray_FromStringAndSize(NULL, mp_ctx.input_size());
+  if (!bytes) {
+    Py_DECREF(numpy);
+    return NULL;
+  }
+  char *out = PyByteArray_AS_STRING(bytes);
+  for (auto i = mp_ctx.input_symbols_begin();
+       i != mp_ctx.input_symbols_end();
+       ++i) {
+    *out++ = *i ? 1 : 0;
+  }
+
+  PyObject *arr = PyObject_CallMethod(numpy, "frombuffer", "Os", bytes,
+				      "bool");
+  Py_DECREF(bytes);
+  Py_DECREF(numpy);
+  return arr;
+}
+
 static PyMethodDef mp_context_methods[] = {
   {"add_output", (PyCFunction)mp_context_add_output, METH_VARARGS,
    "Add an output symbol"
   },
+  {"add_outputs", (PyCFunction)mp_context_add_outputs, METH_VARARGS,
+   "add_outputs(indices, offsets)\n\n"
+   "Add many output symbols given in CSR form: the edges of the i-th"
+   " output are indices[offsets[i]:offsets[i+1]]. Both arguments are"
+   " one-dimensional integer arrays, such as NumPy arrays."
+  },
   {"run", (PyCFunction)mp_context_run, METH_NOARGS,
    "Run"
   },
@@ -202,6 +312,10 @@ static PyMethodDef mp_context_methods[] = {
   {"input_symbols", (PyCFunction)mp_context_input_symbols, METH_NOARGS,
    "Input symbols"
   },
+  {"input_symbols_array", (PyCFunction)mp_context_input_symbols_array,
+   METH_NOARGS,
+   "Input symbols as a NumPy bool array"
+  },
   {NULL}  /* Sentinel */
 };
 
@@ -246,12 +360,259 @@ static PyTypeObject mp_ctx_py_type = {
   mp_context_new,                 /* tp_new */
 };
 
+/** Convert a Python sequence of integers. Return false and set the
+ *  Python error on failure.
+ */
+static bool to_size_vector(PyObject *seq, std::vector<std::size_t> &out) {
+  PyObject *fast = PySequence_Fast(seq, "Expected a sequence of integers");
+  if (!fast) return false;
+  Py_ssize_t len = PySequence_Fast_GET_SIZE(fast);
+  out.resize(len);
+  for (Py_ssize_t i = 0; i < len; ++i) {
+    out[i] = PyLong_AsSize_t(PySequence_Fast_GET_ITEM(fast, i));
+    if (PyErr_Occurred()) {
+      Py_DECREF(fast);
+      return false;
+    }
+  }
+  Py_DECREF(fast);
+  return true;
+}
+
+/** Convert a Python sequence of floats. Return false and set the
+ *  Python error on failure.
+ */
+static bool to_double_vector(PyObject *seq, std::vector<double> &out) {
+  PyObject *fast = PySequence_Fast(seq, "Expected a sequence of floats");
+  if (!fast) return false;
+  Py_ssize_t len = PySequence_Fast_GET_SIZE(fast);
+  out.resize(len);
+  for (Py_ssize_t i = 0; i < len; ++i) {
+    out[i] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(fast, i));
+    if (PyErr_Occurred()) {
+      Py_DECREF(fast);
+      return false;
+    }
+  }
+  Py_DECREF(fast);
+  return true;
+}
+
+/** Set d[key] = value and release the reference to value. */
+static bool dict_set_steal(PyObject *d, const char *key, PyObject *value) {
+  if (!value) return false;
+  int err = PyDict_SetItemString(d, key, value);
+  Py_DECREF(value);
+  return err == 0;
+}
+
+/** Convert the results of a simulation to a new dict. */
+static PyObject *sim_results_to_dict(const uep::sim::uep_sim_results &res,
+				     const std::vector<std::size_t> &Ks) {
+  // Same keys as UEPSimulation.run, plus some more stats
+  PyObject *out = PyDict_New();
+  if (!out) return NULL;
+  PyObject *counts = PyList_New(Ks.size());
+  PyObject *rates = PyList_New(Ks.size());
+  if (counts && rates) {
+    for (std::size_t i = 0; i < Ks.size(); ++i) {
+      PyList_SET_ITEM(counts, i, PyLong_FromSize_t(res.error_counts[i]));
+      PyList_SET_ITEM(rates, i,
+		      PyFloat_FromDouble(res.error_rate(i, Ks[i])));
+    }
+  }
+  const double nb = res.nblocks;
+  // No ripple samples in bit-parallel mode and in sweeps
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  const bool has_ripple = res.ripple_count > 0;
+  if (!dict_set_steal(out, "error_counts", counts) ||
+      !dict_set_steal(out, "error_rates", rates) ||
+      !dict_set_steal(out, "drop_count", PyLong_FromSize_t(res.drop_count)) ||
+      !dict_set_steal(out, "drop_rate", PyFloat_FromDouble(res.drop_rate())) ||
+      !dict_set_steal(out, "avg_ripple",
+		      PyFloat_FromDouble(res.avg_ripple())) ||
+      !dict_set_steal(out, "min_ripple",
+		      PyFloat_FromDouble(has_ripple ? res.ripple_min : nan)) ||
+      !dict_set_steal(out, "max_ripple",
+		      PyFloat_FromDouble(has_ripple ? res.ripple_max : nan)) ||
+      !dict_set_steal(out, "avg_dec_time",
+		      PyFloat_FromDouble(res.dec_time / nb)) ||
+      !dict_set_steal(out, "avg_enc_time",
+		      PyFloat_FromDouble(res.enc_time / nb)) ||
+      !dict_set_steal(out, "failed_blocks",
+		      PyLong_FromSize_t(res.failed_blocks)) ||
+      !dict_set_steal(out, "nblocks", PyLong_FromSize_t(res.nblocks))) {
+    Py_DECREF(out);
+    return NULL;
+  }
+  return out;
+}
+
+static PyObject *mppy_run_uep_simulation(PyObject *self,
+					 PyObject *args,
+					 PyObject *kwds) {
+  static const char *kwlist[] = {"Ks", "RFs", "EF", "c", "delta",
+				 "nblocks", "overhead", "iid_per",
+				 "markov_pGB", "markov_pBG",
+				 "threads", "seed", "bit_parallel", "store", NULL};
+  PyObject *ks_seq, *rfs_seq;
+  Py_ssize_t EF, nblocks = 1, threads = 0;
+  unsigned long long seed = 0;
+  int bit_parallel = 0;
+  const char *store = NULL;
+  uep::sim::uep_sim_parameters p;
+  p.overhead = 0;
+  p.iid_per = 0;
+  p.markov_pGB = 0;
+  p.markov_pBG = 1;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOndd|nddddnKpz",
+				   const_cast<char**>(kwlist),
+				   &ks_seq, &rfs_seq, &EF, &p.c, &p.delta,
+				   &nblocks, &p.overhead, &p.iid_per,
+				   &p.markov_pGB, &p.markov_pBG,
+				   &threads, &seed, &bit_parallel, &store)) {
+    return NULL;
+  }
+  if (!to_size_vector(ks_seq, p.Ks) || !to_size_vector(rfs_seq, p.RFs)) {
+    return NULL;
+  }
+  if (EF < 1 || nblocks < 0 || threads < 0) {
+    PyErr_SetString(PyExc_ValueError, "Negative EF, nblocks or threads");
+    return NULL;
+  }
+  p.EF = EF;
+  p.nblocks = nblocks;
+  p.threads = threads;
+  p.seed = seed;
+  p.bit_parallel = bit_parallel;
+
+  uep::sim::uep_sim_results res;
+  std::string error;
+  Py_BEGIN_ALLOW_THREADS
+  try {
+    res = uep::sim::run_uep_simulation(p);
+    if (store) {
+      uep::result_store_writer w(store);
+      w.append(uep::sim::to_result_record(p, p.overhead, res));
+    }
+  }
+  catch (const std::exception &e) {
+    error = e.what();
+  }
+  Py_END_ALLOW_THREADS
+  if (!error.empty()) {
+    PyErr_SetString(PyExc_RuntimeError, error.c_str());
+    return NULL;
+  }
+
+  return sim_results_to_dict(res, p.Ks);
+}
+
+static PyObject *mppy_run_uep_sweep(PyObject *self,
+				    PyObject *args,
+				    PyObject *kwds) {
+  static const char *kwlist[] = {"Ks", "RFs", "EF", "c", "delta",
+				 "overheads", "nblocks", "iid_per",
+				 "markov_pGB", "markov_pBG",
+				 "threads", "seed", "store", NULL};
+  PyObject *ks_seq, *rfs_seq, *oh_seq;
+  Py_ssize_t EF, nblocks = 1, threads = 0;
+  unsigned long long seed = 0;
+  uep::sim::uep_sim_parameters p;
+  std::vector<double> overheads;
+  const char *store = NULL;
+  p.overhead = 0;
+  p.iid_per = 0;
+  p.markov_pGB = 0;
+  p.markov_pBG = 1;
+  p.bit_parallel = false;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOnddO|ndddnKz",
+				   const_cast<char**>(kwlist),
+				   &ks_seq, &rfs_seq, &EF, &p.c, &p.delta,
+				   &oh_seq, &nblocks, &p.iid_per,
+				   &p.markov_pGB, &p.markov_pBG,
+				   &threads, &seed, &store)) {
+    return NULL;
+  }
+  if (!to_size_vector(ks_seq, p.Ks) || !to_size_vector(rfs_seq, p.RFs) ||
+      !to_double_vector(oh_seq, overheads)) {
+    return NULL;
+  }
+  if (EF < 1 || nblocks < 0 || threads < 0) {
+    PyErr_SetString(PyExc_ValueError, "Negative EF, nblocks or threads");
+    return NULL;
+  }
+  p.EF = EF;
+  p.nblocks = nblocks;
+  p.threads = threads;
+  p.seed = seed;
+
+  std::vector<uep::sim::uep_sim_results> res;
+  std::string error;
+  Py_BEGIN_ALLOW_THREADS
+  try {
+    res = uep::sim::run_uep_sweep(p, overheads);
+    if (store) {
+      uep::result_store_writer w(store);
+      for (std::size_t k = 0; k < res.size(); ++k) {
+	w.append(uep::sim::to_result_record(p, overheads[k], res[k]));
+      }
+    }
+  }
+  catch (const std::exception &e) {
+    error = e.what();
+  }
+  Py_END_ALLOW_THREADS
+  if (!error.empty()) {
+    PyErr_SetString(PyExc_RuntimeError, error.c_str());
+    return NULL;
+  }
+
+  PyObject *out = PyList_New(res.size());
+  if (!out) return NULL;
+  for (std::size_t k = 0; k < res.size(); ++k) {
+    PyObject *d = sim_results_to_dict(res[k], p.Ks);
+    if (!d) {
+      Py_DECREF(out);
+      return NULL;
+    }
+    PyList_SET_ITEM(out, k, d);
+  }
+  return out;
+}
+
+static PyMethodDef mppy_methods[] = {
+  {"run_uep_simulation", (PyCFunction)mppy_run_uep_simulation,
+   METH_VARARGS | METH_KEYWORDS,
+   "run_uep_simulation(Ks, RFs, EF, c, delta, nblocks=1, overhead=0,"
+   " iid_per=0, markov_pGB=0, markov_pBG=1, threads=0, seed=0,"
+   " bit_parallel=False, store=None)\n\n"
+   "Simulate the decoding of nblocks UEP blocks on a pool of threads,"
+   " without holding the GIL. Return a dict with the error counts and"
+   " rates of each sub-block, the channel drops and the ripple stats."
+   " With bit_parallel, decode 64 channel realizations of the same rows"
+   " at once; the ripple stats are NaN. If store is a path, also append"
+   " the results to that result store."
+  },
+  {"run_uep_sweep", (PyCFunction)mppy_run_uep_sweep,
+   METH_VARARGS | METH_KEYWORDS,
+   "run_uep_sweep(Ks, RFs, EF, c, delta, overheads, nblocks=1, iid_per=0,"
+   " markov_pGB=0, markov_pBG=1, threads=0, seed=0, store=None)\n\n"
+   "Same as run_uep_simulation for each overhead, in a single pass that"
+   " decodes each block packet by packet. Return a list with one dict"
+   " per overhead; the ripple stats are NaN and avg_dec_time is the"
+   " time of the whole pass. If store is a path, also append one record"
+   " per overhead to that result store."
+  },
+  {NULL}  /* Sentinel */
+};
+
 static PyModuleDef mppymodule = {
     PyModuleDef_HEAD_INIT,
     "mppy",
     "Module that uses the C++ message passing implementation.",
     -1,
-    NULL, NULL, NULL, NULL, NULL
+    mppy_methods, NULL, NULL, NULL, NULL
 };
 
 PyMODINIT_FUNC
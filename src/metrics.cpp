@@ -0,0 +1,286 @@
+#include "metrics.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+namespace uep {
+namespace metrics {
+
+const unsigned int histogram::SUB_BITS;
+const std::size_t histogram::SUB_COUNT;
+const std::size_t histogram::BUCKETS;
+
+histogram::histogram() {
+  reset();
+}
+
+std::size_t histogram::bucket_index(std::uint64_t v) {
+  if (v < SUB_COUNT) return v;
+  unsigned int e = 63 - __builtin_clzll(v); // e >= SUB_BITS
+  unsigned int shift = e - SUB_BITS;
+  return (shift + 1) * SUB_COUNT + ((v >> shift) - SUB_COUNT);
+}
+
+std::uint64_t histogram::bucket_upper(std::size_t i) {
+  if (i < SUB_COUNT) return i;
+  unsigned int shift = i / SUB_COUNT - 1;
+  std::uint64_t lower = std::uint64_t(SUB_COUNT + i % SUB_COUNT) << shift;
+  return lower + ((std::uint64_t(1) << shift) - 1);
+}
+
+std::uint64_t histogram::count() const {
+  return n.load(std::memory_order_relaxed);
+}
+
+std::uint64_t histogram::sum() const {
+  return total.load(std::memory_order_relaxed);
+}
+
+std::uint64_t histogram::min() const {
+  return count() == 0 ? 0 : lo.load(std::memory_order_relaxed);
+}
+
+std::uint64_t histogram::max() const {
+  return hi.load(std::memory_order_relaxed);
+}
+
+double histogram::mean() const {
+  std::uint64_t c = count();
+  if (c == 0) return std::numeric_limits<double>::quiet_NaN();
+  return static_cast<double>(sum()) / c;
+}
+
+std::uint64_t histogram::percentile(double q) const {
+  // Count the buckets, since n can be ahead of them
+  std::uint64_t c = 0;
+  for (const auto &b : buckets) c += b.load(std::memory_order_relaxed);
+  if (c == 0) return 0;
+
+  std::uint64_t rank = std::max<std::uint64_t>(1, std::ceil(q * c));
+  std::uint64_t seen = 0;
+  for (std::size_t i = 0; i < BUCKETS; ++i) {
+    seen += buckets[i].load(std::memory_order_relaxed);
+    if (seen >= rank) return std::min(bucket_upper(i), max());
+  }
+  return max();
+}
+
+void histogram::reset() {
+  for (auto &b : buckets) b.store(0, std::memory_order_relaxed);
+  n.store(0, std::memory_order_relaxed);
+  total.store(0, std::memory_order_relaxed);
+  lo.store(std::numeric_limits<std::uint64_t>::max(),
+	   std::memory_order_relaxed);
+  hi.store(0, std::memory_order_relaxed);
+}
+
+registry &registry::global() {
+  static registry r;
+  return r;
+}
+
+namespace {
+
+template <class Metric>
+Metric &find_or_add(std::map<std::string, std::unique_ptr<Metric>> &m,
+		    const std::string &name) {
+  auto i = m.find(name);
+  if (i == m.end()) {
+    i = m.emplace(name, std::make_unique<Metric>()).first;
+  }
+  return *i->second;
+}
+
+/** Write a JSON string. The names of the metrics are plain ASCII. */
+void write_string(std::ostream &out, const std::string &s) {
+  out << '"';
+  for (char c : s) {
+    if (c == '"' || c == '\\') out << '\\';
+    out << c;
+  }
+  out << '"';
+}
+
+/** Write a JSON number. JSON has no NaN nor infinity. */
+void write_number(std::ostream &out, double x) {
+  if (std::isfinite(x)) out << x;
+  else out << "null";
+}
+
+}
+
+counter &registry::get_counter(const std::string &name) {
+  std::lock_guard<std::mutex> lock(mutex);
+  return find_or_add(counters, name);
+}
+
+gauge &registry::get_gauge(const std::string &name) {
+  std::lock_guard<std::mutex> lock(mutex);
+  return find_or_add(gauges, name);
+}
+
+histogram &registry::get_histogram(const std::string &name) {
+  std::lock_guard<std::mutex> lock(mutex);
+  return find_or_add(histograms, name);
+}
+
+void registry::write_json(std::ostream &out) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+
+  out << "{\"time\": " << std::chrono::duration<double>(now).count();
+  out << ",\n \"counters\": {";
+  const char *sep = "";
+  for (const auto &c : counters) {
+    out << sep << "\n  ";
+    write_string(out, c.first);
+    out << ": " << c.second->value();
+    sep = ",";
+  }
+  out << "},\n \"gauges\": {";
+  sep = "";
+  for (const auto &g : gauges) {
+    out << sep << "\n  ";
+    write_string(out, g.first);
+    out << ": ";
+    write_number(out, g.second->value());
+    sep = ",";
+  }
+  out << "},\n \"histograms\": {";
+  sep = "";
+  for (const auto &h : histograms) {
+    const histogram &hist = *h.second;
+    out << sep << "\n  ";
+    write_string(out, h.first);
+    out << ": {\"count\": " << hist.count()
+	<< ", \"sum\": " << hist.sum()
+	<< ", \"min\": " << hist.min()
+	<< ", \"max\": " << hist.max()
+	<< ", \"mean\": ";
+    write_number(out, hist.mean());
+    out << ", \"p50\": " << hist.percentile(0.5)
+	<< ", \"p90\": " << hist.percentile(0.9)
+	<< ", \"p99\": " << hist.percentile(0.99)
+	<< ", \"p999\": " << hist.percentile(0.999)
+	<< "}";
+    sep = ",";
+  }
+  out << "}}\n";
+}
+
+void registry::reset() {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto &c : counters) c.second->reset();
+  for (auto &g : gauges) g.second->reset();
+  for (auto &h : histograms) h.second->reset();
+}
+
+struct exporter::impl {
+  typedef boost::asio::local::stream_protocol stream_protocol;
+
+  registry &reg;
+  boost::asio::io_service io;
+  boost::asio::steady_timer timer;
+  stream_protocol::acceptor acceptor;
+  std::string file_path;
+  std::chrono::milliseconds file_period;
+  std::string socket_path;
+  std::thread runner;
+
+  explicit impl(registry &r) :
+    reg(r),
+    timer(io),
+    acceptor(io) {
+  }
+
+  /** Replace file_path with a new snapshot. */
+  void write_snapshot() {
+    const std::string tmp = file_path + ".tmp";
+    {
+      std::ofstream out(tmp, std::ios_base::trunc);
+      reg.write_json(out);
+      if (!out) return; // Keep the last good snapshot
+    }
+    std::rename(tmp.c_str(), file_path.c_str());
+  }
+
+  void schedule_write() {
+    timer.expires_from_now(file_period);
+    timer.async_wait([this](const boost::system::error_code &ec) {
+	if (ec) return; // Cancelled
+	write_snapshot();
+	schedule_write();
+      });
+  }
+
+  void accept_next() {
+    auto sock = std::make_shared<stream_protocol::socket>(io);
+    auto handler = [this, sock](const boost::system::error_code &ec) {
+      if (ec) return; // Closed
+      std::ostringstream json;
+      reg.write_json(json);
+      boost::system::error_code wec;
+      boost::asio::write(*sock, boost::asio::buffer(json.str()), wec);
+      sock->close(wec);
+      accept_next();
+    };
+    acceptor.async_accept(*sock, handler);
+  }
+};
+
+exporter::exporter(registry &r) :
+  pimpl(new impl(r)) {
+}
+
+exporter::~exporter() {
+  stop();
+}
+
+void exporter::write_file(const std::string &path,
+			  std::chrono::milliseconds period) {
+  pimpl->file_path = path;
+  pimpl->file_period = period;
+}
+
+void exporter::listen(const std::string &path) {
+  impl::stream_protocol::endpoint ep(path);
+  std::remove(path.c_str());
+  pimpl->acceptor.open(ep.protocol());
+  pimpl->acceptor.bind(ep);
+  pimpl->acceptor.listen();
+  pimpl->socket_path = path;
+}
+
+void exporter::start() {
+  if (pimpl->runner.joinable()) {
+    throw std::logic_error("The exporter is already running");
+  }
+  if (!pimpl->file_path.empty()) {
+    pimpl->write_snapshot();
+    pimpl->schedule_write();
+  }
+  if (pimpl->acceptor.is_open()) pimpl->accept_next();
+  pimpl->runner = std::thread([this](){ pimpl->io.run(); });
+}
+
+void exporter::stop() {
+  if (!pimpl->runner.joinable()) return;
+  pimpl->io.post([this](){
+      boost::system::error_code ec;
+      pimpl->timer.cancel(ec);
+      pimpl->acceptor.close(ec);
+    });
+  pimpl->runner.join();
+  if (!pimpl->file_path.empty()) pimpl->write_snapshot();
+  if (!pimpl->socket_path.empty()) std::remove(pimpl->socket_path.c_str());
+}
+
+}}
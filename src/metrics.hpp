@@ -0,0 +1,214 @@
+#ifndef UEP_METRICS_HPP
+#define UEP_METRICS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+namespace uep {
+namespace metrics {
+
+/** Monotonic event counter. */
+class counter {
+public:
+  counter() : n(0) {}
+  counter(const counter&) = delete;
+  counter &operator=(const counter&) = delete;
+
+  void add(std::uint64_t v = 1) {
+    n.fetch_add(v, std::memory_order_relaxed);
+  }
+
+  std::uint64_t value() const {
+    return n.load(std::memory_order_relaxed);
+  }
+
+  void reset() {
+    n.store(0, std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<std::uint64_t> n;
+};
+
+/** Value that can go up and down, such as a queue depth. */
+class gauge {
+public:
+  gauge() : v(0) {}
+  gauge(const gauge&) = delete;
+  gauge &operator=(const gauge&) = delete;
+
+  void set(double x) {
+    v.store(x, std::memory_order_relaxed);
+  }
+
+  double value() const {
+    return v.load(std::memory_order_relaxed);
+  }
+
+  void reset() {
+    set(0);
+  }
+
+private:
+  std::atomic<double> v;
+};
+
+/** Histogram of non-negative integer samples, such as latencies in
+ *  nanoseconds.
+ *
+ *  As in HdrHistogram, the values below 2^SUB_BITS have their own
+ *  bucket and each following power of two is split in 2^SUB_BITS
+ *  linear buckets, so any value is reported with a relative error
+ *  below 2^-SUB_BITS. Recording a sample is a few relaxed atomic
+ *  operations and never allocates.
+ */
+class histogram {
+public:
+  /** Sub-buckets per power of two, as a power of two. */
+  static const unsigned int SUB_BITS = 5;
+  static const std::size_t SUB_COUNT = std::size_t(1) << SUB_BITS;
+  /** Total number of buckets to cover all the 64-bit values. */
+  static const std::size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+  histogram();
+  histogram(const histogram&) = delete;
+  histogram &operator=(const histogram&) = delete;
+
+  /** Add a sample. */
+  void record(std::uint64_t v) {
+    buckets[bucket_index(v)].fetch_add(1, std::memory_order_relaxed);
+    n.fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(v, std::memory_order_relaxed);
+    std::uint64_t m = lo.load(std::memory_order_relaxed);
+    while (v < m &&
+	   !lo.compare_exchange_weak(m, v, std::memory_order_relaxed)) {}
+    m = hi.load(std::memory_order_relaxed);
+    while (v > m &&
+	   !hi.compare_exchange_weak(m, v, std::memory_order_relaxed)) {}
+  }
+
+  /** Add a duration in nanoseconds. */
+  template <class Rep, class Period>
+  void record(std::chrono::duration<Rep, Period> d) {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    record(static_cast<std::uint64_t>(ns > 0 ? ns : 0));
+  }
+
+  std::uint64_t count() const;
+  std::uint64_t sum() const;
+  /** Smallest sample, 0 when empty. */
+  std::uint64_t min() const;
+  /** Largest sample, 0 when empty. */
+  std::uint64_t max() const;
+  /** Average of the samples, NaN when empty. */
+  double mean() const;
+  /** Return an upper bound of the `q`-quantile, 0 <= q <= 1, within
+   *  the resolution of the buckets. Return 0 when empty.
+   */
+  std::uint64_t percentile(double q) const;
+
+  void reset();
+
+  /** Index of the bucket that holds `v`. */
+  static std::size_t bucket_index(std::uint64_t v);
+  /** Largest value held by bucket `i`. */
+  static std::uint64_t bucket_upper(std::size_t i);
+
+private:
+  std::array<std::atomic<std::uint64_t>, BUCKETS> buckets;
+  std::atomic<std::uint64_t> n;
+  std::atomic<std::uint64_t> total;
+  std::atomic<std::uint64_t> lo;
+  std::atomic<std::uint64_t> hi;
+};
+
+/** Set of named metrics. The metrics are created on the first lookup
+ *  and live as long as the registry, so the references can be kept
+ *  and updated without locking.
+ */
+class registry {
+public:
+  registry() = default;
+  registry(const registry&) = delete;
+  registry &operator=(const registry&) = delete;
+
+  /** Registry used by the library. */
+  static registry &global();
+
+  metrics::counter &get_counter(const std::string &name);
+  metrics::gauge &get_gauge(const std::string &name);
+  metrics::histogram &get_histogram(const std::string &name);
+
+  /** Write a JSON object with all the metrics. */
+  void write_json(std::ostream &out) const;
+  /** Reset the values of all the metrics. */
+  void reset();
+
+private:
+  mutable std::mutex mutex;
+  std::map<std::string, std::unique_ptr<metrics::counter>> counters;
+  std::map<std::string, std::unique_ptr<metrics::gauge>> gauges;
+  std::map<std::string, std::unique_ptr<metrics::histogram>> histograms;
+};
+
+/** Shortcuts to the metrics of the global registry. */
+inline counter &get_counter(const std::string &name) {
+  return registry::global().get_counter(name);
+}
+inline gauge &get_gauge(const std::string &name) {
+  return registry::global().get_gauge(name);
+}
+inline histogram &get_histogram(const std::string &name) {
+  return registry::global().get_histogram(name);
+}
+
+/** Publish the snapshots of a registry from a background thread,
+ *  either by periodically rewriting a file or by answering the
+ *  connections to a local UNIX socket with the current snapshot, or
+ *  both. The snapshots are the JSON written by
+ *  registry::write_json().
+ */
+class exporter {
+public:
+  explicit exporter(registry &r = registry::global());
+  exporter(const exporter&) = delete;
+  exporter &operator=(const exporter&) = delete;
+  /** Stop the exporter. */
+  ~exporter();
+
+  /** Rewrite `path` every `period`. The file is replaced atomically,
+   *  so readers never see a partial snapshot. Must be called before
+   *  start().
+   */
+  void write_file(const std::string &path,
+		  std::chrono::milliseconds period = std::chrono::seconds(1));
+  /** Write a snapshot to each client that connects to the UNIX
+   *  socket at `path`, then close the connection. A stale socket
+   *  file is replaced. Must be called before start().
+   */
+  void listen(const std::string &path);
+
+  /** Start the background thread. An exporter can be started only
+   *  once.
+   */
+  void start();
+  /** Write the last snapshot, stop the thread and remove the socket
+   *  file.
+   */
+  void stop();
+
+private:
+  struct impl;
+  std::unique_ptr<impl> pimpl;
+};
+
+}}
+
+#endif
@@ -5,6 +5,51 @@
 #include "log.hpp"
 #include "nal_reader.hpp"
 
+/** Packets and bytes produced by a nal_reader. */
+struct overhead_count {
+  std::size_t npkts0, npkts1;
+  std::size_t size0, size1;
+  std::size_t oh0, oh1;
+
+  /** Fraction of the packet bytes that are overhead. */
+  double fraction() const {
+    return static_cast<double>(oh0 + oh1) / (size0 + size1 + oh0 + oh1);
+  }
+
+  void print(const std::string &prefix) const {
+    std::cout << prefix << "npkts0=" << npkts0 << std::endl;
+    std::cout << prefix << "npkts1=" << npkts1 << std::endl;
+    std::cout << prefix << "size0=" << size0 << std::endl;
+    std::cout << prefix << "size1=" << size1 << std::endl;
+    std::cout << prefix << "oh0=" << oh0 << std::endl;
+    std::cout << prefix << "oh1=" << oh1 << std::endl;
+  }
+};
+
+overhead_count count_overhead(const std::string &streamname,
+			      std::size_t pktsize,
+			      uep::nal_packing packing) {
+  uep::nal_reader nl(streamname, pktsize);
+  nl.packing(packing);
+  overhead_count c{};
+  // Read all packets to count the sizes + padding
+  while (nl.has_packet()) {
+    fountain_packet p = nl.next_packet();
+    if (p.getPriority() == 0)
+      ++c.npkts0;
+    else if (p.getPriority() == 1)
+      ++c.npkts1;
+    else
+      throw std::runtime_error("prio not 0 or 1");
+  }
+
+  c.oh0 = nl.total_overhead().at(0);
+  c.oh1 = nl.total_overhead().at(1);
+  c.size0 = nl.total_read().at(0);
+  c.size1 = nl.total_read().at(1);
+  return c;
+}
+
 int main(int argc, char **argv) {
 #ifdef UEP_VERBOSE_LOGS
   uep::log::init("nal_overhead.log");
@@ -36,28 +81,17 @@ int main(int argc, char **argv) {
     }
   }
 
-  uep::nal_reader nl(streamname, pktsize);
-  std::size_t npkts0 = 0, npkts1 = 0;
-  // Read all packets to count the sizes + padding
-  while (nl.has_packet()) {
-    fountain_packet p = nl.next_packet();
-    if (p.getPriority() == 0)
-      ++npkts0;
-    else if (p.getPriority() == 1)
-      ++npkts1;
-    else
-      throw std::runtime_error("prio not 0 or 1");
-  }
+  std::cout << std::fixed;
+  overhead_count padded = count_overhead(streamname, pktsize,
+					 uep::padded_packing);
+  padded.print("");
+  std::cout << "frac_oh=" << padded.fraction() << std::endl;
 
-  std::size_t oh0 = nl.total_overhead().at(0);
-  std::size_t oh1 = nl.total_overhead().at(1);
-  std::size_t size0 = nl.total_read().at(0);
-  std::size_t size1 = nl.total_read().at(1);
-
-  std::cout << "npkts0=" << npkts0 << std::endl;
-  std::cout << "npkts1=" << npkts1 << std::endl;
-  std::cout << "size0=" << size0 << std::endl;
-  std::cout << "size1=" << size1 << std::endl;
-  std::cout << "oh0=" << oh0 << std::endl;
-  std::cout << "oh1=" << oh1 << std::endl;
+  // The packed packets need room for the prefix
+  if (pktsize > uep::packed_prefix_size) {
+    overhead_count packed = count_overhead(streamname, pktsize,
+					   uep::packed_packing);
+    packed.print("packed_");
+    std::cout << "packed_frac_oh=" << packed.fraction() << std::endl;
+  }
 }
@@ -132,116 +132,64 @@ bool overwriteCharVecToFile(std::string filename, std::vector<char> v) {
 }
 
 std::vector<streamTrace> loadTrace(std::string streamName) {
-	std::ifstream file;
-	file = std::ifstream("dataset/"+streamName+".trace", std::ios::in|std::ios::binary);
-	if (!file.is_open()) throw std::runtime_error("Failed opening file");
-	file.seekg (0, std::ios::beg);
-	std::string line;
-	std::string header;
-	//std::regex regex("^0x\\([0-9]+\\)=[0-9]+No$");
-	uint16_t lineN = 0;
-	uint16_t nRows = 0;
-	while (!file.eof()) {
-		std::getline(file,line);
-		nRows++;
-	}
-	file.close();
-	file = std::ifstream("dataset/"+streamName+".trace", std::ios::in|std::ios::binary|std::ios::ate);
-	if (!file.is_open()) throw std::runtime_error("Failed opening file");
-	file.seekg (0, std::ios::beg);
-
+	trace_index ti = trace_index::load("dataset/"+streamName+".trace");
 	std::vector<streamTrace> sTp;
-	//std::cout << nRows << std::endl;
-	while (!file.eof()) {
-		std::getline(file,line);
-		//std::cout << line << std::endl;
-		if (line.length()==0) {
-			break;
-		}
-		lineN++;
-		std::istringstream iss(line);
-		if (lineN>2) {
-			std::string whiteSpacesTrimmed;
-			int n = line.find(" ");
-			std::string s = line;
-			while (n>=0) {
-				if (n==0) {
-					s = s.substr(1,s.length());
-				} else if (n>0) {
-					whiteSpacesTrimmed += s.substr(0,n) + " ";
-					s = s.substr(n,s.length());
-				}
-				n = s.find(" ");
-			}
-			whiteSpacesTrimmed += s;
-			streamTrace elem;
-			for (int i=0; i<8; i++) {
-				int n = whiteSpacesTrimmed.find(" ");
-				std::string s = whiteSpacesTrimmed.substr(0,n);
-				int nn;
-
-				//std::cout << i << std::endl;
-				switch (i) {
-				case (0):
-					elem.startPos = strtoul(s.substr(s.find("x")+1,s.length()).c_str(), NULL, 16);
-					break;
-				case (1): case (2): case(3): case (4):
-					if (s == "0") {
-						nn = 0;
-					} else {
-						nn = stoi( s );
-					}
-					break;
-				case (5):
-					if (s == "StreamHeader") {
-						elem.packetType = streamTrace::stream_header;
-					} else if (s == "ParameterSet") {
-						elem.packetType = streamTrace::parameter_set;
-					} else if (s == "SliceData") {
-						elem.packetType = streamTrace::slice_data;
-					}
-					break;
-				case (6):
-					if (s == "Yes") {
-						elem.discardable = true;
-					} else if (s == "No") {
-						elem.discardable = false;
-					}
-					break;
-				case (7):
-					if (s == "Yes") {
-						elem.truncatable = true;
-					} else if (s == "No") {
-						elem.truncatable = false;
-					}
-				break;
-				}
-				switch (i) {
-				case (1):
-					elem.len = nn;
-					break;
-				case (2):
-					elem.lid = nn;
-					break;
-				case (3):
-					elem.tid = nn;
-					break;
-				case (4):
-					elem.qid = (uint16_t)nn;
-					break;
-				}
-				whiteSpacesTrimmed = whiteSpacesTrimmed.substr(n+1,whiteSpacesTrimmed.length());
-			}
-			sTp.push_back(elem);
-		}
+	sTp.reserve(ti.size());
+	for (const trace_record &r : ti) {
+		sTp.push_back(r.to_stream_trace());
 	}
-	file.close();
 	return (sTp);
 }
 
 // PACKET SOURCE
 
-int sliceDataInd;
+std::vector<size_t> split_stream_by_qid(const std::string &streamName,
+					const std::vector<streamTrace> &trace,
+					size_t first, size_t n_qids) {
+	const std::string base = "dataset/"+streamName;
+	std::vector<size_t> lengths(n_qids, 0);
+	std::vector<bool> to_write(n_qids, false);
+	bool any = false;
+	for (size_t i=0; i<n_qids; i++) {
+		std::string streamN = base+"."+std::to_string(i)+".264";
+		if (file_exists(streamN, &lengths[i])) {
+			std::cout << streamN << " already created. Length: "<< lengths[i] <<"\n";
+		} else {
+			to_write[i] = true;
+			any = true;
+		}
+	}
+	if (!any) return lengths;
+
+	auto bitstream = mapped_file::open_shared(base+".264");
+	// Opened on the first NAL, so that no file is created without NALs
+	std::vector<std::unique_ptr<std::ofstream>> outs(n_qids);
+	for (size_t ii=first; ii<trace.size(); ii++) {
+		const streamTrace &st = trace[ii];
+		size_t i;
+		if (size_t(st.qid) >= n_qids) i = n_qids-1;
+		else if (st.packetType == streamTrace::slice_data) i = st.qid;
+		else continue;
+		if (!to_write[i]) continue;
+
+		if (st.startPos > bitstream->size() ||
+		    size_t(st.len) > bitstream->size() - st.startPos)
+			throw std::runtime_error("The NAL is outside of the H264 bitstream");
+		if (!outs[i]) {
+			std::string streamN = base+"."+std::to_string(i)+".264";
+			outs[i].reset(new std::ofstream(streamN, std::ios::binary|std::ios::trunc));
+			if (!outs[i]->is_open()) throw std::runtime_error("Failed opening file");
+		}
+		outs[i]->write(bitstream->data() + st.startPos, st.len);
+		lengths[i] += st.len;
+	}
+	for (auto &o : outs) {
+		if (!o) continue;
+		o->close();
+		if (!*o) throw std::runtime_error("Failed writing file");
+	}
+	return lengths;
+}
 
 bool packet_source::operator!() const { return !static_cast<bool>(*this); }
 
@@ -254,7 +202,6 @@ packet_source::operator bool() const {
 }
 
 packet_source::packet_source(const parameter_set &ps) {
-	//paramSet = ps;
 	Ks = ps.Ks;
 	rfs = ps.RFs;
 	ef = ps.EF;
@@ -262,92 +209,47 @@ packet_source::packet_source(const parameter_set &ps) {
 	size_t leng = 0;
 	if (file_exists("dataset/"+nomeStream+".264", &leng)) totalLength = leng;
 	else throw std::runtime_error("Failed opening file");
-	currInd.resize(Ks.size());
-	currRep.resize(Ks.size());
+	currInd.assign(Ks.size(), 0);
+	currRep.assign(Ks.size(), 0);
 	files.resize(Ks.size());
-	max_count.resize(Ks.size());
-	for (uint i=0; i<currInd.size(); i++) { currInd[i]=0; currRep[i]=0; max_count[i] = 0;}
 	currQid = 0;
 	efReal = 0;
-	//streamName = ps.streamName;
 	Ls = 64;
-	/* RANDOM GENERATION OF FILE */
-	/*
-	bool textFile = true;
-	int fileSize = max_count; // file size = fileSize * Ls;
-	std::ofstream newFile (streamName+".txt");
-	//std::cout << streamName << ".txt\n";
-	if (newFile.is_open()) {
-		for (int ii = 0; ii<fileSize; ii++) {
-			if (!textFile) {
-				boost::random::uniform_int_distribution<> dist(0, 255);
-				newFile << ((char) dist(gen));
-			} else {
-				boost::random::uniform_int_distribution<> dist(65, 90);
-				int randN = dist(gen);
-				newFile << ((char) randN);
-			}
-		}
-	}
-	newFile.close();
-	*/
+
 	videoTrace = loadTrace(nomeStream);
-	//max_count = videoTrace[videoTrace.size()-1].startPos + videoTrace[videoTrace.size()-1].len;
-	//std::cout << "max_count: " << std::to_string(max_count) << std::endl;
-	// parse .trace to produce a txt with parts repeated
 	// first rows of videoTrace are: stream header and parameter set. must be passed through TCP
-	int fromHead = videoTrace[0].startPos;
-	int toHead;
+	size_t sliceDataInd = 0;
 	headerLength = 0;
-	for (toHead = fromHead; videoTrace[toHead].packetType < 3; toHead++) { headerLength += videoTrace[toHead].len; }
-	//int fromSliceData = videoTrace[toHead].startPos;
-	sliceDataInd = toHead;
-	toHead = videoTrace[toHead-1].startPos + videoTrace[toHead-1].len;
-	// int fromSliceData = toHead + 1;
-
-	header = readByteFromFile("dataset/"+nomeStream+".264",fromHead,headerLength);
-
-	for (uint8_t i=0; i<Ks.size(); i++) {
-		std::string streamN = "dataset/"+nomeStream+"."+std::to_string(i)+".264";
-		size_t leng=0;
-		if (file_exists(streamN, &leng)) {
-			std::cout << streamN << " already created. Length: "<< leng <<"\n";
-		} else {
-			uint ii=sliceDataInd;
-			while (ii<videoTrace.size()) {
-				if (((videoTrace[ii].packetType == 3) && (videoTrace[ii].qid == i))||
-					((uint(videoTrace[ii].qid) >= ps.Ks.size()) && (i == ps.Ks.size()-1))) {
-					//std::vector<char> slice;
-					std::vector<char> slice = readByteFromFile("dataset/"+nomeStream+".264",videoTrace[ii].startPos,videoTrace[ii].len);
-					 leng += videoTrace[ii].len;
-					if (!writeCharVecToFile(streamN,slice)) {
-						std::cout << "error in writing file\n";
-					}
-					//std::cout << "read " << ii << "th row - qid: " << std::to_string(i) << " -> " << streamN << std::endl;
-				}
-				ii++;
-			}
-		}
-		max_count[i] = leng;
+	while (sliceDataInd < videoTrace.size() &&
+	       videoTrace[sliceDataInd].packetType < streamTrace::slice_data) {
+		headerLength += videoTrace[sliceDataInd].len;
+		sliceDataInd++;
 	}
-
-	for (uint8_t i=0; i<Ks.size(); i++) {
+	auto bitstream = mapped_file::open_shared("dataset/"+nomeStream+".264");
+	size_t fromHead = videoTrace.at(0).startPos;
+	if (fromHead + headerLength > bitstream->size())
+		throw std::runtime_error("The header is outside of the H264 bitstream");
+	header.assign(bitstream->data() + fromHead,
+		      bitstream->data() + fromHead + headerLength);
+
+	// Split the slices by qid, then keep the split files mapped
+	max_count = split_stream_by_qid(nomeStream, videoTrace, sliceDataInd, Ks.size());
+	for (size_t i=0; i<Ks.size(); i++) {
 		std::string streamN = "dataset/"+nomeStream+"."+std::to_string(i)+".264";
-		files[i] = std::ifstream(streamN, std::ios::in|std::ios::binary);
-		if (!files[i].is_open()) throw std::runtime_error("Failed opening file");
+		if (!file_exists(streamN)) throw std::runtime_error("Failed opening file");
+		files[i] = mapped_file::open_shared(streamN);
 	}
 }
 
 fountain_packet packet_source::next_packet() { // using uep_encoder
 	if (currInd[currQid]*Ls >= max_count[currQid]) throw std::runtime_error("Max packet count");
-	std::string streamN = "dataset/"+nomeStream+"."+std::to_string(currQid)+".264";
-	bool readingOk;
-	std::vector<char> read = readByteFromFile(streamN,currInd[currQid]*Ls,Ls, &readingOk);
+	const mapped_file &f = *files[currQid];
+	size_t from = currInd[currQid]*Ls;
 	currInd[currQid]++;
-	if (!readingOk) throw std::runtime_error("Impossible to read source file");
-	if (read.size() < Ls) { // last bits
-		for (uint i=0; i<Ls-read.size(); i++) read.push_back(' ');
-	}
+	if (from >= f.size()) throw std::runtime_error("Impossible to read source file");
+	size_t len = std::min(Ls, f.size() - from);
+	std::vector<char> read(Ls, ' '); // Pad the last bits with spaces
+	std::copy(f.data() + from, f.data() + from + len, read.begin());
 	fountain_packet fp(read);
 	fp.setPriority(currQid);
 	cerr << "packet_source::next_packet size=" << fp.size()
@@ -387,17 +289,27 @@ nal_reader::nal_reader(std::istream &in_trace, std::istream &in_bitstream,
   basic_lg(boost::log::keywords::channel = log::basic),
   perf_lg(boost::log::keywords::channel = log::performance),
   pkt_size(pktsize),
-  file(in_bitstream),
-  trace(in_trace),
+  trace(trace_index::parse(in_trace)),
+  trace_pos(0),
+  last_nal{nullptr, 0},
+  run_size(0),
+  run_prio(0),
+  packing_mode(padded_packing),
+  eos_packed(false),
   use_eos(false),
   _tot_added_oh(2, 0),
   _tot_size(2, 0) {
   BOOST_LOG_SEV(basic_lg, log::trace) << "Creating reader with given istreams";
 
-  auto oldg = file.tellg();
-  file.seekg(0, ios_base::end);
-  totalLength = file.tellg() - oldg;
-  file.seekg(oldg);
+  // The trace has absolute offsets: keep the whole bitstream
+  in_bitstream.seekg(0, ios_base::end);
+  bitstream_copy.resize(in_bitstream.tellg());
+  in_bitstream.seekg(0);
+  in_bitstream.read(bitstream_copy.data(), bitstream_copy.size());
+  if (static_cast<std::size_t>(in_bitstream.gcount()) != bitstream_copy.size())
+    throw ios_base::failure("Failed to read the H264 bitstream");
+  bitstream = bitstream_copy.data();
+  totalLength = bitstream_copy.size();
   BOOST_LOG_SEV(basic_lg, log::debug) << "Total bytes to read from H264 bitstream: "
 				      << totalLength;
 
@@ -410,21 +322,22 @@ nal_reader::nal_reader(const std::string &strname, std::size_t pktsize) :
   perf_lg(boost::log::keywords::channel = log::performance),
   stream_name(strname),
   pkt_size(pktsize),
-  file_backend(new ifstream(filename(), ios_base::binary|ios_base::ate)),
-  trace_backend(new ifstream(tracename())),
-  file(*file_backend),
-  trace(*trace_backend),
+  mapping(mapped_file::open_shared(filename())),
+  bitstream(mapping->data()),
+  trace(trace_index::load(tracename())),
+  trace_pos(0),
+  last_nal{nullptr, 0},
+  run_size(0),
+  run_prio(0),
+  packing_mode(padded_packing),
+  eos_packed(false),
   use_eos(false),
   _tot_added_oh(2,0),
   _tot_size(2,0) {
   BOOST_LOG_SEV(basic_lg, log::trace) << "Creating reader for "
 				      << stream_name;
 
-  if (!file_backend) throw ios_base::failure("Failed to open the H264 file");
-  if (!trace_backend) throw ios_base::failure("Failed to open the trace file");
-
-  totalLength = file.tellg();
-  file.seekg(0);
+  totalLength = mapping->size();
   BOOST_LOG_SEV(basic_lg, log::debug) << "Total bytes to read from H264 bitstream: "
 				      << totalLength;
 
@@ -436,65 +349,8 @@ nal_reader::nal_reader(const parameter_set &ps) :
 }
 
 streamTrace nal_reader::read_trace_line() {
-  string line;
-  getline(trace,line);
-  utils::skip_empty(trace);
-  if (line.empty()) {
-    throw runtime_error("Empty trace line");
-  }
-  BOOST_LOG_SEV(basic_lg, log::trace) << "Reading trace line"
-				      << ". Raw line: "
-				      << line;
-
-  istringstream iss(line);
-  streamTrace elem;
-
-  iss >> std::hex >> elem.startPos;
-  if (iss.fail()) { // Was not a packet line, ignore and take next one
-    BOOST_LOG_SEV(basic_lg, log::trace) << "Skip non-packet line";
-    return read_trace_line();
-  }
-
-  iss >> std::dec;
-  iss >> elem.len;
-  iss >> elem.lid;
-  iss >> elem.tid;
-  iss >> elem.qid;
-
-  string pkt_type;
-  iss >> std::ws; // Skip whitespace
-  getline(iss, pkt_type, ' ');
-  BOOST_LOG_SEV(basic_lg, log::trace) << "Raw pkt_type=" << pkt_type;
-  if (pkt_type == "StreamHeader") {
-    elem.packetType = streamTrace::stream_header;
-  } else if (pkt_type == "ParameterSet") {
-    elem.packetType = streamTrace::parameter_set;
-  } else if (pkt_type == "SliceData") {
-    elem.packetType = streamTrace::slice_data;
-  }
-  else throw runtime_error("Unknown packet type");
-
-  string disc;
-  iss >> std::ws; // Skip whitespace
-  getline(iss, disc, ' ');
-  BOOST_LOG_SEV(basic_lg, log::trace) << "Raw disc=" << disc;
-  if (disc == "Yes") {
-    elem.discardable = true;
-  } else if (disc == "No") {
-    elem.discardable = false;
-  }
-  else throw runtime_error("Unknown discardable field");
-
-  string trunc;
-  iss >> std::ws; // Skip whitespace
-  getline(iss, trunc, ' ');
-  BOOST_LOG_SEV(basic_lg, log::trace) << "Raw trunc=" << trunc;
-  if (trunc == "Yes") {
-    elem.truncatable = true;
-  } else if (trunc == "No") {
-    elem.truncatable = false;
-  }
-  else throw runtime_error("Unknown truncatable field");
+  if (trace_ended()) throw runtime_error("Out of trace records");
+  streamTrace elem = trace[trace_pos++].to_stream_trace();
 
   BOOST_LOG_SEV(basic_lg, log::trace) << std::hex
 				      << "Read streamTrace: offset="
@@ -512,17 +368,21 @@ streamTrace nal_reader::read_trace_line() {
   return elem;
 }
 
+bool nal_reader::trace_ended() const {
+  return trace_pos == trace.size();
+}
+
 void nal_reader::read_header() {
   BOOST_LOG_SEV(basic_lg, log::trace) << "Reading header";
   streamTrace st_line = read_trace_line();
-  buffer_type nal = read_nal(st_line);
+  nal_view nal = read_nal(st_line);
   while (st_line.packetType == streamTrace::stream_header ||
 	 st_line.packetType == streamTrace::parameter_set) {
     BOOST_LOG_SEV(basic_lg, log::trace) << "Found packet with type "
 					<< st_line.packetType
 					<< " offset="
 					<< std::hex << st_line.startPos;
-    hdr.insert(hdr.end(), nal.begin(), nal.end());
+    hdr.insert(hdr.end(), nal.data, nal.data + nal.size);
     BOOST_LOG_SEV(basic_lg, log::trace) << "Read into header buffer"
 					<< ". Total size=" << hdr.size();
     st_line = read_trace_line();
@@ -531,88 +391,156 @@ void nal_reader::read_header() {
 
   // Don't drop the first slice NAL
   assert(last_nal.empty());
-  last_nal = std::move(nal);
+  last_nal = nal;
   last_prio = classify(st_line);
+  run_prio = last_prio;
 }
 
-buffer_type nal_reader::read_nal(const streamTrace &st) {
-  buffer_type buf(st.len);
-  if (file.tellg() != st.startPos) {
-    file.seekg(st.startPos);
-  }
-  file.read(buf.data(), buf.size());
-  assert(file.gcount() == st.len);
-  return buf;
+nal_reader::nal_view nal_reader::read_nal(const streamTrace &st) {
+  if (st.len <= 0 || st.startPos > totalLength ||
+      static_cast<std::size_t>(st.len) > totalLength - st.startPos)
+    throw runtime_error("The NAL is outside of the H264 bitstream");
+  return nal_view{bitstream + st.startPos, static_cast<std::size_t>(st.len)};
 }
 
-void nal_reader::pack_nals() {
-  if (last_nal.empty()) throw runtime_error("Out of NALs");
-
-  std::size_t prio = last_prio;
-  buffer_type packed = std::move(last_nal);
-  last_nal.clear();
-
-  while(trace) {
+void nal_reader::next_nal() {
+  if (!trace_ended()) {
     streamTrace st_line = read_trace_line();
     last_nal = read_nal(st_line);
     last_prio = classify(st_line);
+  }
+  else if (packing_mode == packed_packing && use_eos && !eos_packed) {
+    static const buffer_type eos_code = [](){
+      buffer_type b{0x00, 0x00, 0x01};
+      b.insert(b.end(), EOS_NAL.begin(), EOS_NAL.end());
+      return b;
+    }();
+    last_nal = nal_view{eos_code.data(), eos_code.size()};
+    last_prio = 0;
+    eos_packed = true;
+    BOOST_LOG_SEV(basic_lg, log::debug) << "NAL reader packs the EOS NAL";
+  }
+}
 
-    // Append the next NAL if same priority
-    if (last_prio == prio && packed.size() <= MAX_PACKED_SIZE) {
-      packed.insert(packed.end(), last_nal.begin(), last_nal.end());
-      last_nal.clear();
+void nal_reader::pack_nals_packed() {
+  // Fill one packet with the following bytes, across the runs
+  std::shared_ptr<buffer_type> buf = pkt_pool.get(pkt_size);
+  std::size_t filled = packed_prefix_size;
+  std::uint16_t run_switch = NO_RUN_SWITCH;
+  std::size_t prio = last_prio;
+  for (;;) {
+    if (last_prio != run_prio) { // A new run starts here
+      if (run_switch == NO_RUN_SWITCH)
+	run_switch = filled - packed_prefix_size;
+      BOOST_LOG(perf_lg) << "nal_reader::pack_nals after_padding"
+			 << " packed_size=" << run_size
+			 << " priority=" << run_prio
+			 << " padding=0"
+			 << " pkt_size=" << pkt_size;
+      run_size = 0;
+      run_prio = last_prio;
     }
-    else { // Different priority
-      if (packed.size() > MAX_PACKED_SIZE) {
-	const auto maxsize = MAX_PACKED_SIZE; // Doesn't link if placed in <<
-	BOOST_LOG_SEV(basic_lg, log::warning) << "Consecutive NALs with priority "
-					      << prio << " exceed "
-					      << maxsize << " bytes";
-      }
-      break;
+    prio = std::min(prio, last_prio);
+
+    std::size_t len = std::min(pkt_size - filled, last_nal.size);
+    std::copy(last_nal.data, last_nal.data + len, buf->begin() + filled);
+    filled += len;
+    last_nal.data += len;
+    last_nal.size -= len;
+    if (eos_packed) _tot_added_oh.at(0) += len;
+    else {
+      _tot_size.at(last_prio) += len;
+      run_size += len;
     }
+    if (!last_nal.empty()) break; // Packet full, the NAL continues
+
+    next_nal();
+    if (last_nal.empty() || filled == pkt_size) break;
   }
 
-  // Segment and pad the packed NALs
-  BOOST_LOG(perf_lg) << "nal_reader::pack_nals before_padding"
-		     << " packed_size=" << packed.size()
-		     << " priority=" << prio;
-  size_t npkts = static_cast<size_t>(ceil(static_cast<double>(packed.size()) /
-					  pkt_size));
-  auto i = packed.cbegin();
-  for (size_t n = 0; n < npkts-1; ++n) {
-    fountain_packet fp;
-    fp.setPriority(prio);
-    fp.buffer().resize(pkt_size);
-    std::copy(i, i + pkt_size, fp.buffer().begin());
-    pkt_queue.push(std::move(fp));
-    i += pkt_size;
+  // Only the last packet of the stream is padded
+  std::size_t padding = pkt_size - filled;
+  std::fill(buf->begin() + filled, buf->end(), 0x00);
+  (*buf)[0] = static_cast<char>(run_switch >> 8);
+  (*buf)[1] = static_cast<char>(run_switch & 0xff);
+  _tot_added_oh.at(prio) += packed_prefix_size + padding;
+  fountain_packet fp{packet(std::move(buf))};
+  fp.setPriority(prio);
+  pkt_queue.push(std::move(fp));
+
+  if (last_nal.empty()) {
+    BOOST_LOG(perf_lg) << "nal_reader::pack_nals after_padding"
+		       << " packed_size=" << run_size
+		       << " priority=" << run_prio
+		       << " padding=" << padding
+		       << " pkt_size=" << pkt_size;
+    BOOST_LOG_SEV(basic_lg, log::debug) << "NAL reader finished";
   }
-  fountain_packet fp;
+}
+
+void nal_reader::pack_nals() {
+  if (last_nal.empty()) throw runtime_error("Out of NALs");
+  if (packing_mode == packed_packing) {
+    pack_nals_packed();
+    return;
+  }
+
+  // Fill one packet, straight from the bitstream, with the NALs of
+  // the current run
+  const std::size_t prio = last_prio;
+  std::shared_ptr<buffer_type> buf = pkt_pool.get(pkt_size);
+  std::size_t filled = 0;
+  bool run_ended = false;
+  for (;;) {
+    std::size_t len = std::min(pkt_size - filled, last_nal.size);
+    std::copy(last_nal.data, last_nal.data + len, buf->begin() + filled);
+    filled += len;
+    last_nal.data += len;
+    last_nal.size -= len;
+    if (!last_nal.empty()) break; // Packet full, the NAL continues
+
+    if (trace_ended()) {
+      run_ended = true;
+      break;
+    }
+    next_nal();
+    if (last_prio != prio) { // Different priority: pad this packet
+      run_ended = true;
+      break;
+    }
+    if (filled == pkt_size) break;
+  }
+
+  std::size_t padding = pkt_size - filled;
+  std::fill(buf->begin() + filled, buf->end(), 0x00);
+  fountain_packet fp{packet(std::move(buf))};
   fp.setPriority(prio);
-  fp.buffer().resize(pkt_size, 0x00); // Pad with zeros the last segment
-  std::copy(i, packed.cend(), fp.buffer().begin());
   pkt_queue.push(std::move(fp));
 
-  _tot_added_oh.at(prio) += pkt_size*npkts - packed.size();
-  _tot_size.at(prio) += packed.size();
-  BOOST_LOG(perf_lg) << "nal_reader::pack_nals after_padding"
-		     << " packed_size=" << packed.size()
-		     << " priority=" << prio
-		     << " padding=" << pkt_size*npkts - packed.size()
-		     << " pkt_size=" << pkt_size;
+  _tot_added_oh.at(prio) += padding;
+  _tot_size.at(prio) += filled;
+  run_size += filled;
+  if (run_ended) {
+    BOOST_LOG(perf_lg) << "nal_reader::pack_nals after_padding"
+		       << " packed_size=" << run_size
+		       << " priority=" << prio
+		       << " padding=" << padding
+		       << " pkt_size=" << pkt_size;
+    run_size = 0;
+  }
 
-  if (!trace) {
+  if (trace_ended() && last_nal.empty()) {
     BOOST_LOG_SEV(basic_lg, log::debug) << "NAL reader finished";
     if (use_eos) {
       static const std::array<char, 3> nal_sc{0x00, 0x00, 0x01};
       assert(EOS_NAL.size() + nal_sc.size() <= pkt_size);
-      fountain_packet fp;
-      fp.setPriority(0);
-      fp.buffer().resize(pkt_size, 0x00); // This must also be the same length
-      auto fpi = fp.buffer().begin();
-      fpi = std::copy(nal_sc.begin(), nal_sc.end(), fpi);
+      std::shared_ptr<buffer_type> buf = pkt_pool.get(pkt_size);
+      // This must also be the same length
+      std::fill(buf->begin(), buf->end(), 0x00);
+      auto fpi = std::copy(nal_sc.begin(), nal_sc.end(), buf->begin());
       std::copy(EOS_NAL.begin(), EOS_NAL.end(), fpi);
+      fountain_packet fp{packet(std::move(buf))};
+      fp.setPriority(0);
       pkt_queue.push(std::move(fp));
       BOOST_LOG_SEV(basic_lg, log::debug) << "NAL reader enqueued the EOS NAL"
 					  << " (" << pkt_queue.back().size()
@@ -675,7 +603,7 @@ const buffer_type &nal_reader::header() const {
 }
 
 bool nal_reader::has_packet() const {
-  return !(pkt_queue.empty() && last_nal.empty() && trace.eof()) ;
+  return !(pkt_queue.empty() && last_nal.empty() && trace_ended()) ;
 }
 
 nal_reader::operator bool() const {
@@ -690,6 +618,18 @@ bool nal_reader::operator!() const {
   return !has_packet();
 }
 
+nal_packing nal_reader::packing() const {
+  return packing_mode;
+}
+
+void nal_reader::packing(nal_packing p) {
+  if (p == packed_packing &&
+      (pkt_size <= packed_prefix_size ||
+       pkt_size - packed_prefix_size > NO_RUN_SWITCH))
+    throw std::invalid_argument("Packet size not valid for packed NALs");
+  packing_mode = p;
+}
+
 bool nal_reader::use_end_of_stream() const {
   return use_eos;
 }
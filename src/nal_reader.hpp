@@ -1,14 +1,18 @@
 #ifndef UEP_NAL_READER_HPP
 #define UEP_NAL_READER_HPP
 
+#include <cstdint>
 #include <fstream>
 #include <istream>
 #include <queue>
 #include <sstream>
 
+#include "buffer_pool.hpp"
 #include "log.hpp"
 #include "lt_param_set.hpp"
+#include "mapped_file.hpp"
 #include "packets.hpp"
+#include "trace_index.hpp"
 
 //#ifdef UEP_SPLIT_STREAMS
 #include "uep_encoder.hpp"
@@ -20,6 +24,16 @@ std::vector<char> readByteFromFile(std::string filename, int from, int len, bool
 std::vector<char> readByteFromFileOpened(std::ifstream ifs, int from, int len);
 bool writeCharVecToFile(std::string filename, std::vector<char> v);
 bool overwriteCharVecToFile(std::string filename, std::vector<char> v);
+/** Write the NALs of `trace`, starting from `first`, to the files
+ *  `dataset/${streamName}.${qid}.264`, in one pass over the mapped
+ *  bitstream. The slices with qid < n_qids go to the file of their
+ *  qid, any NAL with a greater qid goes to the last file. The files
+ *  that already exist are kept as they are. Return the length of
+ *  each file.
+ */
+std::vector<size_t> split_stream_by_qid(const std::string &streamName,
+					const std::vector<uep::streamTrace> &trace,
+					size_t first, size_t n_qids);
 //typedef uep::lt_uep_parameter_set all_params;
 typedef uep::all_parameter_set<uep::uep_encoder<>::parameter_set> all_params;
 //all_params parset;
@@ -36,7 +50,11 @@ struct packet_source {
   uint efReal;
   //parameter_set paramSet;
   std::string nomeStream;
-  std::vector<std::ifstream> files;
+  std::vector<std::shared_ptr<const uep::mapped_file>> files; /**< Mapping
+								  *   of the
+								  *   split
+								  *   files.
+								  */
   //boost::random::mt19937 gen;
   size_t totalLength;
   std::vector<uep::streamTrace> videoTrace;
@@ -54,21 +72,58 @@ struct packet_source {
 
 namespace uep {
 
+/** How the runs of consecutive NALs with the same priority are
+ *  packed into packets.
+ */
+enum nal_packing : unsigned char {
+  /** Each run starts a new packet and its last packet is
+   *  zero-padded.
+   */
+  padded_packing = 0,
+  /** The runs follow each other without padding. Each packet starts
+   *  with the 2-byte big-endian offset in its payload of the first
+   *  byte of a new run, or NO_RUN_SWITCH, and takes the highest
+   *  priority (lowest value) among the runs it carries. The EOS NAL
+   *  is carried as a normal NAL.
+   */
+  packed_packing = 1
+};
+
+/** Size of the prefix of the packets built with packed_packing. */
+const std::size_t packed_prefix_size = 2;
+/** Prefix of a packet that does not contain the start of a run. */
+const std::uint16_t NO_RUN_SWITCH = 0xffff;
+
+/** Read the NAL units of an H264 bitstream and pack them into
+ *  fixed-size packets with the same priority.
+ *
+ *  The consecutive NALs with the same priority form a run, which is
+ *  split into packets and zero-padded at its end. Each packet is
+ *  built when it is requested, so only one packet is held at a time
+ *  and the first packet of a run does not wait for the whole run.
+ *
+ *  The bitstream is memory-mapped, and the mapping is shared by all
+ *  the readers of the same stream. The NALs are never copied except
+ *  into the pooled buffers of the output packets. The NALs are
+ *  located with the binary trace index `${trace}.idx` when it exists
+ *  (see trace_index), otherwise by parsing the text trace.
+ */
 class nal_reader {
 public:
   /** Type of the parameter set used to setup the reader. */
   typedef net_parameter_set parameter_set;
 
-  /** The maximum length a pack of NALs with the same priority can be
-   *  before being split into packets.
-   */
-  static const std::size_t MAX_PACKED_SIZE = 16*1024*1024;
   /** Invalid NAL used to signal the end of stream. */
   static const buffer_type EOS_NAL;
 
   /** Construct a reader with the given parameter set. */
   explicit nal_reader(const parameter_set &ps);
+  /** Construct a reader for `dataset/${strname}.264`. */
   explicit nal_reader(const std::string &strname, std::size_t pktsize);
+  /** Construct a reader that takes the NALs from the given
+   *  bitstream. The whole bitstream is read into memory at
+   *  construction.
+   */
   explicit nal_reader(std::istream &in_trace, std::istream &in_bitstream,
 		      std::size_t pktsize);
 
@@ -99,36 +154,51 @@ public:
   bool use_end_of_stream() const;
   void use_end_of_stream(bool use);
 
+  /** Packing of the NALs into the packets. It must be set before
+   *  the first call to next_packet().
+   */
+  nal_packing packing() const;
+  void packing(nal_packing p);
+
   const std::vector<std::size_t> &total_overhead() const;
   const std::vector<std::size_t> &total_read() const;
 private:
+  /** Bytes of a NAL unit inside the bitstream. */
+  struct nal_view {
+    const char *data;
+    std::size_t size;
+
+    bool empty() const { return size == 0; }
+  };
+
   log::default_logger basic_lg, perf_lg;
 
   std::string stream_name;
   std::size_t pkt_size;
 
-  std::unique_ptr<std::ifstream> file_backend; /**< Holds the `file`
-						*   stream if it is
-						*   not passed
-						*   externally.
-						*/
-  std::unique_ptr<std::ifstream> trace_backend; /**< Holds the `trace`
-						 *   stream if it is
-						 *   not passed
-						 *   externally.
-						 */
-  std::istream &file; /**< Reference to the stream that reads from the
-		       *   raw H264 bitstream.
-		       */
-  std::istream &trace; /**< Reference to the stream that reads from
-			*   the trace file.
-			*/
+  std::shared_ptr<const mapped_file> mapping; /**< Mapping of the H264
+					       *   bitstream, when
+					       *   read from a file.
+					       */
+  buffer_type bitstream_copy; /**< Holds the H264 bitstream when it is
+			       *   read from an istream.
+			       */
+  const char *bitstream; /**< First byte of the raw H264 bitstream. */
+  trace_index trace; /**< Position of the NALs in the bitstream. */
+  std::size_t trace_pos; /**< Next record of the trace to read. */
 
   buffer_type hdr;
   std::size_t totalLength;
 
-  buffer_type last_nal;
-  std::size_t last_prio;
+  nal_view last_nal; /**< Part of the next NAL not yet packed. */
+  std::size_t last_prio; /**< Priority of last_nal. */
+  std::size_t run_size; /**< Bytes packed so far in the current run. */
+  std::size_t run_prio; /**< Priority of the current run. */
+  nal_packing packing_mode;
+  bool eos_packed; /**< True once the EOS NAL is being packed, with
+		    *   packed_packing.
+		    */
+  buffer_pool pkt_pool; /**< Buffers of the output packets. */
   std::queue<fountain_packet> pkt_queue;
 
   bool use_eos; /**< Flag to enable the sending of the EOS code. */
@@ -147,16 +217,24 @@ private:
   std::string tracename() const;
   /** Read the first NALs into the `hdr` buffer. */
   void read_header();
-  /** Read the next line from the NAL trace. */
+  /** Read the next record from the NAL trace. */
   streamTrace read_trace_line();
-  /** Read the NAL unit corresponding to the given trace line. */
-  buffer_type read_nal(const streamTrace &st);
+  /** True when all the trace records have been read. */
+  bool trace_ended() const;
+  /** Return the NAL unit corresponding to the given trace line. */
+  nal_view read_nal(const streamTrace &st);
   /** Assign a priority to the NAL unit. */
   std::size_t classify(const streamTrace &st);
-  /** Create more packets by packing together NALs with the same
-   *  priority.
+  /** Create the next packet by packing together NALs with the same
+   *  priority. The packet is padded when the run ends.
    */
   void pack_nals();
+  /** Create the next packet with packed_packing. */
+  void pack_nals_packed();
+  /** Read the next NAL of the trace into last_nal. With
+   *  packed_packing the EOS NAL follows the last one.
+   */
+  void next_nal();
 };
 
 }
@@ -1,105 +1,328 @@
 #include "nal_writer.hpp"
 
+#include "metrics.hpp"
+
 using namespace std;
 
 namespace uep {
 
+const std::size_t nal_writer::WRITE_CHUNK;
+
 nal_writer::nal_writer(const buffer_type &header,
-		       const std::string &strname) :
+		       const std::string &strname,
+		       bool async,
+		       nal_packing packing) :
   basic_lg(boost::log::keywords::channel = log::basic),
   perf_lg(boost::log::keywords::channel = log::performance),
   stream_name(strname),
   file_backend(new ofstream(filename(), ios_base::binary)),
   file(*file_backend),
+  buf_start(0),
   buf_prio(0),
-  eos_recvd(false) {
+  end_scan_pos(0),
+  eos_recvd(false),
+  packing_mode(packing),
+  async_mode(async),
+  back_busy(false),
+  writer_stop(false),
+  wstats() {
   BOOST_LOG_SEV(basic_lg, log::trace) << "Create a NAL writer for "
 				      << stream_name;
 
   file.write(header.data(), header.size());
   file.flush();
   BOOST_LOG_SEV(basic_lg, log::trace) << "Written the header";
+  start_writer();
 }
 
 nal_writer::nal_writer(const parameter_set &ps) :
   nal_writer(ps.header, ps.streamName) {
 }
 
-nal_writer::nal_writer(std::ostream &out) :
+nal_writer::nal_writer(std::ostream &out, bool async, nal_packing packing) :
   basic_lg(boost::log::keywords::channel = log::basic),
   perf_lg(boost::log::keywords::channel = log::performance),
   file(out),
-  buf_prio(0) {
+  buf_start(0),
+  buf_prio(0),
+  end_scan_pos(0),
+  eos_recvd(false),
+  packing_mode(packing),
+  async_mode(async),
+  back_busy(false),
+  writer_stop(false),
+  wstats() {
   BOOST_LOG_SEV(basic_lg, log::trace) << "Create a NAL writer with a given ostream";
+  start_writer();
 }
 
-nal_writer::nal_writer(std::ostream &out, const buffer_type &header) :
-  nal_writer(out) {
+nal_writer::nal_writer(std::ostream &out, const buffer_type &header,
+		       bool async, nal_packing packing) :
+  nal_writer(out, false, packing) {
   file.write(header.data(), header.size());
   file.flush();
   BOOST_LOG_SEV(basic_lg, log::trace) << "Written the header";
+  async_mode = async;
+  start_writer();
 }
 
 nal_writer::~nal_writer() {
-  flush();
+  try {
+    flush();
+  }
+  catch (const std::exception &e) {
+    BOOST_LOG_SEV(basic_lg, log::error) << "Could not write the stream: "
+					<< e.what();
+  }
+
+  if (writer_thread.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(writer_mutex);
+      writer_stop = true;
+    }
+    writer_cv.notify_all();
+    writer_thread.join();
+
+    BOOST_LOG(perf_lg) << "nal_writer::~nal_writer written_bytes="
+		       << wstats.written_bytes
+		       << " max_queue_depth=" << wstats.max_queue_depth
+		       << " stall_count=" << wstats.stall_count
+		       << " stall_time="
+		       << std::chrono::duration<double>(wstats.stall_time).count();
+  }
 }
 
 void nal_writer::push(const fountain_packet &p) {
   if (eos_recvd) {
     throw std::runtime_error("The EOS was received");
   }
+  if (async_mode) {
+    std::unique_lock<std::mutex> lock(writer_mutex);
+    check_writer_error(lock);
+  }
+  if (packing_mode == packed_packing) {
+    push_packed(p);
+    return;
+  }
 
   std::size_t prio = p.getPriority();
   BOOST_LOG_SEV(basic_lg, log::trace) << "Writer has a new packet"
 				      << " with prio=" << prio;
+  const char *data = p.buffer().data();
   if (prio == buf_prio) {
-    nal_buf.insert(nal_buf.end(), p.buffer().begin(), p.buffer().end());
-    BOOST_LOG_SEV(basic_lg, log::trace) << "Appended " << p.buffer().size()
-					<< " bytes to the nal_buf";
-    enqueue_nals(false);
+    append_run(data, p.buffer().size());
   }
   else {
     enqueue_nals(true);
     buf_prio = prio;
-    nal_buf = p.buffer();
-    BOOST_LOG_SEV(basic_lg, log::trace) << "Set " << p.buffer().size()
-					<< " bytes in the nal_buf";
-    enqueue_nals(false);
+    start_run(data, p.buffer().size());
   }
 }
 
+void nal_writer::push_packed(const fountain_packet &p) {
+  if (p.buffer().empty()) { // Lost packet: the current NAL is cut
+    BOOST_LOG_SEV(basic_lg, log::trace) << "Writer has a lost packet";
+    enqueue_nals(true);
+    return;
+  }
+  if (p.buffer().size() < packed_prefix_size) {
+    throw std::runtime_error("The packet is shorter than the prefix");
+  }
+
+  const unsigned char *prefix =
+    reinterpret_cast<const unsigned char*>(p.buffer().data());
+  std::uint16_t run_switch = (prefix[0] << 8) | prefix[1];
+  const char *data = p.buffer().data() + packed_prefix_size;
+  std::size_t size = p.buffer().size() - packed_prefix_size;
+  BOOST_LOG_SEV(basic_lg, log::trace) << "Writer has a new packet"
+				      << " with run_switch=" << run_switch;
+
+  if (run_switch == NO_RUN_SWITCH) {
+    append_run(data, size);
+    return;
+  }
+  if (run_switch > size) {
+    throw std::runtime_error("The run switch is outside of the packet");
+  }
+  append_run(data, run_switch);
+  enqueue_nals(true);
+  if (eos_recvd) return;
+  start_run(data + run_switch, size - run_switch);
+}
+
+void nal_writer::append_run(const char *data, std::size_t size) {
+  compact();
+  nal_buf.insert(nal_buf.end(), data, data + size);
+  BOOST_LOG_SEV(basic_lg, log::trace) << "Appended " << size
+				      << " bytes to the nal_buf";
+  enqueue_nals(false);
+}
+
+void nal_writer::start_run(const char *data, std::size_t size) {
+  nal_buf.assign(data, data + size);
+  buf_start = 0;
+  end_scan_pos = 0;
+  BOOST_LOG_SEV(basic_lg, log::trace) << "Set " << size
+				      << " bytes in the nal_buf";
+  enqueue_nals(false);
+}
+
 void nal_writer::flush() {
   enqueue_nals(true);
+  sync_out();
+}
+
+nal_packing nal_writer::packing() const {
+  return packing_mode;
+}
+
+bool nal_writer::is_async() const {
+  return async_mode;
+}
+
+nal_writer_stats nal_writer::stats() const {
+  std::lock_guard<std::mutex> lock(writer_mutex);
+  return wstats;
+}
+
+void nal_writer::compact() {
+  if (buf_start == 0 || buf_start < nal_buf.size() - buf_start) return;
+  nal_buf.erase(nal_buf.begin(), nal_buf.begin() + buf_start);
+  buf_start = 0;
+}
+
+void nal_writer::emit(const char *nal, std::size_t size) {
+  if (out_buf.size() + size > WRITE_CHUNK) write_out();
+  if (size >= WRITE_CHUNK && !async_mode) {
+    file.write(nal, size); // Do not copy the large NALs
+    return;
+  }
+
+  // The NALs larger than a chunk go to the writer thread in pieces
+  while (size > 0) {
+    if (out_buf.capacity() < WRITE_CHUNK) out_buf.reserve(WRITE_CHUNK);
+    std::size_t n = std::min(size, WRITE_CHUNK - out_buf.size());
+    out_buf.insert(out_buf.end(), nal, nal + n);
+    nal += n;
+    size -= n;
+    if (out_buf.size() == WRITE_CHUNK) write_out();
+  }
+}
+
+void nal_writer::write_out() {
+  static metrics::gauge &queue_bytes =
+    metrics::get_gauge("nal_writer.queue_bytes");
+  static metrics::counter &stalls = metrics::get_counter("nal_writer.stalls");
+
+  if (out_buf.empty()) return;
+  if (!async_mode) {
+    file.write(out_buf.data(), out_buf.size());
+    out_buf.clear();
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(writer_mutex);
+  if (back_busy) {
+    auto t0 = std::chrono::steady_clock::now();
+    wait_writer(lock);
+    ++wstats.stall_count;
+    wstats.stall_time += std::chrono::steady_clock::now() - t0;
+    stalls.add();
+  }
+  check_writer_error(lock);
+
+  // The writer left back_buf empty: swap the chunks
+  std::swap(out_buf, back_buf);
+  back_busy = true;
+  wstats.queued_bytes += back_buf.size();
+  wstats.queue_depth = back_buf.size();
+  wstats.max_queue_depth = std::max(wstats.max_queue_depth,
+				    wstats.queue_depth);
+  queue_bytes.set(wstats.queue_depth);
+  lock.unlock();
+  writer_cv.notify_all();
+}
+
+void nal_writer::sync_out() {
+  write_out();
+  if (async_mode) {
+    // The writer thread is idle after this: the file can be used here
+    std::unique_lock<std::mutex> lock(writer_mutex);
+    wait_writer(lock);
+    check_writer_error(lock);
+  }
   file.flush();
 }
 
+void nal_writer::start_writer() {
+  if (!async_mode || writer_thread.joinable()) return;
+  writer_thread = std::thread(&nal_writer::run_writer, this);
+  BOOST_LOG_SEV(basic_lg, log::trace) << "Started the writer thread";
+}
+
+void nal_writer::wait_writer(std::unique_lock<std::mutex> &lock) {
+  writer_cv.wait(lock, [this](){ return !back_busy; });
+}
+
+void nal_writer::check_writer_error(std::unique_lock<std::mutex> &lock) {
+  if (!writer_error) return;
+  std::exception_ptr e = writer_error;
+  writer_error = nullptr;
+  lock.unlock();
+  std::rethrow_exception(e);
+}
+
+void nal_writer::run_writer() {
+  static metrics::gauge &queue_bytes =
+    metrics::get_gauge("nal_writer.queue_bytes");
+
+  std::unique_lock<std::mutex> lock(writer_mutex);
+  for (;;) {
+    writer_cv.wait(lock, [this](){ return back_busy || writer_stop; });
+    if (!back_busy) break; // Stopped with nothing left to write
+
+    // back_buf is not touched by the other thread while back_busy
+    lock.unlock();
+    std::exception_ptr err;
+    try {
+      file.write(back_buf.data(), back_buf.size());
+      if (!file) throw std::runtime_error("Could not write the output stream");
+    }
+    catch (...) {
+      err = std::current_exception();
+    }
+    lock.lock();
+
+    if (err) writer_error = err;
+    else wstats.written_bytes += back_buf.size();
+    wstats.queue_depth = 0;
+    queue_bytes.set(0);
+    back_buf.clear();
+    back_busy = false;
+    writer_cv.notify_all();
+  }
+}
+
 void nal_writer::enqueue_nals(bool must_end) {
-  BOOST_LOG_SEV(basic_lg, log::trace) << "Try to enqueue NALs"
-				      << " must_end=" << std::boolalpha
-				      << must_end;
-  auto i = nal_buf.begin();
-  BOOST_LOG_SEV(basic_lg, log::trace) << "nal_buf starts at " << (void*) &*i;
-  BOOST_LOG_SEV(basic_lg, log::trace) << "nal_buf size: " << nal_buf.size();
+  std::size_t nal_count = 0;
+  std::size_t written = 0;
+  const auto live = nal_buf.begin() + buf_start;
+  auto i = live;
   for(;;) {
     i = find_startcode(i, nal_buf.end());
-    BOOST_LOG_SEV(basic_lg, log::trace) << "startcode found at " << (void*) &*i;
 
     if (i == nal_buf.end()) { // No more NALs
       if (must_end) {
-	BOOST_LOG_SEV(basic_lg, log::trace) << "Found no startcode and must_end:"
-					    << " drop " << nal_buf.size()
-					    << " bytes from the nal_buf";
 	nal_buf.clear();
+	buf_start = 0;
       }
       else {
-	std::size_t drop_count = nal_buf.size() >= 3 ? nal_buf.size()-3 : 0;
-	BOOST_LOG_SEV(basic_lg, log::trace) << "Found no startcode:"
-					    << " drop " << drop_count
-					    << " bytes from the nal_buf";
 	// Leave 3 bytes (possible begin of startcode)
-	nal_buf.erase(nal_buf.begin(), nal_buf.begin() + drop_count);
+	std::size_t live_size = nal_buf.size() - buf_start;
+	if (live_size > 3) buf_start += live_size - 3;
       }
-      return;
+      end_scan_pos = 0;
+      break;
     }
 
     // Check for the EOS code
@@ -115,45 +338,51 @@ void nal_writer::enqueue_nals(bool must_end) {
 	BOOST_LOG_SEV(basic_lg, log::info) << "Received the EOS";
 	eos_recvd = true;
 	nal_buf.clear();
-	file.flush();
-	return;
+	buf_start = 0;
+	end_scan_pos = 0;
+	sync_out();
+	break;
       }
     }
 
-    // +3 bytes to not stop on the found startcode
-    auto end = find_nal_end(i + 3, nal_buf.end());
-    BOOST_LOG_SEV(basic_lg, log::trace) << "NAL end found at " << (void*) &*end;
+    // +3 bytes to not stop on the found startcode. The partial NAL
+    // left at the start of the live data was already scanned up to
+    // end_scan_pos
+    auto from = i + 3;
+    if (i == live && end_scan_pos > 3)
+      from = live + end_scan_pos;
+    auto end = find_nal_end(from, nal_buf.end());
 
     if (end == nal_buf.end()) { // No end found: NAL may continue
       if (must_end) { // NAL can not continue: enqueue
-	BOOST_LOG_SEV(basic_lg, log::trace) << "must_end: write to file "
-					    << end-i
-					    << " bytes, clear the nal_buf";
-	const char *ic = &(*i);
-	size_t cnt = end-i;
-	file.write(ic, cnt);
+	emit(&(*i), end-i);
+	written += end-i;
+	++nal_count;
 	nal_buf.clear();
+	buf_start = 0;
+	end_scan_pos = 0;
       }
       else {
-	// Leave partial NAL
-	BOOST_LOG_SEV(basic_lg, log::trace) << "Keep partial NAL, erase "
-					    << i - nal_buf.begin()
-					    << " bytes from the nal_buf";
-	nal_buf.erase(nal_buf.begin(), i);
+	// Leave partial NAL. Its last 2 bytes can start the end sequence
+	buf_start = i - nal_buf.begin();
+	end_scan_pos = std::max<std::size_t>(3, nal_buf.size() - buf_start - 2);
       }
-      return;
+      break;
     }
 
     // Full NAL found: enqueue
-    BOOST_LOG_SEV(basic_lg, log::trace) << "Full NAL in buf, write "
-					<< end-i
-					<< " bytes";
-    const char *ic = &(*i);
-    size_t cnt = end-i;
-    file.write(ic, cnt);
+    emit(&(*i), end-i);
+    written += end-i;
+    ++nal_count;
     i = end;
-    BOOST_LOG_SEV(basic_lg, log::trace) << "Advance i to " << (void*) &*i;
   }
+
+  BOOST_LOG_SEV(basic_lg, log::trace) << "Enqueued " << nal_count
+				      << " NALs (" << written << " bytes)"
+				      << " must_end=" << std::boolalpha
+				      << must_end
+				      << " left=" << nal_buf.size() - buf_start
+				      << " scan_pos=" << end_scan_pos;
 }
 
 std::string nal_writer::filename() const {
@@ -1,39 +1,106 @@
 #ifndef UEP_NAL_WRITER_HPP
 #define UEP_NAL_WRITER_HPP
 
+#include <chrono>
+#include <condition_variable>
+#include <exception>
 #include <fstream>
+#include <mutex>
 #include <queue>
 #include <ostream>
 #include <sstream>
+#include <thread>
 
 #include "log.hpp"
 #include "lt_param_set.hpp"
 #include "nal_reader.hpp"
 #include "packets.hpp"
+#include "startcode_scanner.hpp"
 
 namespace uep {
 
+/** Counters of the background writer of a nal_writer. */
+struct nal_writer_stats {
+  /** Bytes handed to the writer thread. */
+  std::size_t queued_bytes;
+  /** Bytes written to the output stream by the writer thread. */
+  std::size_t written_bytes;
+  /** Bytes handed to the writer thread and not yet written. */
+  std::size_t queue_depth;
+  /** Largest value taken by queue_depth. */
+  std::size_t max_queue_depth;
+  /** Number of times push() waited for the writer thread. */
+  std::size_t stall_count;
+  /** Total time spent waiting for the writer thread. */
+  std::chrono::steady_clock::duration stall_time;
+};
+
+/** Reassemble the NALs carried by a sequence of packets and write
+ *  them to a stream.
+ *
+ *  The received bytes are appended to a reassembly buffer. The bytes
+ *  of the written NALs are not erased: the start of the live data
+ *  moves forward and the buffer is compacted only when the consumed
+ *  prefix is larger than the live data. The complete NALs are
+ *  collected and written in chunks of WRITE_CHUNK bytes. The large
+ *  ones are written straight from the reassembly buffer.
+ *
+ *  In asynchronous mode the chunks are written by a background
+ *  thread, so that push() does not block on the output stream. The
+ *  output is double-buffered: one chunk is filled while the other
+ *  one is written. When both are full push() waits for the writer
+ *  thread. The large NALs are split across the chunks, so the
+ *  writer thread never holds more than WRITE_CHUNK bytes. The errors
+ *  of the writer thread are rethrown by the next call to push() or
+ *  flush().
+ *
+ *  With packed_packing the run switches are read from the packet
+ *  prefix instead of the packet priority.
+ */
 class nal_writer {
 public:
   /** Type of the parameter set used to setup the writer. */
   typedef net_parameter_set parameter_set;
 
+  /** Size of the writes to the output stream. */
+  static const std::size_t WRITE_CHUNK = 256*1024;
+
   /** Construct using a given parameter set. */
   explicit nal_writer(const parameter_set &ps);
   /** Construct a writer that will write to `strname`. The given
    *  header is prepended to the output stream. The stream name is
-   *  mapped to `dataset_client/${strname}.264`.
+   *  mapped to `dataset_client/${strname}.264`. When `async` is true
+   *  the output is written by a background thread. The packets must
+   *  be built with the given packing.
    */
-  explicit nal_writer(const buffer_type &header, const std::string &strname);
+  explicit nal_writer(const buffer_type &header, const std::string &strname,
+		      bool async = false,
+		      nal_packing packing = padded_packing);
   /** Construct a writer that will write to the given ostream. */
-  explicit nal_writer(std::ostream &out, const buffer_type &header);
-  explicit nal_writer(std::ostream &out);
+  explicit nal_writer(std::ostream &out, const buffer_type &header,
+		      bool async = false,
+		      nal_packing packing = padded_packing);
+  explicit nal_writer(std::ostream &out, bool async = false,
+		      nal_packing packing = padded_packing);
 
   ~nal_writer();
 
   void push(const fountain_packet &p);
+  /** Write all the received data and flush the output stream. In
+   *  asynchronous mode wait for the writer thread to finish.
+   */
   void flush();
 
+  /** Packing of the received packets. */
+  nal_packing packing() const;
+
+  /** True when the output is written by a background thread. */
+  bool is_async() const;
+  /** Return a snapshot of the writer thread counters. They are all
+   *  zero in synchronous mode.
+   */
+  nal_writer_stats stats() const;
+
   // Can always be pushed to. Remove this?
   explicit operator bool() const;
   bool operator!() const;
@@ -47,23 +114,81 @@ private:
   std::ostream &file;
 
   buffer_type nal_buf; /**< Holds the partially received NALs. */
+  std::size_t buf_start; /**< Offset of the first live byte in
+			  *   nal_buf. The bytes before it were
+			  *   already consumed.
+			  */
   std::size_t buf_prio; /**< The priority of the NALs in the buffer. */
+  std::size_t end_scan_pos; /**< When the live data starts with a
+			    *   partial NAL, offset from buf_start
+			    *   where the search for its end resumes:
+			    *   the bytes before it were already
+			    *   scanned.
+			    */
+  buffer_type out_buf; /**< Complete NALs waiting to be written. */
 
   bool eos_recvd; /**< Flag set when the EOS is received. */
+  nal_packing packing_mode;
+
+  bool async_mode; /**< Write the output from writer_thread. */
+  std::thread writer_thread;
+  mutable std::mutex writer_mutex; /**< Protects the members below. */
+  std::condition_variable writer_cv;
+  buffer_type back_buf; /**< Chunk owned by the writer thread while
+			 *   back_busy is set.
+			 */
+  bool back_busy; /**< Set while back_buf waits to be written. */
+  bool writer_stop; /**< Ask the writer thread to terminate. */
+  std::exception_ptr writer_error; /**< Error raised by the writer. */
+  nal_writer_stats wstats;
 
   /** Look in the NAL buffer, enqueue any full NALs found and remove
    *  them from the buffer. The argument is set to true if there can
    *  not be partial NALs left in the buffer.
    */
   void enqueue_nals(bool must_end);
+  /** Append to the NAL buffer the bytes that continue the current run. */
+  void append_run(const char *data, std::size_t size);
+  /** Replace the NAL buffer with the first bytes of a new run. */
+  void start_run(const char *data, std::size_t size);
+  /** Handle a packet built with packed_packing. */
+  void push_packed(const fountain_packet &p);
+  /** Drop the consumed bytes when they are more than the live ones. */
+  void compact();
+  /** Queue a complete NAL for writing. */
+  void emit(const char *nal, std::size_t size);
+  /** Write the queued NALs to the output stream, or hand them to
+   *  the writer thread in asynchronous mode.
+   */
+  void write_out();
+  /** Write the queued NALs, wait for the writer thread and flush the
+   *  output stream.
+   */
+  void sync_out();
+  /** Start the writer thread when async_mode is set. */
+  void start_writer();
+  /** Wait until the writer thread has written back_buf. The lock must
+   *  hold writer_mutex.
+   */
+  void wait_writer(std::unique_lock<std::mutex> &lock);
+  /** Rethrow the error of the writer thread, if any. The lock must
+   *  hold writer_mutex.
+   */
+  void check_writer_error(std::unique_lock<std::mutex> &lock);
+  /** Body of the writer thread. */
+  void run_writer();
 
   std::string filename() const;
 };
 
-/** Search for the start of a NAL in the given range. */
+/** Search for the start of a NAL in the given range. Iter must be a
+ *  contiguous iterator over char.
+ */
 template <class Iter>
 Iter find_startcode(Iter first, Iter last);
-/** Search for the end of a NAL in the given range. */
+/** Search for the end of a NAL in the given range. Iter must be a
+ *  contiguous iterator over char.
+ */
 template <class Iter>
 Iter find_nal_end(Iter first, Iter last);
 
@@ -71,54 +196,16 @@ Iter find_nal_end(Iter first, Iter last);
 
 template <class Iter>
 Iter find_startcode(Iter first, Iter last) {
-  static const char sc[3] = {0x00, 0x00, 0x01};
-  auto i = std::search(first, last, sc, sc+3);
-  return i;
+  if (first == last) return last;
+  const char *b = &*first;
+  return first + (scan_startcode(b, b + (last - first)) - b);
 }
 
 template <class Iter>
 Iter find_nal_end(Iter first, Iter last) {
-  log::default_logger basic_lg = log::basic_lg::get();
-  log::default_logger perf_lg = log::perf_lg::get();
-
-  static const char zeros[2] = {0x00, 0x00};
-
-  // Search for a sequence [0, 0, (0|1|2)] that cannot be present in the NAL
-  // Typically will find the 4- or 3-byte startcode
-  Iter i = first;
-  for (;;) {
-    i = std::search(i, last, zeros, zeros+2);
-
-    if (i == last) {
-      BOOST_LOG_SEV(basic_lg, log::trace) << "Not found 0x00, 0x00";
-    }
-    else if (last - i < 3) {
-      BOOST_LOG_SEV(basic_lg, log::trace) << "Found 0x00, 0x00 at "
-					  << (void*) &*i
-					  << " too short (<3)";
-    }
-
-    if (i == last) return i; // Not found
-    if (last - i < 3) return last; // No end: needs 3 bytes
-
-    char next = *(i+2);
-    if (next == 0x00 ||
-	next == 0x01 ||
-	next == 0x02) { // Found
-      BOOST_LOG_SEV(basic_lg, log::trace) << "Found the end at "
-					  << (void*) &*i
-					  << " next char="
-					  << std::hex << (unsigned int) next;
-      return i;
-    }
-    else {
-      BOOST_LOG_SEV(basic_lg, log::trace) << "Not found at "
-					  << (void*) &*i
-					  << " next char="
-					  << std::hex << (unsigned int) next;
-      i+=3; // Retry after this match
-    }
-  }
+  if (first == last) return last;
+  const char *b = &*first;
+  return first + (scan_nal_end(b, b + (last - first)) - b);
 }
 
 }
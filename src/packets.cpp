@@ -36,6 +36,11 @@ packet::packet(buffer_type &&b) : shared_data(new buffer_type(std::move(b))) {
 packet::packet(size_t size, char value) :
   shared_data(new vector<char>(size, value)) {}
 
+packet::packet(std::shared_ptr<buffer_type> data) :
+  shared_data(std::move(data)) {
+  if (!shared_data) throw invalid_argument("The buffer cannot be null");
+}
+
 packet::packet(const packet &p) :
   shared_data(new vector<char>(*p.shared_data)) {}
 
@@ -241,12 +246,14 @@ packet operator^(const packet &a, const packet &b) {
   return c ^= b;
 }
 
-fountain_packet::fountain_packet(int blockno_, int seqno_, int seed_,
+fountain_packet::fountain_packet(std::uint32_t blockno_,
+				 std::uint32_t seqno_, int seed_,
 				 size_type count, char value) :
   packet(count, value),
   blockno(blockno_), seqno(seqno_), seed(seed_), priorita(0) {}
 
-fountain_packet::fountain_packet(int blockno_, int seqno_, int seed_,
+fountain_packet::fountain_packet(std::uint32_t blockno_,
+				 std::uint32_t seqno_, int seed_,
 				 size_type count, char value, uint8_t p_) :
   packet(count, value),
   blockno(blockno_), seqno(seqno_), seed(seed_), priorita(p_) {}
@@ -254,7 +261,8 @@ fountain_packet::fountain_packet(int blockno_, int seqno_, int seed_,
 fountain_packet::fountain_packet() :
   fountain_packet(0,0,0,0,0,0) {}
 
-fountain_packet::fountain_packet(int blockno_, int seqno_, int seed_) :
+fountain_packet::fountain_packet(std::uint32_t blockno_,
+				 std::uint32_t seqno_, int seed_) :
   fountain_packet(blockno_, seqno_, seed_, 0, 0, 0) {}
 
 fountain_packet::fountain_packet(size_type count, char value) :
@@ -288,7 +296,7 @@ uint8_t fountain_packet::getPriority() const {
   return priorita;
 }
 
-int fountain_packet::block_number() const {
+std::uint32_t fountain_packet::block_number() const {
   return blockno;
 }
 
@@ -296,7 +304,7 @@ int fountain_packet::block_seed() const {
   return seed;
 }
 
-int fountain_packet::sequence_number() const {
+std::uint32_t fountain_packet::sequence_number() const {
   return seqno;
 }
 
@@ -304,7 +312,7 @@ void fountain_packet::setPriority(uint8_t p_) {
 	priorita = p_;
 }
 
-void fountain_packet::block_number(int blockno_) {
+void fountain_packet::block_number(std::uint32_t blockno_) {
   blockno = blockno_;
 }
 
@@ -312,7 +320,7 @@ void fountain_packet::block_seed(int seed_) {
   seed = seed_;
 }
 
-void fountain_packet::sequence_number(int seqno_) {
+void fountain_packet::sequence_number(std::uint32_t seqno_) {
   seqno = seqno_;
 }
 
@@ -55,6 +55,10 @@ public:
   packet(uep::buffer_type &&b);
 
   explicit packet(size_t size, char value = 0);
+  /** Construct a packet that holds the given shared buffer. The
+   *  data is not copied.
+   */
+  explicit packet(std::shared_ptr<uep::buffer_type> data);
   /** Copy-construct a packet.
    *  This constructor duplicates the packet data.
    *  \sa shallow_copy(), packet(packet&&)
@@ -184,12 +188,14 @@ class fountain_packet : public packet {
 public:
   fountain_packet();
 
-  explicit fountain_packet(int blockno_, int seqno_, int seed_);
+  explicit fountain_packet(std::uint32_t blockno_, std::uint32_t seqno_,
+			   int seed_);
   explicit fountain_packet(size_type count, char value);
-  explicit fountain_packet(int blockno_, int seqno_, int seed_,
-			size_type count, char value);
-  explicit fountain_packet(int blockno_, int seqno_, int seed_,
-			   size_type count, char value, uint8_t priority);
+  explicit fountain_packet(std::uint32_t blockno_, std::uint32_t seqno_,
+			   int seed_, size_type count, char value);
+  explicit fountain_packet(std::uint32_t blockno_, std::uint32_t seqno_,
+			   int seed_, size_type count, char value,
+			   uint8_t priority);
   /** Construct a fountain_packet with a copy of a packet's data. */
   explicit fountain_packet(const packet &p);
   /** Construct a fountain_packet moving a packet's data. */
@@ -205,20 +211,20 @@ public:
   /** Get the priority */
   uint8_t getPriority() const;
   /** Get the block number. */
-  int block_number() const;
+  std::uint32_t block_number() const;
   /** Get the seed used to generate this packet's block. */
   int block_seed() const;
   /** Get the sequence number within the block. */
-  int sequence_number() const;
+  std::uint32_t sequence_number() const;
 
   /** Set the priority */
   void setPriority(uint8_t p);
   /** Set the block number. */
-  void block_number(int blockno_);
+  void block_number(std::uint32_t blockno_);
   /** Set the seed used to generate this packet's block. */
   void block_seed(int seed_);
   /** Set the sequence number within the block. */
-  void sequence_number(int seqno_);
+  void sequence_number(std::uint32_t seqno_);
 
   /** Override the superclass' method to return a fountain_packet.
    *  \sa packet::shallow_copy()
@@ -226,8 +232,8 @@ public:
   fountain_packet shallow_copy() const;
 
 private:
-  int blockno;
-  int seqno;
+  std::uint32_t blockno;
+  std::uint32_t seqno;
   int seed;
   uint8_t priorita;
 };
@@ -35,80 +35,294 @@ std::uint32_t extract_ntoh_uint32(IterType &in) {
   return out;
 }
 
-std::vector<char> build_raw_packet(const fountain_packet &fp) {
-  vector<char> out;
-  out.reserve(data_header_size + fp.size());
+/** Write a block or sequence number with the width used by version
+ *  `v` and advance the iterator. Throw if the number does not fit.
+ */
+template <class IterType>
+IterType write_hton_number(std::size_t n, raw_header_version v,
+			   IterType begin, IterType end) {
+  if (v == header_v0)
+    return write_hton<std::uint16_t>(numeric_cast<uint16_t>(n), begin, end);
+  else
+    return write_hton<std::uint32_t>(numeric_cast<uint32_t>(n), begin, end);
+}
 
-  out.push_back(raw_packet_type::data);
+/** Read a block or sequence number with the width used by version
+ *  `v` and advance the iterator.
+ */
+template <class IterType>
+std::size_t extract_ntoh_number(IterType &in, raw_header_version v) {
+  if (v == header_v0) return extract_ntoh_uint16(in);
+  else return extract_ntoh_uint32(in);
+}
 
-  uint16_t blockno = numeric_cast<uint16_t>(fp.block_number());
-  append_hton_int(out, blockno);
+char raw_type_byte(raw_packet_type t, raw_header_version v) {
+  return static_cast<char>((v << 4) | t);
+}
 
-  uint16_t seqno = numeric_cast<uint16_t>(fp.sequence_number());
-  append_hton_int(out, seqno);
+raw_packet_type raw_packet_type_of(char type_byte) {
+  return static_cast<raw_packet_type>(type_byte & 0x0f);
+}
+
+raw_header_version raw_header_version_of(char type_byte) {
+  unsigned char v = static_cast<unsigned char>(type_byte) >> 4;
+  switch (v) {
+  case header_v0:
+  case header_v1:
+    return static_cast<raw_header_version>(v);
+  default:
+    throw runtime_error("Unknown header version");
+  }
+}
+
+std::size_t raw_data_header_size(raw_header_version v) {
+  return v == header_v0 ? data_header_size : data_header_size_v1;
+}
+
+std::size_t raw_ack_size(raw_header_version v) {
+  return v == header_v0 ? ack_header_size : ack_header_size_v1;
+}
+
+std::size_t raw_data_multi_header_size(raw_header_version v) {
+  return v == header_v0 ? data_multi_header_size : data_multi_header_size_v1;
+}
+
+std::size_t raw_data_multi_seqno_size(raw_header_version v) {
+  return v == header_v0 ? data_multi_seqno_size : data_multi_seqno_size_v1;
+}
+
+std::size_t raw_max_number(raw_header_version v) {
+  if (v == header_v0) return std::numeric_limits<std::uint16_t>::max();
+  else return std::numeric_limits<std::uint32_t>::max();
+}
+
+std::size_t extend_block_number(std::size_t short_blockno,
+				std::size_t reference) {
+  // Signed distance, in the 16-bit space, from the reference
+  std::int16_t d = static_cast<std::int16_t>
+    (static_cast<std::uint16_t>(short_blockno - reference));
+  return static_cast<std::uint32_t>(reference + d);
+}
+
+raw_data_header build_raw_data_header(const fountain_packet &fp,
+				      raw_header_version v) {
+  raw_data_header out;
+  auto i = out.begin();
+
+  *i++ = raw_type_byte(raw_packet_type::data, v);
+
+  i = write_hton_number(fp.block_number(), v, i, out.end());
+  i = write_hton_number(fp.sequence_number(), v, i, out.end());
 
   // Don't throw on negative values
   uint32_t seed = numeric_cast<int32_t>(fp.block_seed());
-  append_hton_int(out, seed);
+  i = write_hton<std::uint32_t>(seed, i, out.end());
 
   // This is not needed when using UDP (length is known)
   uint16_t length = numeric_cast<uint16_t>(fp.size());
-  append_hton_int(out, length);
-
-  out.insert(out.end(), fp.cbegin(), fp.cend());
+  i = write_hton<std::uint16_t>(length, i, out.end());
 
+  std::fill(i, out.end(), 0);
   return out;
 }
 
-fountain_packet parse_raw_data_packet(const std::vector<char> &rp) {
-  if (rp.size() < data_header_size) throw runtime_error("The packet is too short");
-  auto i = rp.cbegin();
-  fountain_packet fp;
+std::size_t parse_raw_data_header(const raw_data_header &h,
+				  fountain_packet &fp) {
+  auto i = h.cbegin();
 
   char type = *i++;
-  if (type != raw_packet_type::data) throw runtime_error("Not a data packet");
-
-  uint16_t blockno = extract_ntoh_uint16(i);
-  fp.block_number(blockno);
+  if (raw_packet_type_of(type) != raw_packet_type::data)
+    throw runtime_error("Not a data packet");
+  raw_header_version v = raw_header_version_of(type);
 
-  uint16_t seqno = extract_ntoh_uint16(i);
-  fp.sequence_number(seqno);
+  fp.block_number(extract_ntoh_number(i, v));
+  fp.sequence_number(extract_ntoh_number(i, v));
 
   uint32_t seed = extract_ntoh_uint32(i);
   fp.block_seed(seed);
 
   uint16_t length = extract_ntoh_uint16(i);
+  return length;
+}
+
+std::vector<char> build_raw_packet(const fountain_packet &fp,
+				   raw_header_version v) {
+  raw_data_header h = build_raw_data_header(fp, v);
+  std::size_t hs = raw_data_header_size(v);
+  vector<char> out;
+  out.reserve(hs + fp.size());
+  out.insert(out.end(), h.cbegin(), h.cbegin() + hs);
+  out.insert(out.end(), fp.cbegin(), fp.cend());
+  return out;
+}
+
+fountain_packet parse_raw_data_packet(const std::vector<char> &rp) {
+  if (rp.empty()) throw runtime_error("The packet is too short");
+  std::size_t hs = raw_data_header_size(raw_header_version_of(rp.front()));
+  if (rp.size() < hs) throw runtime_error("The packet is too short");
+  raw_data_header h;
+  copy(rp.cbegin(), rp.cbegin() + hs, h.begin());
+  fountain_packet fp;
+
+  std::size_t length = parse_raw_data_header(h, fp);
   if (length != 0) {
-    if (rp.size() < length + data_header_size)
+    if (rp.size() < length + hs)
       throw runtime_error("The packet is too short");
-    fp.resize(length);
-    copy(i, i + length, fp.begin());
+    auto i = rp.cbegin() + hs;
+    fp.assign(i, i + length);
   }
 
   return fp;
 }
 
-std::vector<char> build_raw_ack(std::size_t blockno) {
+std::size_t symbols_per_datagram(std::size_t symbol_size,
+				 std::size_t datagram_size,
+				 raw_header_version v) {
+  std::size_t hs = raw_data_multi_header_size(v);
+  std::size_t n = 0;
+  if (datagram_size > hs)
+    n = (datagram_size - hs) /
+      (raw_data_multi_seqno_size(v) + symbol_size);
+  return std::min(std::max<std::size_t>(n, 1), max_symbols_per_datagram);
+}
+
+raw_data_multi_header build_raw_data_multi_header(const fountain_packet &fp,
+						  std::size_t count,
+						  raw_header_version v) {
+  if (count == 0 || count > max_symbols_per_datagram)
+    throw invalid_argument("Invalid number of symbols");
+
+  raw_data_multi_header out;
+  auto i = out.begin();
+
+  *i++ = raw_type_byte(raw_packet_type::data_multi, v);
+
+  i = write_hton_number(fp.block_number(), v, i, out.end());
+
+  // Don't throw on negative values
+  uint32_t seed = numeric_cast<int32_t>(fp.block_seed());
+  i = write_hton<std::uint32_t>(seed, i, out.end());
+
+  *i++ = static_cast<char>(count);
+
+  uint16_t length = numeric_cast<uint16_t>(fp.size());
+  i = write_hton<std::uint16_t>(length, i, out.end());
+
+  std::fill(i, out.end(), 0);
+  return out;
+}
+
+raw_data_multi_seqno build_raw_data_multi_seqno(const fountain_packet &fp,
+						raw_header_version v) {
+  raw_data_multi_seqno out;
+  auto i = write_hton_number(fp.sequence_number(), v, out.begin(), out.end());
+  std::fill(i, out.end(), 0);
+  return out;
+}
+
+std::size_t parse_raw_data_multi_header(const raw_data_multi_header &h,
+					fountain_packet &fp,
+					std::size_t &length) {
+  auto i = h.cbegin();
+
+  char type = *i++;
+  if (raw_packet_type_of(type) != raw_packet_type::data_multi)
+    throw runtime_error("Not a multi-symbol data packet");
+  raw_header_version v = raw_header_version_of(type);
+
+  fp.block_number(extract_ntoh_number(i, v));
+
+  uint32_t seed = extract_ntoh_uint32(i);
+  fp.block_seed(seed);
+
+  std::size_t count = static_cast<unsigned char>(*i++);
+  if (count == 0 || count > max_symbols_per_datagram)
+    throw runtime_error("Invalid number of symbols");
+
+  length = extract_ntoh_uint16(i);
+  return count;
+}
+
+void parse_raw_data_multi_seqno(const raw_data_multi_seqno &s,
+				fountain_packet &fp,
+				raw_header_version v) {
+  auto i = s.cbegin();
+  fp.sequence_number(extract_ntoh_number(i, v));
+}
+
+std::vector<char> build_raw_multi_packet(const std::vector<fountain_packet> &fps,
+					 raw_header_version v) {
+  if (fps.empty()) throw invalid_argument("No symbols to pack");
+  const fountain_packet &first = fps.front();
+  raw_data_multi_header h = build_raw_data_multi_header(first, fps.size(), v);
+  std::size_t hs = raw_data_multi_header_size(v);
+  std::size_t ss = raw_data_multi_seqno_size(v);
+
   vector<char> out;
-  out.reserve(ack_header_size);
+  out.reserve(hs + fps.size() * (ss + first.size()));
+  out.insert(out.end(), h.cbegin(), h.cbegin() + hs);
+  for (const fountain_packet &fp : fps) {
+    if (fp.block_number() != first.block_number() ||
+	fp.block_seed() != first.block_seed() ||
+	fp.size() != first.size())
+      throw invalid_argument("The symbols must share block, seed and size");
+    raw_data_multi_seqno s = build_raw_data_multi_seqno(fp, v);
+    out.insert(out.end(), s.cbegin(), s.cbegin() + ss);
+    out.insert(out.end(), fp.cbegin(), fp.cend());
+  }
+  return out;
+}
+
+std::vector<fountain_packet> parse_raw_multi_packet(const std::vector<char> &rp) {
+  if (rp.empty()) throw runtime_error("The packet is too short");
+  raw_header_version v = raw_header_version_of(rp.front());
+  std::size_t hs = raw_data_multi_header_size(v);
+  std::size_t ss = raw_data_multi_seqno_size(v);
+  if (rp.size() < hs) throw runtime_error("The packet is too short");
+  raw_data_multi_header h;
+  copy(rp.cbegin(), rp.cbegin() + hs, h.begin());
+  fountain_packet proto;
+  std::size_t length;
+  std::size_t count = parse_raw_data_multi_header(h, proto, length);
+  if (rp.size() < hs + count * (ss + length))
+    throw runtime_error("The packet is too short");
 
-  out.push_back(raw_packet_type::block_ack);
+  vector<fountain_packet> fps;
+  fps.reserve(count);
+  auto i = rp.cbegin() + hs;
+  for (std::size_t n = 0; n < count; ++n) {
+    fountain_packet fp(proto.block_number(), 0, proto.block_seed());
+    raw_data_multi_seqno s;
+    copy(i, i + ss, s.begin());
+    i += ss;
+    parse_raw_data_multi_seqno(s, fp, v);
+    fp.assign(i, i + length);
+    i += length;
+    fps.push_back(move(fp));
+  }
+  return fps;
+}
+
+std::vector<char> build_raw_ack(std::size_t blockno, raw_header_version v) {
+  vector<char> out(raw_ack_size(v));
+  auto i = out.begin();
 
-  uint16_t block_ack = numeric_cast<uint16_t>(blockno);
-  append_hton_int(out, block_ack);
+  *i++ = raw_type_byte(raw_packet_type::block_ack, v);
+  write_hton_number(blockno, v, i, out.end());
 
   return out;
 }
 
 std::size_t parse_raw_ack_packet(const std::vector<char> &rp) {
-  if (rp.size() < ack_header_size)
-    throw runtime_error("The packet is too short");
+  if (rp.empty()) throw runtime_error("The packet is too short");
   auto i = rp.cbegin();
 
   char type = *i++;
-  if (type != raw_packet_type::block_ack)
+  if (raw_packet_type_of(type) != raw_packet_type::block_ack)
     throw runtime_error("Not an ACK packet");
+  raw_header_version v = raw_header_version_of(type);
+  if (rp.size() < raw_ack_size(v))
+    throw runtime_error("The packet is too short");
 
-  uint16_t blockno = extract_ntoh_uint16(i);
-  return blockno;
+  return extract_ntoh_number(i, v);
 }
@@ -5,10 +5,12 @@
 #include "rw_utils.hpp"
 
 #include <algorithm>
+#include <array>
 #include <climits>
 #include <cstdint>
 #include <istream>
 #include <iterator>
+#include <limits>
 #include <ostream>
 #include <stdexcept>
 #include <streambuf>
@@ -17,28 +19,176 @@
 
 #include <boost/numeric/conversion/cast.hpp>
 
-/** Byte used to identify the type of packet. */
+/** Type of packet, stored in the lower nibble of the first byte. */
 enum raw_packet_type : char {
   data = 0,
-  block_ack = 1
+  block_ack = 1,
+  data_multi = 2
 };
 
-/** Total size of the header of a data packet. */
+/** Version of the raw headers, stored in the upper nibble of the
+ *  first byte. Version 0 carries 16-bit block and sequence numbers,
+ *  version 1 carries 32-bit ones.
+ */
+enum raw_header_version : unsigned char {
+  header_v0 = 0,
+  header_v1 = 1
+};
+
+/** Total size of the header of a version 0 data packet. */
 const std::size_t data_header_size = 11;
-/** Total size of the header of an ACK packet. */
+/** Total size of the header of a version 1 data packet. */
+const std::size_t data_header_size_v1 = 15;
+/** Total size of the header of a version 0 ACK packet. */
 const std::size_t ack_header_size = 3;
+/** Total size of the header of a version 1 ACK packet. */
+const std::size_t ack_header_size_v1 = 5;
+/** Size of the common header of a version 0 multi-symbol data
+ *  packet.
+ */
+const std::size_t data_multi_header_size = 10;
+/** Size of the common header of a version 1 multi-symbol data
+ *  packet.
+ */
+const std::size_t data_multi_header_size_v1 = 12;
+/** Size of the sequence number that precedes each symbol in a
+ *  version 0 multi-symbol data packet.
+ */
+const std::size_t data_multi_seqno_size = 2;
+/** Size of the sequence number that precedes each symbol in a
+ *  version 1 multi-symbol data packet.
+ */
+const std::size_t data_multi_seqno_size_v1 = 4;
+/** Maximum number of symbols carried by a multi-symbol data
+ *  packet. With a buffer for the header, two for each symbol and one
+ *  spare, the buffer sequence stays within the 64 buffers that asio
+ *  passes to a single scatter/gather call.
+ */
+const std::size_t max_symbols_per_datagram = 31;
+
+/** Build the first byte of a raw packet. */
+char raw_type_byte(raw_packet_type t, raw_header_version v);
+/** Extract the packet type from the first byte of a raw packet. */
+raw_packet_type raw_packet_type_of(char type_byte);
+/** Extract the header version from the first byte of a raw
+ *  packet. If the version is unknown throw a runtime_error.
+ */
+raw_header_version raw_header_version_of(char type_byte);
+
+/** Size of the header of a data packet with the given version. */
+std::size_t raw_data_header_size(raw_header_version v);
+/** Size of an ACK packet with the given version. */
+std::size_t raw_ack_size(raw_header_version v);
+/** Size of the common header of a multi-symbol data packet with the
+ *  given version.
+ */
+std::size_t raw_data_multi_header_size(raw_header_version v);
+/** Size of the per-symbol sequence numbers of a multi-symbol data
+ *  packet with the given version.
+ */
+std::size_t raw_data_multi_seqno_size(raw_header_version v);
+/** Largest block or sequence number that a header version can
+ *  carry.
+ */
+std::size_t raw_max_number(raw_header_version v);
+
+/** Recover a full block number from the 16 bits carried by a version
+ *  0 header, choosing the value closest to `reference` (usually the
+ *  current block number of the receiver).
+ */
+std::size_t extend_block_number(std::size_t short_blockno,
+				std::size_t reference);
+
+/** Fixed-size buffer that holds the header of a data packet. Only
+ *  the first raw_data_header_size() bytes are used.
+ */
+typedef std::array<char, data_header_size_v1> raw_data_header;
+
+/** Build the network-endian header of a data packet that carries the
+ *  given fountain_packet. The payload is not copied: it must be sent
+ *  right after the header.
+ */
+raw_data_header build_raw_data_header(const fountain_packet &fp,
+				      raw_header_version v = header_v0);
+/** Parse the header of a raw data packet of any version. Set the
+ *  block number, sequence number and seed of `fp` and return the
+ *  payload length declared in the header. If the header is malformed
+ *  throw a runtime_error.
+ */
+std::size_t parse_raw_data_header(const raw_data_header &h,
+				  fountain_packet &fp);
+/** Fixed-size buffer that holds the common header of a multi-symbol
+ *  data packet. Only the first raw_data_multi_header_size() bytes
+ *  are used.
+ */
+typedef std::array<char, data_multi_header_size_v1> raw_data_multi_header;
+/** Fixed-size buffer that holds a per-symbol sequence number. Only
+ *  the first raw_data_multi_seqno_size() bytes are used.
+ */
+typedef std::array<char, data_multi_seqno_size_v1> raw_data_multi_seqno;
+
+/** Number of symbols of size `symbol_size` that fit in a
+ *  multi-symbol datagram of `datagram_size` bytes. It is always at
+ *  least 1 and at most max_symbols_per_datagram.
+ */
+std::size_t symbols_per_datagram(std::size_t symbol_size,
+				 std::size_t datagram_size,
+				 raw_header_version v = header_v0);
+
+/** Build the common header of a multi-symbol data packet that
+ *  carries `count` symbols of the same block as `fp`, with the same
+ *  size.
+ *
+ *  The packet is laid out as the header followed by `count` pairs of
+ *  sequence number (see build_raw_data_multi_seqno) and payload.
+ */
+raw_data_multi_header build_raw_data_multi_header(const fountain_packet &fp,
+						  std::size_t count,
+						  raw_header_version v = header_v0);
+/** Build the per-symbol sequence number of a multi-symbol packet. */
+raw_data_multi_seqno build_raw_data_multi_seqno(const fountain_packet &fp,
+						raw_header_version v = header_v0);
+/** Parse the common header of a multi-symbol data packet of any
+ *  version. Set the block number and seed of `fp`, store the symbol
+ *  size in `length` and return the number of symbols. If the header
+ *  is malformed throw a runtime_error.
+ */
+std::size_t parse_raw_data_multi_header(const raw_data_multi_header &h,
+					fountain_packet &fp,
+					std::size_t &length);
+/** Parse a per-symbol sequence number with the given version into
+ *  `fp`.
+ */
+void parse_raw_data_multi_seqno(const raw_data_multi_seqno &s,
+				fountain_packet &fp,
+				raw_header_version v = header_v0);
+
+/** Build a raw multi-symbol packet from a sequence of
+ *  fountain_packets of the same block and size.
+ */
+std::vector<char> build_raw_multi_packet(const std::vector<fountain_packet> &fps,
+					 raw_header_version v = header_v0);
+/** Parse a raw multi-symbol packet of any version into its
+ *  fountain_packets. If the packet is malformed throw a
+ *  runtime_error.
+ */
+std::vector<fountain_packet> parse_raw_multi_packet(const std::vector<char> &rp);
 
 /** Build a raw packet, with network-endian fields, from a
  *  fountain_packet.
  */
-std::vector<char> build_raw_packet(const fountain_packet &fp);
+std::vector<char> build_raw_packet(const fountain_packet &fp,
+				   raw_header_version v = header_v0);
 /** Build a raw ACK packet that carries the given block number. */
-std::vector<char> build_raw_ack(std::size_t blockno);
-/** Parse a raw data packet into a fountain_packet.
+std::vector<char> build_raw_ack(std::size_t blockno,
+				raw_header_version v = header_v0);
+/** Parse a raw data packet of any version into a fountain_packet.
  *  If the packet is malformed throw a runtime_error.
  */
 fountain_packet parse_raw_data_packet(const std::vector<char> &rp);
-/** Parse a raw ACK packet to get the block number carried by it. */
+/** Parse a raw ACK packet of any version to get the block number
+ *  carried by it.
+ */
 std::size_t parse_raw_ack_packet(const std::vector<char> &rp);
 
 #endif
@@ -0,0 +1,341 @@
+#include "perf_trace.hpp"
+
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+namespace uep {
+namespace perf_trace {
+
+const char MAGIC[8] = {'U', 'E', 'P', 'P', 'E', 'R', 'F', '\0'};
+const std::size_t trace_ring::CAPACITY;
+
+std::atomic<bool> active(false);
+thread_local trace_ring *current_ring = nullptr;
+
+trace_ring::trace_ring() :
+  head(0),
+  tail(0),
+  drop_count(0),
+  is_detached(false),
+  buf(new record[CAPACITY]) {
+  static_assert((CAPACITY & (CAPACITY - 1)) == 0,
+		"The capacity must be a power of two");
+}
+
+std::size_t trace_ring::pop(record *out, std::size_t max) {
+  std::size_t t = tail.load(std::memory_order_relaxed);
+  std::size_t n = std::min(head.load(std::memory_order_acquire) - t, max);
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = buf[(t + i) & (CAPACITY - 1)];
+  }
+  tail.store(t + n, std::memory_order_release);
+  return n;
+}
+
+void trace_ring::discard() {
+  tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+  drop_count.store(0, std::memory_order_relaxed);
+}
+
+std::size_t trace_ring::dropped() const {
+  return drop_count.load(std::memory_order_relaxed);
+}
+
+void trace_ring::detach() {
+  is_detached.store(true, std::memory_order_release);
+}
+
+bool trace_ring::detached() const {
+  return is_detached.load(std::memory_order_acquire);
+}
+
+namespace {
+
+/** Period of the drainer when the rings are empty. */
+const std::chrono::milliseconds DRAIN_PERIOD(1);
+
+/** Keep the ring of a thread alive until the drainer has emptied it. */
+struct ring_holder {
+  std::shared_ptr<trace_ring> ring;
+
+  ~ring_holder() {
+    current_ring = nullptr;
+    if (ring) ring->detach();
+  }
+};
+
+thread_local ring_holder holder;
+
+/** Registry of the rings and background thread that writes them to
+ *  the trace file.
+ */
+class tracer {
+public:
+  ~tracer() {
+    stop();
+  }
+
+  std::shared_ptr<trace_ring> add_ring() {
+    auto r = std::make_shared<trace_ring>();
+    std::lock_guard<std::mutex> lock(mutex);
+    rings.push_back(r);
+    return r;
+  }
+
+  void start(const std::string &path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (drainer.joinable()) {
+      throw std::runtime_error("The performance trace is already active");
+    }
+    out.open(path, std::ios_base::binary | std::ios_base::trunc);
+    if (!out) throw std::runtime_error("Cannot open " + path);
+
+    file_header h;
+    std::copy(MAGIC, MAGIC + sizeof(MAGIC), h.magic);
+    h.version = VERSION;
+    h.record_size = sizeof(record);
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+
+    // Forget the records of a previous session
+    for (const auto &r : rings) r->discard();
+    written = 0;
+    removed_drops = 0;
+    stopping = false;
+    drainer = std::thread(&tracer::run, this);
+    active.store(true, std::memory_order_relaxed);
+  }
+
+  trace_stats stop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!drainer.joinable()) return trace_stats{0, 0};
+    active.store(false, std::memory_order_relaxed);
+    stopping = true;
+    cv.notify_all();
+    lock.unlock();
+    drainer.join();
+    lock.lock();
+
+    out.close();
+    trace_stats s{written, removed_drops};
+    for (const auto &r : rings) s.dropped += r->dropped();
+    return s;
+  }
+
+  bool is_active() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return drainer.joinable();
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<std::shared_ptr<trace_ring>> rings;
+  std::thread drainer;
+  bool stopping;
+  std::ofstream out; /**< Used only by the drainer while it runs. */
+  std::size_t written;
+  std::size_t removed_drops; /**< Drops of the rings already removed. */
+
+  /** Body of the drainer thread. */
+  void run() {
+    std::vector<record> batch(trace_ring::CAPACITY);
+    std::vector<std::shared_ptr<trace_ring>> rs;
+    std::vector<trace_ring*> done;
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      bool last_pass = stopping;
+      rs = rings;
+      lock.unlock();
+
+      std::size_t count = 0;
+      done.clear();
+      for (const auto &r : rs) {
+	// The producer detaches after its last push
+	bool det = r->detached();
+	std::size_t n;
+	while ((n = r->pop(batch.data(), batch.size())) > 0) {
+	  out.write(reinterpret_cast<const char*>(batch.data()),
+		    n * sizeof(record));
+	  count += n;
+	}
+	if (det) done.push_back(r.get());
+      }
+      rs.clear();
+
+      lock.lock();
+      written += count;
+      for (trace_ring *d : done) {
+	auto i = std::find_if(rings.begin(), rings.end(),
+			      [d](const std::shared_ptr<trace_ring> &r) {
+				return r.get() == d;
+			      });
+	removed_drops += (*i)->dropped();
+	rings.erase(i);
+      }
+      if (last_pass) break;
+      if (count == 0) {
+	cv.wait_for(lock, DRAIN_PERIOD, [this](){ return stopping; });
+      }
+    }
+    out.flush();
+  }
+};
+
+tracer &the_tracer() {
+  static tracer t;
+  return t;
+}
+
+/** Write a fountain_packet as its operator<< does. */
+void write_packet(std::ostream &o, const record &r) {
+  o << "fountain_packet{"
+    << "blockno=" << r.args[0]
+    << ", seqno=" << r.args[1]
+    << ", seed="
+    << std::hex << std::showbase << static_cast<std::uint32_t>(r.args[2])
+    << std::dec << std::noshowbase
+    << ", size=" << r.args[3]
+    << ", priority=" << r.args[4]
+    << "}";
+}
+
+}
+
+trace_ring &register_thread() {
+  holder.ring = the_tracer().add_ring();
+  current_ring = holder.ring.get();
+  return *current_ring;
+}
+
+void start(const std::string &path) {
+  the_tracer().start(path);
+}
+
+trace_stats stop() {
+  return the_tracer().stop();
+}
+
+bool is_active() {
+  return the_tracer().is_active();
+}
+
+std::vector<record> read(std::istream &in) {
+  file_header h;
+  if (!in.read(reinterpret_cast<char*>(&h), sizeof(h)) ||
+      !std::equal(MAGIC, MAGIC + sizeof(MAGIC), h.magic)) {
+    throw std::runtime_error("Not a performance trace");
+  }
+  if (h.version != VERSION || h.record_size != sizeof(record)) {
+    throw std::runtime_error("Unsupported performance trace version");
+  }
+
+  // A partial record at the end of a truncated trace is ignored
+  std::vector<record> recs;
+  record r;
+  while (in.read(reinterpret_cast<char*>(&r), sizeof(r))) {
+    recs.push_back(r);
+  }
+  return recs;
+}
+
+std::string message(const record &r) {
+  std::ostringstream o;
+  const std::uint64_t *a = r.args;
+  switch (r.event) {
+  case lt_encoder_next_coded:
+    o << "lt_encoder::next_coded new_coded_packet=";
+    write_packet(o, r);
+    o << " encode_time=" << arg_to_double(a[5]);
+    break;
+  case lt_decoder_push_recvd:
+    o << "lt_decoder::push recvd_pkts=" << a[0];
+    break;
+  case lt_decoder_push_new_block:
+    o << "lt_decoder::push new_block blockno=" << a[0];
+    break;
+  case lt_decoder_push_old_block:
+    o << "lt_decoder::push old_block blockno=" << a[0];
+    break;
+  case lt_decoder_push_uniq:
+    o << "lt_decoder::push uniq_pkts=" << a[0];
+    break;
+  case lt_decoder_push_duplicate:
+    o << "lt_decoder::push duplicate_pkts blockno=" << a[0];
+    break;
+  case lt_decoder_push_time:
+    o << "lt_decoder::push push_time=" << arg_to_double(a[0]);
+    break;
+  case uep_encoder_push_new_packet:
+    o << "uep_encoder::push new_packet"
+      << " orig_size=" << a[0]
+      << " priority=" << a[1]
+      << " seqno=" << a[2];
+    break;
+  case uep_decoder_push_time:
+    o << "uep_decoder::push push_time=" << arg_to_double(a[0]);
+    break;
+  case data_server_pkt_sent:
+    o << "data_server::handle_sent udp_pkt_sent sent_size=" << a[0];
+    break;
+  case data_client_drop_pkt:
+    o << "data_client::handle_received drop_pkt";
+    write_packet(o, r);
+    break;
+  case data_client_received:
+    o << "data_client::handle_received received_count=" << a[0];
+    break;
+  case block_decoder_mp_setup:
+    o << "block_decoder::run_message_passing mp_setup_time="
+      << arg_to_double(a[0]);
+    break;
+  default:
+    throw std::runtime_error("Unknown performance trace event " +
+			     std::to_string(r.event));
+  }
+  return o.str();
+}
+
+std::string timestamp(const record &r) {
+  std::time_t secs = r.timestamp / 1000000000;
+  long usecs = (r.timestamp % 1000000000) / 1000;
+  std::tm tm;
+  localtime_r(&secs, &tm);
+  char buf[40];
+  std::size_t len = std::strftime(buf, sizeof(buf), "[%Y-%m-%d %H:%M:%S", &tm);
+  std::snprintf(buf + len, sizeof(buf) - len, ".%06ld]", usecs);
+  return buf;
+}
+
+void write_text(std::vector<record> recs, std::istream *perflog,
+		std::ostream &out) {
+  std::stable_sort(recs.begin(), recs.end(),
+		   [](const record &lhs, const record &rhs) {
+		     return lhs.timestamp < rhs.timestamp;
+		   });
+  auto write_line = [&out](const record &r) {
+    out << timestamp(r) << " | " << message(r) << '\n';
+  };
+
+  auto i = recs.cbegin();
+  if (perflog) {
+    // The fixed-width timestamps sort as strings
+    std::string line;
+    while (std::getline(*perflog, line)) {
+      std::size_t ts_end = line.find(']');
+      if (!line.empty() && line[0] == '[' && ts_end != std::string::npos) {
+	const std::string ts = line.substr(0, ts_end + 1);
+	for (; i != recs.cend() && timestamp(*i) < ts; ++i) write_line(*i);
+      }
+      out << line << '\n';
+    }
+  }
+  for (; i != recs.cend(); ++i) write_line(*i);
+}
+
+}}
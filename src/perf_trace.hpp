@@ -0,0 +1,238 @@
+#ifndef UEP_PERF_TRACE_HPP
+#define UEP_PERF_TRACE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/** Record a hot-path performance event. The arguments are stored in
+ *  a fixed-size binary record, without formatting. When the project
+ *  is configured with `-DUEP_PERF_TRACE=OFF` the arguments are not
+ *  evaluated and no code is generated.
+ */
+#ifdef UEP_PERF_TRACE
+#define UEP_TRACE(...) ::uep::perf_trace::emit(__VA_ARGS__)
+#else
+#define UEP_TRACE(...) \
+  ((void)sizeof(::uep::perf_trace::make_record(__VA_ARGS__)))
+#endif
+
+namespace uep {
+namespace perf_trace {
+
+/** Events recorded in the binary trace. Each one is converted back
+ *  to a line of the text performance log.
+ */
+enum event_type : std::uint32_t {
+  /** blockno, seqno, seed, size, priority, encode_time. */
+  lt_encoder_next_coded = 1,
+  /** Number of received packets. */
+  lt_decoder_push_recvd,
+  /** blockno. */
+  lt_decoder_push_new_block,
+  /** blockno. */
+  lt_decoder_push_old_block,
+  /** Number of packets passed to the block decoder. */
+  lt_decoder_push_uniq,
+  /** blockno. */
+  lt_decoder_push_duplicate,
+  /** push_time. */
+  lt_decoder_push_time,
+  /** orig_size, priority, seqno. */
+  uep_encoder_push_new_packet,
+  /** push_time. */
+  uep_decoder_push_time,
+  /** sent_size. */
+  data_server_pkt_sent,
+  /** blockno, seqno, seed, size, priority. */
+  data_client_drop_pkt,
+  /** received_count. */
+  data_client_received,
+  /** mp_setup_time. */
+  block_decoder_mp_setup,
+  n_event_types
+};
+
+/** Number of arguments stored in a record. */
+const std::size_t record_args = 6;
+
+/** Fixed-size record of the binary trace, stored in the native byte
+ *  order. The floating point arguments are stored bit by bit.
+ */
+struct record {
+  std::int64_t timestamp; /**< Nanoseconds since the system_clock epoch. */
+  std::uint32_t event; /**< An event_type. */
+  std::uint32_t reserved; /**< Always zero. */
+  std::uint64_t args[record_args];
+};
+static_assert(sizeof(record) == 64, "Unexpected record padding");
+
+/** Header at the start of a binary trace. */
+struct file_header {
+  char magic[8]; /**< Always MAGIC. */
+  std::uint32_t version;
+  std::uint32_t record_size; /**< Must be sizeof(record). */
+};
+static_assert(sizeof(file_header) == 16, "Unexpected file_header padding");
+
+extern const char MAGIC[8];
+const std::uint32_t VERSION = 1;
+
+/** Store an integer argument. */
+template <class T,
+	  class = typename std::enable_if<std::is_integral<T>::value>::type>
+inline std::uint64_t to_arg(T v) {
+  return static_cast<std::uint64_t>(v);
+}
+
+/** Store a floating point argument. */
+inline std::uint64_t to_arg(double v) {
+  std::uint64_t u;
+  std::memcpy(&u, &v, sizeof(u));
+  return u;
+}
+
+/** Read back an argument stored with to_arg(double). */
+inline double arg_to_double(std::uint64_t u) {
+  double v;
+  std::memcpy(&v, &u, sizeof(v));
+  return v;
+}
+
+/** Build a record with the current time. */
+template <class... Args>
+inline record make_record(event_type ev, Args... args) {
+  static_assert(sizeof...(Args) <= record_args, "Too many trace arguments");
+  record r;
+  r.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+  r.event = ev;
+  r.reserved = 0;
+  const std::uint64_t a[record_args] = {to_arg(args)...};
+  std::copy(a, a + record_args, r.args);
+  return r;
+}
+
+/** Single-producer single-consumer ring of records. The owning
+ *  thread pushes and the drainer thread pops, without locks. When
+ *  the ring is full the new records are dropped and counted, so the
+ *  producer never waits.
+ */
+class trace_ring {
+public:
+  /** Number of records in a ring. Must be a power of two. */
+  static const std::size_t CAPACITY = 4096;
+
+  trace_ring();
+  trace_ring(const trace_ring&) = delete;
+  trace_ring &operator=(const trace_ring&) = delete;
+
+  /** Append a record. Return false and count it as dropped if the
+   *  ring is full. Called only by the producer.
+   */
+  bool push(const record &r) {
+    std::size_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == CAPACITY) {
+      drop_count.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    buf[h & (CAPACITY - 1)] = r;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  /** Move up to `max` records to `out`, oldest first, and return
+   *  their number. Called only by the consumer.
+   */
+  std::size_t pop(record *out, std::size_t max);
+  /** Drop all the records in the ring. Called only by the consumer. */
+  void discard();
+  /** Number of records dropped because the ring was full. */
+  std::size_t dropped() const;
+
+  /** Mark the ring as no longer used by its producer. */
+  void detach();
+  /** True after detach(). */
+  bool detached() const;
+
+private:
+  std::atomic<std::size_t> head; /**< Written by the producer. */
+  char pad_head[64 - sizeof(std::atomic<std::size_t>)];
+  std::atomic<std::size_t> tail; /**< Written by the consumer. */
+  char pad_tail[64 - sizeof(std::atomic<std::size_t>)];
+  std::atomic<std::size_t> drop_count;
+  std::atomic<bool> is_detached;
+  std::unique_ptr<record[]> buf;
+};
+
+/** Totals of a tracing session. */
+struct trace_stats {
+  std::size_t written; /**< Records written to the file. */
+  std::size_t dropped; /**< Records dropped by full rings. */
+};
+
+/** Flag checked by emit(). Set between start() and stop(). */
+extern std::atomic<bool> active;
+
+/** Ring of the calling thread, null before its first event. */
+extern thread_local trace_ring *current_ring;
+
+/** Create the ring of the calling thread and register it with the
+ *  drainer.
+ */
+trace_ring &register_thread();
+
+/** Return the ring of the calling thread. */
+inline trace_ring &thread_ring() {
+  trace_ring *r = current_ring;
+  return r ? *r : register_thread();
+}
+
+/** Record an event if tracing is active. */
+template <class... Args>
+inline void emit(event_type ev, Args... args) {
+  if (!active.load(std::memory_order_relaxed)) return;
+  thread_ring().push(make_record(ev, args...));
+}
+
+/** Start writing the events to the binary trace `path`, from a
+ *  background thread. Throw std::runtime_error if the file cannot be
+ *  opened or tracing is already active.
+ */
+void start(const std::string &path);
+/** Stop tracing, write the records still in the rings and close the
+ *  file. Do nothing if tracing is not active.
+ */
+trace_stats stop();
+/** True between start() and stop(). */
+bool is_active();
+
+/** Read all the records of a binary trace. Throw std::runtime_error
+ *  if it is not valid.
+ */
+std::vector<record> read(std::istream &in);
+
+/** Format the message of a record as the one previously written to
+ *  the performance log by Boost.Log.
+ */
+std::string message(const record &r);
+/** Format the timestamp of a record as the performance log does. */
+std::string timestamp(const record &r);
+
+/** Write the records as lines of the text performance log, sorted
+ *  by time. If `perflog` is not null, merge them with its lines.
+ */
+void write_text(std::vector<record> recs, std::istream *perflog,
+		std::ostream &out);
+
+}}
+
+#endif
@@ -0,0 +1,44 @@
+#include <fstream>
+#include <iostream>
+
+#include "perf_trace.hpp"
+
+/** Convert a binary performance trace to the lines of the text
+ *  performance log and write them to stdout. When the text log of the
+ *  same run is given, its lines are merged in time order, so the
+ *  output is the log that the scripts expect.
+ */
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 3) {
+    std::cerr << "Usage: " << argv[0]
+	      << " <trace file>"
+	      << " [<perf log>]"
+	      << std::endl;
+    return 2;
+  }
+
+  std::ifstream trace(argv[1], std::ios_base::binary);
+  if (!trace) {
+    std::cerr << "Cannot open " << argv[1] << std::endl;
+    return 1;
+  }
+  std::ifstream perflog;
+  if (argc == 3) {
+    perflog.open(argv[2]);
+    if (!perflog) {
+      std::cerr << "Cannot open " << argv[2] << std::endl;
+      return 1;
+    }
+  }
+
+  try {
+    uep::perf_trace::write_text(uep::perf_trace::read(trace),
+				argc == 3 ? &perflog : nullptr,
+				std::cout);
+  }
+  catch (const std::runtime_error &e) {
+    std::cerr << argv[1] << ": " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -18,14 +18,25 @@ def run_nal_overhead(n, L):
     data['size1'] = int(re.search("size1=(\d+)", out).group(1))
     data['oh0'] = int(re.search("oh0=(\d+)", out).group(1))
     data['oh1'] = int(re.search("oh1=(\d+)", out).group(1))
+    # Same counts with the padding-free packing, when L allows it
+    for k in ['npkts0', 'npkts1', 'size0', 'size1', 'oh0', 'oh1']:
+        m = re.search("packed_" + k + "=(\d+)", out)
+        if m: data['packed_' + k] = int(m.group(1))
     return data
 
+def udp_overhead(d, L, uep_hdr, lt_hdr, prefix=""):
+    tot_src = d[prefix + 'size0'] + d[prefix + 'size1']
+    tot_udp = ((d[prefix + 'npkts0'] + d[prefix + 'npkts1']) *
+               (L + uep_hdr + lt_hdr))
+    return (tot_udp - tot_src) / tot_src
+
 if __name__ == "__main__":
     shelf = shelve.open("plot_overhead_data")
 
-    if 'Ls' in shelf and 'ohs' in shelf:
+    if 'Ls' in shelf and 'ohs' in shelf and 'ohs_packed' in shelf:
         Ls = shelf['Ls']
         ohs = shelf['ohs']
+        ohs_packed = shelf['ohs_packed']
     else:
         Ls = list(np.linspace(1, 1500, 256, dtype=int))
         Ls += range(330, 560)
@@ -36,24 +47,33 @@ if __name__ == "__main__":
         lt_hdr = 11
 
         ohs = []
+        ohs_packed = []
         for L in Ls:
             d = run_nal_overhead(strname, L)
-            tot_src = d['size0'] + d['size1']
-            tot_udp = (d['npkts0'] + d['npkts1']) * (L + uep_hdr + lt_hdr)
-            oh = (tot_udp - tot_src) / tot_src
-            ohs.append(oh)
+            ohs.append(udp_overhead(d, L, uep_hdr, lt_hdr))
+            if 'packed_npkts0' in d:
+                ohs_packed.append(udp_overhead(d, L, uep_hdr, lt_hdr,
+                                               "packed_"))
+            else:
+                ohs_packed.append(np.nan)
 
         shelf['Ls'] = Ls
         shelf['ohs'] = ohs
+        shelf['ohs_packed'] = ohs_packed
 
     shelf.close()
 
     i_min = np.argmin(ohs)
     print("Best packet size = {:d}".format(Ls[i_min]))
     print("Min overhead = {:f}".format(ohs[i_min]))
+    i_min_packed = np.nanargmin(ohs_packed)
+    print("Best packet size (packed) = {:d}".format(Ls[i_min_packed]))
+    print("Min overhead (packed) = {:f}".format(ohs_packed[i_min_packed]))
 
     plt.figure();
-    plt.plot(Ls, ohs)
+    plt.plot(Ls, ohs, label="padded")
+    plt.plot(Ls, ohs_packed, label="packed")
+    plt.legend()
 
     plt.ylim(0, 0.2)
     plt.xlim(1, 1500)
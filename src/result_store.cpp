@@ -0,0 +1,357 @@
+#include "result_store.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace uep {
+
+constexpr std::uint8_t result_column_header::scalar_flag;
+constexpr std::size_t result_column_header::max_name;
+
+const char result_store::MAGIC[8] = {'U','E','P','R','E','S','\0','\0'};
+const std::uint32_t result_store::VERSION;
+
+namespace {
+
+std::system_error errno_error(const std::string &what) {
+  return std::system_error(errno, std::system_category(), what);
+}
+
+std::runtime_error bad_store(const std::string &path, const std::string &why) {
+  return std::runtime_error("Invalid result store " + path + ": " + why);
+}
+
+/** Round up to a multiple of 8, to keep all the values aligned. */
+std::uint64_t pad8(std::uint64_t n) {
+  return (n + 7) & ~std::uint64_t(7);
+}
+
+/** Size in bytes of a value of the given type. */
+std::size_t value_size(std::uint8_t type) {
+  switch (static_cast<result_type>(type)) {
+  case result_type::float64:
+  case result_type::int64:
+  case result_type::uint64:
+    return 8;
+  case result_type::string:
+    return 1;
+  }
+  return 0;
+}
+
+/** Write all the bytes, retrying on short writes. */
+void write_all(int fd, const char *p, std::size_t n, const std::string &path) {
+  while (n > 0) {
+    ssize_t w = ::write(fd, p, n);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      throw errno_error("Failed to write " + path);
+    }
+    p += w;
+    n -= w;
+  }
+}
+
+/** Walk the record headers from `pos`, the end of a complete record,
+ *  and cut off a truncated record left at the end of the file by an
+ *  interrupted writer. Return the new size of the file. Must be
+ *  called under the exclusive lock.
+ */
+std::uint64_t drop_truncated_tail(int fd, std::uint64_t pos,
+				  const std::string &path) {
+  struct stat st;
+  if (::fstat(fd, &st) != 0) throw errno_error("Failed to stat " + path);
+  const std::uint64_t size = st.st_size;
+  // Cut by someone else: walk all the file again
+  if (pos > size) pos = sizeof(result_store_header);
+
+  while (size - pos >= sizeof(result_record_header)) {
+    result_record_header rh;
+    ssize_t n = ::pread(fd, &rh, sizeof(rh), pos);
+    if (n < 0) throw errno_error("Failed to read " + path);
+    if (n != sizeof(rh)) break;
+    if (rh.size > size - pos) break;
+    if (rh.size < sizeof(rh) || rh.size % 8 != 0) {
+      throw bad_store(path, "wrong record size");
+    }
+    pos += rh.size;
+  }
+
+  if (pos != size && ::ftruncate(fd, pos) != 0) {
+    throw errno_error("Failed to truncate " + path);
+  }
+  return pos;
+}
+
+}
+
+	     //// result_record ////
+
+void result_record::add_column(const std::string &name, result_type type,
+			       bool scalar, std::uint64_t count,
+			       const void *data, std::size_t bytes) {
+  if (name.empty() || name.size() > result_column_header::max_name) {
+    throw std::invalid_argument("Wrong column name length");
+  }
+  for (const column &c : cols) {
+    if (c.name == name) throw std::invalid_argument("Duplicate column");
+  }
+  const char *p = static_cast<const char*>(data);
+  cols.push_back(column{name, type, scalar, count,
+			std::vector<char>(p, p + bytes)});
+}
+
+void result_record::add_double(const std::string &name, double v) {
+  add_column(name, result_type::float64, true, 1, &v, sizeof(v));
+}
+
+void result_record::add_int(const std::string &name, std::int64_t v) {
+  add_column(name, result_type::int64, true, 1, &v, sizeof(v));
+}
+
+void result_record::add_uint(const std::string &name, std::uint64_t v) {
+  add_column(name, result_type::uint64, true, 1, &v, sizeof(v));
+}
+
+void result_record::add_string(const std::string &name, const std::string &v) {
+  add_column(name, result_type::string, true, v.size(), v.data(), v.size());
+}
+
+void result_record::add_doubles(const std::string &name,
+				const std::vector<double> &v) {
+  add_column(name, result_type::float64, false, v.size(),
+	     v.data(), v.size() * sizeof(double));
+}
+
+std::size_t result_record::size() const {
+  return cols.size();
+}
+
+std::vector<char> result_record::serialize() const {
+  std::uint64_t offset = sizeof(result_record_header) +
+    cols.size() * sizeof(result_column_header);
+  std::vector<result_column_header> headers(cols.size());
+  for (std::size_t j = 0; j < cols.size(); ++j) {
+    result_column_header &h = headers[j];
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.name, cols[j].name.data(), cols[j].name.size());
+    h.type = static_cast<std::uint8_t>(cols[j].type);
+    h.flags = cols[j].scalar ? result_column_header::scalar_flag : 0;
+    h.count = cols[j].count;
+    h.offset = offset;
+    offset += pad8(cols[j].bytes.size());
+  }
+
+  result_record_header rh;
+  rh.size = offset;
+  rh.columns = static_cast<std::uint32_t>(cols.size());
+  rh.reserved = 0;
+
+  // The padding is zero-filled
+  std::vector<char> out(offset, 0);
+  std::memcpy(out.data(), &rh, sizeof(rh));
+  if (!headers.empty()) {
+    std::memcpy(out.data() + sizeof(rh), headers.data(),
+		headers.size() * sizeof(result_column_header));
+  }
+  for (std::size_t j = 0; j < cols.size(); ++j) {
+    if (!cols[j].bytes.empty()) {
+      std::memcpy(out.data() + headers[j].offset, cols[j].bytes.data(),
+		  cols[j].bytes.size());
+    }
+  }
+  return out;
+}
+
+	     //// result_store_writer ////
+
+result_store_writer::result_store_writer(const std::string &p) :
+  path(p) {
+  fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) throw errno_error("Failed to open " + path);
+
+  try {
+    // Write the header of a new store, or check the existing one
+    if (::flock(fd, LOCK_EX) != 0) throw errno_error("Failed to lock " + path);
+    result_store_header hdr;
+    ssize_t n = ::pread(fd, &hdr, sizeof(hdr), 0);
+    if (n < 0) throw errno_error("Failed to read " + path);
+    if (n == 0) {
+      std::memcpy(hdr.magic, result_store::MAGIC, sizeof(hdr.magic));
+      hdr.version = result_store::VERSION;
+      hdr.reserved = 0;
+      write_all(fd, reinterpret_cast<const char*>(&hdr), sizeof(hdr), path);
+    }
+    else if (n != sizeof(hdr) ||
+	     std::memcmp(hdr.magic, result_store::MAGIC, sizeof(hdr.magic)) != 0) {
+      throw bad_store(path, "wrong magic");
+    }
+    else if (hdr.version != result_store::VERSION) {
+      throw bad_store(path, "unsupported version or byte order");
+    }
+    good_end = sizeof(hdr);
+    ::flock(fd, LOCK_UN);
+  }
+  catch (...) {
+    ::close(fd);
+    throw;
+  }
+}
+
+result_store_writer::~result_store_writer() {
+  ::close(fd);
+}
+
+void result_store_writer::append(const result_record &r) {
+  const std::vector<char> bytes = r.serialize();
+  if (::flock(fd, LOCK_EX) != 0) throw errno_error("Failed to lock " + path);
+  try {
+    // O_APPEND writes right after the last complete record
+    good_end = drop_truncated_tail(fd, good_end, path);
+    write_all(fd, bytes.data(), bytes.size(), path);
+    good_end += bytes.size();
+  }
+  catch (...) {
+    ::flock(fd, LOCK_UN);
+    throw;
+  }
+  ::flock(fd, LOCK_UN);
+}
+
+	     //// result_record_view ////
+
+result_record_view::result_record_view(const char *record) :
+  rec(record) {
+}
+
+std::size_t result_record_view::size() const {
+  return reinterpret_cast<const result_record_header*>(rec)->columns;
+}
+
+const result_column_header &result_record_view::column(std::size_t j) const {
+  if (j >= size()) throw std::out_of_range("Column out of range");
+  return reinterpret_cast<const result_column_header*>(
+    rec + sizeof(result_record_header))[j];
+}
+
+const result_column_header *
+result_record_view::find(const std::string &name) const {
+  for (std::size_t j = 0; j < size(); ++j) {
+    const result_column_header &c = column(j);
+    if (std::strncmp(c.name, name.c_str(), sizeof(c.name)) == 0 &&
+	name.size() < sizeof(c.name)) {
+      return &c;
+    }
+  }
+  return nullptr;
+}
+
+const result_column_header &
+result_record_view::typed(const std::string &name, result_type type) const {
+  const result_column_header *c = find(name);
+  if (!c) throw std::out_of_range("No column " + name);
+  if (c->type != static_cast<std::uint8_t>(type)) {
+    throw std::runtime_error("Wrong type of column " + name);
+  }
+  return *c;
+}
+
+const char *result_record_view::values(const result_column_header &c) const {
+  return rec + c.offset;
+}
+
+double result_record_view::get_double(const std::string &name) const {
+  const result_column_header &c = typed(name, result_type::float64);
+  if (c.count != 1) throw std::runtime_error("Not a scalar: " + name);
+  return *reinterpret_cast<const double*>(values(c));
+}
+
+std::int64_t result_record_view::get_int(const std::string &name) const {
+  const result_column_header &c = typed(name, result_type::int64);
+  if (c.count != 1) throw std::runtime_error("Not a scalar: " + name);
+  return *reinterpret_cast<const std::int64_t*>(values(c));
+}
+
+std::uint64_t result_record_view::get_uint(const std::string &name) const {
+  const result_column_header &c = typed(name, result_type::uint64);
+  if (c.count != 1) throw std::runtime_error("Not a scalar: " + name);
+  return *reinterpret_cast<const std::uint64_t*>(values(c));
+}
+
+std::string result_record_view::get_string(const std::string &name) const {
+  const result_column_header &c = typed(name, result_type::string);
+  return std::string(values(c), c.count);
+}
+
+std::vector<double>
+result_record_view::get_doubles(const std::string &name) const {
+  const result_column_header &c = typed(name, result_type::float64);
+  const double *p = reinterpret_cast<const double*>(values(c));
+  return std::vector<double>(p, p + c.count);
+}
+
+std::vector<std::int64_t>
+result_record_view::get_ints(const std::string &name) const {
+  const result_column_header &c = typed(name, result_type::int64);
+  const std::int64_t *p = reinterpret_cast<const std::int64_t*>(values(c));
+  return std::vector<std::int64_t>(p, p + c.count);
+}
+
+	     //// result_store ////
+
+result_store result_store::open(const std::string &path) {
+  result_store rs;
+  // Not shared: the file may have grown since another mapping
+  rs.mapping = std::make_shared<const mapped_file>(path);
+  const mapped_file &m = *rs.mapping;
+
+  if (m.size() < sizeof(result_store_header)) throw bad_store(path, "too short");
+  const auto &hdr = *reinterpret_cast<const result_store_header*>(m.data());
+  if (std::memcmp(hdr.magic, MAGIC, sizeof(MAGIC)) != 0)
+    throw bad_store(path, "wrong magic");
+  if (hdr.version != VERSION)
+    throw bad_store(path, "unsupported version or byte order");
+
+  // The mapping is page-aligned and all the sizes are multiples of 8
+  std::uint64_t pos = sizeof(result_store_header);
+  while (m.size() - pos >= sizeof(result_record_header)) {
+    const char *rec = m.data() + pos;
+    const auto &rh = *reinterpret_cast<const result_record_header*>(rec);
+    if (rh.size > m.size() - pos) break; // Truncated by a writer
+    if (rh.size % 8 != 0 ||
+	rh.size < sizeof(result_record_header) +
+	std::uint64_t(rh.columns) * sizeof(result_column_header)) {
+      throw bad_store(path, "wrong record size");
+    }
+    const auto *cols = reinterpret_cast<const result_column_header*>(
+      rec + sizeof(result_record_header));
+    for (std::uint32_t j = 0; j < rh.columns; ++j) {
+      std::size_t vs = value_size(cols[j].type);
+      if (vs == 0) throw bad_store(path, "unknown column type");
+      if (cols[j].offset % 8 != 0 || cols[j].offset > rh.size ||
+	  cols[j].count > (rh.size - cols[j].offset) / vs) {
+	throw bad_store(path, "column out of the record");
+      }
+    }
+    rs.records.push_back(rec);
+    pos += rh.size;
+  }
+  return rs;
+}
+
+std::size_t result_store::size() const {
+  return records.size();
+}
+
+result_record_view result_store::operator[](std::size_t i) const {
+  return result_record_view(records.at(i));
+}
+
+}
@@ -0,0 +1,191 @@
+#ifndef UEP_RESULT_STORE_HPP
+#define UEP_RESULT_STORE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mapped_file.hpp"
+
+namespace uep {
+
+/** Header at the start of a result store. The headers and the values
+ *  are stored in the native byte order.
+ */
+struct result_store_header {
+  char magic[8]; /**< Always result_store::MAGIC. */
+  std::uint32_t version;
+  std::uint32_t reserved; /**< Always zero. */
+};
+static_assert(sizeof(result_store_header) == 16,
+	      "Unexpected result_store_header padding");
+
+/** Header of a record. It is followed by the column headers and then
+ *  by the values of the columns.
+ */
+struct result_record_header {
+  std::uint64_t size; /**< Bytes of the record, header included. */
+  std::uint32_t columns; /**< Number of columns. */
+  std::uint32_t reserved; /**< Always zero. */
+};
+static_assert(sizeof(result_record_header) == 16,
+	      "Unexpected result_record_header padding");
+
+/** Types of the values of a column. */
+enum class result_type : std::uint8_t {
+  float64 = 'd',
+  int64 = 'q',
+  uint64 = 'Q',
+  string = 's' /**< UTF-8 bytes, count is the length. */
+};
+
+/** Header of a column of a record. */
+struct result_column_header {
+  static constexpr std::uint8_t scalar_flag = 0x01;
+  static constexpr std::size_t max_name = 31;
+
+  char name[32]; /**< Null-padded name. */
+  std::uint8_t type; /**< A result_type. */
+  std::uint8_t flags; /**< Bitwise OR of the flags above. */
+  std::uint16_t reserved16; /**< Always zero. */
+  std::uint32_t reserved32; /**< Always zero. */
+  std::uint64_t count; /**< Number of values. */
+  /** Offset of the values from the record header, multiple of 8. */
+  std::uint64_t offset;
+};
+static_assert(sizeof(result_column_header) == 56,
+	      "Unexpected result_column_header padding");
+
+/** Record being built, made of named columns of typed values. */
+class result_record {
+public:
+  /** Add a scalar column. Throw std::invalid_argument if the name is
+   *  empty, too long or already used.
+   */
+  void add_double(const std::string &name, double v);
+  void add_int(const std::string &name, std::int64_t v);
+  void add_uint(const std::string &name, std::uint64_t v);
+  void add_string(const std::string &name, const std::string &v);
+  /** Add an array column. */
+  void add_doubles(const std::string &name, const std::vector<double> &v);
+  template <class Iter>
+  void add_ints(const std::string &name, Iter first, Iter last);
+
+  /** Number of columns. */
+  std::size_t size() const;
+  /** Serialized record, with its header. */
+  std::vector<char> serialize() const;
+
+private:
+  struct column {
+    std::string name;
+    result_type type;
+    bool scalar;
+    std::uint64_t count;
+    std::vector<char> bytes;
+  };
+  std::vector<column> cols;
+
+  void add_column(const std::string &name, result_type type, bool scalar,
+		  std::uint64_t count, const void *data, std::size_t bytes);
+};
+
+/** Appends records to a result store, creating it if needed. Several
+ *  writers can append to the same file: each record is written with a
+ *  single call under an exclusive lock. A truncated record at the end
+ *  of the file, left by an interrupted writer, is removed before
+ *  appending.
+ */
+class result_store_writer {
+public:
+  /** Open the store at `path`. Throw std::system_error if it cannot
+   *  be opened and std::runtime_error if it is not a result store.
+   */
+  explicit result_store_writer(const std::string &path);
+  ~result_store_writer();
+
+  result_store_writer(const result_store_writer&) = delete;
+  result_store_writer &operator=(const result_store_writer&) = delete;
+
+  /** Append a record. Throw std::system_error on failure. */
+  void append(const result_record &r);
+
+private:
+  std::string path;
+  int fd;
+  /** End of the last complete record known to this writer. */
+  std::uint64_t good_end;
+};
+
+/** Read-only view of a record in a mapped result store. */
+class result_record_view {
+public:
+  explicit result_record_view(const char *record);
+
+  /** Number of columns. */
+  std::size_t size() const;
+  /** Header of the j-th column. */
+  const result_column_header &column(std::size_t j) const;
+  /** Header of the column `name`, or nullptr if there is none. */
+  const result_column_header *find(const std::string &name) const;
+
+  /** Value of a scalar column. Throw std::out_of_range if it is
+   *  missing and std::runtime_error if it has another type.
+   */
+  double get_double(const std::string &name) const;
+  std::int64_t get_int(const std::string &name) const;
+  std::uint64_t get_uint(const std::string &name) const;
+  std::string get_string(const std::string &name) const;
+  /** Values of an array column, with the same errors as above. */
+  std::vector<double> get_doubles(const std::string &name) const;
+  std::vector<std::int64_t> get_ints(const std::string &name) const;
+
+private:
+  const char *rec;
+
+  const result_column_header &typed(const std::string &name,
+				    result_type type) const;
+  const char *values(const result_column_header &c) const;
+};
+
+/** Memory-mapped result store.
+ *
+ *  Opening a store only reads the headers of the records: the values
+ *  are read from the mapping when they are accessed. A truncated
+ *  record at the end of the file, left by an interrupted writer, is
+ *  ignored.
+ */
+class result_store {
+public:
+  static const char MAGIC[8];
+  static const std::uint32_t VERSION = 1;
+
+  /** Map the store at `path`. Throw std::runtime_error if it is not
+   *  valid.
+   */
+  static result_store open(const std::string &path);
+
+  /** Number of complete records. */
+  std::size_t size() const;
+  /** View of the i-th record. */
+  result_record_view operator[](std::size_t i) const;
+
+private:
+  std::shared_ptr<const mapped_file> mapping;
+  std::vector<const char*> records;
+};
+
+	      //// result_record template definitions ////
+
+template <class Iter>
+void result_record::add_ints(const std::string &name, Iter first, Iter last) {
+  std::vector<std::int64_t> v(first, last);
+  add_column(name, result_type::int64, false, v.size(),
+	     v.data(), v.size() * sizeof(std::int64_t));
+}
+
+}
+
+#endif
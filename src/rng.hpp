@@ -4,6 +4,7 @@
 #include <algorithm>
 #include <functional>
 #include <random>
+#include <stdexcept>
 #include <vector>
 
 /** Implement a discrete distribution with elements in [1,K] according
@@ -0,0 +1,116 @@
+#include "startcode_scanner.hpp"
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define UEP_SCAN_X86
+#include <immintrin.h>
+#endif
+
+namespace uep {
+
+namespace {
+
+typedef const char *(*scan_fn)(const char*, const char*);
+
+const char *zero_pair_scalar(const char *p, const char *last) {
+  if (last - p < 2) return last;
+  const char *const end = last - 1; // p[1] must be valid
+  while (p < end) {
+    p = static_cast<const char*>(std::memchr(p, 0, end - p));
+    if (!p) return last;
+    if (p[1] == 0) return p;
+    p += 2; // p[1] is not zero
+  }
+  return last;
+}
+
+#ifdef __SSE2__
+/** Compare each position and the next one with zero, 16 at a time. */
+const char *zero_pair_sse2(const char *p, const char *last) {
+  const __m128i zero = _mm_setzero_si128();
+  while (last - p >= 17) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+    __m128i both = _mm_and_si128(_mm_cmpeq_epi8(a, zero),
+				 _mm_cmpeq_epi8(b, zero));
+    unsigned int mask = _mm_movemask_epi8(both);
+    if (mask) return p + __builtin_ctz(mask);
+    p += 16;
+  }
+  return zero_pair_scalar(p, last);
+}
+#endif
+
+#ifdef UEP_SCAN_X86
+/** Same as zero_pair_sse2, 32 positions at a time. */
+__attribute__((target("avx2")))
+const char *zero_pair_avx2(const char *p, const char *last) {
+  const __m256i zero = _mm256_setzero_si256();
+  while (last - p >= 33) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1));
+    __m256i both = _mm256_and_si256(_mm256_cmpeq_epi8(a, zero),
+				    _mm256_cmpeq_epi8(b, zero));
+    unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(both));
+    if (mask) return p + __builtin_ctz(mask);
+    p += 32;
+  }
+  return zero_pair_scalar(p, last);
+}
+#endif
+
+struct scan_impl {
+  scan_fn fn;
+  const char *isa;
+};
+
+scan_impl select_impl() {
+#ifdef UEP_SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return {zero_pair_avx2, "avx2"};
+#endif
+#ifdef __SSE2__
+  return {zero_pair_sse2, "sse2"};
+#else
+  return {zero_pair_scalar, "scalar"};
+#endif
+}
+
+const scan_impl &impl() {
+  static const scan_impl i = select_impl();
+  return i;
+}
+
+}
+
+const char *scan_zero_pair(const char *first, const char *last) {
+  return impl().fn(first, last);
+}
+
+const char *scan_startcode(const char *first, const char *last) {
+  const char *p = first;
+  for (;;) {
+    p = scan_zero_pair(p, last);
+    if (last - p < 3) return last;
+    if (p[2] == 0x01) return p;
+    ++p; // The second zero can start another pair
+  }
+}
+
+const char *scan_nal_end(const char *first, const char *last) {
+  const char *p = first;
+  for (;;) {
+    p = scan_zero_pair(p, last);
+    if (last - p < 3) return last; // No end: needs 3 bytes
+    unsigned char next = static_cast<unsigned char>(p[2]);
+    if (next <= 0x02) return p;
+    p += 3; // Retry after this match
+  }
+}
+
+const char *scan_isa() {
+  return impl().isa;
+}
+
+}
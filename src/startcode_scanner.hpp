@@ -0,0 +1,29 @@
+#ifndef UEP_STARTCODE_SCANNER_HPP
+#define UEP_STARTCODE_SCANNER_HPP
+
+namespace uep {
+
+/** Return the first position `p` in [first, last) such that `p[0]`
+ *  and `p[1]` are both zero, or `last` if there is none. The search
+ *  uses AVX2 or SSE2, chosen at runtime, when they are available.
+ */
+const char *scan_zero_pair(const char *first, const char *last);
+
+/** Return the first Annex-B startcode (0x00 0x00 0x01) in [first,
+ *  last), or `last` if there is none.
+ */
+const char *scan_startcode(const char *first, const char *last);
+
+/** Return the end of the NAL unit that continues at `first`: the
+ *  first sequence 0x00 0x00 (0x00|0x01|0x02), which cannot appear
+ *  inside a NAL. Return `last` if the range contains no such sequence
+ *  or ends with an incomplete one.
+ */
+const char *scan_nal_end(const char *first, const char *last);
+
+/** Name of the instruction set used by scan_zero_pair(). */
+const char *scan_isa();
+
+}
+
+#endif
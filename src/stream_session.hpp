@@ -0,0 +1,468 @@
+#ifndef UEP_NET_STREAM_SESSION_HPP
+#define UEP_NET_STREAM_SESSION_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "counter.hpp"
+#include "log.hpp"
+#include "packets.hpp"
+
+namespace uep { namespace net {
+
+/** Coded stream shared by many subscribers.
+ *
+ *  A single Encoder, fed by a single Source, codes the stream once.
+ *  The coded packets of the current block (the frontier) are cached
+ *  and each subscriber reads them through its own cursor, so every
+ *  packet is generated only once, by the first subscriber that needs
+ *  it, and the other ones get a shallow copy.
+ *
+ *  A subscriber leaves the frontier block when its client ACKs it or
+ *  when it has read the maximum number of packets per block. The
+ *  encoder moves to the next block only when all the subscribers
+ *  have left the current one: the subscribers that are ahead wait
+ *  and are woken up by their handler when the frontier reaches them.
+ *
+ *  A subscriber cannot hold the others back for long: after reading
+ *  max_cached_per_block() packets of a block it moves to the next
+ *  one, and when the frontier has not moved for max_block_time() the
+ *  subscribers still on it are pushed to the next block. Those that
+ *  did not read or ACK anything in that time are evicted: their next
+ *  read gets session_end.
+ *
+ *  Follower subscribers (used to send to a multicast group) always
+ *  read the frontier block and do not hold it back. When a follower
+ *  reaches the maximum number of packets per block it pushes all the
+ *  other subscribers to the next block.
+ *
+ *  New subscribers are accepted only while the frontier is still the
+ *  first block (see is_joinable()), since the cursors cannot go
+ *  back. All the methods are thread-safe. The wake handlers are
+ *  called without holding the lock, but may be called by any thread
+ *  that uses the session: they should just post some work.
+ */
+template <class Encoder, class Source>
+class stream_session {
+public:
+  typedef Encoder encoder_type;
+  typedef Source source_type;
+  typedef std::size_t subscriber_id;
+  typedef std::chrono::steady_clock clock;
+
+  /** Default of max_cached_per_block(). */
+  static constexpr std::size_t DEFAULT_MAX_CACHED = 0x10000;
+
+  /** Result of next_coded(). */
+  enum read_status {
+    session_ready, // Some packets were read
+    session_wait, // The subscriber must wait for the frontier
+    session_end // There are no more packets
+  };
+
+  stream_session() :
+    basic_lg(boost::log::keywords::channel = log::basic),
+    perf_lg(boost::log::keywords::channel = log::performance),
+    max_per_block(Encoder::MAX_SEQNO),
+    max_cached(DEFAULT_MAX_CACHED),
+    max_block_time_(std::chrono::seconds(5)),
+    next_id(0),
+    has_advanced(false),
+    has_ended(false),
+    read_count(0) {
+  }
+
+  /** Replace the encoder with a new one built using the given
+   *  parameters.
+   */
+  template<typename ...Args>
+  void setup_encoder(Args... args) {
+    std::lock_guard<std::mutex> lck(mtx);
+    encoder_ = std::make_unique<Encoder>(args...);
+  }
+
+  /** Replace the source with a new one built using the given
+   *  parameters.
+   */
+  template<typename ...Args>
+  void setup_source(Args... args) {
+    std::lock_guard<std::mutex> lck(mtx);
+    source_ = std::make_unique<Source>(args...);
+  }
+
+  /** Return a reference to the source object. */
+  Source &source() const {
+    return *source_;
+  }
+
+  /** Return a const reference to the encoder object. */
+  const Encoder &encoder() const {
+    return *encoder_;
+  }
+
+  /** Set the maximum number of coded packets generated for each
+   *  block.
+   */
+  void max_sequence_number(std::size_t m) {
+    if (m > Encoder::MAX_SEQNO)
+      throw std::overflow_error("Cannot exceed the Encoder's limit");
+    if (m < 1)
+      throw std::underflow_error("Must send at least one packet");
+    std::lock_guard<std::mutex> lck(mtx);
+    max_per_block = m;
+  }
+
+  /** Set the maximum number of coded packets of a block that are
+   *  cached, and so read by any subscriber.
+   */
+  void max_cached_per_block(std::size_t m) {
+    if (m < 1)
+      throw std::underflow_error("Must cache at least one packet");
+    std::lock_guard<std::mutex> lck(mtx);
+    max_cached = m;
+  }
+
+  std::size_t max_cached_per_block() const {
+    std::lock_guard<std::mutex> lck(mtx);
+    return max_cached;
+  }
+
+  /** Set the time after which the subscribers that hold the frontier
+   *  block are pushed to the next one, or evicted if idle.
+   */
+  void max_block_time(clock::duration t) {
+    if (t <= clock::duration::zero())
+      throw std::invalid_argument("The block time must be positive");
+    std::lock_guard<std::mutex> lck(mtx);
+    max_block_time_ = t;
+  }
+
+  clock::duration max_block_time() const {
+    std::lock_guard<std::mutex> lck(mtx);
+    return max_block_time_;
+  }
+
+  /** Add a subscriber that starts from the first coded packet of the
+   *  frontier block. The handler `wake` is called when a subscriber
+   *  that got session_wait can read again. If the session is not
+   *  joinable throw a logic_error.
+   */
+  subscriber_id subscribe(const std::function<void()> &wake,
+			  bool follower = false) {
+    std::lock_guard<std::mutex> lck(mtx);
+    if (has_advanced || has_ended)
+      throw std::logic_error("The session has already moved past the first block");
+    load_block();
+    auto now = clock::now();
+    if (cursors.empty()) frontier_time = now;
+    cursor c;
+    c.blockno = encoder_->blockno();
+    c.index = 0;
+    c.follower = follower;
+    c.waiting = false;
+    c.evicted = false;
+    c.last_active = now;
+    c.wake = wake;
+    subscriber_id id = next_id++;
+    cursors.insert(std::make_pair(id, c));
+    BOOST_LOG_SEV(basic_lg, log::debug) << "New stream_session subscriber "
+					<< id << " follower="
+					<< std::boolalpha << follower;
+    return id;
+  }
+
+  /** Remove a subscriber. The frontier can then move past its block. */
+  void unsubscribe(subscriber_id id) {
+    std::vector<std::function<void()>> wakes;
+    {
+      std::lock_guard<std::mutex> lck(mtx);
+      if (cursors.erase(id) == 0) return;
+      advance(wakes);
+    }
+    call_all(wakes);
+  }
+
+  /** True when new subscribers can be added. */
+  bool is_joinable() const {
+    std::lock_guard<std::mutex> lck(mtx);
+    return !has_advanced && !has_ended;
+  }
+
+  /** True when all the blocks have been coded and passed by the
+   *  subscribers.
+   */
+  bool is_ended() const {
+    std::lock_guard<std::mutex> lck(mtx);
+    return has_ended;
+  }
+
+  /** Append to `out` up to `max_count` coded packets of the frontier
+   *  block, without reading more than `limit` packets of the block
+   *  for this subscriber. The packets share their data with the
+   *  cache.
+   */
+  read_status next_coded(subscriber_id id,
+			 std::size_t max_count,
+			 std::size_t limit,
+			 std::vector<fountain_packet> &out) {
+    std::vector<std::function<void()>> wakes;
+    read_status st;
+    {
+      std::lock_guard<std::mutex> lck(mtx);
+      st = read(id, max_count, limit, out, wakes);
+    }
+    call_all(wakes);
+    return st;
+  }
+
+  /** Record that the client of a subscriber wants the block
+   *  `blockno`. Return true if the subscriber left the frontier
+   *  block: the packets it has not sent yet are no longer useful.
+   */
+  bool acknowledge(subscriber_id id, std::size_t blockno) {
+    std::vector<std::function<void()>> wakes;
+    bool moved = false;
+    {
+      std::lock_guard<std::mutex> lck(mtx);
+      auto i = cursors.find(id);
+      if (i == cursors.end()) return false;
+      cursor &c = i->second;
+      if (c.follower || c.evicted || has_ended) return false;
+      c.last_active = clock::now();
+
+      std::size_t d = distance_from_frontier(blockno);
+      if (d == 0 || d > Encoder::BLOCK_WINDOW) return false; // Old ACK
+      if (d > distance_from_frontier(c.blockno)) {
+	moved = c.blockno == encoder_->blockno();
+	c.blockno = blockno;
+	advance(wakes);
+      }
+    }
+    call_all(wakes);
+    return moved;
+  }
+
+  /** Block number of the frontier block. */
+  std::size_t blockno() const {
+    std::lock_guard<std::mutex> lck(mtx);
+    return encoder_->blockno();
+  }
+
+  /** Number of subscribers. */
+  std::size_t subscriber_count() const {
+    std::lock_guard<std::mutex> lck(mtx);
+    return cursors.size();
+  }
+
+  /** Total number of coded packets generated by the encoder. */
+  std::size_t total_coded_count() const {
+    std::lock_guard<std::mutex> lck(mtx);
+    return encoder_->total_coded_count() + encoder_->coded_count();
+  }
+
+  /** Total number of coded packets read by all the subscribers. */
+  std::size_t total_read_count() const {
+    std::lock_guard<std::mutex> lck(mtx);
+    return read_count;
+  }
+
+private:
+  /** Position of a subscriber in the stream. */
+  struct cursor {
+    std::size_t blockno; /**< Block that the subscriber wants. It is
+			  *   the frontier or a block ahead of it.
+			  */
+    std::size_t index; /**< Next packet to read in the frontier block. */
+    bool follower;
+    bool waiting; /**< Set when it got session_wait. */
+    bool evicted; /**< Set when it held the frontier while idle. */
+    clock::time_point last_active; /**< Last read or ACK. */
+    std::function<void()> wake;
+  };
+
+  log::default_logger basic_lg, perf_lg;
+
+  mutable std::mutex mtx;
+  std::unique_ptr<Encoder> encoder_;
+  std::unique_ptr<Source> source_;
+  std::size_t max_per_block;
+  std::size_t max_cached; /**< Maximum size of block_cache. */
+  clock::duration max_block_time_;
+  std::vector<fountain_packet> block_cache; /**< Coded packets of the
+					     *   frontier block.
+					     */
+  clock::time_point frontier_time; /**< When the frontier moved to the
+				    *   current block.
+				    */
+  std::map<subscriber_id, cursor> cursors;
+  subscriber_id next_id;
+  bool has_advanced; /**< Set when the frontier has moved past the
+		      *   first block.
+		      */
+  bool has_ended;
+  std::size_t read_count;
+
+  /** Forward distance from the frontier to `bn`. */
+  std::size_t distance_from_frontier(std::size_t bn) const {
+    circular_counter<std::size_t>
+      frontier(Encoder::MAX_BLOCKNO),
+      other(Encoder::MAX_BLOCKNO);
+    frontier.set(encoder_->blockno());
+    other.set(bn);
+    return frontier.forward_distance(other);
+  }
+
+  /** Load the encoder until it has a full block, padding the last
+   *  partial one. Set has_ended when there is no more data.
+   */
+  void load_block() {
+    while (*source_ && !encoder_->has_block()) {
+      encoder_->push(source_->next_packet());
+    }
+    if (!encoder_->has_block() && encoder_->size() > 0) {
+      BOOST_LOG_SEV(basic_lg, log::debug) <<
+	"Session encoder left with partial data: padding";
+      encoder_->pad_partial_block();
+    }
+    if (!*encoder_) {
+      BOOST_LOG_SEV(basic_lg, log::info) << "Session out of data";
+      has_ended = true;
+    }
+  }
+
+  /** True when no subscriber holds the frontier block. */
+  bool frontier_passed() const {
+    bool any = false;
+    for (const auto &i : cursors) {
+      const cursor &c = i.second;
+      if (c.follower || c.evicted) continue;
+      if (c.blockno == encoder_->blockno()) return false;
+      any = true;
+    }
+    return any;
+  }
+
+  /** Move the frontier while all the subscribers have passed it and
+   *  collect the handlers of the subscribers that can read again.
+   */
+  void advance(std::vector<std::function<void()>> &wakes) {
+    bool moved = false;
+    while (!has_ended && frontier_passed()) {
+      BOOST_LOG(perf_lg) << "stream_session::advance"
+			 << " blockno=" << encoder_->blockno()
+			 << " coded_pkts=" << encoder_->coded_count()
+			 << " subscribers=" << cursors.size();
+      encoder_->next_block();
+      block_cache.clear();
+      load_block();
+      frontier_time = clock::now();
+      has_advanced = true;
+      moved = true;
+    }
+    if (!moved && !has_ended) return;
+
+    for (auto &i : cursors) {
+      cursor &c = i.second;
+      if (c.follower) c.blockno = encoder_->blockno();
+      if (c.blockno == encoder_->blockno()) c.index = 0;
+      if (c.waiting &&
+	  (has_ended || c.evicted || c.blockno == encoder_->blockno())) {
+	c.waiting = false;
+	if (c.wake) wakes.push_back(c.wake);
+      }
+    }
+  }
+
+  /** Implementation of next_coded(). Must hold the lock. */
+  read_status read(subscriber_id id, std::size_t max_count,
+		   std::size_t limit, std::vector<fountain_packet> &out,
+		   std::vector<std::function<void()>> &wakes) {
+    auto i = cursors.find(id);
+    if (i == cursors.end())
+      throw std::invalid_argument("Unknown subscriber");
+    cursor &c = i->second;
+    limit = std::min({limit, max_per_block, max_cached});
+    auto now = clock::now();
+    c.last_active = now;
+    expire_frontier(now, wakes);
+
+    for (;;) {
+      if (has_ended || c.evicted) return session_end;
+      if (c.blockno != encoder_->blockno()) {
+	c.waiting = true;
+	return session_wait;
+      }
+
+      std::size_t count = 0;
+      while (count < max_count && c.index < limit) {
+	if (c.index == block_cache.size())
+	  block_cache.push_back(encoder_->next_coded());
+	out.push_back(block_cache[c.index].shallow_copy());
+	++c.index;
+	++count;
+      }
+      read_count += count;
+      if (count > 0 || max_count == 0) return session_ready;
+
+      // This subscriber reached the limit of the frontier block
+      std::size_t next_bn = encoder_->block_number_counter().next();
+      if (c.follower) {
+	for (auto &j : cursors) {
+	  if (j.second.blockno == encoder_->blockno())
+	    j.second.blockno = next_bn;
+	}
+      }
+      else {
+	c.blockno = next_bn;
+      }
+      advance(wakes);
+    }
+  }
+
+  /** Push to the next block the subscribers that have held the
+   *  frontier for more than max_block_time_, evicting the idle ones.
+   */
+  void expire_frontier(clock::time_point now,
+		       std::vector<std::function<void()>> &wakes) {
+    if (has_ended || now - frontier_time < max_block_time_) return;
+
+    std::size_t next_bn = encoder_->block_number_counter().next();
+    for (auto &i : cursors) {
+      cursor &c = i.second;
+      if (c.follower || c.evicted || c.blockno != encoder_->blockno())
+	continue;
+      if (now - c.last_active >= max_block_time_) {
+	BOOST_LOG_SEV(basic_lg, log::warning) << "Evicted the idle"
+					      << " stream_session subscriber "
+					      << i.first;
+	c.evicted = true;
+      }
+      else {
+	BOOST_LOG_SEV(basic_lg, log::info) << "Pushed the stream_session"
+					   << " subscriber " << i.first
+					   << " to block " << next_bn;
+	c.blockno = next_bn;
+      }
+    }
+    frontier_time = now; // Check again after another max_block_time_
+    advance(wakes);
+  }
+
+  /** Call the collected wake handlers. */
+  static void call_all(const std::vector<std::function<void()>> &wakes) {
+    for (const auto &w : wakes) w();
+  }
+};
+
+template <class Encoder, class Source>
+constexpr std::size_t stream_session<Encoder, Source>::DEFAULT_MAX_CACHED;
+
+}}
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef UEP_TOKEN_BUCKET_HPP
+#define UEP_TOKEN_BUCKET_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace uep {
+
+/** Token bucket used to pace a flow at a given average rate.
+ *
+ *  Tokens accumulate at rate() per second, up to depth(). Consuming
+ *  `n` tokens succeeds only when at least `n` are available, so the
+ *  flow can burst up to depth() and is otherwise held at rate(). A
+ *  rate that is not finite and positive disables the limit.
+ *
+ *  The current time is always passed explicitly by the caller.
+ */
+class token_bucket {
+public:
+  typedef std::chrono::steady_clock clock;
+  typedef clock::time_point time_point;
+  typedef clock::duration duration;
+
+  /** Construct an unlimited token bucket. */
+  token_bucket() :
+    token_bucket(std::numeric_limits<double>::infinity(), 0) {
+  }
+
+  /** Construct a token bucket with the given rate (tokens/s) and
+   *  depth. The bucket starts full at the first call to reset().
+   */
+  explicit token_bucket(double rate, double depth) :
+    rate_(rate),
+    depth_(depth),
+    tokens_(depth),
+    has_started(false) {
+    if (depth_ < 0) throw std::invalid_argument("The depth cannot be < 0");
+  }
+
+  /** Fill the bucket and restart the accumulation from `now`. */
+  void reset(time_point now) {
+    tokens_ = depth_;
+    last_fill = now;
+    has_started = true;
+  }
+
+  /** Change the rate and depth. The tokens accumulated up to `now`
+   *  are kept, up to the new depth.
+   */
+  void configure(double rate, double depth, time_point now) {
+    if (depth < 0) throw std::invalid_argument("The depth cannot be < 0");
+    refill(now);
+    rate_ = rate;
+    depth_ = depth;
+    tokens_ = std::min(tokens_, depth_);
+  }
+
+  /** Try to take `n` tokens from the bucket. Return false, without
+   *  taking any, when there are not enough tokens at time `now`.
+   */
+  bool consume(double n, time_point now) {
+    if (unlimited()) return true;
+    refill(now);
+    if (tokens_ < n) return false;
+    tokens_ -= n;
+    return true;
+  }
+
+  /** Return the time to wait, starting from `now`, before `n` tokens
+   *  are available.
+   */
+  duration wait_time(double n, time_point now) const {
+    if (unlimited()) return duration::zero();
+    if (n > depth_)
+      throw std::invalid_argument("Cannot wait for more tokens than the depth");
+    double missing = n - available(now);
+    if (missing <= 0) return duration::zero();
+    std::chrono::duration<double> secs(missing / rate_);
+    // Round up: after the wait the tokens must be available
+    return std::chrono::duration_cast<duration>(secs) + duration(1);
+  }
+
+  /** Number of tokens available at time `now`. */
+  double available(time_point now) const {
+    if (unlimited()) return std::numeric_limits<double>::infinity();
+    if (!has_started || now <= last_fill) return tokens_;
+    std::chrono::duration<double> dt = now - last_fill;
+    return std::min(depth_, tokens_ + rate_ * dt.count());
+  }
+
+  /** True when the rate is not limited. */
+  bool unlimited() const {
+    return !std::isfinite(rate_) || rate_ <= 0;
+  }
+
+  /** Return the rate in tokens/s. */
+  double rate() const {
+    return rate_;
+  }
+
+  /** Return the maximum number of tokens that can be held. */
+  double depth() const {
+    return depth_;
+  }
+
+private:
+  double rate_;
+  double depth_;
+  double tokens_;
+  time_point last_fill; /**< Time up to which the tokens have been
+			 *   accumulated.
+			 */
+  bool has_started; /**< Set after the first reset. */
+
+  /** Accumulate the tokens up to time `now`. */
+  void refill(time_point now) {
+    if (!has_started) {
+      reset(now);
+      return;
+    }
+    tokens_ = available(now);
+    if (now > last_fill) last_fill = now;
+  }
+};
+
+}
+
+#endif
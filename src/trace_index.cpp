@@ -0,0 +1,255 @@
+#include "trace_index.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+namespace uep {
+
+constexpr std::uint8_t trace_record::discardable_flag;
+constexpr std::uint8_t trace_record::truncatable_flag;
+
+const char trace_index::MAGIC[8] = {'U','E','P','T','I','D','X','\0'};
+const std::uint32_t trace_index::VERSION;
+
+trace_record trace_record::from_stream_trace(const streamTrace &st) {
+  trace_record r;
+  r.offset = st.startPos;
+  r.len = static_cast<std::uint32_t>(st.len);
+  r.lid = static_cast<std::uint16_t>(st.lid);
+  r.tid = static_cast<std::uint16_t>(st.tid);
+  r.qid = static_cast<std::uint16_t>(st.qid);
+  r.type = static_cast<std::uint8_t>(st.packetType);
+  r.flags = (st.discardable ? discardable_flag : 0) |
+    (st.truncatable ? truncatable_flag : 0);
+  r.reserved = 0;
+  return r;
+}
+
+streamTrace trace_record::to_stream_trace() const {
+  streamTrace st;
+  st.startPos = offset;
+  st.len = static_cast<int>(len);
+  st.lid = lid;
+  st.tid = tid;
+  st.qid = qid;
+  st.packetType = static_cast<streamTrace::packet_type_t>(type);
+  st.discardable = (flags & discardable_flag) != 0;
+  st.truncatable = (flags & truncatable_flag) != 0;
+  return st;
+}
+
+namespace {
+
+/** Cursor over the fields of a line of the text trace. The text
+ *  must be null-terminated after the last line.
+ */
+struct line_parser {
+  const char *p;
+  const char *end;
+
+  void skip_spaces() {
+    while (p != end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+  }
+
+  /** Return the next whitespace-separated word. */
+  std::string word() {
+    skip_spaces();
+    const char *b = p;
+    while (p != end && *p != ' ' && *p != '\t' && *p != '\r') ++p;
+    return std::string(b, p);
+  }
+
+  unsigned long long number(int base) {
+    skip_spaces();
+    char *num_end;
+    unsigned long long n = std::strtoull(p, &num_end, base);
+    if (num_end == p || num_end > end)
+      throw std::runtime_error("Malformed trace line");
+    p = num_end;
+    return n;
+  }
+
+  bool yes_no() {
+    std::string w = word();
+    if (w == "Yes") return true;
+    if (w == "No") return false;
+    throw std::runtime_error("Unknown Yes/No field in the trace");
+  }
+};
+
+std::runtime_error bad_index(const std::string &path, const std::string &why) {
+  return std::runtime_error("Invalid trace index " + path + ": " + why);
+}
+
+/** Modification time of a file in nanoseconds since the epoch. */
+std::uint64_t mtime_ns(const struct stat &st) {
+  return static_cast<std::uint64_t>(st.st_mtim.tv_sec) * 1000000000 +
+    st.st_mtim.tv_nsec;
+}
+
+}
+
+trace_index::trace_index() :
+  records(nullptr),
+  count(0),
+  trace_size(0),
+  trace_mtime(0) {
+}
+
+trace_index trace_index::parse(std::istream &trace) {
+  const std::string text{std::istreambuf_iterator<char>(trace),
+			 std::istreambuf_iterator<char>()};
+  trace_index ti;
+  const char *p = text.c_str();
+  const char *text_end = p + text.size();
+  while (p != text_end) {
+    const char *eol = static_cast<const char*>(std::memchr(p, '\n', text_end - p));
+    if (!eol) eol = text_end;
+    line_parser lp{p, eol};
+    p = eol == text_end ? eol : eol + 1;
+
+    // Skip the lines that are not NALs: the header and empty lines
+    lp.skip_spaces();
+    if (lp.end - lp.p < 2 || lp.p[0] != '0' ||
+	(lp.p[1] != 'x' && lp.p[1] != 'X'))
+      continue;
+
+    trace_record r;
+    r.offset = lp.number(16);
+    r.len = static_cast<std::uint32_t>(lp.number(10));
+    r.lid = static_cast<std::uint16_t>(lp.number(10));
+    r.tid = static_cast<std::uint16_t>(lp.number(10));
+    r.qid = static_cast<std::uint16_t>(lp.number(10));
+
+    std::string type = lp.word();
+    if (type == "StreamHeader") {
+      r.type = streamTrace::stream_header;
+    }
+    else if (type == "ParameterSet") {
+      r.type = streamTrace::parameter_set;
+    }
+    else if (type == "SliceData") {
+      r.type = streamTrace::slice_data;
+    }
+    else throw std::runtime_error("Unknown packet type in the trace");
+
+    r.flags = 0;
+    if (lp.yes_no()) r.flags |= trace_record::discardable_flag;
+    if (lp.yes_no()) r.flags |= trace_record::truncatable_flag;
+    r.reserved = 0;
+    ti.owned.push_back(r);
+  }
+  ti.records = ti.owned.data();
+  ti.count = ti.owned.size();
+  return ti;
+}
+
+trace_index trace_index::parse_file(const std::string &trace_path) {
+  // Stat before reading: a trace changed meanwhile makes a stale index
+  struct stat st;
+  std::ifstream ifs(trace_path, std::ios_base::binary);
+  if (!ifs || ::stat(trace_path.c_str(), &st) != 0)
+    throw std::ios_base::failure("Failed to open the trace file");
+  trace_index ti = parse(ifs);
+  ti.trace_size = st.st_size;
+  ti.trace_mtime = mtime_ns(st);
+  return ti;
+}
+
+trace_index trace_index::open(const std::string &index_path) {
+  trace_index ti;
+  ti.mapping = mapped_file::open_shared(index_path);
+  const mapped_file &m = *ti.mapping;
+
+  if (m.size() < sizeof(trace_index_header))
+    throw bad_index(index_path, "too short");
+  const auto &hdr = *reinterpret_cast<const trace_index_header*>(m.data());
+  if (std::memcmp(hdr.magic, MAGIC, sizeof(MAGIC)) != 0)
+    throw bad_index(index_path, "wrong magic");
+  if (hdr.version != VERSION)
+    throw bad_index(index_path, "unsupported version or byte order");
+  if (hdr.record_size != sizeof(trace_record))
+    throw bad_index(index_path, "wrong record size");
+  // Divide, since a corrupt count can overflow the product
+  const std::size_t body = m.size() - sizeof(trace_index_header);
+  if (body % sizeof(trace_record) != 0 ||
+      body / sizeof(trace_record) != hdr.count)
+    throw bad_index(index_path, "wrong size");
+
+  // The mapping is page-aligned and the header keeps the records aligned
+  ti.records = reinterpret_cast<const trace_record*>(m.data() +
+						     sizeof(trace_index_header));
+  ti.count = hdr.count;
+  ti.trace_size = hdr.trace_size;
+  ti.trace_mtime = hdr.trace_mtime;
+  return ti;
+}
+
+trace_index trace_index::load(const std::string &trace_path) {
+  std::string ip = index_path(trace_path);
+  struct stat st;
+  if (::stat(ip.c_str(), &st) == 0) {
+    if (::stat(trace_path.c_str(), &st) != 0) return open(ip);
+
+    // Reparse a stale index, or one in an older format
+    try {
+      trace_index ti = open(ip);
+      if (ti.trace_mtime != 0 &&
+	  ti.trace_size == static_cast<std::uint64_t>(st.st_size) &&
+	  ti.trace_mtime == mtime_ns(st))
+	return ti;
+    }
+    catch (const std::runtime_error&) {
+    }
+  }
+
+  return parse_file(trace_path);
+}
+
+std::string trace_index::index_path(const std::string &trace_path) {
+  return trace_path + ".idx";
+}
+
+void trace_index::write(std::ostream &out) const {
+  trace_index_header hdr;
+  std::memcpy(hdr.magic, MAGIC, sizeof(MAGIC));
+  hdr.version = VERSION;
+  hdr.record_size = sizeof(trace_record);
+  hdr.count = count;
+  hdr.trace_size = trace_size;
+  hdr.trace_mtime = trace_mtime;
+  out.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+  out.write(reinterpret_cast<const char*>(records), count * sizeof(trace_record));
+  if (!out) throw std::ios_base::failure("Failed to write the trace index");
+}
+
+std::size_t trace_index::size() const {
+  return count;
+}
+
+bool trace_index::empty() const {
+  return count == 0;
+}
+
+const trace_record &trace_index::operator[](std::size_t i) const {
+  return records[i];
+}
+
+const trace_record *trace_index::begin() const {
+  return records;
+}
+
+const trace_record *trace_index::end() const {
+  return records + count;
+}
+
+bool trace_index::is_mapped() const {
+  return static_cast<bool>(mapping);
+}
+
+}
@@ -0,0 +1,119 @@
+#ifndef UEP_TRACE_INDEX_HPP
+#define UEP_TRACE_INDEX_HPP
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "lt_param_set.hpp"
+#include "mapped_file.hpp"
+
+namespace uep {
+
+/** Fixed-size record of a NAL unit in a binary trace index. */
+struct trace_record {
+  static constexpr std::uint8_t discardable_flag = 0x01;
+  static constexpr std::uint8_t truncatable_flag = 0x02;
+
+  std::uint64_t offset; /**< Offset of the NAL in the bitstream. */
+  std::uint32_t len; /**< Length of the NAL. */
+  std::uint16_t lid;
+  std::uint16_t tid;
+  std::uint16_t qid;
+  std::uint8_t type; /**< A streamTrace::packet_type_t. */
+  std::uint8_t flags; /**< Bitwise OR of the flags above. */
+  std::uint32_t reserved; /**< Always zero. */
+
+  /** Build the record of a parsed trace line. */
+  static trace_record from_stream_trace(const streamTrace &st);
+  /** Convert back to the representation used by the readers. */
+  streamTrace to_stream_trace() const;
+};
+static_assert(sizeof(trace_record) == 24, "Unexpected trace_record padding");
+
+/** Header at the start of a binary trace index. The header and the
+ *  records are stored in the native byte order.
+ */
+struct trace_index_header {
+  char magic[8]; /**< Always trace_index::MAGIC. */
+  std::uint32_t version;
+  std::uint32_t record_size; /**< Must be sizeof(trace_record). */
+  std::uint64_t count; /**< Number of records after the header. */
+  std::uint64_t trace_size; /**< Size of the indexed text trace. */
+  /** Modification time of the indexed text trace, in nanoseconds
+   *  since the epoch. Zero if unknown.
+   */
+  std::uint64_t trace_mtime;
+};
+static_assert(sizeof(trace_index_header) == 40,
+	      "Unexpected trace_index_header padding");
+
+/** Index of the NAL units of an H264 bitstream.
+ *
+ *  It is either parsed from a JSVM text trace or memory-mapped from
+ *  a binary index written by write(). Opening a binary index takes
+ *  constant time, whatever the length of the stream.
+ */
+class trace_index {
+public:
+  static const char MAGIC[8];
+  static const std::uint32_t VERSION = 2;
+
+  /** Construct an empty index. */
+  trace_index();
+  trace_index(const trace_index&) = delete;
+  trace_index(trace_index&&) = default;
+  trace_index &operator=(const trace_index&) = delete;
+  trace_index &operator=(trace_index&&) = default;
+
+  /** Parse a JSVM text trace. The lines that do not describe a NAL
+   *  are skipped. Throw std::runtime_error on malformed lines.
+   */
+  static trace_index parse(std::istream &trace);
+  /** Parse the text trace at `trace_path` and remember its size and
+   *  modification time, which write() stores in the index.
+   */
+  static trace_index parse_file(const std::string &trace_path);
+  /** Map a binary index. Throw std::runtime_error if it is not
+   *  valid.
+   */
+  static trace_index open(const std::string &index_path);
+  /** Load the index of the text trace `trace_path`: map
+   *  index_path(trace_path) if it exists and was written from the
+   *  current trace, with the same size and modification time,
+   *  otherwise parse the text trace. A valid index is used as is when
+   *  the trace is missing.
+   */
+  static trace_index load(const std::string &trace_path);
+  /** Name of the binary index of a text trace. */
+  static std::string index_path(const std::string &trace_path);
+
+  /** Write the binary index to `out`. */
+  void write(std::ostream &out) const;
+
+  /** Number of NAL units. */
+  std::size_t size() const;
+  bool empty() const;
+  /** Record of the i-th NAL unit. */
+  const trace_record &operator[](std::size_t i) const;
+  const trace_record *begin() const;
+  const trace_record *end() const;
+
+  /** True if the records are memory-mapped from a binary index. */
+  bool is_mapped() const;
+
+private:
+  std::shared_ptr<const mapped_file> mapping;
+  std::vector<trace_record> owned; /**< Records of a parsed trace. */
+  const trace_record *records;
+  std::size_t count;
+  std::uint64_t trace_size; /**< See trace_index_header. */
+  std::uint64_t trace_mtime;
+};
+
+}
+
+#endif
@@ -4,6 +4,9 @@ using namespace std;
 
 namespace uep {
 
+constexpr std::size_t uep_decoder::MAX_BLOCKNO;
+constexpr std::size_t uep_decoder::BLOCK_WINDOW;
+
 uep_decoder::uep_decoder(const parameter_set &ps) :
   uep_decoder(ps.Ks.begin(), ps.Ks.end(),
 	      ps.RFs.begin(), ps.RFs.end(),
@@ -69,6 +72,10 @@ void uep_decoder::flush(std::size_t blockno_) {
   deduplicate_queued();
 }
 
+void uep_decoder::first_block_number(std::size_t blockno_) {
+  std_dec->first_block_number(blockno_);
+}
+
 void uep_decoder::flush_n_blocks(std::size_t n) {
   std_dec->flush_n_blocks(n);
   deduplicate_queued();
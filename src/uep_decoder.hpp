@@ -80,6 +80,11 @@ public:
    */
   void flush_n_blocks(std::size_t n);
 
+  /** Expect the first block to be numbered `blockno_` instead of
+   *  zero. \sa lt_decoder::first_block_number
+   */
+  void first_block_number(std::size_t blockno_);
+
   /** Return true if the current block has been decoded. */
   bool has_decoded() const;
   /** Return the output block size. */
@@ -200,6 +205,8 @@ uep_decoder::uep_decoder(KsIter ks_begin, KsIter ks_end,
 template <class Iter>
 void uep_decoder::push(Iter first, Iter last) {
   using namespace std::chrono;
+  static metrics::histogram &push_ns =
+    metrics::get_histogram("uep_decoder.push_ns");
 
   auto tic = high_resolution_clock::now();
 
@@ -208,8 +215,8 @@ void uep_decoder::push(Iter first, Iter last) {
 
   duration<double> push_tdiff = high_resolution_clock::now() - tic;
   _avg_dec_time.add_sample(push_tdiff.count());
-  BOOST_LOG(perf_lg) << "uep_decoder::push push_time="
-		     << push_tdiff.count();
+  UEP_TRACE(perf_trace::uep_decoder_push_time, push_tdiff.count());
+  push_ns.record(push_tdiff);
 }
 
 }
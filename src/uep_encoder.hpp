@@ -3,6 +3,7 @@
 
 #include "encoder.hpp"
 #include "lt_param_set.hpp"
+#include "metrics.hpp"
 
 namespace uep {
 
@@ -69,6 +70,10 @@ public:
    *  packets to skip.
    */
   void next_block(std::size_t bn);
+  /** Number the current block as `bn` instead of zero.
+   *  \sa lt_encoder::first_block_number
+   */
+  void first_block_number(std::size_t bn);
 
   /** Return true when the encoder has been passed at least K packets
    *  and is ready to produce a coded packet.
@@ -208,6 +213,9 @@ void uep_encoder<Gen>::push(const fountain_packet &p) {
 
 template <class Gen>
 void uep_encoder<Gen>::push(fountain_packet &&p) {
+  static metrics::gauge &queued =
+    metrics::get_gauge("uep_encoder.queued_pkts");
+
   if (pktsize == 0) pktsize = p.buffer().size();
   else if (pktsize != p.buffer().size()) {
     throw std::invalid_argument("The packets must have the same size");
@@ -216,10 +224,8 @@ void uep_encoder<Gen>::push(fountain_packet &&p) {
   uep_packet up(std::move(p.buffer()));
   up.priority(p.getPriority());
   up.sequence_number(seqno_ctr.value());
-  BOOST_LOG(perf_lg) << "uep_encoder::push new_packet"
-		     << " orig_size=" << up.buffer().size()
-		     << " priority=" << up.priority()
-		     << " seqno=" << up.sequence_number();
+  UEP_TRACE(perf_trace::uep_encoder_push_new_packet,
+	    up.buffer().size(), up.priority(), up.sequence_number());
 
   if (inp_queues.size() <= up.priority())
     throw std::runtime_error("Priority is out of range");
@@ -227,6 +233,7 @@ void uep_encoder<Gen>::push(fountain_packet &&p) {
   seqno_ctr.next();
 
   check_has_block();
+  queued.set(queue_size());
 }
 
 template <class Gen>
@@ -279,6 +286,11 @@ void uep_encoder<Gen>::next_block() {
   check_has_block();
 }
 
+template <class Gen>
+void uep_encoder<Gen>::first_block_number(std::size_t bn) {
+  std_enc->first_block_number(bn);
+}
+
 template <class Gen>
 void uep_encoder<Gen>::next_block(std::size_t bn) {
   auto curr_bnc = std_enc->block_number_counter();
@@ -0,0 +1,481 @@
+#include "uep_simulation.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+#include <time.h>
+
+#include "bit_parallel_mp.hpp"
+#include "message_passing.hpp"
+#include "rng.hpp"
+#include "utils.hpp"
+
+namespace uep { namespace sim {
+
+namespace {
+
+/** Blocks taken by a worker at a time. */
+const std::size_t BLOCKS_PER_CHUNK = 16;
+/** Groups of bit-parallel blocks taken by a worker at a time. */
+const std::size_t GROUPS_PER_CHUNK = 1;
+
+/** Streams of random numbers used for each block. */
+enum block_stream {
+  rows_stream = 0,
+  channel_stream = 1
+};
+
+/** Seed of an independent stream for a block. */
+std::uint32_t block_seed(std::uint64_t seed, std::size_t block,
+			 block_stream s) {
+  std::seed_seq seq{static_cast<std::uint32_t>(seed),
+		    static_cast<std::uint32_t>(seed >> 32),
+		    static_cast<std::uint32_t>(block),
+		    static_cast<std::uint32_t>(std::uint64_t(block) >> 32),
+		    static_cast<std::uint32_t>(s)};
+  std::uint32_t out;
+  seq.generate(&out, &out + 1);
+  return out;
+}
+
+/** CPU time used by the calling thread. */
+double thread_cpu_time() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/** Transition probabilities of the channel used by a simulation. */
+struct channel_model {
+  bool enabled; /**< False for an error-free channel. */
+  double p01, p10;
+
+  explicit channel_model(const uep_sim_parameters &p) {
+    if (p.iid_per > 0) {
+      enabled = true;
+      p01 = p.iid_per;
+      p10 = 1 - p.iid_per;
+    }
+    else {
+      enabled = p.markov_pGB != 0 && p.markov_pBG != 1;
+      p01 = p.markov_pGB;
+      p10 = p.markov_pBG;
+    }
+  }
+};
+
+/** Packets per block with the given overhead. */
+std::size_t packets_per_block(std::size_t K, double overhead) {
+  return std::ceil(K * (1 + overhead));
+}
+
+/** Run `work(worker, unit)` for the units [0, nunits) on a pool of
+ *  threads, `chunk` units at a time. Each thread builds its worker
+ *  with `make_worker()` and passes it to `merge` under a lock at the
+ *  end. The first exception thrown by a thread is rethrown.
+ */
+template <class MakeWorker, class Work, class Merge>
+void run_on_pool(std::size_t nthreads, std::size_t nunits, std::size_t chunk,
+		 MakeWorker make_worker, Work work, Merge merge) {
+  if (nthreads == 0) {
+    nthreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  nthreads = std::min(nthreads, (nunits + chunk - 1) / chunk);
+
+  std::atomic<std::size_t> next_unit(0);
+  std::mutex merge_mutex;
+  std::exception_ptr error;
+
+  auto thread_main = [&]() {
+    try {
+      auto w = make_worker();
+      for (;;) {
+	std::size_t first = next_unit.fetch_add(chunk);
+	if (first >= nunits) break;
+	std::size_t last = std::min(first + chunk, nunits);
+	for (std::size_t u = first; u < last; ++u) work(w, u);
+      }
+      std::lock_guard<std::mutex> lock(merge_mutex);
+      merge(w);
+    }
+    catch (...) {
+      // Stop the other workers
+      next_unit.store(nunits);
+      std::lock_guard<std::mutex> lock(merge_mutex);
+      if (!error) error = std::current_exception();
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (std::size_t i = 1; i < nthreads; ++i) workers.emplace_back(thread_main);
+  thread_main();
+  for (auto &t : workers) t.join();
+
+  if (error) std::rethrow_exception(error);
+}
+
+/** Simulate the blocks assigned to one thread. */
+class sim_worker {
+public:
+  sim_worker(const uep_sim_parameters &p, const uep_row_generator &rg) :
+    params(p),
+    rowgen(rg),
+    res(p.Ks.size()),
+    chan(p),
+    bp_ctx(rg.K()) {
+  }
+
+  void run_block(std::size_t b, std::size_t n) {
+    double t = thread_cpu_time();
+    rowgen.reset(block_seed(params.seed, b, rows_stream));
+    // The channel starts in the stationary state at each block
+    markov2_distribution channel(chan.p01, chan.p10,
+				 block_seed(params.seed, b, channel_stream));
+    // A reset context would remember the hash tables of the previous
+    // blocks, which changes the order of decoding and the ripple
+    mp::mp_context<bool> ctx(rowgen.K());
+    for (std::size_t l = 0; l < n; ++l) {
+      if (chan.enabled && channel() == 1) {
+	++res.drop_count;
+	continue;
+      }
+      const auto row = rowgen.next_row();
+      ctx.add_output(true, row.cbegin(), row.cend());
+    }
+    double t_run = thread_cpu_time();
+    res.enc_time += t_run - t;
+
+    ctx.run();
+    res.dec_time += thread_cpu_time() - t_run;
+
+    auto in = ctx.input_symbols_begin();
+    for (std::size_t i = 0; i < params.Ks.size(); ++i) {
+      for (std::size_t k = 0; k < params.Ks[i]; ++k) {
+	if (!*in++) ++res.error_counts[i];
+      }
+    }
+    if (!ctx.has_decoded()) ++res.failed_blocks;
+
+    double ripple = ctx.average_ripple_size();
+    res.ripple_sum += ripple;
+    ++res.ripple_count;
+    res.ripple_min = std::min(res.ripple_min, ripple);
+    res.ripple_max = std::max(res.ripple_max, ripple);
+    ++res.nblocks;
+  }
+
+  /** Simulate the blocks [g*TRIALS, (g+1)*TRIALS) with the same rows
+   *  and a different channel realization for each block.
+   */
+  void run_group(std::size_t g, std::size_t n) {
+    typedef mp::bit_parallel_mp::mask_type mask_type;
+    const std::size_t T = mp::bit_parallel_mp::TRIALS;
+    const std::size_t first = g * T;
+    const std::size_t ntrials = std::min(T, params.nblocks - first);
+    const mask_type valid = ntrials == T ?
+      ~mask_type(0) : (mask_type(1) << ntrials) - 1;
+
+    double t = thread_cpu_time();
+    rowgen.reset(block_seed(params.seed, g, rows_stream));
+    channels.clear();
+    if (chan.enabled) {
+      for (std::size_t b = first; b < first + ntrials; ++b) {
+	channels.emplace_back(chan.p01, chan.p10,
+			      block_seed(params.seed, b, channel_stream));
+      }
+    }
+    bp_ctx.reset();
+    for (std::size_t l = 0; l < n; ++l) {
+      mask_type recv = valid;
+      for (std::size_t k = 0; k < channels.size(); ++k) {
+	if (channels[k]() == 1) recv &= ~(mask_type(1) << k);
+      }
+      res.drop_count += popcount(valid & ~recv);
+      const auto row = rowgen.next_row();
+      bp_ctx.add_output(recv, row.cbegin(), row.cend());
+    }
+    double t_run = thread_cpu_time();
+    res.enc_time += t_run - t;
+
+    bp_ctx.run();
+    res.dec_time += thread_cpu_time() - t_run;
+
+    std::size_t in = 0;
+    for (std::size_t i = 0; i < params.Ks.size(); ++i) {
+      for (std::size_t k = 0; k < params.Ks[i]; ++k) {
+	res.error_counts[i] += popcount(valid & ~bp_ctx.input_mask(in++));
+      }
+    }
+    res.failed_blocks += popcount(valid & ~bp_ctx.decoded_trials());
+    res.nblocks += ntrials;
+  }
+
+  const uep_sim_results &results() const {
+    return res;
+  }
+
+private:
+  const uep_sim_parameters &params;
+  uep_row_generator rowgen;
+  uep_sim_results res;
+  channel_model chan;
+  mp::bit_parallel_mp bp_ctx;
+  std::vector<markov2_distribution> channels;
+
+  static std::size_t popcount(std::uint64_t x) {
+    return __builtin_popcountll(x);
+  }
+};
+
+/** Simulate the blocks assigned to one thread for all the overheads
+ *  of a sweep at once.
+ */
+class sweep_worker {
+public:
+  sweep_worker(const uep_sim_parameters &p, const uep_row_generator &rg,
+	       const std::vector<std::size_t> &ns) :
+    params(p),
+    rowgen(rg),
+    points(ns),
+    n_max(*std::max_element(ns.cbegin(), ns.cend())),
+    res(ns.size(), uep_sim_results(p.Ks.size())),
+    chan(p) {
+    for (std::size_t k = 0; k < points.size(); ++k) {
+      res[k].n_per_block = points[k];
+    }
+  }
+
+  /** Same as sim_worker::run_block with n_max packets, recording the
+   *  number of sent packets needed to decode each input symbol.
+   */
+  void run_block(std::size_t b) {
+    double t = thread_cpu_time();
+    rowgen.reset(block_seed(params.seed, b, rows_stream));
+    markov2_distribution channel(chan.p01, chan.p10,
+				 block_seed(params.seed, b, channel_stream));
+    mp::mp_context<bool> ctx(rowgen.K());
+    auto in = ctx.input_symbols_begin();
+
+    undecoded.resize(rowgen.K());
+    std::iota(undecoded.begin(), undecoded.end(), 0);
+    decoded_at.assign(rowgen.K(), NEVER);
+    dropped_at.clear();
+    std::size_t known = 0;
+    for (std::size_t l = 0; l < n_max; ++l) {
+      if (chan.enabled && channel() == 1) {
+	dropped_at.push_back(l);
+	continue;
+      }
+      // After the block is decoded only the channel matters
+      if (ctx.has_decoded()) continue;
+
+      const auto row = rowgen.next_row();
+      ctx.add_output(true, row.cbegin(), row.cend());
+      ctx.run();
+      if (ctx.decoded_count() == known) continue;
+
+      // Some inputs were decoded with l+1 packets
+      known = ctx.decoded_count();
+      auto last = std::remove_if(undecoded.begin(), undecoded.end(),
+				 [&](std::size_t i) {
+				   if (!in[i]) return false;
+				   decoded_at[i] = l + 1;
+				   return true;
+				 });
+      undecoded.erase(last, undecoded.end());
+    }
+
+    for (std::size_t k = 0; k < points.size(); ++k) {
+      const std::size_t n = points[k];
+      uep_sim_results &r = res[k];
+      std::size_t i = 0;
+      bool failed = false;
+      for (std::size_t s = 0; s < params.Ks.size(); ++s) {
+	for (std::size_t j = 0; j < params.Ks[s]; ++j) {
+	  if (decoded_at[i++] > n) {
+	    ++r.error_counts[s];
+	    failed = true;
+	  }
+	}
+      }
+      if (failed) ++r.failed_blocks;
+      r.drop_count += std::lower_bound(dropped_at.cbegin(), dropped_at.cend(),
+				       n) - dropped_at.cbegin();
+      ++r.nblocks;
+    }
+
+    double t_block = thread_cpu_time() - t;
+    for (uep_sim_results &r : res) r.dec_time += t_block;
+  }
+
+  const std::vector<uep_sim_results> &results() const {
+    return res;
+  }
+
+private:
+  static constexpr std::size_t NEVER = std::numeric_limits<std::size_t>::max();
+
+  const uep_sim_parameters &params;
+  uep_row_generator rowgen;
+  const std::vector<std::size_t> &points;
+  const std::size_t n_max;
+  std::vector<uep_sim_results> res;
+  channel_model chan;
+  /** Inputs not decoded yet. */
+  std::vector<std::size_t> undecoded;
+  /** Sent packets needed to decode each input, or NEVER. */
+  std::vector<std::size_t> decoded_at;
+  /** Indices of the dropped packets, in increasing order. */
+  std::vector<std::size_t> dropped_at;
+};
+
+constexpr std::size_t sweep_worker::NEVER;
+
+/** Check the parameters and build the row generator. */
+uep_row_generator make_row_generator(const uep_sim_parameters &p) {
+  if (p.Ks.empty() || p.Ks.size() != p.RFs.size()) {
+    throw std::invalid_argument("Wrong Ks, RFs");
+  }
+  return uep_row_generator(p.Ks.cbegin(), p.Ks.cend(),
+			   p.RFs.cbegin(), p.RFs.cend(),
+			   p.EF, p.c, p.delta);
+}
+
+}
+
+uep_sim_results::uep_sim_results(std::size_t nsub) :
+  nblocks(0),
+  n_per_block(0),
+  error_counts(nsub, 0),
+  failed_blocks(0),
+  drop_count(0),
+  ripple_sum(0),
+  ripple_count(0),
+  ripple_min(std::numeric_limits<double>::infinity()),
+  ripple_max(-std::numeric_limits<double>::infinity()),
+  enc_time(0),
+  dec_time(0) {
+}
+
+void uep_sim_results::merge(const uep_sim_results &other) {
+  if (error_counts.size() != other.error_counts.size()) {
+    throw std::invalid_argument("Different number of sub-blocks");
+  }
+  nblocks += other.nblocks;
+  for (std::size_t i = 0; i < error_counts.size(); ++i) {
+    error_counts[i] += other.error_counts[i];
+  }
+  failed_blocks += other.failed_blocks;
+  drop_count += other.drop_count;
+  ripple_sum += other.ripple_sum;
+  ripple_count += other.ripple_count;
+  ripple_min = std::min(ripple_min, other.ripple_min);
+  ripple_max = std::max(ripple_max, other.ripple_max);
+  enc_time += other.enc_time;
+  dec_time += other.dec_time;
+}
+
+double uep_sim_results::error_rate(std::size_t i, std::size_t Ki) const {
+  return static_cast<double>(error_counts.at(i)) / (nblocks * Ki);
+}
+
+double uep_sim_results::drop_rate() const {
+  return static_cast<double>(drop_count) / (nblocks * n_per_block);
+}
+
+double uep_sim_results::avg_ripple() const {
+  if (ripple_count == 0) return std::numeric_limits<double>::quiet_NaN();
+  return ripple_sum / ripple_count;
+}
+
+uep_sim_results run_uep_simulation(const uep_sim_parameters &p) {
+  // Build the degree distribution only once
+  const uep_row_generator rowgen(make_row_generator(p));
+  const std::size_t n = packets_per_block(rowgen.K(), p.overhead);
+
+  // The work is split in units of one block, or of one group of
+  // blocks in bit-parallel mode. Without errors all the blocks of a
+  // group would be the same: decode them one at a time instead.
+  const bool bit_parallel = p.bit_parallel && channel_model(p).enabled;
+  const std::size_t T = mp::bit_parallel_mp::TRIALS;
+  const std::size_t nunits = bit_parallel ?
+    (p.nblocks + T - 1) / T : p.nblocks;
+  const std::size_t chunk = bit_parallel ?
+    GROUPS_PER_CHUNK : BLOCKS_PER_CHUNK;
+
+  uep_sim_results total(p.Ks.size());
+  total.n_per_block = n;
+  run_on_pool(p.threads, nunits, chunk,
+	      [&]() { return sim_worker(p, rowgen); },
+	      [&](sim_worker &w, std::size_t u) {
+		if (bit_parallel) w.run_group(u, n);
+		else w.run_block(u, n);
+	      },
+	      [&](const sim_worker &w) { total.merge(w.results()); });
+  return total;
+}
+
+std::vector<uep_sim_results>
+run_uep_sweep(const uep_sim_parameters &p,
+	      const std::vector<double> &overheads) {
+  if (overheads.empty()) {
+    throw std::invalid_argument("No overheads");
+  }
+  if (p.bit_parallel) {
+    throw std::invalid_argument("The sweep is not bit-parallel");
+  }
+  const uep_row_generator rowgen(make_row_generator(p));
+  std::vector<std::size_t> ns;
+  for (double oh : overheads) {
+    ns.push_back(packets_per_block(rowgen.K(), oh));
+  }
+
+  std::vector<uep_sim_results> total(overheads.size(),
+				     uep_sim_results(p.Ks.size()));
+  for (std::size_t k = 0; k < ns.size(); ++k) total[k].n_per_block = ns[k];
+  run_on_pool(p.threads, p.nblocks, BLOCKS_PER_CHUNK,
+	      [&]() { return sweep_worker(p, rowgen, ns); },
+	      [](sweep_worker &w, std::size_t b) { w.run_block(b); },
+	      [&](const sweep_worker &w) {
+		for (std::size_t k = 0; k < total.size(); ++k) {
+		  total[k].merge(w.results()[k]);
+		}
+	      });
+  return total;
+}
+
+result_record to_result_record(const uep_sim_parameters &p, double overhead,
+			       const uep_sim_results &r) {
+  result_record rec;
+  rec.add_ints("Ks", p.Ks.cbegin(), p.Ks.cend());
+  rec.add_ints("RFs", p.RFs.cbegin(), p.RFs.cend());
+  rec.add_int("EF", p.EF);
+  rec.add_double("c", p.c);
+  rec.add_double("delta", p.delta);
+  rec.add_double("iid_per", p.iid_per);
+  rec.add_double("markov_pGB", p.markov_pGB);
+  rec.add_double("markov_pBG", p.markov_pBG);
+  rec.add_uint("seed", p.seed);
+  rec.add_int("bit_parallel", p.bit_parallel);
+  rec.add_double("overhead", overhead);
+  rec.add_int("nblocks", r.nblocks);
+  rec.add_int("n_per_block", r.n_per_block);
+  rec.add_ints("error_counts", r.error_counts.cbegin(), r.error_counts.cend());
+  rec.add_int("failed_blocks", r.failed_blocks);
+  rec.add_int("drop_count", r.drop_count);
+  rec.add_double("drop_rate", r.drop_rate());
+  rec.add_double("avg_ripple", r.avg_ripple());
+  rec.add_double("enc_time", r.enc_time);
+  rec.add_double("dec_time", r.dec_time);
+  return rec;
+}
+
+}}
@@ -0,0 +1,114 @@
+#ifndef UEP_UEP_SIMULATION_HPP
+#define UEP_UEP_SIMULATION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "result_store.hpp"
+
+namespace uep { namespace sim {
+
+/** Parameters of a Monte-Carlo simulation of the UEP decoding
+ *  probability, as in UEPSimulation of uep.py.
+ */
+struct uep_sim_parameters {
+  std::vector<std::size_t> Ks; /**< Sub-block sizes. */
+  std::vector<std::size_t> RFs; /**< Repetition factors. */
+  std::size_t EF; /**< Expansion factor. */
+  double c; /**< Coefficient c of the robust soliton distribution. */
+  double delta; /**< Parameter delta of the robust soliton distribution. */
+
+  std::size_t nblocks; /**< Number of simulated blocks. */
+  /** Received packets per block are ceil(K * (1 + overhead)) before
+   *  the channel losses.
+   */
+  double overhead;
+  /** Drop probability of the IID channel. If zero, use the Markov
+   *  channel.
+   */
+  double iid_per;
+  /** Transition probabilities of the Markov channel. The channel is
+   *  error-free when markov_pGB == 0 or markov_pBG == 1.
+   */
+  double markov_pGB, markov_pBG;
+
+  /** Number of worker threads, zero to use all the CPUs. */
+  std::size_t threads;
+  /** Seed of the simulation. Each block uses independent random
+   *  streams derived from this seed and its index, so the results do
+   *  not depend on the number of threads.
+   */
+  std::uint64_t seed;
+  /** Decode groups of bit_parallel_mp::TRIALS blocks at once with
+   *  bit_parallel_mp. The blocks of a group use the same rows and
+   *  independent channel realizations. The ripple is not measured.
+   *  Ignored on an error-free channel, where the blocks of a group
+   *  would all be the same.
+   */
+  bool bit_parallel;
+};
+
+/** Results aggregated over all the simulated blocks. */
+struct uep_sim_results {
+  std::size_t nblocks; /**< Number of simulated blocks. */
+  std::size_t n_per_block; /**< Packets per block before the channel. */
+  /** Undecoded input packets of each sub-block. */
+  std::vector<std::size_t> error_counts;
+  std::size_t failed_blocks; /**< Blocks not completely decoded. */
+  std::size_t drop_count; /**< Packets lost on the channel. */
+  /** Sum over the blocks of the average ripple size. */
+  double ripple_sum;
+  /** Number of blocks where the ripple was measured. */
+  std::size_t ripple_count;
+  /** Smallest and largest average ripple size of a block. */
+  double ripple_min, ripple_max;
+  /** Thread CPU time spent to generate the rows and build the graphs. */
+  double enc_time;
+  /** Thread CPU time spent in the message passing. */
+  double dec_time;
+
+  /** Build empty results for `nsub` sub-blocks. */
+  explicit uep_sim_results(std::size_t nsub = 0);
+  /** Add the results of other blocks. */
+  void merge(const uep_sim_results &other);
+
+  /** Fraction of undecoded input packets of sub-block `i`. */
+  double error_rate(std::size_t i, std::size_t Ki) const;
+  /** Fraction of packets lost on the channel. */
+  double drop_rate() const;
+  /** Average over the blocks of the average ripple size, NaN if it
+   *  was not measured.
+   */
+  double avg_ripple() const;
+};
+
+/** Simulate the decoding of p.nblocks blocks on a pool of threads. */
+uep_sim_results run_uep_simulation(const uep_sim_parameters &p);
+
+/** Simulate the decoding of p.nblocks blocks for each of the given
+ *  overheads in a single pass. Each block is decoded incrementally,
+ *  packet by packet, up to the largest overhead, recording how many
+ *  packets were sent when each input symbol was first decoded. The
+ *  k-th result is the same as run_uep_simulation with
+ *  p.overhead = overheads[k], except that the ripple is not measured
+ *  and enc_time is zero: dec_time is the CPU time of the whole pass,
+ *  the same for all the overheads. p.overhead is ignored and
+ *  p.bit_parallel must be false.
+ */
+std::vector<uep_sim_results>
+run_uep_sweep(const uep_sim_parameters &p,
+	      const std::vector<double> &overheads);
+
+/** Build the result_record of a simulation with the given overhead.
+ *  The columns are the parameters (Ks, RFs, EF, c, delta, iid_per,
+ *  markov_pGB, markov_pBG, seed, bit_parallel), the overhead and the
+ *  results (nblocks, n_per_block, error_counts, failed_blocks,
+ *  drop_count, drop_rate, avg_ripple, enc_time, dec_time).
+ */
+result_record to_result_record(const uep_sim_parameters &p, double overhead,
+			       const uep_sim_results &r);
+
+}}
+
+#endif
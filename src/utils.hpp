@@ -91,9 +91,14 @@ public:
   }
 
   explicit markov2_distribution(double p01, double p10) :
-    tx_01(p01), tx_10(p10) {
+    markov2_distribution(p01, p10, std::random_device{}()) {
+  }
+
+  /** Use a fixed seed, to reproduce the same sequence of states. */
+  explicit markov2_distribution(double p01, double p10,
+				std::mt19937::result_type seed) :
+    rng(seed), tx_01(p01), tx_10(p10) {
     std::bernoulli_distribution initial(p01 / (p01 + p10));
-    rng.seed(std::random_device{}());
     state = initial(rng) ? 1 : 0;
   }
 
@@ -0,0 +1,118 @@
+#define BOOST_TEST_MODULE test_annexb_reader
+#include <boost/test/unit_test.hpp>
+
+#include "annexb_reader.hpp"
+#include "nal_reader.hpp"
+
+#include <boost/filesystem.hpp>
+
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include <sys/stat.h>
+
+using namespace std;
+using namespace uep;
+
+namespace {
+
+const std::string stream_name = "CREW_352x288_30_orig_01";
+const std::string bitstream_path = "dataset/" + stream_name + ".264";
+
+/** Check that the reader produces the same packets as nal_reader. */
+void check_same_as_nal_reader(annexb_reader &r, size_t pkt_size) {
+  nal_reader ref(stream_name, pkt_size);
+  ref.use_end_of_stream(true);
+  r.use_end_of_stream(true);
+
+  BOOST_CHECK(r.header() == ref.header());
+  size_t npkts = 0;
+  while (r && ref) {
+    fountain_packet a = r.next_packet();
+    fountain_packet b = ref.next_packet();
+    BOOST_REQUIRE_EQUAL(a.getPriority(), b.getPriority());
+    BOOST_REQUIRE(a.buffer() == b.buffer());
+    ++npkts;
+  }
+  BOOST_CHECK(!r);
+  BOOST_CHECK(!ref);
+  BOOST_CHECK_GT(npkts, 0);
+  BOOST_CHECK_EQUAL(r.totLength(), ref.totLength());
+  BOOST_CHECK(r.total_read() == ref.total_read());
+  BOOST_CHECK(r.total_overhead() == ref.total_overhead());
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(parse_nal_header) {
+  // Coded slice extension: D=1 Q=2 T=3, discardable
+  const char ext[] = {0x74, char(0x80), 0x12, 0x68};
+  nal_unit_header h = nal_unit_header::parse(ext, sizeof(ext));
+  BOOST_CHECK_EQUAL(h.nal_unit_type, 20);
+  BOOST_CHECK(h.svc_extension);
+  BOOST_CHECK_EQUAL(h.dependency_id, 1);
+  BOOST_CHECK_EQUAL(h.quality_id, 2);
+  BOOST_CHECK_EQUAL(h.temporal_id, 3);
+  BOOST_CHECK(h.discardable);
+  BOOST_CHECK_EQUAL(h.priority(), 1);
+
+  // Not discardable
+  const char ext_nd[] = {0x74, char(0x80), 0x12, 0x60};
+  BOOST_CHECK_EQUAL(nal_unit_header::parse(ext_nd, 4).priority(), 0);
+
+  const char sps[] = {0x67, 0x42};
+  h = nal_unit_header::parse(sps, sizeof(sps));
+  BOOST_CHECK_EQUAL(h.nal_unit_type, 7);
+  BOOST_CHECK(!h.svc_extension);
+  BOOST_CHECK(h.is_parameter_set());
+  BOOST_CHECK_EQUAL(h.priority(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(same_packets_as_nal_reader) {
+  for (size_t pkt_size : {64, 512, 1500}) {
+    ifstream in(bitstream_path, ios_base::binary);
+    annexb_reader r(in, pkt_size);
+    check_same_as_nal_reader(r, pkt_size);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(read_from_fifo) {
+  namespace fs = boost::filesystem;
+  const fs::path fifo = fs::temp_directory_path() /
+    fs::unique_path("test_annexb_reader-%%%%%%%%");
+  BOOST_REQUIRE_EQUAL(mkfifo(fifo.c_str(), 0600), 0);
+
+  ifstream ifs(bitstream_path, ios_base::binary);
+  const std::string stream{std::istreambuf_iterator<char>(ifs),
+			   std::istreambuf_iterator<char>()};
+
+  // Write the bitstream in chunks of random size, as an encoder would
+  std::thread writer([&](){
+      std::mt19937 rng(5);
+      std::uniform_int_distribution<size_t> chunk(1, 5000);
+      ofstream out(fifo.string(), ios_base::binary);
+      for (size_t i = 0; i < stream.size();) {
+	size_t len = std::min(chunk(rng), stream.size() - i);
+	out.write(stream.data() + i, len);
+	out.flush();
+	i += len;
+      }
+    });
+
+  {
+    annexb_reader r(fifo.string(), 512);
+    check_same_as_nal_reader(r, 512);
+  }
+  writer.join();
+  fs::remove(fifo);
+}
+
+BOOST_AUTO_TEST_CASE(no_slices) {
+  istringstream only_header(std::string("\x00\x00\x01\x67\x42\x00\x00\x01\x68",
+					9));
+  BOOST_CHECK_THROW(annexb_reader(only_header, 512), std::runtime_error);
+  BOOST_CHECK_THROW(annexb_reader("dataset/does_not_exist.264", 512),
+		    std::runtime_error);
+}
@@ -0,0 +1,99 @@
+#define BOOST_TEST_MODULE test_bit_parallel_mp
+#include <boost/test/unit_test.hpp>
+
+#include <random>
+#include <vector>
+
+#include "bit_parallel_mp.hpp"
+#include "message_passing.hpp"
+
+using namespace std;
+using namespace uep::mp;
+
+typedef bit_parallel_mp::mask_type mask_type;
+
+BOOST_AUTO_TEST_CASE(simple_graph) {
+  // out0 = in0, out1 = in0 ^ in1, out2 = in1 ^ in2
+  bit_parallel_mp bp(3);
+  vector<size_t> e0{0}, e1{0, 1}, e2{1, 2};
+  bp.add_output(0b0111, e0.cbegin(), e0.cend());
+  bp.add_output(0b1011, e1.cbegin(), e1.cend());
+  bp.add_output(0b1101, e2.cbegin(), e2.cend());
+  BOOST_CHECK_EQUAL(bp.output_size(), 3);
+  bp.run();
+
+  BOOST_CHECK_EQUAL(bp.input_mask(0), 0b0111);
+  BOOST_CHECK_EQUAL(bp.input_mask(1), 0b0011);
+  BOOST_CHECK_EQUAL(bp.input_mask(2), 0b0001);
+  BOOST_CHECK_EQUAL(bp.decoded_trials(), 0b0001);
+  BOOST_CHECK_EQUAL(bp.decoded_count(0), 3);
+  BOOST_CHECK_EQUAL(bp.decoded_count(2), 1);
+  BOOST_CHECK_EQUAL(bp.decoded_count(3), 0);
+
+  bp.reset();
+  BOOST_CHECK_EQUAL(bp.output_size(), 0);
+  BOOST_CHECK_EQUAL(bp.input_mask(0), 0);
+}
+
+BOOST_AUTO_TEST_CASE(parallel_edges) {
+  // in0 ^ in0 ^ in1 cannot be used by the peeling decoder
+  bit_parallel_mp bp(2);
+  vector<size_t> e0{0, 0, 1};
+  bp.add_output(~mask_type(0), e0.cbegin(), e0.cend());
+  bp.run();
+  BOOST_CHECK_EQUAL(bp.input_mask(0), 0);
+  BOOST_CHECK_EQUAL(bp.input_mask(1), 0);
+}
+
+BOOST_AUTO_TEST_CASE(same_as_mp_context) {
+  const size_t K = 60;
+  const size_t N = 80;
+  mt19937 rng(1234);
+  uniform_int_distribution<size_t> degree(1, 4);
+  uniform_int_distribution<size_t> input(0, K-1);
+  bernoulli_distribution drop(0.2);
+
+  for (int graph = 0; graph < 20; ++graph) {
+    vector<vector<size_t>> rows(N);
+    vector<mask_type> recv(N, 0);
+    bit_parallel_mp bp(K);
+    for (size_t j = 0; j < N; ++j) {
+      size_t d = degree(rng);
+      for (size_t k = 0; k < d; ++k) rows[j].push_back(input(rng));
+      for (size_t t = 0; t < bit_parallel_mp::TRIALS; ++t) {
+	if (!drop(rng)) recv[j] |= mask_type(1) << t;
+      }
+      bp.add_output(recv[j], rows[j].cbegin(), rows[j].cend());
+    }
+    bp.run();
+
+    size_t full = 0;
+    for (size_t t = 0; t < bit_parallel_mp::TRIALS; ++t) {
+      mp_context<bool> ctx(K);
+      for (size_t j = 0; j < N; ++j) {
+	if ((recv[j] >> t) & 1) {
+	  ctx.add_output(true, rows[j].cbegin(), rows[j].cend());
+	}
+      }
+      ctx.run();
+
+      auto in = ctx.input_symbols_begin();
+      for (size_t i = 0; i < K; ++i) {
+	BOOST_CHECK_EQUAL(*in++, static_cast<bool>((bp.input_mask(i) >> t) & 1));
+      }
+      BOOST_CHECK_EQUAL(ctx.decoded_count(), bp.decoded_count(t));
+      BOOST_CHECK_EQUAL(ctx.has_decoded(),
+			static_cast<bool>((bp.decoded_trials() >> t) & 1));
+      if (ctx.has_decoded()) ++full;
+    }
+    BOOST_TEST_MESSAGE("Graph " << graph << ": " << full << " decoded trials");
+  }
+}
+
+BOOST_AUTO_TEST_CASE(wrong_input) {
+  bit_parallel_mp bp(2);
+  vector<size_t> e0{2};
+  bp.add_output(1, e0.cbegin(), e0.cend());
+  BOOST_CHECK_THROW(bp.run(), std::out_of_range);
+  BOOST_CHECK_THROW(bp.decoded_count(64), std::out_of_range);
+}
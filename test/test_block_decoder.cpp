@@ -157,3 +157,39 @@ BOOST_FIXTURE_TEST_CASE(out_of_order, setup_packets) {
     ++i; ++j;
   }
 }
+
+BOOST_FIXTURE_TEST_CASE(decode_after_reset, setup_packets) {
+  block_decoder dec(lt_row_generator(robust_soliton_distribution(3,0.1,0.5)));
+  for (int block = 0; block < 3; ++block) {
+    dec.reset();
+    BOOST_CHECK_THROW(dec.seed(), runtime_error);
+    BOOST_CHECK_EQUAL(dec.received_count(), 0);
+    // The seqnos of the previous block must be forgotten
+    for (auto i = received.crbegin(); i != received.crend(); ++i) {
+      BOOST_CHECK(dec.push(*i));
+      if (!dec.has_decoded()) BOOST_CHECK(!dec.push(*i));
+    }
+    BOOST_CHECK(dec.has_decoded());
+    BOOST_CHECK_EQUAL(dec.received_count(), 4);
+
+    auto i = dec.block_begin();
+    auto j = expected.cbegin();
+    while (i != dec.block_end()) {
+      BOOST_CHECK(*i == *j);
+      ++i; ++j;
+    }
+  }
+}
+
+BOOST_FIXTURE_TEST_CASE(sparse_seqnos, setup_packets) {
+  // Seqnos far apart need the rows and bits of all the ones before
+  block_decoder dec(lt_row_generator(robust_soliton_distribution(3,0.1,0.5)));
+  fountain_packet far(L, 0x11);
+  far.block_seed(seed);
+  far.block_number(42);
+  far.sequence_number(1000);
+  BOOST_CHECK(dec.push(far));
+  BOOST_CHECK(!dec.push(far));
+  BOOST_CHECK(dec.push(received[1]));
+  BOOST_CHECK_EQUAL(dec.received_count(), 2);
+}
@@ -0,0 +1,308 @@
+#define BOOST_TEST_MODULE test_control_server
+#include <boost/test/unit_test.hpp>
+
+#include "control_client.hpp"
+#include "control_server.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace uep;
+using namespace uep::net;
+
+// Set globally the log severity level
+struct global_fixture {
+  global_fixture() {
+    uep::log::init();
+    auto warn_filter = boost::log::expressions::attr<
+      uep::log::severity_level>("Severity") >= uep::log::warning;
+    boost::log::core::get()->set_filter(warn_filter);
+  }
+
+  ~global_fixture() {
+  }
+};
+BOOST_GLOBAL_FIXTURE(global_fixture);
+
+namespace {
+
+const std::string stream_name = "CREW_352x288_30_orig_01";
+
+std::string read_file(const std::string &path) {
+  std::ifstream ifs(path, std::ios::in | std::ios::binary);
+  BOOST_REQUIRE(ifs.is_open());
+  return std::string(std::istreambuf_iterator<char>(ifs),
+		     std::istreambuf_iterator<char>());
+}
+
+/** Split a stream at the startcodes and strip the trailing zeros of
+ *  each NAL, since the nal_writer does not preserve the startcode
+ *  length.
+ */
+std::vector<std::string> split_nals(const std::string &s) {
+  const std::string sc("\0\0\1", 3);
+  std::vector<std::string> nals;
+  std::size_t begin = 0;
+  for (;;) {
+    std::size_t end = s.find(sc, begin);
+    std::string nal = s.substr(begin, end == std::string::npos ?
+			       std::string::npos : end - begin);
+    nal.erase(nal.find_last_not_of('\0') + 1);
+    nals.push_back(std::move(nal));
+    if (end == std::string::npos) break;
+    begin = end + sc.size();
+  }
+  return nals;
+}
+
+/** True when two streams carry the same NALs. */
+bool same_nals(const std::string &a, const std::string &b) {
+  return split_nals(a) == split_nals(b);
+}
+
+uep_server_parameters small_server_params(std::size_t threads) {
+  uep_server_parameters sp = DEFAULT_SERVER_PARAMETERS;
+  sp.Ks = {10,90};
+  sp.RFs = {2,1};
+  sp.EF = 1;
+  sp.packet_size = 1024;
+  sp.sendRate = 10e6;
+  sp.tcp_port_num = "0";
+  sp.oneshot = false;
+  sp.threads = threads;
+  return sp;
+}
+
+/** Run `n_threads` threads, each with `per_thread` clients that
+ *  request the stream from the pool, and check that all of them
+ *  receive it.
+ */
+void run_clients(const control_server_pool &pool,
+		 std::size_t n_threads,
+		 std::size_t per_thread) {
+  auto cp = DEFAULT_CLIENT_PARAMETERS;
+  cp.stream_name = stream_name;
+  cp.local_data_port = "0";
+  cp.timeout = 10;
+  cp.remote_control_port = std::to_string(pool.local_endpoint().port());
+
+  const std::size_t n_clients = n_threads * per_thread;
+  std::vector<std::ostringstream> outs(n_clients);
+  std::vector<char> dones(n_clients, false);
+  std::vector<std::thread> client_threads;
+  for (std::size_t t = 0; t < n_threads; ++t) {
+    client_threads.emplace_back([&,t]() {
+	boost::asio::io_service io;
+	std::vector<std::unique_ptr<control_client>> ccs;
+	for (std::size_t i = 0; i < per_thread; ++i) {
+	  auto &out = outs[t * per_thread + i];
+	  ccs.emplace_back(new control_client(io, cp, out));
+	  ccs.back()->start();
+	}
+	io.run();
+	for (std::size_t i = 0; i < per_thread; ++i) {
+	  dones[t * per_thread + i] = ccs[i]->is_done();
+	}
+      });
+  }
+  for (auto &t : client_threads) t.join();
+
+  const std::string orig = read_file("dataset/" + stream_name + ".264");
+  for (std::size_t i = 0; i < n_clients; ++i) {
+    BOOST_CHECK(dones[i]);
+    BOOST_CHECK(same_nals(outs[i].str(), orig));
+  }
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(pool_rejects_bad_params) {
+  auto sp = small_server_params(0);
+  BOOST_CHECK_THROW(control_server_pool{sp}, std::invalid_argument);
+
+  sp = small_server_params(2);
+  sp.oneshot = true;
+  BOOST_CHECK_THROW(control_server_pool{sp}, std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(single_thread_pool) {
+  control_server_pool pool(small_server_params(1));
+  BOOST_CHECK_EQUAL(pool.size(), 1);
+  BOOST_CHECK_NE(pool.local_endpoint().port(), 0);
+  pool.start();
+
+  boost::asio::io_service io;
+  auto cp = DEFAULT_CLIENT_PARAMETERS;
+  cp.stream_name = stream_name;
+  cp.local_data_port = "0";
+  cp.timeout = 10;
+  cp.remote_control_port = std::to_string(pool.local_endpoint().port());
+  std::ostringstream out;
+  control_client cc(io, cp, out);
+  cc.start();
+  io.run();
+
+  pool.stop();
+  pool.join();
+
+  BOOST_CHECK(cc.is_done());
+  BOOST_CHECK(same_nals(out.str(), read_file("dataset/" + stream_name + ".264")));
+  BOOST_CHECK_EQUAL(pool.accepted_counts().at(0), 1);
+}
+
+BOOST_AUTO_TEST_CASE(many_clients_sharded) {
+  const std::size_t n_threads = 4;
+  const std::size_t n_client_threads = 2;
+  const std::size_t clients_per_thread = 4;
+
+  control_server_pool pool(small_server_params(n_threads));
+  BOOST_CHECK_EQUAL(pool.size(), n_threads);
+  pool.start();
+  run_clients(pool, n_client_threads, clients_per_thread);
+  pool.stop();
+  pool.join();
+
+  auto counts = pool.accepted_counts();
+  BOOST_CHECK_EQUAL(counts.size(), n_threads);
+  BOOST_CHECK_EQUAL(std::accumulate(counts.cbegin(), counts.cend(),
+				    std::size_t(0)),
+		    n_client_threads * clients_per_thread);
+  BOOST_CHECK_GT(std::count_if(counts.cbegin(), counts.cend(),
+			       [](std::size_t c) { return c > 0; }),
+		 1);
+}
+
+BOOST_AUTO_TEST_CASE(shared_stream_unicast) {
+  auto sp = small_server_params(1);
+  sp.shared_streams = true;
+  control_server_pool pool(sp);
+  pool.start();
+  run_clients(pool, 2, 3);
+  pool.stop();
+  pool.join();
+  BOOST_CHECK_EQUAL(pool.accepted_counts().at(0), 6);
+}
+
+BOOST_AUTO_TEST_CASE(shared_stream_multicast) {
+  auto sp = small_server_params(1);
+  sp.shared_streams = true;
+  sp.multicast_addr = "239.255.0.1";
+  control_server_pool pool(sp);
+  pool.start();
+  run_clients(pool, 2, 3);
+  pool.stop();
+  pool.join();
+  BOOST_CHECK_EQUAL(pool.accepted_counts().at(0), 6);
+}
+
+BOOST_AUTO_TEST_CASE(packed_nals) {
+  auto sp = small_server_params(1);
+  sp.packing = packed_packing;
+  control_server_pool pool(sp);
+  pool.start();
+  run_clients(pool, 1, 2);
+  pool.stop();
+  pool.join();
+}
+
+BOOST_AUTO_TEST_CASE(shared_stream_across_threads) {
+  auto sp = small_server_params(2);
+  sp.shared_streams = true;
+  control_server_pool pool(sp);
+
+  // All the threads get the same session while it is joinable
+  auto s = pool.join_stream(stream_name);
+  std::vector<decltype(s)> joined(4);
+  std::vector<std::thread> joiners;
+  for (auto &j : joined) {
+    joiners.emplace_back([&pool,&j]() { j = pool.join_stream(stream_name); });
+  }
+  for (auto &t : joiners) t.join();
+  for (const auto &j : joined) {
+    BOOST_CHECK_EQUAL(j, s);
+  }
+
+  pool.start();
+  run_clients(pool, 2, 3);
+  pool.stop();
+  pool.join();
+  BOOST_CHECK_GT(s->total_coded_count(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(shared_multicast_across_threads) {
+  auto sp = small_server_params(2);
+  sp.shared_streams = true;
+  sp.multicast_addr = "239.255.0.1";
+  control_server_pool pool(sp);
+  pool.start();
+  run_clients(pool, 2, 3);
+  pool.stop();
+  pool.join();
+}
+
+BOOST_AUTO_TEST_CASE(live_input_fifo) {
+  const std::string fifo = "test_control_server.fifo";
+  ::unlink(fifo.c_str());
+  BOOST_REQUIRE_EQUAL(::mkfifo(fifo.c_str(), 0600), 0);
+
+  auto sp = small_server_params(1);
+  sp.live_input = fifo;
+  control_server_pool pool(sp);
+  pool.start();
+
+  // Act as a live encoder that starts after the client has connected
+  // and then writes the bitstream slower than the send rate
+  const std::string orig = read_file("dataset/" + stream_name + ".264");
+  bool accepted_while_opening = false;
+  std::thread writer([&]() {
+      using namespace std::chrono;
+      auto deadline = steady_clock::now() + seconds(5);
+      while (pool.accepted_counts().at(0) < 1 &&
+	     steady_clock::now() < deadline) {
+	std::this_thread::sleep_for(milliseconds(10));
+      }
+      // The server thread must not be blocked by the FIFO open
+      boost::asio::io_service io;
+      boost::asio::ip::tcp::socket s(io);
+      s.connect(boost::asio::ip::tcp::endpoint(
+		  boost::asio::ip::address_v4::loopback(),
+		  pool.local_endpoint().port()));
+      while (pool.accepted_counts().at(0) < 2 &&
+	     steady_clock::now() < deadline) {
+	std::this_thread::sleep_for(milliseconds(10));
+      }
+      accepted_while_opening = pool.accepted_counts().at(0) == 2;
+      s.close();
+
+      std::ofstream ofs(fifo, std::ios::out | std::ios::binary);
+      const std::size_t chunk = 4*1024;
+      for (std::size_t i = 0; i < orig.size(); i += chunk) {
+	ofs.write(orig.data() + i, std::min(chunk, orig.size() - i));
+	ofs.flush();
+	std::this_thread::sleep_for(milliseconds(5));
+      }
+    });
+  run_clients(pool, 1, 1);
+  writer.join();
+  pool.stop();
+  pool.join();
+  ::unlink(fifo.c_str());
+
+  BOOST_CHECK(accepted_while_opening);
+}
+
+BOOST_AUTO_TEST_CASE(live_input_rejects_shared) {
+  auto sp = small_server_params(1);
+  sp.live_input = "live.264";
+  sp.shared_streams = true;
+  BOOST_CHECK_THROW(control_server_pool{sp}, std::invalid_argument);
+}
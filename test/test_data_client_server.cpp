@@ -7,6 +7,10 @@
 #include "uep_decoder.hpp"
 #include "uep_encoder.hpp"
 
+#include <atomic>
+#include <limits>
+#include <thread>
+
 template<typename DS, typename DC>
 void setup_termination_checks(boost::asio::io_service &io,
 			      DS &ds, DC &dc, double timeout) {
@@ -271,6 +275,216 @@ BOOST_AUTO_TEST_CASE(send_with_ack) {
   BOOST_CHECK(equal(recv.cbegin(), recv.cend(), orig.cbegin()));
 }
 
+BOOST_AUTO_TEST_CASE(paced_send_rate) {
+  using namespace std;
+
+  io_service io; // Global io_service object
+
+  const size_t L = 1024; // pkt size
+  const size_t K = 100; // block size
+  const double c = 0.1;
+  const double delta = 0.5;
+  const size_t N = 10*K; // total packets to send
+  const double rate = 8e6; // about 1 s for all the blocks
+  const mt19937::result_type src_seed = 0x42;
+
+  lt_encoder<std::mt19937>::parameter_set enc_ps{K,c,delta};
+  lt_decoder::parameter_set dec_ps = enc_ps;
+  random_packet_source::parameter_set src_ps{src_seed,L,N};
+  memory_sink::parameter_set sink_ps;
+
+  data_server<lt_encoder<std::mt19937>,random_packet_source> ds(io);
+  data_client<lt_decoder,memory_sink> dc(io);
+
+  ds.setup_encoder(enc_ps);
+  ds.setup_source(src_ps);
+  ds.target_send_rate(rate);
+  ds.open("127.0.0.1", "9999");
+
+  dc.setup_decoder(dec_ps);
+  dc.setup_sink(sink_ps);
+  dc.bind("9999");
+  dc.start_receive(ds.server_endpoint());
+
+  ds.start();
+  boost::asio::steady_timer end_timer(io, std::chrono::seconds(30));
+  end_timer.async_wait([&ds,&dc]
+		       (const boost::system::error_code&) -> void {
+			 ds.stop();
+			 dc.stop();
+		       });
+  io.run();
+
+  const std::vector<packet> &orig = ds.source().original;
+  const std::vector<packet> &recv = dc.sink().received;
+  BOOST_CHECK_EQUAL(recv.size(), N);
+  BOOST_CHECK(equal(recv.cbegin(), recv.cend(), orig.cbegin()));
+
+  // The bucket allows at most a burst above the target rate. The
+  // timer latency on a loaded machine can only lower it.
+  BOOST_CHECK_LE(ds.achieved_send_rate(), 1.05 * rate);
+  BOOST_CHECK_GE(ds.achieved_send_rate(), 0.8 * rate);
+}
+
+BOOST_AUTO_TEST_CASE(paced_burst_after_stall) {
+  using namespace std;
+  using namespace std::chrono;
+
+  io_service io;
+
+  const size_t L = 1024; // pkt size
+  const size_t K = 100; // block size
+  const size_t N = 10*K; // total packets to send
+  const double rate = 8e6; // about 1 s for all the blocks
+
+  lt_encoder<std::mt19937>::parameter_set enc_ps{K, 0.1, 0.5};
+  lt_decoder::parameter_set dec_ps = enc_ps;
+  random_packet_source::parameter_set src_ps{0x42, L, N};
+  memory_sink::parameter_set sink_ps;
+
+  data_server<lt_encoder<std::mt19937>,random_packet_source> ds(io);
+  data_client<lt_decoder,memory_sink> dc(io);
+
+  ds.setup_encoder(enc_ps);
+  ds.setup_source(src_ps);
+  ds.target_send_rate(rate);
+  ds.open("127.0.0.1", "9999");
+
+  dc.setup_decoder(dec_ps);
+  dc.setup_sink(sink_ps);
+  dc.bind("9999");
+  dc.start_receive(ds.server_endpoint());
+
+  // Block the io_service thread for 300 ms while sending, then
+  // again for 50 ms shortly after
+  boost::asio::steady_timer stall_timer(io, milliseconds(300));
+  stall_timer.async_wait([](const boost::system::error_code&) {
+      std::this_thread::sleep_for(milliseconds(300));
+    });
+  boost::asio::steady_timer stall2_timer(io, milliseconds(700));
+  stall2_timer.async_wait([](const boost::system::error_code&) {
+      std::this_thread::sleep_for(milliseconds(50));
+    });
+  boost::asio::steady_timer end_timer(io, seconds(3));
+  end_timer.async_wait([&ds,&dc](const boost::system::error_code&) {
+      ds.stop();
+      dc.stop();
+    });
+
+  // Sample the sent bytes from another thread
+  const metrics::counter &sent =
+    metrics::get_counter("data_server.sent_bytes");
+  vector<pair<steady_clock::time_point, std::uint64_t>> samples;
+  atomic<bool> done(false);
+  thread sampler([&]() {
+      while (!done) {
+	samples.emplace_back(steady_clock::now(), sent.value());
+	this_thread::sleep_for(microseconds(200));
+      }
+    });
+  ds.start();
+  io.run();
+  done = true;
+  sampler.join();
+
+  BOOST_CHECK_EQUAL(dc.sink().received.size(), N);
+
+  // A token bucket sends at most its depth plus the target rate in
+  // any interval. Allow two more packets, counted at the end of
+  // their transmission.
+  const double depth_bytes = rate / 8 * duration<double>(
+    ds.pacing_tick() * decltype(ds)::MAX_BURST_TICKS).count();
+  double max_excess = 0;
+  double max_credit = -numeric_limits<double>::infinity();
+  for (const auto &s : samples) {
+    double credit = rate / 8 *
+      duration<double>(s.first - samples.front().first).count() -
+      static_cast<double>(s.second);
+    max_credit = max(max_credit, credit);
+    max_excess = max(max_excess, max_credit - credit);
+  }
+  BOOST_CHECK_LE(max_excess, depth_bytes + 2*L);
+}
+
+/** Send 10 blocks packing the symbols in datagrams of up to 1472
+ *  bytes. When `client_layout` is false the client expects
+ *  single-symbol datagrams and must fall back to copying.
+ */
+void send_multi_symbol(bool client_layout,
+		       raw_header_version v = header_v1) {
+  using namespace std;
+
+  io_service io;
+
+  const size_t L = 50; // pkt size
+  const size_t K = 100; // block size
+  const double c = 0.1;
+  const double delta = 0.5;
+  const size_t N = 10*K; // total packets to send
+  const size_t D = 1472; // datagram size
+  const mt19937::result_type src_seed = 0x42;
+
+  lt_encoder<std::mt19937>::parameter_set enc_ps{K,c,delta};
+  lt_decoder::parameter_set dec_ps = enc_ps;
+  random_packet_source::parameter_set src_ps{src_seed,L,N};
+  memory_sink::parameter_set sink_ps;
+
+  data_server<lt_encoder<std::mt19937>,random_packet_source> ds(io);
+  data_client<lt_decoder,memory_sink> dc(io);
+
+  ds.setup_encoder(enc_ps);
+  ds.setup_source(src_ps);
+  ds.datagram_size(D);
+  ds.header_version(v);
+  ds.open("127.0.0.1", "9999");
+
+  dc.setup_decoder(dec_ps);
+  dc.setup_sink(sink_ps);
+  if (client_layout) dc.datagram_size(D, L);
+  dc.header_version(v);
+  dc.expected_count(N);
+  dc.bind("9999");
+  dc.start_receive(ds.server_endpoint());
+
+  ds.start();
+  setup_termination_checks(io, ds, dc, 60);
+  io.run();
+
+  const std::vector<packet> &orig = ds.source().original;
+  const std::vector<packet> &recv = dc.sink().received;
+  BOOST_CHECK_EQUAL(recv.size(), N);
+  BOOST_CHECK(equal(recv.cbegin(), recv.cend(), orig.cbegin()));
+}
+
+BOOST_AUTO_TEST_CASE(multi_symbol_datagrams) {
+  send_multi_symbol(true);
+}
+
+BOOST_AUTO_TEST_CASE(multi_symbol_datagrams_fallback) {
+  send_multi_symbol(false);
+}
+
+BOOST_AUTO_TEST_CASE(multi_symbol_datagrams_v0) {
+  send_multi_symbol(true, header_v0);
+}
+
+BOOST_AUTO_TEST_CASE(header_version_seqno_limit) {
+  io_service io;
+  data_server<lt_encoder<std::mt19937>,random_packet_source> ds(io);
+
+  BOOST_CHECK_EQUAL(ds.header_version(), header_v1);
+  BOOST_CHECK_NO_THROW(ds.max_sequence_number(0x10000));
+  BOOST_CHECK_NO_THROW(ds.max_sequence_number(0xffffffff));
+
+  ds.header_version(header_v0);
+  BOOST_CHECK_EQUAL(ds.max_sequence_number(), 0xffff);
+  BOOST_CHECK_THROW(ds.max_sequence_number(0x10000), std::overflow_error);
+  BOOST_CHECK_NO_THROW(ds.max_sequence_number(0xffff));
+
+  BOOST_CHECK_THROW(ds.header_version(static_cast<raw_header_version>(2)),
+		    std::invalid_argument);
+}
+
 BOOST_AUTO_TEST_CASE(send_with_pkt_limit) {
   using namespace std;
 
@@ -270,6 +270,9 @@ struct decoder_overflow_fixture {
   int nblocks = 0xffff * 2;
 
   int last_block_passed = 0xffff - 50;
+  // Number the blocks so that the counters wrap around after 0xffff
+  // blocks
+  size_t first_blockno = lt_decoder::MAX_BLOCKNO - 0xffff;
 
   robust_soliton_distribution deg;
   lt_encoder<std::mt19937> enc;
@@ -279,6 +282,8 @@ struct decoder_overflow_fixture {
 
   decoder_overflow_fixture() :
     deg(K,c,delta), enc(deg), dec(deg) {
+    enc.first_block_number(first_blockno);
+    dec.first_block_number(first_blockno);
     for (int i = 0; i < nblocks*K; i++) {
       packet p = random_pkt(L);
       original.push_back(p);
@@ -311,7 +316,7 @@ BOOST_FIXTURE_TEST_CASE(decoder_overflow, decoder_overflow_fixture) {
     pass_next_block(last_block_passed);
   }
   BOOST_CHECK_EQUAL(enc.blockno(), 0);
-  BOOST_CHECK_EQUAL(dec.blockno(), 0xffff);
+  BOOST_CHECK_EQUAL(dec.blockno(), lt_decoder::MAX_BLOCKNO);
 
   pass_next_block(last_block_passed);
   BOOST_CHECK_EQUAL(dec.blockno(), 0);
@@ -329,7 +334,7 @@ BOOST_FIXTURE_TEST_CASE(decoder_overflow_jump, decoder_overflow_fixture) {
 
 BOOST_FIXTURE_TEST_CASE(decoder_ignore_jump_back, decoder_overflow_fixture) {
   vector<fountain_packet> old_block;
-  size_t old_blockno = last_block_passed+1;
+  size_t old_blockno = first_blockno + last_block_passed+1;
   for (int i = 0; i < N; ++i) {
     old_block.push_back(enc.next_coded());
   }
@@ -341,7 +346,7 @@ BOOST_FIXTURE_TEST_CASE(decoder_ignore_jump_back, decoder_overflow_fixture) {
   for (auto i = old_block.cbegin(); i != old_block.cend(); ++i) {
     dec.push(*i);
   }
-  BOOST_CHECK_EQUAL(dec.blockno(), last_block_passed+3);
+  BOOST_CHECK_EQUAL(dec.blockno(), first_blockno + last_block_passed+3);
 
   for (int i = last_block_passed+4; i <= 0xffff + 3; ++i) {
     pass_next_block(i);
@@ -376,7 +381,7 @@ BOOST_AUTO_TEST_CASE(skip_multiple_blocks) {
   BOOST_CHECK_EQUAL(enc.blockno(), 0);
   BOOST_CHECK_EQUAL(enc.size(), 30*K);
 
-  enc.next_block(0xff00);
+  enc.next_block(enc.MAX_BLOCKNO - 0xff);
   BOOST_CHECK_EQUAL(enc.blockno(), 0);
   BOOST_CHECK_EQUAL(enc.size(), 30*K);
 
@@ -405,6 +410,40 @@ BOOST_AUTO_TEST_CASE(skip_multiple_blocks) {
   BOOST_CHECK_THROW(enc.next_block(100), std::logic_error);
 }
 
+BOOST_AUTO_TEST_CASE(stray_far_block) {
+  encdec_setup s(4, 10, 0.1, 0.5);
+  s.gen_pkts(2*s.K);
+  for (auto i = s.original.cbegin(); i != s.original.cend(); ++i) {
+    s.enc.push(*i);
+  }
+
+  do {
+    s.dec.push(s.enc.next_coded());
+  } while (!s.dec.has_decoded());
+
+  // A packet far ahead must not make the decoder skip to it
+  fountain_packet stray = s.enc.next_coded();
+  stray.block_number(lt_decoder::MAX_BLOCK_SKIP + 1);
+  s.dec.push(stray);
+  BOOST_CHECK_EQUAL(s.dec.blockno(), 0);
+  BOOST_CHECK_EQUAL(s.dec.queue_size(), s.K);
+  BOOST_CHECK_EQUAL(s.dec.total_failed_count(), 0);
+
+  s.enc.next_block();
+  do {
+    s.dec.push(s.enc.next_coded());
+  } while (!s.dec.has_decoded());
+  BOOST_CHECK_EQUAL(s.dec.blockno(), 1);
+  BOOST_CHECK_EQUAL(s.dec.queue_size(), 2*s.K);
+
+  // Up to MAX_BLOCK_SKIP blocks are skipped
+  stray.block_number(1 + lt_decoder::MAX_BLOCK_SKIP);
+  s.dec.push(stray);
+  BOOST_CHECK_EQUAL(s.dec.blockno(), 1 + lt_decoder::MAX_BLOCK_SKIP);
+  BOOST_CHECK_EQUAL(s.dec.total_failed_count(),
+		    (lt_decoder::MAX_BLOCK_SKIP - 1) * s.K);
+}
+
 BOOST_AUTO_TEST_CASE(missing_decoded) {
   const size_t L = 10;
   const size_t K = 100;
@@ -539,6 +578,14 @@ BOOST_AUTO_TEST_CASE(check_decoder_flush) {
 
   lt_encoder<std::mt19937> enc(K, c, delta);
   lt_decoder dec(K,c,delta);
+  // Number the blocks so that the counters wrap around after 2^16
+  // blocks
+  const size_t first_blockno = lt_decoder::MAX_BLOCKNO - 0xffff;
+  auto bn = [first_blockno](size_t i) {
+    return (first_blockno + i) & lt_decoder::MAX_BLOCKNO;
+  };
+  enc.first_block_number(first_blockno);
+  dec.first_block_number(first_blockno);
   vector<packet> original;
 
   // Push blocks to the encoder
@@ -551,28 +598,28 @@ BOOST_AUTO_TEST_CASE(check_decoder_flush) {
 
   BOOST_CHECK_EQUAL(dec.total_failed_count(), 0);
   BOOST_CHECK_EQUAL(dec.total_decoded_count(), 0);
-  BOOST_CHECK_EQUAL(dec.blockno(), 0);
+  BOOST_CHECK_EQUAL(dec.blockno(), bn(0));
 
   // Skip one block
   dec.flush();
   BOOST_CHECK_EQUAL(dec.total_failed_count(), K);
   BOOST_CHECK_EQUAL(dec.total_decoded_count(), 0);
-  BOOST_CHECK_EQUAL(dec.blockno(), 1);
+  BOOST_CHECK_EQUAL(dec.blockno(), bn(1));
 
   // Skip to block 50
-  dec.flush(50);
+  dec.flush(bn(50));
   BOOST_CHECK_EQUAL(dec.total_failed_count(), 50*K);
   BOOST_CHECK_EQUAL(dec.total_decoded_count(), 0);
-  BOOST_CHECK_EQUAL(dec.blockno(), 50);
+  BOOST_CHECK_EQUAL(dec.blockno(), bn(50));
 
   // Decode block 50
-  enc.next_block(50);
+  enc.next_block(bn(50));
   while (!dec.has_decoded())
     dec.push(enc.next_coded());
 
   BOOST_CHECK_EQUAL(dec.total_failed_count(), 50*K);
   BOOST_CHECK_EQUAL(dec.total_decoded_count(), K);
-  BOOST_CHECK_EQUAL(dec.blockno(), 50);
+  BOOST_CHECK_EQUAL(dec.blockno(), bn(50));
 
   // Partial block 51
   enc.next_block();
@@ -582,14 +629,14 @@ BOOST_AUTO_TEST_CASE(check_decoder_flush) {
   size_t partial = dec.decoded_count();
 
   // Skip to block 50 again (+ 2^16 blocks)
-  dec.flush(50);
+  dec.flush(bn(50 + 0x10000));
 
   // failed 0--49, partially failed 51, skip 52--2^16, skip 0--49
   size_t failed_pkts = 51*K -partial + (static_cast<size_t>(pow(2,16))-2)*K;
   size_t good_pkts = K + partial;
   BOOST_CHECK_EQUAL(dec.total_failed_count(), failed_pkts);
   BOOST_CHECK_EQUAL(dec.total_decoded_count(), good_pkts);
-  BOOST_CHECK_EQUAL(dec.blockno(), 50);
+  BOOST_CHECK_EQUAL(dec.blockno(), bn(50 + 0x10000));
 }
 
 BOOST_AUTO_TEST_CASE(check_decoder_flush_n) {
@@ -600,6 +647,14 @@ BOOST_AUTO_TEST_CASE(check_decoder_flush_n) {
 
   lt_encoder<std::mt19937> enc(K, c, delta);
   lt_decoder dec(K,c,delta);
+  // Number the blocks so that the counters wrap around after 2^16
+  // blocks
+  const size_t first_blockno = lt_decoder::MAX_BLOCKNO - 0xffff;
+  auto bn = [first_blockno](size_t i) {
+    return (first_blockno + i) & lt_decoder::MAX_BLOCKNO;
+  };
+  enc.first_block_number(first_blockno);
+  dec.first_block_number(first_blockno);
   vector<packet> original;
 
   // Push blocks to the encoder
@@ -612,28 +667,28 @@ BOOST_AUTO_TEST_CASE(check_decoder_flush_n) {
 
   BOOST_CHECK_EQUAL(dec.total_failed_count(), 0);
   BOOST_CHECK_EQUAL(dec.total_decoded_count(), 0);
-  BOOST_CHECK_EQUAL(dec.blockno(), 0);
+  BOOST_CHECK_EQUAL(dec.blockno(), bn(0));
 
   // Skip one block
   dec.flush();
   BOOST_CHECK_EQUAL(dec.total_failed_count(), K);
   BOOST_CHECK_EQUAL(dec.total_decoded_count(), 0);
-  BOOST_CHECK_EQUAL(dec.blockno(), 1);
+  BOOST_CHECK_EQUAL(dec.blockno(), bn(1));
 
   // Skip to block 50
-  dec.flush(50);
+  dec.flush(bn(50));
   BOOST_CHECK_EQUAL(dec.total_failed_count(), 50*K);
   BOOST_CHECK_EQUAL(dec.total_decoded_count(), 0);
-  BOOST_CHECK_EQUAL(dec.blockno(), 50);
+  BOOST_CHECK_EQUAL(dec.blockno(), bn(50));
 
   // Decode block 50
-  enc.next_block(50);
+  enc.next_block(bn(50));
   while (!dec.has_decoded())
     dec.push(enc.next_coded());
 
   BOOST_CHECK_EQUAL(dec.total_failed_count(), 50*K);
   BOOST_CHECK_EQUAL(dec.total_decoded_count(), K);
-  BOOST_CHECK_EQUAL(dec.blockno(), 50);
+  BOOST_CHECK_EQUAL(dec.blockno(), bn(50));
 
   // Partial block 51
   enc.next_block();
@@ -650,5 +705,5 @@ BOOST_AUTO_TEST_CASE(check_decoder_flush_n) {
   size_t good_pkts = K + partial;
   BOOST_CHECK_EQUAL(dec.total_failed_count(), failed_pkts);
   BOOST_CHECK_EQUAL(dec.total_decoded_count(), good_pkts);
-  BOOST_CHECK_EQUAL(dec.blockno(), nblocks % static_cast<size_t>(pow(2,16)));
+  BOOST_CHECK_EQUAL(dec.blockno(), bn(nblocks));
 }
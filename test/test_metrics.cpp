@@ -0,0 +1,170 @@
+#define BOOST_TEST_MODULE test_metrics
+#include <boost/test/unit_test.hpp>
+
+#include "metrics.hpp"
+
+#include <boost/asio.hpp>
+#include <boost/filesystem.hpp>
+
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+using namespace uep;
+using namespace uep::metrics;
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+fs::path temp_path(const std::string &name) {
+  return fs::temp_directory_path() / fs::unique_path(name + "-%%%%%%%%");
+}
+
+std::string read_file(const fs::path &p) {
+  ifstream in(p.string());
+  return std::string(std::istreambuf_iterator<char>(in),
+		     std::istreambuf_iterator<char>());
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(histogram_buckets) {
+  for (uint64_t v = 0; v < 4 * histogram::SUB_COUNT; ++v) {
+    size_t i = histogram::bucket_index(v);
+    BOOST_REQUIRE_GE(histogram::bucket_upper(i), v);
+    if (v < 2 * histogram::SUB_COUNT) {
+      BOOST_REQUIRE_EQUAL(histogram::bucket_upper(i), v);
+    }
+  }
+
+  std::mt19937_64 rng(3);
+  for (int n = 0; n < 100000; ++n) {
+    uint64_t v = rng() >> (rng() % 64);
+    size_t i = histogram::bucket_index(v);
+    BOOST_REQUIRE_LT(i, histogram::BUCKETS);
+    uint64_t up = histogram::bucket_upper(i);
+    BOOST_REQUIRE_GE(up, v);
+    BOOST_REQUIRE_LE(double(up - v), double(v) / histogram::SUB_COUNT);
+    if (i > 0) BOOST_REQUIRE_LT(histogram::bucket_upper(i - 1), v);
+  }
+  BOOST_CHECK_EQUAL(histogram::bucket_index(~uint64_t(0)),
+		    histogram::BUCKETS - 1);
+  BOOST_CHECK_EQUAL(histogram::bucket_upper(histogram::BUCKETS - 1),
+		    ~uint64_t(0));
+}
+
+BOOST_AUTO_TEST_CASE(histogram_stats) {
+  histogram h;
+  BOOST_CHECK_EQUAL(h.count(), 0);
+  BOOST_CHECK_EQUAL(h.percentile(0.5), 0);
+  BOOST_CHECK_EQUAL(h.min(), 0);
+  BOOST_CHECK(std::isnan(h.mean()));
+
+  for (uint64_t v = 1; v <= 10000; ++v) h.record(v);
+  BOOST_CHECK_EQUAL(h.count(), 10000);
+  BOOST_CHECK_EQUAL(h.min(), 1);
+  BOOST_CHECK_EQUAL(h.max(), 10000);
+  BOOST_CHECK_CLOSE(h.mean(), 5000.5, 1e-9);
+  BOOST_CHECK_CLOSE(double(h.percentile(0.5)), 5000, 100.0 / 32);
+  BOOST_CHECK_CLOSE(double(h.percentile(0.99)), 9900, 100.0 / 32);
+  BOOST_CHECK_EQUAL(h.percentile(1), 10000);
+  BOOST_CHECK_EQUAL(h.percentile(0), 1);
+
+  h.record(std::chrono::microseconds(3));
+  BOOST_CHECK_EQUAL(h.count(), 10001);
+  BOOST_CHECK_EQUAL(h.sum(), 10000 * 10001 / 2 + 3000);
+
+  h.reset();
+  BOOST_CHECK_EQUAL(h.count(), 0);
+  BOOST_CHECK_EQUAL(h.max(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(concurrent_updates) {
+  registry r;
+  histogram &h = r.get_histogram("h");
+  counter &c = r.get_counter("c");
+  BOOST_CHECK(&h == &r.get_histogram("h"));
+  BOOST_CHECK(&c == &r.get_counter("c"));
+
+  vector<thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&h, &c, t](){
+	for (uint64_t i = 0; i < 100000; ++i) {
+	  h.record(i + t);
+	  c.add();
+	}
+      });
+  }
+  for (auto &th : threads) th.join();
+  BOOST_CHECK_EQUAL(h.count(), 400000);
+  BOOST_CHECK_EQUAL(c.value(), 400000);
+  BOOST_CHECK_EQUAL(h.min(), 0);
+  BOOST_CHECK_EQUAL(h.max(), 100002);
+}
+
+BOOST_AUTO_TEST_CASE(json_snapshot) {
+  registry r;
+  r.get_counter("pkts").add(42);
+  r.get_gauge("queue").set(2.5);
+  r.get_histogram("push_ns").record(100);
+  r.get_histogram("empty_ns");
+
+  ostringstream out;
+  r.write_json(out);
+  const string json = out.str();
+  BOOST_CHECK_NE(json.find("\"pkts\": 42"), string::npos);
+  BOOST_CHECK_NE(json.find("\"queue\": 2.5"), string::npos);
+  BOOST_CHECK_NE(json.find("\"push_ns\": {\"count\": 1, \"sum\": 100"),
+		 string::npos);
+  BOOST_CHECK_NE(json.find("\"mean\": null"), string::npos);
+
+  r.reset();
+  BOOST_CHECK_EQUAL(r.get_counter("pkts").value(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(export_file_and_socket) {
+  registry r;
+  counter &c = r.get_counter("events");
+  c.add(7);
+
+  const fs::path file = temp_path("test_metrics");
+  const fs::path sock = temp_path("test_metrics_sock");
+  {
+    exporter e(r);
+    e.write_file(file.string(), std::chrono::milliseconds(10));
+    e.listen(sock.string());
+    e.start();
+    BOOST_CHECK_NE(read_file(file).find("\"events\": 7"), string::npos);
+
+    c.add(1);
+    for (int i = 0; i < 200; ++i) {
+      if (read_file(file).find("\"events\": 8") != string::npos) break;
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    BOOST_CHECK_NE(read_file(file).find("\"events\": 8"), string::npos);
+
+    // Each connection gets a full snapshot
+    for (int i = 0; i < 2; ++i) {
+      boost::asio::io_service io;
+      boost::asio::local::stream_protocol::socket s(io);
+      s.connect(boost::asio::local::stream_protocol::endpoint(sock.string()));
+      boost::asio::streambuf sb;
+      boost::system::error_code ec;
+      boost::asio::read(s, sb, ec);
+      BOOST_CHECK(ec == boost::asio::error::eof);
+      std::string json{boost::asio::buffers_begin(sb.data()),
+		       boost::asio::buffers_end(sb.data())};
+      BOOST_CHECK_NE(json.find("\"events\": 8"), string::npos);
+    }
+
+    c.add(1);
+    e.stop();
+    BOOST_CHECK_NE(read_file(file).find("\"events\": 9"), string::npos);
+  }
+  BOOST_CHECK(!fs::exists(sock));
+  BOOST_CHECK(!fs::exists(file.string() + ".tmp"));
+  fs::remove(file);
+}
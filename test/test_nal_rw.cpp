@@ -4,6 +4,8 @@
 #include "nal_reader.hpp"
 #include "nal_writer.hpp"
 
+#include <boost/filesystem.hpp>
+
 using namespace std;
 using namespace uep;
 
@@ -83,6 +85,29 @@ struct global_fixture {
 };
 BOOST_GLOBAL_FIXTURE(global_fixture);
 
+/** Move to a new temporary directory. The original working
+ *  directory is restored and the temporary one removed on
+ *  destruction, also when a check throws.
+ */
+struct tmp_cwd_guard {
+  const boost::filesystem::path orig_dir;
+  const boost::filesystem::path tmp_dir;
+
+  tmp_cwd_guard() :
+    orig_dir(boost::filesystem::current_path()),
+    tmp_dir(boost::filesystem::temp_directory_path() /
+	    boost::filesystem::unique_path()) {
+    boost::filesystem::create_directories(tmp_dir);
+    boost::filesystem::current_path(tmp_dir);
+  }
+
+  ~tmp_cwd_guard() {
+    boost::system::error_code ec;
+    boost::filesystem::current_path(orig_dir, ec);
+    boost::filesystem::remove_all(tmp_dir, ec);
+  }
+};
+
 BOOST_AUTO_TEST_CASE(nal_read) {
   nal_reader::parameter_set ps;
   ps.streamName = "CREW_352x288_30_orig_01";
@@ -176,3 +201,282 @@ BOOST_AUTO_TEST_CASE(nal_eos) {
   BOOST_CHECK(compare_streams("dataset/CREW_352x288_30_orig_01.264",
 			      "dataset_client/CREW_352x288_30_orig_01.264"));
 }
+
+BOOST_AUTO_TEST_CASE(shared_mapping) {
+  const std::string path = "dataset/CREW_352x288_30_orig_01.264";
+  auto m1 = mapped_file::open_shared(path);
+  auto m2 = mapped_file::open_shared(path);
+  BOOST_CHECK_EQUAL(m1.get(), m2.get());
+
+  size_t len = 0;
+  BOOST_REQUIRE(file_exists(path, &len));
+  BOOST_REQUIRE_EQUAL(m1->size(), len);
+  std::vector<char> first = readByteFromFile(path, 0, 4096);
+  BOOST_CHECK(std::equal(first.cbegin(), first.cend(), m1->data()));
+
+  BOOST_CHECK_THROW(mapped_file::open_shared("dataset/does_not_exist.264"),
+		    std::system_error);
+}
+
+BOOST_AUTO_TEST_CASE(nal_read_istream) {
+  const std::string name = "CREW_352x288_30_orig_01";
+  const size_t pkt_size = 512;
+  ifstream trace("dataset/" + name + ".trace");
+  ifstream bitstream("dataset/" + name + ".264", ios_base::binary);
+  nal_reader rs(trace, bitstream, pkt_size);
+  nal_reader rf(name, pkt_size);
+  rs.use_end_of_stream(true);
+  rf.use_end_of_stream(true);
+
+  BOOST_CHECK_EQUAL(rs.totLength(), rf.totLength());
+  BOOST_CHECK(rs.header() == rf.header());
+  size_t npkts = 0;
+  while (rs && rf) {
+    fountain_packet a = rs.next_packet();
+    fountain_packet b = rf.next_packet();
+    BOOST_CHECK_EQUAL(a.getPriority(), b.getPriority());
+    BOOST_CHECK(a.buffer() == b.buffer());
+    ++npkts;
+  }
+  BOOST_CHECK(!rs);
+  BOOST_CHECK(!rf);
+  BOOST_CHECK_GE(npkts, ceil(static_cast<double>(rf.totLength()) / pkt_size));
+  BOOST_CHECK(rs.total_read() == rf.total_read());
+}
+
+BOOST_AUTO_TEST_CASE(nal_read_counters) {
+  // Each packet is either data or padding
+  for (size_t pkt_size : {100, 1024, 20000}) {
+    nal_reader r("CREW_352x288_30_orig_01", pkt_size);
+    size_t npkts = 0;
+    while (r) {
+      BOOST_CHECK_EQUAL(r.next_packet().size(), pkt_size);
+      ++npkts;
+    }
+    size_t data = r.total_read()[0] + r.total_read()[1];
+    size_t padding = r.total_overhead()[0] + r.total_overhead()[1];
+    BOOST_CHECK_EQUAL(data + padding, npkts * pkt_size);
+    BOOST_CHECK_EQUAL(data + r.header().size(), r.totLength());
+  }
+}
+
+BOOST_AUTO_TEST_CASE(packet_source_split) {
+  namespace fs = boost::filesystem;
+  const std::string name = "CREW_352x288_30_orig_01";
+  const std::vector<size_t> Ks{4, 8};
+  const size_t Ls = 64;
+
+  // Run in an empty directory, since the split files go in dataset/
+  tmp_cwd_guard cwd;
+  fs::create_directories("dataset");
+  for (const std::string ext : {".264", ".trace"}) {
+    fs::create_symlink(fs::canonical(cwd.orig_dir / "dataset" / (name + ext)),
+		       fs::path("dataset") / (name + ext));
+  }
+
+  // Expected content of the split files
+  std::ifstream trace_in("dataset/" + name + ".trace");
+  trace_index ti = trace_index::parse(trace_in);
+  const std::string bs_path = "dataset/" + name + ".264";
+  const size_t bs_size = fs::file_size(bs_path);
+  std::string bitstream = std::string(readByteFromFile(bs_path, 0,
+						       bs_size).data(),
+				      bs_size);
+  std::vector<std::string> expected(Ks.size());
+  auto i = ti.begin();
+  while (i->type != streamTrace::slice_data) ++i;
+  // The header is made of the NALs before the first slice
+  const size_t header_size = i->offset;
+  for (; i != ti.end(); ++i) {
+    if (i->qid >= Ks.size())
+      expected.back() += bitstream.substr(i->offset, i->len);
+    else if (i->type == streamTrace::slice_data)
+      expected[i->qid] += bitstream.substr(i->offset, i->len);
+  }
+
+  all_params ps;
+  ps.Ks = Ks;
+  ps.RFs = {1, 1};
+  ps.EF = 1;
+  ps.streamName = name;
+  for (int run = 0; run < 2; ++run) { // The second run reuses the files
+    packet_source src(ps);
+    BOOST_CHECK_EQUAL(src.header.size(), header_size);
+    BOOST_CHECK(std::equal(src.header.cbegin(), src.header.cend(),
+			   bitstream.cbegin()));
+    for (size_t q = 0; q < Ks.size(); ++q) {
+      std::ifstream split("dataset/" + name + "." + std::to_string(q) + ".264",
+			  std::ios_base::binary);
+      std::string content{std::istreambuf_iterator<char>(split),
+			  std::istreambuf_iterator<char>()};
+      BOOST_CHECK_EQUAL(src.max_count[q], expected[q].size());
+      BOOST_CHECK(content == expected[q]);
+    }
+
+    std::vector<size_t> count(Ks.size(), 0);
+    for (size_t n = 0; n < 120; ++n) {
+      fountain_packet fp = src.next_packet();
+      size_t q = fp.getPriority();
+      std::string exp = expected[q].substr(count[q]*Ls, Ls);
+      exp.resize(Ls, ' ');
+      BOOST_CHECK_EQUAL(fp.size(), Ls);
+      BOOST_CHECK(std::string(fp.buffer().cbegin(), fp.buffer().cend()) == exp);
+      ++count[q];
+    }
+    BOOST_CHECK_EQUAL(count[0] * Ks[1], count[1] * Ks[0]);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(nal_write_small_packets) {
+  // The output must not depend on how the stream is segmented
+  std::ifstream ifs("dataset/CREW_352x288_30_orig_01.264", ios_base::binary);
+  buffer_type stream{std::istreambuf_iterator<char>(ifs),
+		     std::istreambuf_iterator<char>()};
+
+  std::ostringstream whole_out;
+  {
+    nal_writer w(whole_out);
+    fountain_packet fp(stream);
+    w.push(fp);
+  }
+
+  for (size_t seg : {1, 2, 5, 100}) {
+    std::ostringstream seg_out;
+    {
+      nal_writer w(seg_out);
+      for (size_t i = 0; i < stream.size(); i += seg) {
+	auto end = stream.cbegin() + std::min(i + seg, stream.size());
+	fountain_packet fp(buffer_type(stream.cbegin() + i, end));
+	w.push(fp);
+      }
+    }
+    BOOST_CHECK(seg_out.str() == whole_out.str());
+  }
+  BOOST_CHECK_GT(whole_out.str().size(), stream.size() * 9 / 10);
+}
+
+BOOST_AUTO_TEST_CASE(nal_write_large_nals) {
+  // NALs larger than the write chunk between small ones
+  buffer_type stream;
+  const size_t chunk = nal_writer::WRITE_CHUNK;
+  for (size_t len : {size_t(10), 3*chunk/2, size_t(20), size_t(30),
+	chunk, size_t(40)}) {
+    stream.insert(stream.end(), {0x00, 0x00, 0x01});
+    stream.insert(stream.end(), len, static_cast<char>(0xab));
+  }
+
+  for (bool async : {false, true}) {
+    for (size_t seg : {size_t(7), size_t(4096), stream.size()}) {
+      std::ostringstream out;
+      nal_writer_stats st;
+      {
+	nal_writer w(out, async);
+	for (size_t i = 0; i < stream.size(); i += seg) {
+	  auto end = stream.cbegin() + std::min(i + seg, stream.size());
+	  fountain_packet fp(buffer_type(stream.cbegin() + i, end));
+	  w.push(fp);
+	}
+	w.flush();
+	st = w.stats();
+      }
+      BOOST_CHECK(out.str() == std::string(stream.cbegin(), stream.cend()));
+      // The large NALs are queued in chunks
+      BOOST_CHECK_LE(st.max_queue_depth, chunk);
+      if (async) BOOST_CHECK_EQUAL(st.written_bytes, stream.size());
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(nal_write_async) {
+  std::ifstream ifs("dataset/CREW_352x288_30_orig_01.264", ios_base::binary);
+  buffer_type stream{std::istreambuf_iterator<char>(ifs),
+		     std::istreambuf_iterator<char>()};
+
+  std::ostringstream sync_out, async_out;
+  nal_writer_stats st;
+  for (bool async : {false, true}) {
+    nal_writer w(async ? async_out : sync_out, async);
+    BOOST_CHECK_EQUAL(w.is_async(), async);
+    for (size_t i = 0; i < stream.size(); i += 1000) {
+      auto end = stream.cbegin() + std::min(i + 1000, stream.size());
+      fountain_packet fp(buffer_type(stream.cbegin() + i, end));
+      w.push(fp);
+    }
+    w.flush();
+    st = w.stats();
+  }
+  BOOST_CHECK(async_out.str() == sync_out.str());
+  BOOST_CHECK_EQUAL(st.written_bytes, async_out.str().size());
+  BOOST_CHECK_EQUAL(st.queued_bytes, st.written_bytes);
+  BOOST_CHECK_EQUAL(st.queue_depth, 0);
+  BOOST_CHECK_GT(st.max_queue_depth, 0);
+  BOOST_CHECK_LE(st.max_queue_depth, nal_writer::WRITE_CHUNK);
+}
+
+BOOST_AUTO_TEST_CASE(nal_write_async_error) {
+  std::ostream bad(nullptr); // Every write fails
+  nal_writer w(bad, true);
+  buffer_type nal{0x00, 0x00, 0x01, 0x65, 0x11, 0x22};
+  fountain_packet fp(nal);
+  w.push(fp);
+  BOOST_CHECK_THROW(w.flush(), std::runtime_error);
+  BOOST_CHECK_EQUAL(w.stats().written_bytes, 0);
+}
+
+/** Drop the zero bytes at the end of the NALs, which the writer is
+ *  free to keep or not.
+ */
+std::string strip_trailing_zeros(const std::string &s) {
+  std::string out;
+  size_t zeros = 0;
+  for (size_t i = 0; i < s.size(); ++i) {
+    if (s[i] == 0) {
+      ++zeros;
+      continue;
+    }
+    if (s[i] == 1 && zeros >= 2) zeros = 2; // Keep only the startcode
+    out.append(zeros, 0);
+    zeros = 0;
+    out.push_back(s[i]);
+  }
+  return out;
+}
+
+BOOST_AUTO_TEST_CASE(nal_packed_packing) {
+  const std::string name = "CREW_352x288_30_orig_01";
+  std::ifstream ifs("dataset/" + name + ".264", ios_base::binary);
+  const std::string orig{std::istreambuf_iterator<char>(ifs),
+			 std::istreambuf_iterator<char>()};
+
+  for (size_t pkt_size : {3, 16, 100, 512}) {
+    nal_reader padded(name, pkt_size);
+    while (padded) padded.next_packet();
+
+    nal_reader r(name, pkt_size);
+    r.use_end_of_stream(true);
+    r.packing(packed_packing);
+    std::ostringstream out;
+    nal_writer w(out, r.header(), false, packed_packing);
+    size_t npkts = 0;
+    while (r && w) {
+      fountain_packet fp = r.next_packet();
+      BOOST_REQUIRE_EQUAL(fp.size(), pkt_size);
+      w.push(fp);
+      ++npkts;
+    }
+    BOOST_CHECK(!r);
+    BOOST_CHECK(!w);
+    w.flush();
+    BOOST_CHECK(strip_trailing_zeros(out.str()) == strip_trailing_zeros(orig));
+
+    // Only the prefixes, the EOS and the end of the last packet
+    size_t data = r.total_read()[0] + r.total_read()[1];
+    size_t oh = r.total_overhead()[0] + r.total_overhead()[1];
+    BOOST_CHECK_EQUAL(data, padded.total_read()[0] + padded.total_read()[1]);
+    BOOST_CHECK_EQUAL(data + oh, npkts * pkt_size);
+    BOOST_CHECK_LT(oh, npkts * packed_prefix_size + 4 + pkt_size);
+  }
+
+  nal_reader r(name, packed_prefix_size);
+  BOOST_CHECK_THROW(r.packing(packed_packing), std::invalid_argument);
+}
@@ -141,3 +141,163 @@ BOOST_AUTO_TEST_CASE(wrong_type) {
   BOOST_CHECK_THROW(parse_raw_data_packet(raw_data), runtime_error);
   BOOST_CHECK_THROW(parse_raw_ack_packet(raw_data), runtime_error);
 }
+
+BOOST_AUTO_TEST_CASE(header_only_rw) {
+  fountain_packet test_fp;
+  test_fp.block_number(0x4);
+  test_fp.sequence_number(0xedde);
+  test_fp.block_seed(0xffee00bb);
+  test_fp.resize(3);
+
+  raw_data_header h = build_raw_data_header(test_fp);
+  const char *expected_raw = "\x00\x00\x04\xed\xde\xff\xee\x00\xbb\x00\x03";
+  BOOST_CHECK(equal(h.cbegin(), h.cbegin() + data_header_size,
+		    expected_raw));
+
+  // The header matches the start of the full raw packet
+  vector<char> raw = build_raw_packet(test_fp);
+  BOOST_CHECK(equal(h.cbegin(), h.cbegin() + data_header_size,
+		    raw.cbegin()));
+
+  fountain_packet decoded_fp;
+  size_t length = parse_raw_data_header(h, decoded_fp);
+  BOOST_CHECK_EQUAL(length, 3);
+  BOOST_CHECK_EQUAL(decoded_fp.block_number(), test_fp.block_number());
+  BOOST_CHECK_EQUAL(decoded_fp.sequence_number(), test_fp.sequence_number());
+  BOOST_CHECK_EQUAL(decoded_fp.block_seed(), test_fp.block_seed());
+  BOOST_CHECK(decoded_fp.empty());
+
+  h[0] = raw_packet_type::block_ack;
+  BOOST_CHECK_THROW(parse_raw_data_header(h, decoded_fp), runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(multi_read_write) {
+  vector<fountain_packet> fps;
+  for (int i = 0; i < 3; ++i) {
+    fountain_packet fp(0x4, 0x100 + i, 0xffee00bb, 2, 0x11 * (i+1));
+    fps.push_back(fp);
+  }
+
+  vector<char> raw = build_raw_multi_packet(fps);
+  const char *expected_raw =
+    "\x02\x00\x04\xff\xee\x00\xbb\x03\x00\x02"
+    "\x01\x00\x11\x11"
+    "\x01\x01\x22\x22"
+    "\x01\x02\x33\x33";
+  BOOST_CHECK_EQUAL(raw.size(), data_multi_header_size + 3 * (2 + 2));
+  BOOST_CHECK(equal(raw.cbegin(), raw.cend(), expected_raw));
+
+  vector<fountain_packet> parsed = parse_raw_multi_packet(raw);
+  BOOST_CHECK(equal(parsed.cbegin(), parsed.cend(),
+		    fps.cbegin(), fps.cend()));
+
+  raw.pop_back();
+  BOOST_CHECK_THROW(parse_raw_multi_packet(raw), runtime_error);
+  raw[0] = raw_packet_type::data;
+  BOOST_CHECK_THROW(parse_raw_multi_packet(raw), runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(multi_wrong_symbols) {
+  vector<fountain_packet> fps;
+  BOOST_CHECK_THROW(build_raw_multi_packet(fps), invalid_argument);
+
+  fps.push_back(fountain_packet(1, 0, 7, 4, 0));
+  fps.push_back(fountain_packet(2, 1, 7, 4, 0));
+  BOOST_CHECK_THROW(build_raw_multi_packet(fps), invalid_argument);
+
+  fps.back() = fountain_packet(1, 1, 7, 5, 0);
+  BOOST_CHECK_THROW(build_raw_multi_packet(fps), invalid_argument);
+
+  fps.assign(max_symbols_per_datagram + 1, fountain_packet(1, 0, 7, 4, 0));
+  BOOST_CHECK_THROW(build_raw_multi_packet(fps), invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(multi_symbol_count) {
+  BOOST_CHECK_EQUAL(symbols_per_datagram(50, 1472), 28);
+  BOOST_CHECK_EQUAL(symbols_per_datagram(1000, 1472), 1);
+  BOOST_CHECK_EQUAL(symbols_per_datagram(2000, 1472), 1);
+  BOOST_CHECK_EQUAL(symbols_per_datagram(2, 1472), max_symbols_per_datagram);
+  BOOST_CHECK_EQUAL(symbols_per_datagram(50, 0), 1);
+}
+
+BOOST_AUTO_TEST_CASE(v1_read_write) {
+  fountain_packet test_fp;
+  test_fp.block_number(0x12345678);
+  test_fp.sequence_number(0x10000);
+  test_fp.block_seed(0xffee00bb);
+  test_fp.resize(3);
+  test_fp[0] = 0x11;
+  test_fp[1] = 0x22;
+  test_fp[2] = 0x33;
+
+  vector<char> raw = build_raw_packet(test_fp, header_v1);
+  const char *expected_raw =
+    "\x10\x12\x34\x56\x78\x00\x01\x00\x00\xff\xee\x00\xbb\x00\x03"
+    "\x11\x22\x33";
+  BOOST_CHECK_EQUAL(raw.size(), data_header_size_v1 + 3);
+  BOOST_CHECK(equal(raw.cbegin(), raw.cend(), expected_raw));
+
+  fountain_packet decoded_fp = parse_raw_data_packet(raw);
+  BOOST_CHECK_EQUAL(test_fp, decoded_fp);
+
+  raw.pop_back();
+  BOOST_CHECK_THROW(parse_raw_data_packet(raw), runtime_error);
+
+  // Version 0 cannot carry the same numbers
+  BOOST_CHECK_THROW(build_raw_packet(test_fp), exception);
+}
+
+BOOST_AUTO_TEST_CASE(v1_ack) {
+  const std::size_t bns[] = {0, 0xffff, 0x10000, 0x12345678, 0xffffffff};
+
+  for (std::size_t bn : bns) {
+    std::vector<char> raw = build_raw_ack(bn, header_v1);
+    BOOST_CHECK_EQUAL(raw.size(), ack_header_size_v1);
+    BOOST_CHECK_EQUAL(raw[0], '\x11');
+    BOOST_CHECK_EQUAL(parse_raw_ack_packet(raw), bn);
+  }
+
+  std::vector<char> shr(ack_header_size, '\x11');
+  BOOST_CHECK_THROW(parse_raw_ack_packet(shr), runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(v1_multi_read_write) {
+  vector<fountain_packet> fps;
+  for (int i = 0; i < 2; ++i) {
+    fountain_packet fp(0x10004, 0x10000 + i, 0xffee00bb, 2, 0x11 * (i+1));
+    fps.push_back(fp);
+  }
+
+  vector<char> raw = build_raw_multi_packet(fps, header_v1);
+  const char *expected_raw =
+    "\x12\x00\x01\x00\x04\xff\xee\x00\xbb\x02\x00\x02"
+    "\x00\x01\x00\x00\x11\x11"
+    "\x00\x01\x00\x01\x22\x22";
+  BOOST_CHECK_EQUAL(raw.size(), data_multi_header_size_v1 + 2 * (4 + 2));
+  BOOST_CHECK(equal(raw.cbegin(), raw.cend(), expected_raw));
+
+  vector<fountain_packet> parsed = parse_raw_multi_packet(raw);
+  BOOST_CHECK(equal(parsed.cbegin(), parsed.cend(),
+		    fps.cbegin(), fps.cend()));
+
+  BOOST_CHECK_EQUAL(symbols_per_datagram(50, 1472, header_v1), 27);
+}
+
+BOOST_AUTO_TEST_CASE(unknown_version) {
+  vector<char> raw = build_raw_packet(fountain_packet(1, 2, 3, 4, 0));
+  raw[0] = raw_type_byte(raw_packet_type::data,
+			 static_cast<raw_header_version>(2));
+  BOOST_CHECK_THROW(parse_raw_data_packet(raw), runtime_error);
+  raw[0] = raw_type_byte(raw_packet_type::block_ack,
+			 static_cast<raw_header_version>(0xf));
+  BOOST_CHECK_THROW(parse_raw_ack_packet(raw), runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(extend_short_blockno) {
+  BOOST_CHECK_EQUAL(extend_block_number(5, 3), 5);
+  BOOST_CHECK_EQUAL(extend_block_number(1, 3), 1);
+  BOOST_CHECK_EQUAL(extend_block_number(0x0002, 0x1fffe), 0x20002);
+  BOOST_CHECK_EQUAL(extend_block_number(0xfffe, 0x20002), 0x1fffe);
+  BOOST_CHECK_EQUAL(extend_block_number(0x0001, 0xffffffff), 1);
+  BOOST_CHECK_EQUAL(extend_block_number(0xffff, 0), 0xffffffff);
+}
@@ -1,6 +1,7 @@
 #define BOOST_TEST_MODULE packets_test
 #include <boost/test/unit_test.hpp>
 
+#include "buffer_pool.hpp"
 #include "packets.hpp"
 #include <boost/numeric/conversion/cast.hpp>
 
@@ -23,6 +24,39 @@ BOOST_AUTO_TEST_CASE(packet_shallow_copy) {
   BOOST_CHECK(pp == p);
 }
 
+BOOST_AUTO_TEST_CASE(packet_shared_buffer) {
+  buffer_pool pool;
+  BOOST_CHECK_EQUAL(pool.free_count(), 0);
+  const char *data;
+  {
+    packet p(pool.get(10));
+    BOOST_CHECK_EQUAL(p.size(), 10);
+    data = p.data();
+    fountain_packet fp(std::move(p));
+    BOOST_CHECK_EQUAL(fp.data(), data); // not copied
+  }
+  // The buffer returns to the pool and is reused
+  BOOST_CHECK_EQUAL(pool.free_count(), 1);
+  packet q(pool.get(5));
+  BOOST_CHECK_EQUAL(q.size(), 5);
+  BOOST_CHECK_EQUAL(q.data(), data);
+  BOOST_CHECK_EQUAL(pool.free_count(), 0);
+
+  BOOST_CHECK_THROW(packet(std::shared_ptr<buffer_type>()), invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(buffer_pool_outlived) {
+  std::shared_ptr<buffer_type> b;
+  {
+    buffer_pool pool(1);
+    b = pool.get(4);
+    auto c = pool.get(4);
+    auto d = pool.get(4);
+  }
+  BOOST_CHECK_EQUAL(b->size(), 4);
+  b.reset(); // The pool is gone: must just free the buffer
+}
+
 BOOST_AUTO_TEST_CASE(fountain_packet_shallow_copy) {
   fountain_packet p(1,2,3, 5, 0x11);
   fountain_packet q(p);
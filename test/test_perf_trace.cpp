@@ -0,0 +1,131 @@
+#define BOOST_TEST_MODULE test_perf_trace
+#include <boost/test/unit_test.hpp>
+
+#include "packets.hpp"
+#include "perf_trace.hpp"
+
+#include <boost/filesystem.hpp>
+
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+using namespace uep;
+using namespace uep::perf_trace;
+
+BOOST_AUTO_TEST_CASE(ring_push_pop) {
+  trace_ring r;
+  record rec = make_record(lt_decoder_push_uniq, 0);
+  for (size_t i = 0; i < trace_ring::CAPACITY; ++i) {
+    rec.args[0] = i;
+    BOOST_REQUIRE(r.push(rec));
+  }
+  BOOST_CHECK(!r.push(rec));
+  BOOST_CHECK_EQUAL(r.dropped(), 1);
+
+  vector<record> out(trace_ring::CAPACITY);
+  BOOST_CHECK_EQUAL(r.pop(out.data(), 10), 10);
+  BOOST_CHECK_EQUAL(out[9].args[0], 9);
+
+  // Wrap around the end of the buffer
+  for (size_t i = 0; i < 10; ++i) {
+    rec.args[0] = trace_ring::CAPACITY + i;
+    BOOST_REQUIRE(r.push(rec));
+  }
+  BOOST_CHECK_EQUAL(r.pop(out.data(), out.size()), trace_ring::CAPACITY);
+  for (size_t i = 0; i < trace_ring::CAPACITY; ++i) {
+    BOOST_REQUIRE_EQUAL(out[i].args[0], i + 10);
+  }
+  BOOST_CHECK_EQUAL(r.pop(out.data(), out.size()), 0);
+}
+
+BOOST_AUTO_TEST_CASE(same_text_as_perf_log) {
+  fountain_packet p(7, 42, static_cast<int>(0xdeadbeef), 100, 0x00, 1);
+
+  ostringstream coded;
+  coded << "lt_encoder::next_coded new_coded_packet=" << p
+	<< " encode_time=" << 1.5e-6;
+  BOOST_CHECK_EQUAL(message(make_record(lt_encoder_next_coded,
+					p.block_number(), p.sequence_number(),
+					static_cast<uint32_t>(p.block_seed()),
+					p.size(), p.getPriority(), 1.5e-6)),
+		    coded.str());
+
+  ostringstream dropped;
+  dropped << "data_client::handle_received drop_pkt" << p;
+  BOOST_CHECK_EQUAL(message(make_record(data_client_drop_pkt,
+					p.block_number(), p.sequence_number(),
+					static_cast<uint32_t>(p.block_seed()),
+					p.size(), p.getPriority())),
+		    dropped.str());
+
+  BOOST_CHECK_EQUAL(message(make_record(uep_encoder_push_new_packet,
+					512, 1, 10)),
+		    "uep_encoder::push new_packet"
+		    " orig_size=512 priority=1 seqno=10");
+
+  record r = make_record(lt_decoder_push_time, 0.25);
+  BOOST_CHECK_EQUAL(message(r), "lt_decoder::push push_time=0.25");
+  BOOST_CHECK_EQUAL(timestamp(r).size(),
+		    string("[2017-01-01 00:00:00.000000]").size());
+
+  r.event = n_event_types;
+  BOOST_CHECK_THROW(message(r), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(trace_from_threads) {
+  namespace fs = boost::filesystem;
+  const fs::path path = fs::temp_directory_path() /
+    fs::unique_path("test_perf_trace-%%%%%%%%");
+
+  const size_t n_threads = 4;
+  const size_t n_events = trace_ring::CAPACITY / 2;
+  start(path.string());
+  BOOST_CHECK(is_active());
+  BOOST_CHECK_THROW(start(path.string()), std::runtime_error);
+
+  vector<thread> threads;
+  for (size_t t = 0; t < n_threads; ++t) {
+    threads.emplace_back([t, n_events](){
+	for (size_t i = 0; i < n_events; ++i) {
+	  emit(lt_decoder_push_new_block, t * n_events + i);
+	}
+      });
+  }
+  for (auto &th : threads) th.join();
+  trace_stats s = stop();
+  BOOST_CHECK(!is_active());
+  BOOST_CHECK_EQUAL(s.written, n_threads * n_events);
+  BOOST_CHECK_EQUAL(s.dropped, 0);
+
+  // Not recorded after stop()
+  emit(lt_decoder_push_new_block, 0);
+
+  ifstream in(path.string(), ios_base::binary);
+  vector<record> recs = read(in);
+  BOOST_REQUIRE_EQUAL(recs.size(), n_threads * n_events);
+  vector<size_t> next(n_threads, 0);
+  for (const record &r : recs) {
+    size_t t = r.args[0] / n_events;
+    BOOST_REQUIRE_EQUAL(r.args[0] % n_events, next[t]++);
+  }
+
+  // Merge with a text log
+  ostringstream text;
+  istringstream perflog("[1970-01-01 00:00:00.000000] | first\n"
+			"[9999-01-01 00:00:00.000000] | last\n");
+  write_text(recs, &perflog, text);
+  string out = text.str();
+  BOOST_CHECK_EQUAL(out.find("] | first\n"), 27);
+  BOOST_CHECK_EQUAL(out.rfind("] | last\n"), out.size() - 9);
+  BOOST_CHECK_EQUAL(static_cast<size_t>(count(out.begin(), out.end(), '\n')),
+		    n_threads * n_events + 2);
+  fs::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(not_a_trace) {
+  istringstream in("[2017-01-01 00:00:00.000000] | not binary\n");
+  BOOST_CHECK_THROW(read(in), std::runtime_error);
+  BOOST_CHECK_EQUAL(stop().written, 0);
+}
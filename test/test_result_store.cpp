@@ -0,0 +1,121 @@
+#define BOOST_TEST_MODULE test_result_store
+#include <boost/test/unit_test.hpp>
+
+#include "result_store.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <limits>
+
+#include <unistd.h>
+
+using namespace uep;
+
+namespace {
+
+result_record make_record(double overhead) {
+  const std::vector<std::size_t> Ks{100, 1900};
+  const std::vector<std::size_t> errors{3, 400};
+  result_record r;
+  r.add_ints("Ks", Ks.cbegin(), Ks.cend());
+  r.add_int("EF", 2);
+  r.add_double("overhead", overhead);
+  r.add_uint("seed", std::numeric_limits<std::uint64_t>::max());
+  r.add_string("git_sha1", "0123abc");
+  r.add_ints("error_counts", errors.cbegin(), errors.cend());
+  r.add_doubles("pers", {0.03, 0.2, 0.5});
+  return r;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(write_and_read) {
+  const std::string path = "test_result_store.rs";
+  std::remove(path.c_str());
+  {
+    result_store_writer w(path);
+    w.append(make_record(0.1));
+    w.append(make_record(0.2));
+  }
+  {
+    // Append to the existing store
+    result_store_writer w(path);
+    w.append(make_record(0.3));
+  }
+
+  result_store rs = result_store::open(path);
+  BOOST_REQUIRE_EQUAL(rs.size(), 3);
+  for (std::size_t i = 0; i < rs.size(); ++i) {
+    result_record_view r = rs[i];
+    BOOST_CHECK_EQUAL(r.size(), 7);
+    BOOST_CHECK_CLOSE(r.get_double("overhead"), 0.1 * (i+1), 1e-9);
+  }
+
+  result_record_view r = rs[1];
+  std::vector<std::int64_t> Ks = r.get_ints("Ks");
+  BOOST_REQUIRE_EQUAL(Ks.size(), 2);
+  BOOST_CHECK_EQUAL(Ks[0], 100);
+  BOOST_CHECK_EQUAL(Ks[1], 1900);
+  BOOST_CHECK_EQUAL(r.get_int("EF"), 2);
+  BOOST_CHECK_EQUAL(r.get_uint("seed"), std::numeric_limits<std::uint64_t>::max());
+  BOOST_CHECK_EQUAL(r.get_string("git_sha1"), "0123abc");
+  BOOST_CHECK_EQUAL(r.get_doubles("pers").size(), 3);
+  BOOST_CHECK(r.find("Ks")->flags == 0);
+  BOOST_CHECK(r.find("EF")->flags & result_column_header::scalar_flag);
+
+  BOOST_CHECK(r.find("K") == nullptr);
+  BOOST_CHECK_THROW(r.get_int("missing"), std::out_of_range);
+  BOOST_CHECK_THROW(r.get_double("EF"), std::runtime_error);
+  BOOST_CHECK_THROW(r.get_int("Ks"), std::runtime_error);
+
+  std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(truncated_record) {
+  const std::string path = "test_result_store.trunc.rs";
+  std::remove(path.c_str());
+  {
+    result_store_writer w(path);
+    w.append(make_record(0.1));
+    w.append(make_record(0.2));
+  }
+  std::ifstream ifs(path, std::ios_base::binary | std::ios_base::ate);
+  const long size = ifs.tellg();
+  BOOST_REQUIRE_EQUAL(truncate(path.c_str(), size - 8), 0);
+
+  {
+    result_store rs = result_store::open(path);
+    BOOST_CHECK_EQUAL(rs.size(), 1);
+  }
+
+  // The next append replaces the truncated record
+  {
+    result_store_writer w(path);
+    w.append(make_record(0.3));
+    w.append(make_record(0.4));
+  }
+  result_store rs = result_store::open(path);
+  BOOST_REQUIRE_EQUAL(rs.size(), 3);
+  BOOST_CHECK_CLOSE(rs[0].get_double("overhead"), 0.1, 1e-9);
+  BOOST_CHECK_CLOSE(rs[1].get_double("overhead"), 0.3, 1e-9);
+  BOOST_CHECK_CLOSE(rs[2].get_double("overhead"), 0.4, 1e-9);
+  std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(wrong_files) {
+  const std::string path = "test_result_store.bad.rs";
+  {
+    std::ofstream ofs(path, std::ios_base::binary | std::ios_base::trunc);
+    ofs << "UEPTIDX this is not a result store";
+  }
+  BOOST_CHECK_THROW(result_store::open(path), std::runtime_error);
+  BOOST_CHECK_THROW(result_store_writer w(path), std::runtime_error);
+  std::remove(path.c_str());
+
+  result_record r;
+  r.add_int("a", 1);
+  BOOST_CHECK_THROW(r.add_double("a", 1), std::invalid_argument);
+  BOOST_CHECK_THROW(r.add_double("", 1), std::invalid_argument);
+  BOOST_CHECK_THROW(r.add_double(std::string(32, 'x'), 1),
+		    std::invalid_argument);
+}
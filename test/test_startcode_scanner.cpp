@@ -0,0 +1,106 @@
+#define BOOST_TEST_MODULE test_startcode_scanner
+#include <boost/test/unit_test.hpp>
+
+#include "startcode_scanner.hpp"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace uep;
+
+namespace {
+
+/** Reference implementations, one byte at a time. */
+const char *ref_zero_pair(const char *first, const char *last) {
+  for (const char *p = first; last - p >= 2; ++p) {
+    if (p[0] == 0 && p[1] == 0) return p;
+  }
+  return last;
+}
+
+const char *ref_startcode(const char *first, const char *last) {
+  static const char sc[3] = {0x00, 0x00, 0x01};
+  return std::search(first, last, sc, sc+3);
+}
+
+const char *ref_nal_end(const char *first, const char *last) {
+  for (const char *p = first; last - p >= 3; ++p) {
+    if (p[0] == 0 && p[1] == 0 && static_cast<unsigned char>(p[2]) <= 2)
+      return p;
+  }
+  return last;
+}
+
+/** Random bytes where 0x00, 0x01, 0x02 and 0x03 are frequent. */
+std::vector<char> random_stream(std::size_t size, unsigned int seed,
+				double p_small) {
+  std::mt19937 rng(seed);
+  std::bernoulli_distribution small(p_small);
+  std::uniform_int_distribution<int> small_val(0, 3);
+  std::uniform_int_distribution<int> any_val(0, 255);
+  std::vector<char> v(size);
+  for (auto &c : v) {
+    c = static_cast<char>(small(rng) ? small_val(rng) : any_val(rng));
+  }
+  return v;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(isa_is_known) {
+  std::string isa = scan_isa();
+  BOOST_CHECK(isa == "avx2" || isa == "sse2" || isa == "scalar");
+  BOOST_TEST_MESSAGE("Using " << isa);
+}
+
+BOOST_AUTO_TEST_CASE(empty_and_short_ranges) {
+  const char b[3] = {0x00, 0x00, 0x01};
+  BOOST_CHECK(scan_zero_pair(b, b) == b);
+  BOOST_CHECK(scan_zero_pair(b, b+1) == b+1);
+  BOOST_CHECK(scan_zero_pair(b, b+2) == b);
+  BOOST_CHECK(scan_startcode(b, b+2) == b+2);
+  BOOST_CHECK(scan_startcode(b, b+3) == b);
+  BOOST_CHECK(scan_nal_end(b, b+2) == b+2);
+  BOOST_CHECK(scan_nal_end(b, b+3) == b);
+}
+
+BOOST_AUTO_TEST_CASE(match_reference) {
+  for (double p_small : {0.05, 0.3, 0.9}) {
+    const std::vector<char> v = random_stream(300, 7, p_small);
+    const char *base = v.data();
+    for (std::size_t first = 0; first < 40; ++first) {
+      for (std::size_t last = first; last <= v.size(); ++last) {
+	const char *f = base + first;
+	const char *l = base + last;
+	BOOST_REQUIRE(scan_zero_pair(f, l) == ref_zero_pair(f, l));
+	BOOST_REQUIRE(scan_startcode(f, l) == ref_startcode(f, l));
+	BOOST_REQUIRE(scan_nal_end(f, l) == ref_nal_end(f, l));
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(long_stream) {
+  // Few zeros: mostly the vectorised loop
+  std::vector<char> v = random_stream(1 << 20, 42, 0.002);
+  for (std::size_t i = 1000; i + 3 < v.size(); i += 1013) {
+    v[i] = 0x00;
+    v[i+1] = 0x00;
+    v[i+2] = 0x01;
+  }
+  const char *f = v.data();
+  const char *l = f + v.size();
+  std::size_t n_sc = 0;
+  const char *p = f, *q = f;
+  for (;;) {
+    p = scan_startcode(p, l);
+    q = ref_startcode(q, l);
+    BOOST_REQUIRE(p == q);
+    if (p == l) break;
+    ++n_sc;
+    p += 3;
+    q += 3;
+  }
+  BOOST_CHECK_GT(n_sc, 0);
+}
@@ -0,0 +1,258 @@
+#define BOOST_TEST_MODULE test_stream_session
+#include <boost/test/unit_test.hpp>
+
+#include "encoder.hpp"
+#include "stream_session.hpp"
+
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace uep;
+using namespace uep::net;
+
+// Set globally the log severity level
+struct global_fixture {
+  global_fixture() {
+    uep::log::init();
+    auto warn_filter = boost::log::expressions::attr<
+      uep::log::severity_level>("Severity") >= uep::log::warning;
+    boost::log::core::get()->set_filter(warn_filter);
+  }
+
+  ~global_fixture() {
+  }
+};
+BOOST_GLOBAL_FIXTURE(global_fixture);
+
+namespace {
+
+const std::size_t K = 10;
+const std::size_t L = 16;
+
+/** Source that produces `count` packets filled with their index. */
+struct counting_source {
+  std::size_t count;
+  std::size_t n;
+
+  explicit counting_source(std::size_t count) : count(count), n(0) {}
+
+  fountain_packet next_packet() {
+    if (n == count) throw std::runtime_error("Max packet count");
+    fountain_packet p;
+    p.resize(L, static_cast<char>(n));
+    ++n;
+    return p;
+  }
+
+  explicit operator bool() const { return n < count; }
+  bool operator!() const { return !static_cast<bool>(*this); }
+};
+
+typedef stream_session<lt_encoder<std::mt19937>, counting_source> session_type;
+
+/** Session over `n_blocks` blocks of K packets. */
+struct setup_session {
+  session_type s;
+
+  explicit setup_session(std::size_t n_blocks = 3) {
+    s.setup_encoder(K, 0.1, 0.5);
+    s.setup_source(n_blocks * K);
+  }
+};
+
+}
+
+BOOST_FIXTURE_TEST_CASE(encode_once, setup_session) {
+  auto a = s.subscribe({});
+  auto b = s.subscribe({});
+  BOOST_CHECK_EQUAL(s.subscriber_count(), 2);
+
+  std::vector<fountain_packet> pa, pb;
+  BOOST_CHECK_EQUAL(s.next_coded(a, 15, 20, pa), session_type::session_ready);
+  BOOST_CHECK_EQUAL(s.next_coded(b, 20, 20, pb), session_type::session_ready);
+  BOOST_CHECK_EQUAL(s.next_coded(a, 20, 20, pa), session_type::session_ready);
+  BOOST_REQUIRE_EQUAL(pa.size(), 20);
+  BOOST_REQUIRE_EQUAL(pb.size(), 20);
+  for (std::size_t i = 0; i < pa.size(); ++i) {
+    BOOST_CHECK_EQUAL(pa[i].sequence_number(), i);
+    BOOST_CHECK(pa[i].data() == pb[i].data());
+  }
+  BOOST_CHECK_EQUAL(s.total_coded_count(), 20);
+  BOOST_CHECK_EQUAL(s.total_read_count(), 40);
+}
+
+BOOST_FIXTURE_TEST_CASE(fast_subscriber_waits, setup_session) {
+  std::size_t a_wakes = 0;
+  auto a = s.subscribe([&a_wakes]() { ++a_wakes; });
+  auto b = s.subscribe({});
+  std::vector<fountain_packet> out;
+
+  s.next_coded(a, 5, 100, out);
+  BOOST_CHECK(s.acknowledge(a, 1));
+  BOOST_CHECK(!s.acknowledge(a, 1));
+  BOOST_CHECK_EQUAL(s.blockno(), 0);
+  BOOST_CHECK_EQUAL(s.next_coded(a, 5, 100, out), session_type::session_wait);
+
+  BOOST_CHECK_EQUAL(s.next_coded(b, 5, 100, out), session_type::session_ready);
+  BOOST_CHECK_EQUAL(a_wakes, 0);
+  BOOST_CHECK(s.acknowledge(b, 1));
+  BOOST_CHECK_EQUAL(s.blockno(), 1);
+  BOOST_CHECK_EQUAL(a_wakes, 1);
+  BOOST_CHECK(!s.is_joinable());
+  BOOST_CHECK_THROW(s.subscribe({}), std::logic_error);
+
+  out.clear();
+  BOOST_CHECK_EQUAL(s.next_coded(a, 1, 100, out), session_type::session_ready);
+  BOOST_REQUIRE_EQUAL(out.size(), 1);
+  BOOST_CHECK_EQUAL(out[0].block_number(), 1);
+  BOOST_CHECK_EQUAL(out[0].sequence_number(), 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(unsubscribe_releases_block, setup_session) {
+  std::size_t a_wakes = 0;
+  auto a = s.subscribe([&a_wakes]() { ++a_wakes; });
+  auto b = s.subscribe({});
+  std::vector<fountain_packet> out;
+
+  s.acknowledge(a, 1);
+  BOOST_CHECK_EQUAL(s.next_coded(a, 1, 100, out), session_type::session_wait);
+  s.unsubscribe(b);
+  BOOST_CHECK_EQUAL(s.subscriber_count(), 1);
+  BOOST_CHECK_EQUAL(s.blockno(), 1);
+  BOOST_CHECK_EQUAL(a_wakes, 1);
+}
+
+BOOST_FIXTURE_TEST_CASE(block_limit_moves_subscriber, setup_session) {
+  auto a = s.subscribe({});
+  auto b = s.subscribe({});
+  std::vector<fountain_packet> out;
+
+  BOOST_CHECK_EQUAL(s.next_coded(a, 100, 12, out), session_type::session_ready);
+  BOOST_CHECK_EQUAL(out.size(), 12);
+  // The limit is reached: a wants the next block
+  BOOST_CHECK_EQUAL(s.next_coded(a, 1, 12, out), session_type::session_wait);
+  BOOST_CHECK_EQUAL(s.blockno(), 0);
+  s.next_coded(b, 100, 12, out);
+  BOOST_CHECK_EQUAL(s.next_coded(b, 1, 12, out), session_type::session_ready);
+  BOOST_CHECK_EQUAL(s.blockno(), 1);
+  BOOST_CHECK_EQUAL(out.back().block_number(), 1);
+}
+
+BOOST_FIXTURE_TEST_CASE(follower_pushes_others, setup_session) {
+  std::size_t a_wakes = 0;
+  auto f = s.subscribe({}, true);
+  auto a = s.subscribe([&a_wakes]() { ++a_wakes; });
+  std::vector<fountain_packet> out;
+
+  // An ACK from a follower is ignored
+  BOOST_CHECK(!s.acknowledge(f, 1));
+
+  s.max_sequence_number(8);
+  BOOST_CHECK_EQUAL(s.next_coded(f, 100, 100, out), session_type::session_ready);
+  BOOST_CHECK_EQUAL(out.size(), 8);
+  BOOST_CHECK_EQUAL(s.next_coded(f, 1, 100, out), session_type::session_ready);
+  BOOST_CHECK_EQUAL(s.blockno(), 1);
+  BOOST_CHECK_EQUAL(out.back().block_number(), 1);
+
+  // The follower does not hold back the frontier
+  BOOST_CHECK(s.acknowledge(a, 2));
+  BOOST_CHECK_EQUAL(s.blockno(), 2);
+  BOOST_CHECK_EQUAL(s.next_coded(f, 1, 100, out), session_type::session_ready);
+  BOOST_CHECK_EQUAL(out.back().block_number(), 2);
+  BOOST_CHECK_EQUAL(out.back().sequence_number(), 0);
+  BOOST_CHECK_EQUAL(a_wakes, 0);
+}
+
+BOOST_AUTO_TEST_CASE(read_until_end) {
+  const std::size_t n_blocks = 4;
+  setup_session ss(n_blocks);
+  session_type &s = ss.s;
+
+  std::size_t wakes = 0;
+  auto a = s.subscribe([&wakes]() { ++wakes; });
+  std::vector<fountain_packet> out;
+  session_type::read_status st;
+  while ((st = s.next_coded(a, 3, 2*K, out)) == session_type::session_ready);
+
+  BOOST_CHECK_EQUAL(st, session_type::session_end);
+  BOOST_CHECK(s.is_ended());
+  BOOST_CHECK_EQUAL(out.size(), n_blocks * 2*K);
+  BOOST_CHECK_EQUAL(s.total_coded_count(), out.size());
+  for (std::size_t i = 0; i < out.size(); ++i) {
+    BOOST_CHECK_EQUAL(out[i].block_number(), i / (2*K));
+    BOOST_CHECK_EQUAL(out[i].sequence_number(), i % (2*K));
+  }
+  BOOST_CHECK_EQUAL(s.next_coded(a, 1, 2*K, out), session_type::session_end);
+  BOOST_CHECK_EQUAL(wakes, 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(cache_limit_moves_subscriber, setup_session) {
+  // b reads without ever ACKing: it leaves the block at the cache limit
+  auto a = s.subscribe({});
+  auto b = s.subscribe({});
+  s.max_cached_per_block(15);
+  std::vector<fountain_packet> out;
+
+  BOOST_CHECK(s.acknowledge(a, 1));
+  BOOST_CHECK_EQUAL(s.next_coded(b, 100, 100, out), session_type::session_ready);
+  BOOST_CHECK_EQUAL(out.size(), 15);
+  BOOST_CHECK_EQUAL(s.total_coded_count(), 15);
+  BOOST_CHECK_EQUAL(s.next_coded(b, 1, 100, out), session_type::session_ready);
+  BOOST_CHECK_EQUAL(s.blockno(), 1);
+  BOOST_CHECK_EQUAL(out.back().block_number(), 1);
+}
+
+BOOST_FIXTURE_TEST_CASE(stalled_subscriber_evicted, setup_session) {
+  // b never reads nor ACKs and never leaves the frontier block
+  std::size_t a_wakes = 0;
+  auto a = s.subscribe([&a_wakes]() { ++a_wakes; });
+  auto b = s.subscribe({});
+  s.max_block_time(std::chrono::milliseconds(50));
+  std::vector<fountain_packet> out;
+
+  BOOST_CHECK(s.acknowledge(a, 1));
+  BOOST_CHECK_EQUAL(s.next_coded(a, 1, 100, out), session_type::session_wait);
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
+  BOOST_CHECK_EQUAL(s.next_coded(a, 1, 100, out), session_type::session_ready);
+  BOOST_CHECK_EQUAL(s.blockno(), 1);
+  BOOST_CHECK_EQUAL(out.back().block_number(), 1);
+  BOOST_CHECK_EQUAL(a_wakes, 1);
+
+  // The evicted subscriber gets to the end of the stream
+  BOOST_CHECK_EQUAL(s.next_coded(b, 1, 100, out), session_type::session_end);
+  BOOST_CHECK(!s.acknowledge(b, 2));
+  BOOST_CHECK_EQUAL(s.subscriber_count(), 2);
+}
+
+BOOST_FIXTURE_TEST_CASE(slow_subscriber_pushed, setup_session) {
+  // b keeps reading but holds the frontier for too long
+  auto a = s.subscribe({});
+  auto b = s.subscribe({});
+  s.max_block_time(std::chrono::milliseconds(100));
+  std::vector<fountain_packet> out;
+
+  BOOST_CHECK(s.acknowledge(a, 1));
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
+  BOOST_CHECK_EQUAL(s.next_coded(b, 1, 100, out), session_type::session_ready);
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
+  BOOST_CHECK_EQUAL(s.next_coded(a, 1, 100, out), session_type::session_ready);
+  BOOST_CHECK_EQUAL(s.blockno(), 1);
+
+  // b was pushed, not evicted
+  out.clear();
+  BOOST_CHECK_EQUAL(s.next_coded(b, 1, 100, out), session_type::session_ready);
+  BOOST_REQUIRE_EQUAL(out.size(), 1);
+  BOOST_CHECK_EQUAL(out[0].block_number(), 1);
+  BOOST_CHECK_EQUAL(out[0].sequence_number(), 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(unknown_subscriber, setup_session) {
+  auto a = s.subscribe({});
+  std::vector<fountain_packet> out;
+  BOOST_CHECK_THROW(s.next_coded(a + 1, 1, 10, out), std::invalid_argument);
+  BOOST_CHECK(!s.acknowledge(a + 1, 1));
+  s.unsubscribe(a + 1);
+  BOOST_CHECK_EQUAL(s.subscriber_count(), 1);
+}
@@ -0,0 +1,95 @@
+#include <chrono>
+#include <limits>
+
+#define BOOST_TEST_MODULE test_token_bucket
+
+#include <boost/test/unit_test.hpp>
+
+#include "token_bucket.hpp"
+
+using namespace std;
+using namespace std::chrono;
+using namespace uep;
+
+BOOST_AUTO_TEST_CASE(unlimited_bucket) {
+  auto t0 = token_bucket::clock::now();
+  token_bucket tb;
+  BOOST_CHECK(tb.unlimited());
+  for (int i = 0; i < 1000; ++i) {
+    BOOST_CHECK(tb.consume(1e9, t0));
+  }
+  BOOST_CHECK(tb.wait_time(1e9, t0) == token_bucket::duration::zero());
+
+  token_bucket zero(0, 10);
+  BOOST_CHECK(zero.unlimited());
+  BOOST_CHECK(zero.consume(100, t0));
+}
+
+BOOST_AUTO_TEST_CASE(burst_then_rate) {
+  auto t0 = token_bucket::clock::now();
+  token_bucket tb(1000, 100); // 1000 tokens/s, burst of 100
+  tb.reset(t0);
+
+  // Empty the initial burst
+  for (int i = 0; i < 10; ++i) {
+    BOOST_CHECK(tb.consume(10, t0));
+  }
+  BOOST_CHECK(!tb.consume(10, t0));
+
+  // 10 tokens need 10 ms
+  auto w = tb.wait_time(10, t0);
+  BOOST_CHECK(w >= milliseconds(10));
+  BOOST_CHECK(w < milliseconds(11));
+  BOOST_CHECK(!tb.consume(10, t0 + milliseconds(9)));
+  BOOST_CHECK(tb.consume(10, t0 + w));
+}
+
+BOOST_AUTO_TEST_CASE(depth_limit) {
+  auto t0 = token_bucket::clock::now();
+  token_bucket tb(1000, 100);
+  tb.reset(t0);
+  BOOST_CHECK(tb.consume(100, t0));
+
+  // After a long idle period only `depth` tokens are available
+  auto t1 = t0 + seconds(10);
+  BOOST_CHECK_CLOSE(tb.available(t1), 100, 1e-9);
+  BOOST_CHECK(tb.consume(100, t1));
+  BOOST_CHECK(!tb.consume(1, t1));
+  BOOST_CHECK_THROW(tb.wait_time(101, t1), invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(average_rate) {
+  auto t0 = token_bucket::clock::now();
+  const double rate = 8e6;
+  const double pkt = 8 * 1035;
+  token_bucket tb(rate, 2 * pkt);
+  tb.reset(t0);
+
+  // Send back-to-back, waiting only when the bucket is empty
+  auto t = t0;
+  size_t sent = 0;
+  while (t - t0 < seconds(1)) {
+    if (tb.consume(pkt, t)) ++sent;
+    else t += max(tb.wait_time(pkt, t), token_bucket::duration(milliseconds(1)));
+  }
+  duration<double> dt = t - t0;
+  BOOST_CHECK_CLOSE(sent * pkt / dt.count(), rate, 1);
+}
+
+BOOST_AUTO_TEST_CASE(configure_keeps_tokens) {
+  auto t0 = token_bucket::clock::now();
+  token_bucket tb(1000, 100);
+  tb.reset(t0);
+  BOOST_CHECK(tb.consume(100, t0));
+
+  // 50 tokens accumulated at the old rate are kept
+  auto t1 = t0 + milliseconds(50);
+  tb.configure(2000, 200, t1);
+  BOOST_CHECK_CLOSE(tb.available(t1), 50, 1e-6);
+  BOOST_CHECK_CLOSE(tb.available(t1 + milliseconds(50)), 150, 1e-6);
+
+  // Shrinking the depth drops the excess tokens
+  tb.configure(2000, 20, t1);
+  BOOST_CHECK_CLOSE(tb.available(t1), 20, 1e-6);
+  BOOST_CHECK_THROW(tb.configure(1, -1, t1), invalid_argument);
+}
@@ -0,0 +1,186 @@
+#define BOOST_TEST_MODULE test_trace_index
+#include <boost/test/unit_test.hpp>
+
+#include "trace_index.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <sys/stat.h>
+#include <sys/time.h>
+
+using namespace uep;
+
+namespace {
+
+const std::string trace_path = "dataset/CREW_352x288_30_orig_01.trace";
+const std::size_t bitstream_size = 1571240;
+
+trace_index parse_file(const std::string &path) {
+  std::ifstream ifs(path, std::ios_base::binary);
+  BOOST_REQUIRE(ifs.is_open());
+  return trace_index::parse(ifs);
+}
+
+void write_file(const std::string &path, const std::string &content) {
+  std::ofstream ofs(path, std::ios_base::binary | std::ios_base::trunc);
+  ofs << content;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(parse_jsvm_trace) {
+  trace_index ti = parse_file(trace_path);
+  BOOST_CHECK(!ti.is_mapped());
+  BOOST_REQUIRE_EQUAL(ti.size(), 1505);
+
+  streamTrace st = ti[0].to_stream_trace();
+  BOOST_CHECK_EQUAL(st.startPos, 0);
+  BOOST_CHECK_EQUAL(st.len, 451);
+  BOOST_CHECK_EQUAL(st.packetType, streamTrace::stream_header);
+  BOOST_CHECK(!st.discardable);
+  BOOST_CHECK(!st.truncatable);
+
+  st = ti[5].to_stream_trace();
+  BOOST_CHECK_EQUAL(st.startPos, 0x1f2);
+  BOOST_CHECK_EQUAL(st.len, 18);
+  BOOST_CHECK_EQUAL(st.packetType, streamTrace::slice_data);
+
+  st = ti[ti.size()-1].to_stream_trace();
+  BOOST_CHECK_EQUAL(st.qid, 3);
+  BOOST_CHECK_EQUAL(st.tid, 4);
+  BOOST_CHECK(st.discardable);
+
+  // The NALs cover the whole bitstream
+  std::size_t next = 0;
+  for (const trace_record &r : ti) {
+    BOOST_CHECK_EQUAL(r.offset, next);
+    next = r.offset + r.len;
+  }
+  BOOST_CHECK_EQUAL(next, bitstream_size);
+}
+
+BOOST_AUTO_TEST_CASE(write_and_map) {
+  const std::string copy_path = "test_trace_index.trace";
+  std::ifstream orig(trace_path, std::ios_base::binary);
+  std::ostringstream text;
+  text << orig.rdbuf();
+  write_file(copy_path, text.str());
+
+  trace_index parsed = trace_index::parse_file(copy_path);
+  {
+    std::ofstream out(trace_index::index_path(copy_path),
+		      std::ios_base::binary | std::ios_base::trunc);
+    parsed.write(out);
+  }
+
+  trace_index mapped = trace_index::load(copy_path);
+  BOOST_CHECK(mapped.is_mapped());
+  BOOST_REQUIRE_EQUAL(mapped.size(), parsed.size());
+  BOOST_CHECK(std::memcmp(mapped.begin(), parsed.begin(),
+			  parsed.size() * sizeof(trace_record)) == 0);
+
+  // A moved index keeps its records
+  trace_index moved(std::move(mapped));
+  BOOST_CHECK_EQUAL(moved[1].len, 15);
+
+  std::remove(trace_index::index_path(copy_path).c_str());
+  std::remove(copy_path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(stale_index) {
+  const std::string copy_path = "test_trace_index.stale.trace";
+  const std::string line0 = "0x00000000 10 0 0 0 StreamHeader No No\n";
+  const std::string line1 = "0x0000000a 20 0 0 0 SliceData Yes No\n";
+  write_file(copy_path, line0);
+  {
+    std::ofstream out(trace_index::index_path(copy_path),
+		      std::ios_base::binary | std::ios_base::trunc);
+    trace_index::parse_file(copy_path).write(out);
+  }
+  BOOST_CHECK(trace_index::load(copy_path).is_mapped());
+
+  // Touched trace
+  struct stat st;
+  BOOST_REQUIRE_EQUAL(::stat(copy_path.c_str(), &st), 0);
+  struct timeval times[2] = {{st.st_atime, 0}, {st.st_mtime + 10, 0}};
+  BOOST_REQUIRE_EQUAL(::utimes(copy_path.c_str(), times), 0);
+  trace_index ti = trace_index::load(copy_path);
+  BOOST_CHECK(!ti.is_mapped());
+  BOOST_CHECK_EQUAL(ti.size(), 1);
+
+  // Changed trace with the old modification time
+  write_file(copy_path, line0 + line1);
+  BOOST_REQUIRE_EQUAL(::utimes(copy_path.c_str(), times), 0);
+  ti = trace_index::load(copy_path);
+  BOOST_CHECK(!ti.is_mapped());
+  BOOST_CHECK_EQUAL(ti.size(), 2);
+
+  // Index written without the stamp of the trace
+  {
+    std::ofstream out(trace_index::index_path(copy_path),
+		      std::ios_base::binary | std::ios_base::trunc);
+    parse_file(copy_path).write(out);
+  }
+  BOOST_CHECK(!trace_index::load(copy_path).is_mapped());
+
+  std::remove(trace_index::index_path(copy_path).c_str());
+  std::remove(copy_path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(reject_bad_index) {
+  const std::string path = "test_trace_index.bad.idx";
+
+  write_file(path, "short");
+  BOOST_CHECK_THROW(trace_index::open(path), std::runtime_error);
+
+  write_file(path, std::string(64, 'x'));
+  BOOST_CHECK_THROW(trace_index::open(path), std::runtime_error);
+
+  // Valid header with a missing record
+  std::istringstream text("0x00000000 10 0 0 0 StreamHeader No No\n"
+			  "0x0000000a 20 0 0 0 SliceData Yes No\n");
+  trace_index ti = trace_index::parse(text);
+  BOOST_REQUIRE_EQUAL(ti.size(), 2);
+  std::ostringstream out;
+  ti.write(out);
+  std::string bin = out.str();
+  write_file(path, bin.substr(0, bin.size() - sizeof(trace_record)));
+  BOOST_CHECK_THROW(trace_index::open(path), std::runtime_error);
+  write_file(path, bin);
+  BOOST_CHECK_EQUAL(trace_index::open(path).size(), 2);
+
+  // Count that overflows the size of the records to the right one
+  trace_index_header hdr;
+  std::memcpy(&hdr, bin.data(), sizeof(hdr));
+  hdr.count += std::uint64_t(1) << 61;
+  bin.replace(0, sizeof(hdr), reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+  write_file(path, bin);
+  BOOST_CHECK_THROW(trace_index::open(path), std::runtime_error);
+
+  std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(large_offsets) {
+  // Offsets past 4 GiB, as in a multi-hour stream
+  std::istringstream text("0x123456789 10 0 0 0 SliceData No No\n");
+  trace_index ti = trace_index::parse(text);
+  BOOST_REQUIRE_EQUAL(ti.size(), 1);
+  BOOST_CHECK_EQUAL(ti[0].offset, 0x123456789ull);
+  streamTrace st = ti[0].to_stream_trace();
+  BOOST_CHECK_EQUAL(st.startPos, 0x123456789ull);
+  BOOST_CHECK_EQUAL(trace_record::from_stream_trace(st).offset,
+		    0x123456789ull);
+}
+
+BOOST_AUTO_TEST_CASE(reject_bad_trace) {
+  std::istringstream bad_type("0x00000000 10 0 0 0 Unknown No No\n");
+  BOOST_CHECK_THROW(trace_index::parse(bad_type), std::runtime_error);
+  std::istringstream bad_flag("0x00000000 10 0 0 0 SliceData Maybe No\n");
+  BOOST_CHECK_THROW(trace_index::parse(bad_flag), std::runtime_error);
+  std::istringstream short_line("0x00000000 10 0\n"
+				"0x0000000a 20 0 0 0 SliceData Yes No\n");
+  BOOST_CHECK_THROW(trace_index::parse(short_line), std::runtime_error);
+}
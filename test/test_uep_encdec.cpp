@@ -374,6 +374,9 @@ struct decoder_overflow_fixture {
 
   size_t nblocks = 0xffff * 2;
   size_t last_block_passed = 0xffff - 50;
+  // Number the blocks so that the counters wrap around after 0xffff
+  // blocks
+  size_t first_blockno = uep_decoder::MAX_BLOCKNO - 0xffff;
 
   uep_encoder<std::mt19937> enc;
   uep_decoder dec;
@@ -383,6 +386,8 @@ struct decoder_overflow_fixture {
   decoder_overflow_fixture() :
     ps{0,0,2,{1,1},{2,1},0.03,0.01},
     enc(ps), dec(ps) {
+      enc.first_block_number(first_blockno);
+      dec.first_block_number(first_blockno);
       vector<fountain_packet> original;
       for (size_t i = 0; i < nblocks; ++i) {
 	for (size_t j = 0; j < ps.Ks[0]; ++j) {
@@ -420,7 +425,7 @@ BOOST_FIXTURE_TEST_CASE(decoder_overflow, decoder_overflow_fixture) {
     enc.next_block();
   }
   BOOST_CHECK_EQUAL(enc.blockno(), 0);
-  BOOST_CHECK_EQUAL(dec.blockno(), 0xffff);
+  BOOST_CHECK_EQUAL(dec.blockno(), uep_decoder::MAX_BLOCKNO);
   do {
     fountain_packet p = enc.next_coded();
     dec.push(move(p));
@@ -449,7 +454,7 @@ BOOST_FIXTURE_TEST_CASE(decoder_overflow_jump, decoder_overflow_fixture) {
 
 BOOST_FIXTURE_TEST_CASE(decoder_ignore_jump_back, decoder_overflow_fixture) {
   vector<fountain_packet> old_block;
-  size_t old_blockno = last_block_passed+1;
+  size_t old_blockno = first_blockno + last_block_passed+1;
   for (int i = 0; i < 50*K; ++i) {
     old_block.push_back(enc.next_coded());
   }
@@ -466,7 +471,7 @@ BOOST_FIXTURE_TEST_CASE(decoder_ignore_jump_back, decoder_overflow_fixture) {
   for (auto i = old_block.cbegin(); i != old_block.cend(); ++i) {
     dec.push(*i);
   }
-  BOOST_CHECK_EQUAL(dec.blockno(), last_block_passed+3);
+  BOOST_CHECK_EQUAL(dec.blockno(), first_blockno + last_block_passed+3);
 
   for (int i = last_block_passed+4; i <= 0xffff + 3; ++i) {
     do {
@@ -521,7 +526,7 @@ BOOST_AUTO_TEST_CASE(skip_multiple_blocks) {
   BOOST_CHECK_EQUAL(enc.blockno(), 0);
   BOOST_CHECK_EQUAL(enc.size(), 30*K_uep);
 
-  enc.next_block(0xff00);
+  enc.next_block(enc.MAX_BLOCKNO - 0xff);
   BOOST_CHECK_EQUAL(enc.blockno(), 0);
   BOOST_CHECK_EQUAL(enc.size(), 30*K_uep);
 
@@ -726,6 +731,14 @@ BOOST_AUTO_TEST_CASE(check_decoder_flush) {
 
   uep_encoder<std::mt19937> enc(ps);
   uep_decoder dec(ps);
+  // Number the blocks so that the counters wrap around after 2^16
+  // blocks
+  const size_t first_blockno = uep_decoder::MAX_BLOCKNO - 0xffff;
+  auto bn = [first_blockno](size_t i) {
+    return (first_blockno + i) & uep_decoder::MAX_BLOCKNO;
+  };
+  enc.first_block_number(first_blockno);
+  dec.first_block_number(first_blockno);
 
   vector<fountain_packet> original;
   for (size_t i = 0; i < nblocks; ++i) {
@@ -745,28 +758,28 @@ BOOST_AUTO_TEST_CASE(check_decoder_flush) {
 
   BOOST_CHECK_EQUAL(dec.total_failed_count(), 0);
   BOOST_CHECK_EQUAL(dec.total_decoded_count(), 0);
-  BOOST_CHECK_EQUAL(dec.blockno(), 0);
+  BOOST_CHECK_EQUAL(dec.blockno(), bn(0));
 
   // Skip one block
   dec.flush();
   BOOST_CHECK_EQUAL(dec.total_failed_count(), K_uep);
   BOOST_CHECK_EQUAL(dec.total_decoded_count(), 0);
-  BOOST_CHECK_EQUAL(dec.blockno(), 1);
+  BOOST_CHECK_EQUAL(dec.blockno(), bn(1));
 
   // Skip to block 50
-  dec.flush(50);
+  dec.flush(bn(50));
   BOOST_CHECK_EQUAL(dec.total_failed_count(), 50*K_uep);
   BOOST_CHECK_EQUAL(dec.total_decoded_count(), 0);
-  BOOST_CHECK_EQUAL(dec.blockno(), 50);
+  BOOST_CHECK_EQUAL(dec.blockno(), bn(50));
 
   // Decode block 50
-  enc.next_block(50);
+  enc.next_block(bn(50));
   while (!dec.has_decoded())
     dec.push(enc.next_coded());
 
   BOOST_CHECK_EQUAL(dec.total_failed_count(), 50*K_uep);
   BOOST_CHECK_EQUAL(dec.total_decoded_count(), K_uep);
-  BOOST_CHECK_EQUAL(dec.blockno(), 50);
+  BOOST_CHECK_EQUAL(dec.blockno(), bn(50));
 
   // Partial block 51
   size_t before = dec.total_decoded_count();
@@ -780,17 +793,17 @@ BOOST_AUTO_TEST_CASE(check_decoder_flush) {
 
   BOOST_CHECK_EQUAL(dec.total_failed_count(), 51*K_uep - partial);
   BOOST_CHECK_EQUAL(dec.total_decoded_count(), K_uep + partial);
-  BOOST_CHECK_EQUAL(dec.blockno(), 52);
+  BOOST_CHECK_EQUAL(dec.blockno(), bn(52));
 
   // Skip to block 50 again (+ 2^16 blocks)
-  dec.flush(50);
+  dec.flush(bn(50 + 0x10000));
 
   // failed 0--49, partially failed 51, skip 52--2^16-1, skip 0--49
   size_t failed_pkts = 51*K_uep -partial + (static_cast<size_t>(pow(2,16))-2)*K_uep;
   size_t good_pkts = K_uep + partial;
   BOOST_CHECK_EQUAL(dec.total_failed_count(), failed_pkts);
   BOOST_CHECK_EQUAL(dec.total_decoded_count(), good_pkts);
-  BOOST_CHECK_EQUAL(dec.blockno(), 50);
+  BOOST_CHECK_EQUAL(dec.blockno(), bn(50 + 0x10000));
 }
 
 BOOST_AUTO_TEST_CASE(check_decoder_flush_n) {
@@ -808,6 +821,14 @@ BOOST_AUTO_TEST_CASE(check_decoder_flush_n) {
 
   uep_encoder<std::mt19937> enc(ps);
   uep_decoder dec(ps);
+  // Number the blocks so that the counters wrap around after 2^16
+  // blocks
+  const size_t first_blockno = uep_decoder::MAX_BLOCKNO - 0xffff;
+  auto bn = [first_blockno](size_t i) {
+    return (first_blockno + i) & uep_decoder::MAX_BLOCKNO;
+  };
+  enc.first_block_number(first_blockno);
+  dec.first_block_number(first_blockno);
 
   vector<fountain_packet> original;
   for (size_t i = 0; i < nblocks; ++i) {
@@ -827,28 +848,28 @@ BOOST_AUTO_TEST_CASE(check_decoder_flush_n) {
 
   BOOST_CHECK_EQUAL(dec.total_failed_count(), 0);
   BOOST_CHECK_EQUAL(dec.total_decoded_count(), 0);
-  BOOST_CHECK_EQUAL(dec.blockno(), 0);
+  BOOST_CHECK_EQUAL(dec.blockno(), bn(0));
 
   // Skip one block
   dec.flush();
   BOOST_CHECK_EQUAL(dec.total_failed_count(), K_uep);
   BOOST_CHECK_EQUAL(dec.total_decoded_count(), 0);
-  BOOST_CHECK_EQUAL(dec.blockno(), 1);
+  BOOST_CHECK_EQUAL(dec.blockno(), bn(1));
 
   // Skip to block 50
-  dec.flush(50);
+  dec.flush(bn(50));
   BOOST_CHECK_EQUAL(dec.total_failed_count(), 50*K_uep);
   BOOST_CHECK_EQUAL(dec.total_decoded_count(), 0);
-  BOOST_CHECK_EQUAL(dec.blockno(), 50);
+  BOOST_CHECK_EQUAL(dec.blockno(), bn(50));
 
   // Decode block 50
-  enc.next_block(50);
+  enc.next_block(bn(50));
   while (!dec.has_decoded())
     dec.push(enc.next_coded());
 
   BOOST_CHECK_EQUAL(dec.total_failed_count(), 50*K_uep);
   BOOST_CHECK_EQUAL(dec.total_decoded_count(), K_uep);
-  BOOST_CHECK_EQUAL(dec.blockno(), 50);
+  BOOST_CHECK_EQUAL(dec.blockno(), bn(50));
 
   // Partial block 51
   size_t before = dec.total_decoded_count();
@@ -866,7 +887,7 @@ BOOST_AUTO_TEST_CASE(check_decoder_flush_n) {
   size_t good_pkts = K_uep + partial;
   BOOST_CHECK_EQUAL(dec.total_failed_count(), failed_pkts);
   BOOST_CHECK_EQUAL(dec.total_decoded_count(), good_pkts);
-  BOOST_CHECK_EQUAL(dec.blockno(), nblocks % static_cast<size_t>(pow(2,16)));
+  BOOST_CHECK_EQUAL(dec.blockno(), bn(nblocks));
 }
 
 BOOST_AUTO_TEST_CASE(uep_random_order) {
@@ -0,0 +1,176 @@
+#define BOOST_TEST_MODULE test_uep_simulation
+#include <boost/test/unit_test.hpp>
+
+#include <cmath>
+
+#include "uep_simulation.hpp"
+
+using namespace std;
+using namespace uep::sim;
+
+struct sim_params_fixture {
+  uep_sim_parameters p;
+
+  sim_params_fixture() {
+    p.Ks = {10, 90};
+    p.RFs = {3, 1};
+    p.EF = 2;
+    p.c = 0.1;
+    p.delta = 0.5;
+    p.nblocks = 200;
+    p.overhead = 0.2;
+    p.iid_per = 0;
+    p.markov_pGB = 0;
+    p.markov_pBG = 1;
+    p.threads = 1;
+    p.seed = 42;
+    p.bit_parallel = false;
+  }
+};
+
+BOOST_FIXTURE_TEST_CASE(same_results_any_threads, sim_params_fixture) {
+  p.iid_per = 0.1;
+  uep_sim_results r1 = run_uep_simulation(p);
+  p.threads = 4;
+  uep_sim_results r4 = run_uep_simulation(p);
+
+  BOOST_CHECK_EQUAL(r1.nblocks, p.nblocks);
+  BOOST_CHECK_EQUAL(r4.nblocks, p.nblocks);
+  BOOST_CHECK_EQUAL(r1.n_per_block, 120);
+  BOOST_CHECK_EQUAL_COLLECTIONS(r1.error_counts.cbegin(),
+				r1.error_counts.cend(),
+				r4.error_counts.cbegin(),
+				r4.error_counts.cend());
+  BOOST_CHECK_EQUAL(r1.drop_count, r4.drop_count);
+  BOOST_CHECK_EQUAL(r1.failed_blocks, r4.failed_blocks);
+  BOOST_CHECK_CLOSE(r1.ripple_sum, r4.ripple_sum, 1e-9);
+  BOOST_CHECK_EQUAL(r1.ripple_min, r4.ripple_min);
+  BOOST_CHECK_EQUAL(r1.ripple_max, r4.ripple_max);
+
+  p.seed = 43;
+  uep_sim_results other = run_uep_simulation(p);
+  BOOST_CHECK_NE(r1.drop_count, other.drop_count);
+}
+
+BOOST_FIXTURE_TEST_CASE(error_free_channel, sim_params_fixture) {
+  p.overhead = 2;
+  p.threads = 0;
+  uep_sim_results r = run_uep_simulation(p);
+  BOOST_CHECK_EQUAL(r.drop_count, 0);
+  BOOST_CHECK_EQUAL(r.failed_blocks, 0);
+  BOOST_CHECK_EQUAL(r.error_counts[0], 0);
+  BOOST_CHECK_EQUAL(r.error_counts[1], 0);
+  BOOST_CHECK_GT(r.avg_ripple(), 0);
+  BOOST_CHECK_LE(r.ripple_min, r.avg_ripple());
+  BOOST_CHECK_GE(r.ripple_max, r.avg_ripple());
+}
+
+BOOST_FIXTURE_TEST_CASE(lossy_channels, sim_params_fixture) {
+  p.overhead = 0;
+  p.iid_per = 0.3;
+  uep_sim_results iid = run_uep_simulation(p);
+  BOOST_CHECK_CLOSE(iid.drop_rate(), 0.3, 10);
+  BOOST_CHECK_GT(iid.failed_blocks, 0);
+  // The repeated sub-block is better protected
+  BOOST_CHECK_LT(iid.error_rate(0, p.Ks[0]), iid.error_rate(1, p.Ks[1]));
+
+  p.iid_per = 0;
+  p.markov_pGB = 0.1;
+  p.markov_pBG = 0.4;
+  uep_sim_results markov = run_uep_simulation(p);
+  BOOST_CHECK_CLOSE(markov.drop_rate(), 0.2, 20);
+}
+
+BOOST_FIXTURE_TEST_CASE(wrong_parameters, sim_params_fixture) {
+  p.RFs = {1};
+  BOOST_CHECK_THROW(run_uep_simulation(p), std::invalid_argument);
+}
+
+BOOST_FIXTURE_TEST_CASE(bit_parallel_any_threads, sim_params_fixture) {
+  p.bit_parallel = true;
+  p.iid_per = 0.1;
+  p.nblocks = 300;
+  uep_sim_results r1 = run_uep_simulation(p);
+  p.threads = 4;
+  uep_sim_results r4 = run_uep_simulation(p);
+
+  BOOST_CHECK_EQUAL(r1.nblocks, p.nblocks);
+  BOOST_CHECK_EQUAL(r4.nblocks, p.nblocks);
+  BOOST_CHECK_EQUAL_COLLECTIONS(r1.error_counts.cbegin(),
+				r1.error_counts.cend(),
+				r4.error_counts.cbegin(),
+				r4.error_counts.cend());
+  BOOST_CHECK_EQUAL(r1.drop_count, r4.drop_count);
+  BOOST_CHECK_EQUAL(r1.failed_blocks, r4.failed_blocks);
+  BOOST_CHECK_EQUAL(r1.ripple_count, 0);
+  BOOST_CHECK(std::isnan(r1.avg_ripple()));
+}
+
+BOOST_FIXTURE_TEST_CASE(bit_parallel_channels, sim_params_fixture) {
+  p.bit_parallel = true;
+  p.overhead = 2;
+  uep_sim_results ok = run_uep_simulation(p);
+  BOOST_CHECK_EQUAL(ok.drop_count, 0);
+  BOOST_CHECK_EQUAL(ok.failed_blocks, 0);
+  BOOST_CHECK_EQUAL(ok.error_counts[0], 0);
+  BOOST_CHECK_EQUAL(ok.error_counts[1], 0);
+
+  // Same channel realizations as the serial simulation
+  p.overhead = 0;
+  p.iid_per = 0.3;
+  p.nblocks = 1000;
+  uep_sim_results bp = run_uep_simulation(p);
+  p.bit_parallel = false;
+  uep_sim_results serial = run_uep_simulation(p);
+  BOOST_CHECK_EQUAL(bp.drop_count, serial.drop_count);
+  BOOST_CHECK_CLOSE(bp.drop_rate(), 0.3, 10);
+  for (std::size_t i = 0; i < p.Ks.size(); ++i) {
+    BOOST_CHECK_CLOSE(bp.error_rate(i, p.Ks[i]),
+		      serial.error_rate(i, p.Ks[i]), 20);
+  }
+}
+
+BOOST_FIXTURE_TEST_CASE(bit_parallel_error_free, sim_params_fixture) {
+  // Without errors the blocks are decoded one at a time
+  p.overhead = 0;
+  p.nblocks = 100;
+  p.bit_parallel = true;
+  uep_sim_results bp = run_uep_simulation(p);
+  p.bit_parallel = false;
+  uep_sim_results serial = run_uep_simulation(p);
+  BOOST_CHECK_EQUAL(bp.nblocks, p.nblocks);
+  BOOST_CHECK_EQUAL(bp.nblocks, serial.nblocks);
+  BOOST_CHECK_EQUAL(bp.failed_blocks, serial.failed_blocks);
+  BOOST_CHECK_EQUAL(bp.drop_count, 0);
+  BOOST_CHECK_EQUAL_COLLECTIONS(bp.error_counts.cbegin(),
+				bp.error_counts.cend(),
+				serial.error_counts.cbegin(),
+				serial.error_counts.cend());
+}
+
+BOOST_FIXTURE_TEST_CASE(sweep_same_as_single_runs, sim_params_fixture) {
+  const vector<double> overheads{0.4, 0, 0.1, 0.25};
+  p.iid_per = 0.1;
+  p.threads = 3;
+  vector<uep_sim_results> sweep = run_uep_sweep(p, overheads);
+  BOOST_REQUIRE_EQUAL(sweep.size(), overheads.size());
+
+  for (std::size_t k = 0; k < overheads.size(); ++k) {
+    p.overhead = overheads[k];
+    uep_sim_results r = run_uep_simulation(p);
+    BOOST_CHECK_EQUAL(sweep[k].nblocks, r.nblocks);
+    BOOST_CHECK_EQUAL(sweep[k].n_per_block, r.n_per_block);
+    BOOST_CHECK_EQUAL_COLLECTIONS(sweep[k].error_counts.cbegin(),
+				  sweep[k].error_counts.cend(),
+				  r.error_counts.cbegin(),
+				  r.error_counts.cend());
+    BOOST_CHECK_EQUAL(sweep[k].drop_count, r.drop_count);
+    BOOST_CHECK_EQUAL(sweep[k].failed_blocks, r.failed_blocks);
+    BOOST_CHECK(std::isnan(sweep[k].avg_ripple()));
+  }
+  BOOST_CHECK_GT(sweep[1].error_counts[1], sweep[0].error_counts[1]);
+
+  BOOST_CHECK_THROW(run_uep_sweep(p, {}), std::invalid_argument);
+  p.bit_parallel = true;
+  BOOST_CHECK_THROW(run_uep_sweep(p, overheads), std::invalid_argument);
+}
@@ -1,3 +1,4 @@
+import array
 import concurrent.futures as cf
 import copy
 import math
@@ -76,13 +77,20 @@ class UEPSimulation:
             if channel is not None:
                 channel.reset()
 
+            # Pass all the rows at once in CSR form
+            indices = array.array('q')
+            offsets = array.array('q', [0])
             for l in range(n):
                 if (channel is None or channel()):
                     t = time.process_time()
-                    mpctx.add_output(self.__rowgen())
+                    indices.extend(self.__rowgen())
+                    offsets.append(len(indices))
                     sum_avg_enc_times += time.process_time() - t
                 else:
                     results['drop_count'] += 1
+            t = time.process_time()
+            mpctx.add_outputs(indices, offsets)
+            sum_avg_enc_times += time.process_time() - t
 
             mpctx.run()
             dec = mpctx.input_symbols()
@@ -106,7 +114,62 @@ class UEPSimulation:
         results['avg_enc_time'] = sum_avg_enc_times / self.nblocks
         return results
 
-def run_parallel(sim):
+    def run_native(self, threads=None, seed=None, bit_parallel=False,
+                   store=None):
+        """Same as run(), but generate the rows and decode the blocks in
+        C++ on `threads` threads (default: all the usable CPUs),
+        without holding the GIL. The rows are produced by the C++
+        uep_row_generator. The seed defaults to a value drawn from
+        `random`, so the results follow its state. With
+        `bit_parallel`, groups of 64 blocks share the rows and are
+        decoded together: much faster, but the ripple is NaN. If
+        `store` is a path, the results are also appended to that
+        result store (see utils/result_store.py)."""
+        if threads is None:
+            threads = len(os.sched_getaffinity(0))
+        if seed is None:
+            seed = random.getrandbits(64)
+        return run_uep_simulation(Ks=self.Ks, RFs=self.RFs, EF=self.EF,
+                                  c=self.c, delta=self.delta,
+                                  nblocks=self.nblocks,
+                                  overhead=self.overhead,
+                                  iid_per=self.iid_per,
+                                  markov_pGB=self.markov_pGB,
+                                  markov_pBG=self.markov_pBG,
+                                  threads=threads, seed=seed,
+                                  bit_parallel=bit_parallel,
+                                  store=store)
+
+    def run_sweep(self, overheads, threads=None, seed=None, store=None):
+        """Same as calling run_native() for each overhead, but in a
+        single pass: each block is decoded packet by packet up to the
+        largest overhead. Return a list with the results of each
+        overhead. The ripple is NaN. If `store` is a path, one record
+        per overhead is also appended to that result store."""
+        if threads is None:
+            threads = len(os.sched_getaffinity(0))
+        if seed is None:
+            seed = random.getrandbits(64)
+        return run_uep_sweep(Ks=self.Ks, RFs=self.RFs, EF=self.EF,
+                             c=self.c, delta=self.delta,
+                             overheads=list(overheads),
+                             nblocks=self.nblocks,
+                             iid_per=self.iid_per,
+                             markov_pGB=self.markov_pGB,
+                             markov_pBG=self.markov_pBG,
+                             threads=threads, seed=seed,
+                             store=store)
+
+def run_parallel(sim, bit_parallel=False, store=None):
+    ncpu = len(os.sched_getaffinity(0))
+    print("Starting native UEPSimulation"
+          " on {:d} CPUs".format(ncpu))
+    results = sim.run_native(ncpu, bit_parallel=bit_parallel, store=store)
+    print("Done")
+    return results
+
+def run_parallel_processes(sim):
+    """Run the Python simulation with one process per CPU."""
     ncpu = len(os.sched_getaffinity(0))
     split_nb = [math.floor(sim.nblocks / ncpu) for i in range(ncpu)]
     for i in range(sim.nblocks % ncpu):
@@ -117,8 +180,8 @@ def run_parallel(sim):
           " on {:d} CPUs".format(ncpu))
     print("Split nblocks = {:d} -> {!s}".format(sim.nblocks, split_nb))
     with cf.ProcessPoolExecutor(ncpu) as executor:
-        sim_copy = copy.deepcopy(sim)
         for nb in split_nb:
+            sim_copy = copy.deepcopy(sim)
             sim_copy.nblocks = nb
             f = executor.submit(sim_copy.run)
             result_futures.append(f)
@@ -130,7 +193,7 @@ def run_parallel(sim):
     results['drop_count'] = 0
     results['drop_rate'] = 0
     results['avg_ripple'] = 0
-    for i, fs in enumerate(result_futures):
+    for i, f in enumerate(result_futures):
         r = f.result()
         w = split_nb[i] / sim.nblocks
         for j, k in enumerate(sim.Ks):
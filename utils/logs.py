@@ -1,4 +1,17 @@
+import os
 import re
+import shutil
+import subprocess
+import sys
+
+def find_trace_converter():
+    """Look for perf_trace_convert next to the running script, then in
+    the PATH."""
+    here = os.path.join(os.path.dirname(os.path.abspath(sys.argv[0])),
+                        "perf_trace_convert")
+    if os.access(here, os.X_OK):
+        return here
+    return shutil.which("perf_trace_convert")
 
 class line_scanner:
     def __init__(self, fname):
@@ -11,8 +24,25 @@ class line_scanner:
             "handler": handler
         })
 
+    def lines(self):
+        """Lines of the log. The per-packet events recorded in the binary
+        trace next to the log are merged back in."""
+        trace = self.filename + ".trace"
+        if not os.path.exists(trace):
+            yield from open(self.filename, "rt")
+            return
+        conv = find_trace_converter()
+        if conv is None:
+            raise RuntimeError("perf_trace_convert is needed to read " + trace)
+        with subprocess.Popen([conv, trace, self.filename],
+                              stdout=subprocess.PIPE,
+                              universal_newlines=True) as p:
+            yield from p.stdout
+        if p.returncode != 0:
+            raise RuntimeError("Cannot convert " + trace)
+
     def scan(self):
-        for line in open(self.filename, "rt"):
+        for line in self.lines():
             for r in self.regexes:
                 m = r["regex"].search(line)
                 if m: r["handler"](m)
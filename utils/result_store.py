@@ -0,0 +1,223 @@
+"""Append-only columnar store of simulation results.
+
+The format is the one of src/result_store.hpp: a header followed by
+records, each one made of named columns of typed values (float64,
+int64, uint64 or UTF-8 strings), in the native byte order. Readers
+map the file and only parse the headers: the values are read when
+they are accessed, without copies for the arrays.
+"""
+
+import fcntl
+import mmap
+import numbers
+import os
+import struct
+
+MAGIC = b'UEPRES\0\0'
+VERSION = 1
+SCALAR_FLAG = 0x01
+MAX_NAME = 31
+
+_FILE_HEADER = struct.Struct('=8sII')
+_RECORD_HEADER = struct.Struct('=QII')
+_COLUMN_HEADER = struct.Struct('=32sBBHIQQ')
+_VALUE_SIZE = {'d': 8, 'q': 8, 'Q': 8, 's': 1}
+
+def _pad8(n):
+    return (n + 7) & ~7
+
+def _encode_column(value):
+    """Return the type, flags, count and bytes of a column."""
+    if isinstance(value, str):
+        data = value.encode()
+        return 's', SCALAR_FLAG, len(data), data
+    if isinstance(value, numbers.Integral):
+        t = 'q' if value < 2**63 else 'Q'
+        return t, SCALAR_FLAG, 1, struct.pack('=' + t, value)
+    if isinstance(value, numbers.Real):
+        return 'd', SCALAR_FLAG, 1, struct.pack('=d', value)
+    values = list(value)
+    t = 'q' if all(isinstance(v, numbers.Integral) for v in values) else 'd'
+    return t, 0, len(values), struct.pack('={:d}{}'.format(len(values), t),
+                                          *values)
+
+def encode_record(record):
+    """Serialize a dict of column names to scalars, strings or
+    sequences of numbers."""
+    columns = list()
+    for name, value in record.items():
+        bname = name.encode()
+        if not 0 < len(bname) <= MAX_NAME:
+            raise ValueError("Wrong column name length: {!s}".format(name))
+        columns.append((bname,) + _encode_column(value))
+
+    offset = _RECORD_HEADER.size + len(columns) * _COLUMN_HEADER.size
+    headers = list()
+    for bname, t, flags, count, data in columns:
+        headers.append(_COLUMN_HEADER.pack(bname, ord(t), flags, 0, 0,
+                                           count, offset))
+        offset += _pad8(len(data))
+
+    out = bytearray(_RECORD_HEADER.pack(offset, len(columns), 0))
+    for h in headers:
+        out += h
+    for bname, t, flags, count, data in columns:
+        out += data
+        out += bytes(_pad8(len(data)) - len(data))
+    return bytes(out)
+
+def append_records(path, records):
+    """Append the records (dicts, see encode_record) to the store at
+    `path`, creating it if needed. The records are written at once
+    under an exclusive lock, as the C++ result_store_writer does, after
+    removing a truncated record left by an interrupted writer."""
+    data = b''.join(encode_record(r) for r in records)
+    fd = os.open(path, os.O_RDWR | os.O_CREAT | os.O_APPEND, 0o644)
+    try:
+        fcntl.flock(fd, fcntl.LOCK_EX)
+        header = os.pread(fd, _FILE_HEADER.size, 0)
+        if len(header) == 0:
+            data = _FILE_HEADER.pack(MAGIC, VERSION, 0) + data
+        else:
+            _check_header(path, header)
+            _drop_truncated_tail(path, fd)
+        view = memoryview(data)
+        while len(view) > 0:
+            view = view[os.write(fd, view):]
+    finally:
+        os.close(fd)
+
+def _drop_truncated_tail(path, fd):
+    """Cut the file at the end of the last complete record. Must be
+    called under the exclusive lock."""
+    size = os.fstat(fd).st_size
+    pos = _FILE_HEADER.size
+    while size - pos >= _RECORD_HEADER.size:
+        rsize, _, _ = _RECORD_HEADER.unpack(
+            os.pread(fd, _RECORD_HEADER.size, pos))
+        if rsize > size - pos:
+            break
+        if rsize < _RECORD_HEADER.size or rsize % 8 != 0:
+            raise ValueError("Invalid result store {!s}:"
+                             " wrong record size".format(path))
+        pos += rsize
+    if pos != size:
+        os.ftruncate(fd, pos)
+
+def _check_header(path, header):
+    if len(header) < _FILE_HEADER.size:
+        raise ValueError("Invalid result store {!s}: too short".format(path))
+    magic, version, _ = _FILE_HEADER.unpack_from(header)
+    if magic != MAGIC:
+        raise ValueError("Invalid result store {!s}: wrong magic".format(path))
+    if version != VERSION:
+        raise ValueError("Invalid result store {!s}: unsupported version"
+                         " or byte order".format(path))
+
+class Record:
+    """Read-only view of a record of a ResultStore. Scalar columns are
+    returned as int, float or str, array columns as memoryviews of
+    the mapped file (use numpy.asarray to get an array without
+    copies)."""
+
+    def __init__(self, view, columns):
+        self._view = view
+        self._columns = columns
+
+    def keys(self):
+        return self._columns.keys()
+
+    def __contains__(self, name):
+        return name in self._columns
+
+    def __getitem__(self, name):
+        t, flags, count, offset = self._columns[name]
+        values = self._view[offset:offset + count * _VALUE_SIZE[t]]
+        if t == 's':
+            return bytes(values).decode()
+        values = values.cast(t)
+        if flags & SCALAR_FLAG:
+            return values[0]
+        return values
+
+    def get(self, name, default=None):
+        if name not in self._columns:
+            return default
+        return self[name]
+
+    def to_dict(self):
+        """Copy all the columns in a dict, with lists for the arrays."""
+        return {name: (v.tolist() if isinstance(v, memoryview) else v)
+                for name, v in ((n, self[n]) for n in self.keys())}
+
+class ResultStore:
+    """Memory-mapped result store. A truncated record at the end of
+    the file, left by an interrupted writer, is ignored."""
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            if os.fstat(f.fileno()).st_size < _FILE_HEADER.size:
+                raise ValueError("Invalid result store {!s}:"
+                                 " too short".format(path))
+            self._map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        self._view = memoryview(self._map)
+        _check_header(path, self._view[:_FILE_HEADER.size])
+
+        self._records = list()
+        pos = _FILE_HEADER.size
+        size = len(self._view)
+        while size - pos >= _RECORD_HEADER.size:
+            rsize, ncols, _ = _RECORD_HEADER.unpack_from(self._view, pos)
+            if rsize > size - pos:
+                break # Truncated by a writer
+            if (rsize % 8 != 0 or
+                rsize < _RECORD_HEADER.size + ncols * _COLUMN_HEADER.size):
+                raise ValueError("Invalid result store {!s}:"
+                                 " wrong record size".format(path))
+            rec_view = self._view[pos:pos + rsize]
+            columns = dict()
+            for j in range(ncols):
+                (bname, t, flags, _, _,
+                 count, offset) = _COLUMN_HEADER.unpack_from(
+                     rec_view, _RECORD_HEADER.size + j * _COLUMN_HEADER.size)
+                t = chr(t)
+                if (t not in _VALUE_SIZE or offset % 8 != 0 or
+                    offset + count * _VALUE_SIZE[t] > rsize):
+                    raise ValueError("Invalid result store {!s}:"
+                                     " wrong column".format(path))
+                name = bname.rstrip(b'\0').decode()
+                columns[name] = (t, flags, count, offset)
+            self._records.append(Record(rec_view, columns))
+            pos += rsize
+
+    def __len__(self):
+        return len(self._records)
+
+    def __getitem__(self, i):
+        return self._records[i]
+
+    def __iter__(self):
+        return iter(self._records)
+
+    def select(self, where=None, **equal):
+        """Return the records with the given column values, that also
+        satisfy `where(record)` if given. Arrays are compared as
+        tuples. The records without one of the columns are
+        skipped."""
+        out = list()
+        for r in self._records:
+            match = True
+            for name, value in equal.items():
+                if name not in r:
+                    match = False
+                    break
+                v = r[name]
+                if isinstance(v, memoryview):
+                    match = tuple(v) == tuple(value)
+                else:
+                    match = v == value
+                if not match:
+                    break
+            if match and (where is None or where(r)):
+                out.append(r)
+        return out